@@ -0,0 +1,183 @@
+//
+//  check.c
+//  ccmach
+//
+//  Created by Landon Fuller on 2/14/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#include <err.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nvram_sprom.h"
+
+#include "check.h"
+
+/** If true, benchmarks are run in addition to the checks */
+bool check_bench = false;
+
+static const char	*check_name;
+static unsigned int	 check_failures;
+
+/**
+ * Parse the common check program arguments, returning the index of the
+ * first non-option argument.
+ */
+int
+check_init (int argc, char * const argv[])
+{
+	int ch;
+
+	check_name = argv[0];
+	while ((ch = getopt(argc, argv, "b")) != -1) {
+		switch (ch) {
+		case 'b':
+			check_bench = true;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-b]\n", check_name);
+			exit(EX_USAGE);
+		}
+	}
+
+	return (optind);
+}
+
+/**
+ * Exit successfully, skipping all checks, if the CPU does not support
+ * AVX2. Check programs built with AVX2 enabled must call this before
+ * executing any AVX2 code.
+ */
+void
+check_require_avx2 (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2"))
+		return;
+#endif
+
+	printf("%s: skipped (no AVX2)\n", check_name);
+	exit(EXIT_SUCCESS);
+}
+
+/** Report the check results, returning the program's exit status */
+int
+check_finish (void)
+{
+	if (check_failures > 0) {
+		printf("%s: %u check(s) failed\n", check_name, check_failures);
+		return (EXIT_FAILURE);
+	}
+
+	printf("%s: ok\n", check_name);
+	return (EXIT_SUCCESS);
+}
+
+/** Record and report a single check failure */
+void
+check_fail (const char *file, int line, const char *fmt, ...)
+{
+	va_list ap;
+
+	check_failures++;
+
+	printf("%s:%d: ", file, line);
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+/** Return a monotonic timestamp, in seconds */
+double
+check_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + (ts.tv_nsec / 1e9));
+}
+
+/** Seed @p rng; equal seeds produce equal sequences */
+void
+check_rng_init (struct check_rng *rng, uint64_t seed)
+{
+	rng->cr_state = seed ^ 0x9E3779B97F4A7C15ULL;
+	if (rng->cr_state == 0)
+		rng->cr_state = 1;
+}
+
+/** Return the next 32-bit value from @p rng (xorshift64*) */
+uint32_t
+check_rng_next (struct check_rng *rng)
+{
+	uint64_t x = rng->cr_state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	rng->cr_state = x;
+
+	return ((x * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/** Fill @p buf with @p len bytes from @p rng */
+void
+check_rng_fill (struct check_rng *rng, void *buf, size_t len)
+{
+	uint8_t *p = buf;
+
+	for (size_t i = 0; i < len; i++)
+		p[i] = check_rng_next(rng);
+}
+
+/** Write the trailing CRC-8 of the SPROM @p image */
+void
+check_sprom_crc (uint8_t *image, size_t size)
+{
+	image[size - 1] = ~bhnd_nvram_crc8(image, size - 1,
+	    BHND_NVRAM_CRC8_INITIAL);
+}
+
+/**
+ * Generate a random SPROM image of revision @p rev, with a valid
+ * revision, signature (if any), and CRC.
+ *
+ * @param rng random number generator.
+ * @param rev SPROM revision.
+ * @param[out] image output buffer, of at least BHND_SPROM_MAX_SIZE bytes.
+ * @param[out] size the layout size of @p rev.
+ *
+ * @retval 0 success
+ * @retval EINVAL if @p rev is not a supported SPROM revision.
+ */
+int
+check_sprom_image (struct check_rng *rng, uint8_t rev, uint8_t *image,
+    size_t *size)
+{
+	size_t		sig_off;
+	uint16_t	sig;
+	int		error;
+
+	if ((error = bhnd_sprom_layout_size(rev, size)))
+		return (error);
+
+	check_rng_fill(rng, image, *size);
+
+	if (bhnd_sprom_layout_sig(rev, &sig_off, &sig) == 0) {
+		image[sig_off] = sig & 0xFF;
+		image[sig_off + 1] = sig >> 8;
+	}
+
+	image[*size - 2] = rev;
+	check_sprom_crc(image, *size);
+
+	return (0);
+}
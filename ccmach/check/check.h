@@ -0,0 +1,54 @@
+//
+//  check.h
+//  ccmach
+//
+//  Created by Landon Fuller on 2/14/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef _NVRAM_CHECK_H_
+#define _NVRAM_CHECK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Shared support for the in-tree check programs.
+ *
+ * Each check program runs its checks against the generated variable and
+ * CIS tuple tables, and exits non-zero if any check fails. With -b, the
+ * program's benchmarks are also run, and their results are reported on
+ * stdout.
+ */
+
+/** Record a check failure if @p cond is false */
+#define	CHECK(cond, ...)	do {					\
+	if (!(cond))							\
+		check_fail(__FILE__, __LINE__, __VA_ARGS__);		\
+} while (0)
+
+/** Deterministic pseudo-random number generator state */
+struct check_rng {
+	uint64_t	cr_state;
+};
+
+extern bool	check_bench;
+
+int		check_init(int argc, char * const argv[]);
+void		check_require_avx2(void);
+int		check_finish(void);
+void		check_fail(const char *file, int line, const char *fmt, ...)
+		    __attribute__((format(printf, 3, 4)));
+
+double		check_now(void);
+
+void		check_rng_init(struct check_rng *rng, uint64_t seed);
+uint32_t	check_rng_next(struct check_rng *rng);
+void		check_rng_fill(struct check_rng *rng, void *buf, size_t len);
+
+int		check_sprom_image(struct check_rng *rng, uint8_t rev,
+		    uint8_t *image, size_t *size);
+void		check_sprom_crc(uint8_t *image, size_t size);
+
+#endif /* _NVRAM_CHECK_H_ */
@@ -0,0 +1,487 @@
+//
+//  check_cis.c
+//  ccmach
+//
+//  Created by Landon Fuller on 2/14/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+/*
+ * CIS decoder checks.
+ *
+ * Tuple chains are generated from the CIS tuple table, with random tuple
+ * bodies of full and truncated length, for a range of SROM revisions. The
+ * result of bhnd_cis_decode() is compared against a reference decode of
+ * the same chain, written directly from the table's variable layouts. The
+ * special-case tuples and malformed chains are checked separately.
+ *
+ * With -b, a chain containing every standard revision 11 tuple is decoded
+ * repeatedly; any CIS files named on the command line are also decoded.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include "nvram_cis.h"
+
+#include "check.h"
+
+/** Maximum generated chain size */
+#define	CHECK_CIS_CHAIN_MAX	(64 * 1024)
+
+/** Maximum decoded environment size */
+#define	CHECK_CIS_ENV_MAX	(256 * 1024)
+
+/** Random chains generated per SROM revision */
+#define	CHECK_CIS_CHAINS	64
+
+/** Benchmark decode passes */
+#define	CHECK_CIS_BENCH_PASSES	20000
+
+/** Read a little-endian value of @p width bytes */
+static uint32_t
+check_cis_read (const uint8_t *p, size_t width)
+{
+	uint32_t v = 0;
+
+	for (size_t i = 0; i < width; i++)
+		v |= (uint32_t)p[i] << (8 * i);
+
+	return (v);
+}
+
+/** Apply a layout's shift to @p v */
+static uint32_t
+check_cis_shift (uint32_t v, int shift)
+{
+	return ((shift >= 0) ? (v >> shift) : (v << -shift));
+}
+
+/** Return the minimum body length (excluding any HNBU subtag) that
+ *  includes every variable of @p t */
+static size_t
+check_cis_body_len (const struct bhnd_cis_tuple *t)
+{
+	size_t len = 0;
+
+	for (size_t i = 0; i < t->num_vars; i++) {
+		const struct bhnd_cis_var	*v = &t->vars[i];
+		size_t				 end;
+
+		end = v->offset + ((size_t)v->width * v->count);
+		if (end > len)
+			len = end;
+	}
+
+	return (len);
+}
+
+/** Reference decode of the standard tuple @p t */
+static void
+check_cis_ref_tuple (struct bhnd_nvram_obuf *ob,
+    const struct bhnd_cis_tuple *t, const uint8_t *body, size_t len)
+{
+	for (size_t i = 0; i < t->num_vars; i++) {
+		const struct bhnd_cis_var	*v = &t->vars[i];
+		uint32_t			 vals[UINT8_MAX];
+
+		if ((size_t)v->offset + ((size_t)v->width * v->count) > len)
+			continue;
+
+		for (size_t e = 0; e < v->count; e++) {
+			vals[e] = check_cis_read(body + v->offset +
+			    (e * v->width), v->width) & v->mask;
+			vals[e] = check_cis_shift(vals[e], v->shift);
+		}
+
+		bhnd_nvram_put_str(ob, v->name);
+		bhnd_nvram_put_char(ob, '=');
+		bhnd_nvram_fmt_value(ob, v->fmt, v->type, vals, v->count,
+		    check_cis_shift(v->mask, v->shift));
+		bhnd_nvram_put_char(ob, '\0');
+	}
+}
+
+/** A tuple chain under construction, and its reference environment */
+struct check_cis_chain {
+	uint8_t			cis[CHECK_CIS_CHAIN_MAX];
+	size_t			size;
+	char			env[CHECK_CIS_ENV_MAX];
+	struct bhnd_nvram_obuf	ref;
+};
+
+static void
+check_cis_chain_init (struct check_cis_chain *ch)
+{
+	ch->size = 0;
+	bhnd_nvram_obuf_init(&ch->ref, ch->env, sizeof(ch->env));
+}
+
+/**
+ * Append a tuple to @p ch. If @p t is non-NULL, the tuple is a standard
+ * tuple, and its reference decode is appended to the reference environment.
+ */
+static void
+check_cis_chain_add (struct check_cis_chain *ch,
+    const struct bhnd_cis_tuple *t, uint8_t tag, int hnbu_tag,
+    const uint8_t *body, size_t len)
+{
+	size_t tlen;
+
+	tlen = len + ((hnbu_tag != BHND_CIS_HNBU_NONE) ? 1 : 0);
+	if (tlen > UINT8_MAX || ch->size + 2 + tlen + 1 > sizeof(ch->cis))
+		errx(EX_SOFTWARE, "tuple too large");
+
+	ch->cis[ch->size++] = tag;
+	ch->cis[ch->size++] = tlen;
+	if (hnbu_tag != BHND_CIS_HNBU_NONE)
+		ch->cis[ch->size++] = hnbu_tag;
+	memcpy(&ch->cis[ch->size], body, len);
+	ch->size += len;
+
+	if (t != NULL)
+		check_cis_ref_tuple(&ch->ref, t, body, len);
+}
+
+/** Terminate @p ch, and its reference environment */
+static void
+check_cis_chain_end (struct check_cis_chain *ch)
+{
+	ch->cis[ch->size++] = BHND_CIS_TPL_END;
+	bhnd_nvram_put_char(&ch->ref, '\0');
+}
+
+/** Decode @p ch, and compare the result against its reference
+ *  environment */
+static void
+check_cis_chain_verify (const struct check_cis_chain *ch, const char *what)
+{
+	static char	buf[CHECK_CIS_ENV_MAX];
+	size_t		len, sized;
+	int		error;
+
+	len = sizeof(buf);
+	error = bhnd_cis_decode(ch->cis, ch->size, buf, &len);
+	CHECK(error == 0, "%s: decode failed: %d", what, error);
+	if (error)
+		return;
+
+	CHECK(len == ch->ref.ob_len && memcmp(buf, ch->env, len) == 0,
+	    "%s: decoded %zu bytes, expected %zu", what, len, ch->ref.ob_len);
+
+	sized = 0;
+	error = bhnd_cis_decode(ch->cis, ch->size, NULL, &sized);
+	CHECK(error == 0 && sized == len, "%s: sized %zu, decoded %zu", what,
+	    sized, len);
+}
+
+/** Append an HNBU_SROMREV tuple for @p rev to @p ch, if the table
+ *  defines one */
+static void
+check_cis_chain_sromrev (struct check_cis_chain *ch, uint8_t rev)
+{
+	const struct bhnd_cis_tuple *t;
+
+	if (rev == 1)
+		return;
+
+	t = bhnd_cis_find_tuple(BHND_CIS_TPL_BRCM_HNBU, BHND_CIS_HNBU_SROMREV,
+	    rev);
+	check_cis_chain_add(ch, t, BHND_CIS_TPL_BRCM_HNBU,
+	    BHND_CIS_HNBU_SROMREV, &rev, 1);
+}
+
+/** Decode chains of random standard tuples for each SROM revision */
+static void
+check_cis_standard (void)
+{
+	static struct check_cis_chain	 ch;
+	static const uint8_t		 revs[] = { 1, 2, 3, 4, 5, 8, 9, 10, 11 };
+	const struct bhnd_cis_tuple	*tuples;
+	struct check_rng		 rng;
+	size_t				 ntuples;
+
+	check_rng_init(&rng, 36);
+	tuples = bhnd_cis_get_tuples(&ntuples);
+
+	for (size_t r = 0; r < sizeof(revs) / sizeof(revs[0]); r++) {
+		uint8_t rev = revs[r];
+
+		for (size_t c = 0; c < CHECK_CIS_CHAINS; c++) {
+			char what[64];
+
+			check_cis_chain_init(&ch);
+			check_cis_chain_sromrev(&ch, rev);
+
+			for (size_t i = 0; i < ntuples; i++) {
+				const struct bhnd_cis_tuple	*t = &tuples[i];
+				uint8_t				 body[UINT8_MAX];
+				size_t				 len;
+
+				if (t->flags & BHND_CIS_TF_SPECIAL)
+					continue;
+
+				if (t->tag == BHND_CIS_TPL_BRCM_HNBU &&
+				    t->hnbu_tag == BHND_CIS_HNBU_SROMREV)
+					continue;
+
+				/* Only the layout selected for this revision */
+				if (bhnd_cis_find_tuple(t->tag, t->hnbu_tag,
+				    rev) != t)
+					continue;
+
+				/* Full-length bodies, and sometimes short (or
+				 * long) ones */
+				len = check_cis_body_len(t);
+				switch (check_rng_next(&rng) % 4) {
+				case 0:
+					len = check_rng_next(&rng) % (len + 1);
+					break;
+				case 1:
+					len += check_rng_next(&rng) % 4;
+					break;
+				}
+				if (len > UINT8_MAX - 1)
+					len = UINT8_MAX - 1;
+
+				check_rng_fill(&rng, body, len);
+				check_cis_chain_add(&ch, t, t->tag, t->hnbu_tag,
+				    body, len);
+
+				/* Interleave null tuples, which have no length */
+				if (check_rng_next(&rng) % 8 == 0)
+					ch.cis[ch.size++] = BHND_CIS_TPL_NULL;
+			}
+
+			check_cis_chain_end(&ch);
+
+			snprintf(what, sizeof(what), "rev %hhu chain %zu", rev, c);
+			check_cis_chain_verify(&ch, what);
+		}
+	}
+}
+
+/** Check the MAC address, boardnum, OEM and UUID special cases */
+static void
+check_cis_special (void)
+{
+	static struct check_cis_chain	 ch;
+	static const uint8_t		 mac[6] = {
+		0x00, 0x10, 0x18, 0xAB, 0x12, 0x34
+	};
+	static const uint8_t		 mac2[6] = {
+		0x00, 0x10, 0x18, 0xCD, 0x56, 0x78
+	};
+	static const uint8_t		 mcast[6] = {
+		0x01, 0x00, 0x5E, 0x00, 0x00, 0x01
+	};
+	static const uint8_t		 oem[8] = {
+		0x00, 0x01, 0x0A, 0x1B, 0xC2, 0xD3, 0xEE, 0xFF
+	};
+	static const uint8_t		 uuid[16] = {
+		0x12, 0x34, 0x56, 0x78, 0x9A, 0xBC, 0xDE, 0xF0,
+		0x0F, 0xED, 0xCB, 0xA9, 0x87, 0x65, 0x43, 0x21
+	};
+	const struct bhnd_cis_tuple	*bt;
+	uint8_t				 boardnum[2] = { 0x21, 0x43 };
+	const char			*bfmt;
+
+	/* The boardnum is formatted as HNBU_BOARDNUM's variable */
+	bt = bhnd_cis_find_tuple(BHND_CIS_TPL_BRCM_HNBU, BHND_CIS_HNBU_BOARDNUM,
+	    1);
+	bfmt = "%u";
+	if (bt != NULL && bt->num_vars == 1 &&
+	    bt->vars[0].fmt == BHND_NVRAM_VFMT_HEX)
+		bfmt = "0x%x";
+
+	if (bhnd_cis_find_tuple(BHND_CIS_TPL_BRCM_HNBU, BHND_CIS_HNBU_MACADDR,
+	    1) != NULL) {
+		char tmp[32];
+
+		/* Multicast addresses are ignored; the boardnum is derived
+		 * from the first valid address, and written before the
+		 * last MAC address */
+		check_cis_chain_init(&ch);
+		check_cis_chain_add(&ch, NULL, BHND_CIS_TPL_BRCM_HNBU,
+		    BHND_CIS_HNBU_MACADDR, mcast, sizeof(mcast));
+		check_cis_chain_add(&ch, NULL, BHND_CIS_TPL_BRCM_HNBU,
+		    BHND_CIS_HNBU_MACADDR, mac, sizeof(mac));
+		check_cis_chain_add(&ch, NULL, BHND_CIS_TPL_BRCM_HNBU,
+		    BHND_CIS_HNBU_MACADDR, mac2, sizeof(mac2));
+
+		snprintf(tmp, sizeof(tmp), bfmt, 0x1234);
+		bhnd_nvram_put_str(&ch.ref, "boardnum=");
+		bhnd_nvram_put_str(&ch.ref, tmp);
+		bhnd_nvram_put_char(&ch.ref, '\0');
+		bhnd_nvram_put_str(&ch.ref, "macaddr=00:10:18:cd:56:78");
+		bhnd_nvram_put_char(&ch.ref, '\0');
+
+		check_cis_chain_end(&ch);
+		check_cis_chain_verify(&ch, "macaddr");
+
+		/* An explicit boardnum takes precedence */
+		if (bt != NULL && !(bt->flags & BHND_CIS_TF_SPECIAL)) {
+			check_cis_chain_init(&ch);
+			check_cis_chain_add(&ch, NULL, BHND_CIS_TPL_BRCM_HNBU,
+			    BHND_CIS_HNBU_MACADDR, mac, sizeof(mac));
+			check_cis_chain_add(&ch, bt, BHND_CIS_TPL_BRCM_HNBU,
+			    BHND_CIS_HNBU_BOARDNUM, boardnum, sizeof(boardnum));
+			bhnd_nvram_put_str(&ch.ref, "macaddr=00:10:18:ab:12:34");
+			bhnd_nvram_put_char(&ch.ref, '\0');
+
+			check_cis_chain_end(&ch);
+			check_cis_chain_verify(&ch, "boardnum");
+		}
+	}
+
+	if (bhnd_cis_find_tuple(BHND_CIS_TPL_BRCM_HNBU, BHND_CIS_HNBU_OEM,
+	    1) != NULL) {
+		check_cis_chain_init(&ch);
+		check_cis_chain_add(&ch, NULL, BHND_CIS_TPL_BRCM_HNBU,
+		    BHND_CIS_HNBU_OEM, oem, sizeof(oem));
+		bhnd_nvram_put_str(&ch.ref, "oem=00010a1bc2d3eeff");
+		bhnd_nvram_put_char(&ch.ref, '\0');
+
+		check_cis_chain_end(&ch);
+		check_cis_chain_verify(&ch, "oem");
+	}
+
+	if (bhnd_cis_find_tuple(BHND_CIS_TPL_BRCM_HNBU, BHND_CIS_HNBU_UUID,
+	    1) != NULL) {
+		check_cis_chain_init(&ch);
+		check_cis_chain_add(&ch, NULL, BHND_CIS_TPL_BRCM_HNBU,
+		    BHND_CIS_HNBU_UUID, uuid, sizeof(uuid));
+		bhnd_nvram_put_str(&ch.ref,
+		    "uuid=12345678-9ABC-DEF0-0FED-CBA987654321");
+		bhnd_nvram_put_char(&ch.ref, '\0');
+
+		check_cis_chain_end(&ch);
+		check_cis_chain_verify(&ch, "uuid");
+	}
+}
+
+/** Check that malformed tuple chains are rejected */
+static void
+check_cis_malformed (void)
+{
+	static const struct {
+		const char	*what;
+		uint8_t		 cis[8];
+		size_t		 size;
+	} chains[] = {
+		{ "missing length",	{ 0x20 },				1 },
+		{ "truncated body",	{ 0x20, 0x04, 0x00, 0x00 },		4 },
+		{ "empty HNBU tuple",	{ 0x80, 0x00, 0xFF },			3 },
+	};
+	size_t len;
+
+	for (size_t i = 0; i < sizeof(chains) / sizeof(chains[0]); i++) {
+		len = 0;
+		CHECK(bhnd_cis_decode(chains[i].cis, chains[i].size, NULL,
+		    &len) == EINVAL, "%s: accepted", chains[i].what);
+	}
+
+	/* A chain may end without an END tuple */
+	len = 0;
+	CHECK(bhnd_cis_decode((const uint8_t *)"\x00\x00", 2, NULL, &len) == 0 &&
+	    len == 1, "unterminated empty chain rejected");
+}
+
+/** Decode @p cis repeatedly, and report the decode rate */
+static void
+check_cis_bench_one (const char *what, const uint8_t *cis, size_t size)
+{
+	static char	buf[CHECK_CIS_ENV_MAX];
+	double		start, secs;
+	size_t		len;
+	int		error;
+
+	start = check_now();
+	for (size_t p = 0; p < CHECK_CIS_BENCH_PASSES; p++) {
+		len = sizeof(buf);
+		if ((error = bhnd_cis_decode(cis, size, buf, &len))) {
+			CHECK(error == 0, "%s: decode failed: %d", what, error);
+			return;
+		}
+	}
+	secs = check_now() - start;
+
+	printf("cis %s: %zu bytes -> %zu bytes, %.0f ns/chain, %.0f MB/s\n",
+	    what, size, len, secs * 1e9 / CHECK_CIS_BENCH_PASSES,
+	    (size * (double)CHECK_CIS_BENCH_PASSES) / secs / 1e6);
+}
+
+/** Time decoding of every standard revision 11 tuple, and of the CIS
+ *  files named in @p paths */
+static void
+check_cis_bench (char * const paths[], size_t npaths)
+{
+	static struct check_cis_chain	 ch;
+	const struct bhnd_cis_tuple	*tuples;
+	struct check_rng		 rng;
+	size_t				 ntuples;
+
+	check_rng_init(&rng, 360);
+	tuples = bhnd_cis_get_tuples(&ntuples);
+
+	check_cis_chain_init(&ch);
+	check_cis_chain_sromrev(&ch, 11);
+	for (size_t i = 0; i < ntuples; i++) {
+		const struct bhnd_cis_tuple	*t = &tuples[i];
+		uint8_t				 body[UINT8_MAX];
+		size_t				 len;
+
+		if ((t->flags & BHND_CIS_TF_SPECIAL) ||
+		    (t->tag == BHND_CIS_TPL_BRCM_HNBU &&
+		    t->hnbu_tag == BHND_CIS_HNBU_SROMREV) ||
+		    bhnd_cis_find_tuple(t->tag, t->hnbu_tag, 11) != t)
+			continue;
+
+		len = check_cis_body_len(t);
+		check_rng_fill(&rng, body, len);
+		check_cis_chain_add(&ch, t, t->tag, t->hnbu_tag, body, len);
+	}
+	check_cis_chain_end(&ch);
+	check_cis_bench_one("rev 11", ch.cis, ch.size);
+
+	for (size_t i = 0; i < npaths; i++) {
+		FILE	*fp;
+		uint8_t	*cis;
+		size_t	 size;
+
+		if ((fp = fopen(paths[i], "r")) == NULL)
+			err(EX_NOINPUT, "%s", paths[i]);
+
+		if ((cis = malloc(CHECK_CIS_CHAIN_MAX)) == NULL)
+			err(EX_OSERR, "malloc");
+
+		size = fread(cis, 1, CHECK_CIS_CHAIN_MAX, fp);
+		if (ferror(fp))
+			err(EX_IOERR, "%s", paths[i]);
+		fclose(fp);
+
+		check_cis_bench_one(paths[i], cis, size);
+		free(cis);
+	}
+}
+
+int
+main (int argc, char * const argv[])
+{
+	int argi;
+
+	argi = check_init(argc, argv);
+
+	check_cis_standard();
+	check_cis_special();
+	check_cis_malformed();
+
+	if (check_bench)
+		check_cis_bench(argv + argi, argc - argi);
+
+	return (check_finish());
+}
@@ -0,0 +1,303 @@
+//
+//  check_enc.c
+//  ccmach
+//
+//  Created by Landon Fuller on 2/14/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+/*
+ * SPROM encoder checks.
+ *
+ * Random images of every supported revision are decoded, and the decoded
+ * environments encoded again. The encoded image must be identified as the
+ * same revision, must decode to the same environment, and must match the
+ * original image in every bit covered by a variable; all other bits are
+ * left clear. Malformed and unrepresentable environments must be rejected.
+ * With -b, encode throughput is measured per revision.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include "nvram_sprom.h"
+#include "nvram_sprom_enc.h"
+
+#include "check.h"
+
+/** Images encoded per SPROM revision */
+#define	CHECK_ENC_IMAGES	64
+
+/** Maximum SPROM revision checked */
+#define	CHECK_ENC_REV_MAX	11
+
+/** Encode passes over all images, per revision, with -b */
+#define	CHECK_ENC_BENCH_PASSES	512
+
+/**
+ * Compute the mask of all image bits covered by a variable in @p enc's
+ * revision.
+ */
+static void
+check_enc_mapped (const struct bhnd_sprom_encoder *enc, uint8_t *mask)
+{
+	memset(mask, 0, enc->se_size);
+
+	for (size_t i = 0; i < enc->se_nvars; i++) {
+		const struct bhnd_sprom_enc_var	*ev = &enc->se_vars[i];
+		uint32_t			 ones[BHND_SPROM_ARRAY_MAX];
+
+		for (size_t e = 0; e < ev->nvals; e++)
+			ones[e] = ev->vmask;
+
+		bhnd_sprom_write_var(mask, ev->sv, ones);
+	}
+}
+
+/**
+ * Generate a random SPROM image of @p enc's revision.
+ *
+ * A NUL character cannot be represented in a packed environment; NUL
+ * elements of character variables are replaced with random letters.
+ */
+static void
+check_enc_image (struct check_rng *rng, const struct bhnd_sprom_encoder *enc,
+    uint8_t *image)
+{
+	size_t size;
+
+	if (check_sprom_image(rng, enc->se_rev, image, &size))
+		errx(EX_SOFTWARE, "no layout for rev %hhu", enc->se_rev);
+
+	for (size_t i = 0; i < enc->se_nvars; i++) {
+		const struct bhnd_sprom_enc_var	*ev = &enc->se_vars[i];
+		struct bhnd_sprom_ctx		 ctx;
+
+		if (ev->nv->type != BHND_NVRAM_DT_CHAR)
+			continue;
+
+		if (bhnd_sprom_ctx_init(&ctx, image, size) ||
+		    bhnd_sprom_decode_var(&ctx, ev->nv))
+			errx(EX_SOFTWARE, "%s: decode failed", ev->nv->name);
+
+		for (size_t e = 0; e < ctx.sp_nvals; e++) {
+			if (ctx.sp_vals[e] == 0)
+				ctx.sp_vals[e] = 'A' + (check_rng_next(rng) % 26);
+		}
+
+		bhnd_sprom_write_var(image, ev->sv, ctx.sp_vals);
+	}
+
+	check_sprom_crc(image, size);
+}
+
+/** Decode @p image, returning its environment in @p env */
+static int
+check_enc_decode (const uint8_t *image, size_t size, char **env, size_t *len)
+{
+	struct bhnd_sprom_ctx	ctx;
+	int			error;
+
+	if ((error = bhnd_sprom_ctx_init(&ctx, image, size)))
+		return (error);
+
+	return (bhnd_sprom_decode_alloc(&ctx, env, len));
+}
+
+/** Round-trip random images of @p rev through the decoder and encoder */
+static void
+check_enc_roundtrip (struct check_rng *rng, uint8_t rev)
+{
+	struct bhnd_sprom_encoder	enc;
+	uint8_t				mask[BHND_SPROM_MAX_SIZE];
+	size_t				sig_off;
+	uint16_t			sig;
+	int				error;
+
+	error = bhnd_sprom_encoder_init(&enc, rev);
+	CHECK(error == 0, "rev %hhu encoder_init failed: %d", rev, error);
+	if (error)
+		return;
+
+	/* The revision byte and signature are always written */
+	check_enc_mapped(&enc, mask);
+	mask[enc.se_size - 2] = 0xFF;
+	if (bhnd_sprom_layout_sig(rev, &sig_off, &sig) == 0) {
+		mask[sig_off] = 0xFF;
+		mask[sig_off + 1] = 0xFF;
+	}
+
+	for (size_t i = 0; i < CHECK_ENC_IMAGES; i++) {
+		uint8_t	 image[BHND_SPROM_MAX_SIZE];
+		uint8_t	 encoded[BHND_SPROM_MAX_SIZE];
+		char	*env, *env2;
+		size_t	 size, len, len2, enc_size;
+		uint8_t	 enc_rev;
+
+		check_enc_image(rng, &enc, image);
+		size = enc.se_size;
+
+		error = check_enc_decode(image, size, &env, &len);
+		CHECK(error == 0, "rev %hhu decode failed: %d", rev, error);
+		if (error)
+			continue;
+
+		error = bhnd_sprom_encode(&enc, env, len, encoded);
+		CHECK(error == 0, "rev %hhu encode failed: %d", rev, error);
+		if (error) {
+			free(env);
+			continue;
+		}
+
+		error = bhnd_sprom_identify(encoded, enc.se_size, &enc_rev,
+		    &enc_size);
+		CHECK(error == 0 && enc_rev == rev && enc_size == size,
+		    "rev %hhu: encoded image not identified", rev);
+
+		/* Mapped bits must match; unmapped bits must be clear */
+		for (size_t b = 0; b < size - 1; b++) {
+			CHECK((encoded[b] & mask[b]) == (image[b] & mask[b]) &&
+			    (encoded[b] & ~mask[b]) == 0,
+			    "rev %hhu: byte 0x%zx is 0x%02hhx, expected 0x%02hhx",
+			    rev, b, encoded[b],
+			    (uint8_t)(image[b] & mask[b]));
+		}
+
+		error = check_enc_decode(encoded, size, &env2, &len2);
+		CHECK(error == 0 && len2 == len && memcmp(env, env2, len) == 0,
+		    "rev %hhu: encoded image decodes differently", rev);
+
+		if (error == 0)
+			free(env2);
+		free(env);
+	}
+
+	bhnd_sprom_encoder_fini(&enc);
+}
+
+/** Check that invalid environments are rejected */
+static void
+check_enc_errors (void)
+{
+	struct bhnd_sprom_encoder	 enc;
+	const struct bhnd_sprom_enc_var	*ev;
+	uint8_t				 image[BHND_SPROM_MAX_SIZE];
+	char				 env[256];
+	size_t				 len;
+	int				 error;
+
+	for (uint8_t rev = 1; rev <= CHECK_ENC_REV_MAX; rev++) {
+		if (bhnd_sprom_encoder_init(&enc, rev))
+			continue;
+
+		/* An empty environment encodes to the base image */
+		error = bhnd_sprom_encode(&enc, "", 0, image);
+		CHECK(error == 0 && memcmp(image, enc.se_base,
+		    enc.se_size - 1) == 0,
+		    "rev %hhu: empty environment not encoded", rev);
+
+		len = snprintf(env, sizeof(env), "sromrev=%hhu", rev) + 1;
+		CHECK(bhnd_sprom_encode(&enc, env, len, image) == 0,
+		    "rev %hhu: matching sromrev rejected", rev);
+
+		len = snprintf(env, sizeof(env), "sromrev=%d", rev + 1) + 1;
+		CHECK(bhnd_sprom_encode(&enc, env, len, image) == EINVAL,
+		    "rev %hhu: mismatched sromrev accepted", rev);
+
+		len = snprintf(env, sizeof(env), "no_such_variable=1") + 1;
+		CHECK(bhnd_sprom_encode(&enc, env, len, image) == ENOENT,
+		    "rev %hhu: unknown variable accepted", rev);
+
+		len = snprintf(env, sizeof(env), "sromrev") + 1;
+		CHECK(bhnd_sprom_encode(&enc, env, len, image) == EINVAL,
+		    "rev %hhu: record without '=' accepted", rev);
+
+		/* A value wider than its variable's mask cannot be encoded */
+		for (size_t i = 0; i < enc.se_nvars; i++) {
+			ev = &enc.se_vars[i];
+			if (ev->nvals != 1 || ev->vmask == UINT32_MAX ||
+			    ev->nv->fmt != BHND_NVRAM_VFMT_HEX)
+				continue;
+
+			len = snprintf(env, sizeof(env), "%s=0x%x",
+			    ev->nv->name, ev->vmask + 1) + 1;
+			CHECK(bhnd_sprom_encode(&enc, env, len, image) ==
+			    ERANGE, "rev %hhu %s: out of range value accepted",
+			    rev, ev->nv->name);
+		}
+
+		bhnd_sprom_encoder_fini(&enc);
+	}
+}
+
+/** Measure encode throughput of decoded random images, per revision */
+static void
+check_enc_bench (void)
+{
+	struct check_rng rng;
+
+	check_rng_init(&rng, 4100);
+
+	for (uint8_t rev = 1; rev <= CHECK_ENC_REV_MAX; rev++) {
+		struct bhnd_sprom_encoder	 enc;
+		uint8_t				 image[BHND_SPROM_MAX_SIZE];
+		char				*envs[CHECK_ENC_IMAGES];
+		size_t				 lens[CHECK_ENC_IMAGES];
+		size_t				 failed;
+		double				 start, secs;
+
+		if (bhnd_sprom_encoder_init(&enc, rev))
+			continue;
+
+		for (size_t i = 0; i < CHECK_ENC_IMAGES; i++) {
+			check_enc_image(&rng, &enc, image);
+			if (check_enc_decode(image, enc.se_size, &envs[i],
+			    &lens[i]))
+				errx(EX_SOFTWARE, "rev %hhu decode failed", rev);
+		}
+
+		failed = 0;
+		start = check_now();
+		for (size_t p = 0; p < CHECK_ENC_BENCH_PASSES; p++) {
+			for (size_t i = 0; i < CHECK_ENC_IMAGES; i++) {
+				if (bhnd_sprom_encode(&enc, envs[i], lens[i],
+				    image))
+					failed++;
+			}
+		}
+		secs = check_now() - start;
+		CHECK(failed == 0, "rev %hhu: %zu encodes failed", rev, failed);
+
+		printf("encode rev %2hhu: %zu vars, %.0f ns/image, "
+		    "%.0f images/sec\n", rev, enc.se_nvars,
+		    secs * 1e9 / (CHECK_ENC_BENCH_PASSES * CHECK_ENC_IMAGES),
+		    (CHECK_ENC_BENCH_PASSES * CHECK_ENC_IMAGES) / secs);
+
+		for (size_t i = 0; i < CHECK_ENC_IMAGES; i++)
+			free(envs[i]);
+		bhnd_sprom_encoder_fini(&enc);
+	}
+}
+
+int
+main (int argc, char * const argv[])
+{
+	struct check_rng rng;
+
+	check_init(argc, argv);
+	check_rng_init(&rng, 41);
+
+	for (uint8_t rev = 1; rev <= CHECK_ENC_REV_MAX; rev++)
+		check_enc_roundtrip(&rng, rev);
+
+	check_enc_errors();
+
+	if (check_bench)
+		check_enc_bench();
+
+	return (check_finish());
+}
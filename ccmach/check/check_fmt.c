@@ -0,0 +1,360 @@
+//
+//  check_fmt.c
+//  ccmach
+//
+//  Created by Landon Fuller on 2/14/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+/*
+ * Value formatter checks.
+ *
+ * Every format and data type is formatted with bhnd_nvram_fmt_value(), and
+ * compared against a reference snprintf(3) implementation of the vendor
+ * formatting, over boundary and random values. With -b, decoding and
+ * formatting full revision 11 images with bhnd_nvram_fmt_pair() is
+ * compared against the snprintf(3) reference.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include "nvram_fmt.h"
+#include "nvram_sprom.h"
+
+#include "check.h"
+
+/** Maximum formatted value length */
+#define	CHECK_FMT_MAX		512
+
+/** Random values checked per format and type */
+#define	CHECK_FMT_RANDOM	4096
+
+/** Images formatted per benchmark pass */
+#define	CHECK_FMT_BENCH_IMAGES	256
+
+/** Benchmark passes */
+#define	CHECK_FMT_BENCH_PASSES	64
+
+/** Sign-extend @p v from the most significant bit set in @p vmask */
+static int32_t
+check_fmt_sext (uint32_t v, uint32_t vmask)
+{
+	uint32_t sign;
+
+	if (vmask == 0)
+		return ((int32_t)v);
+
+	for (sign = 1U << 31; (sign & vmask) == 0; sign >>= 1)
+		continue;
+
+	if (v & sign)
+		v |= ~(sign | (sign - 1));
+
+	return ((int32_t)v);
+}
+
+/**
+ * Reference formatter, following the vendor decoder's use of
+ * snprintf(3). Returns the formatted length, or -1 if the value count is
+ * invalid for @p fmt.
+ */
+static int
+check_fmt_ref (char *buf, size_t size, bhnd_nvram_fmt fmt,
+    bhnd_nvram_dt type, const uint32_t *vals, size_t nvals, uint32_t vmask)
+{
+	size_t	len;
+	bool	empty;
+
+	len = 0;
+	buf[0] = '\0';
+
+#define	REF_APPEND(...)	\
+	len += snprintf(buf + len, (len < size) ? size - len : 0, __VA_ARGS__)
+
+	switch (fmt) {
+	case BHND_NVRAM_VFMT_MACADDR:
+		if (nvals != 6)
+			return (-1);
+
+		REF_APPEND("%02x:%02x:%02x:%02x:%02x:%02x", vals[0] & 0xFF,
+		    vals[1] & 0xFF, vals[2] & 0xFF, vals[3] & 0xFF,
+		    vals[4] & 0xFF, vals[5] & 0xFF);
+		break;
+
+	case BHND_NVRAM_VFMT_LEDDC:
+		if (nvals != 2)
+			return (-1);
+
+		REF_APPEND("%d", (int32_t)(((vals[1] & 0xFF) << 24) |
+		    ((vals[0] & 0xFF) << 8)));
+		break;
+
+	case BHND_NVRAM_VFMT_CCODE:
+		empty = true;
+		for (size_t i = 0; i < nvals; i++)
+			empty &= (vals[i] == 0);
+
+		for (size_t i = 0; i < nvals && !empty; i++)
+			REF_APPEND("%c", (char)vals[i]);
+		break;
+
+	case BHND_NVRAM_VFMT_HEX:
+	case BHND_NVRAM_VFMT_DEC:
+		for (size_t i = 0; i < nvals; i++) {
+			if (i > 0)
+				REF_APPEND(",");
+
+			if (type == BHND_NVRAM_DT_CHAR)
+				REF_APPEND("%c", (char)vals[i]);
+			else if (fmt == BHND_NVRAM_VFMT_HEX)
+				REF_APPEND("0x%x", vals[i]);
+			else if (type == BHND_NVRAM_DT_SINT)
+				REF_APPEND("%d", check_fmt_sext(vals[i], vmask));
+			else
+				REF_APPEND("%u", vals[i]);
+		}
+		break;
+	}
+
+#undef	REF_APPEND
+
+	return ((int)len);
+}
+
+/** Format @p vals with both formatters, and compare the results */
+static void
+check_fmt_one (bhnd_nvram_fmt fmt, bhnd_nvram_dt type, const uint32_t *vals,
+    size_t nvals, uint32_t vmask)
+{
+	struct bhnd_nvram_obuf	ob;
+	char			buf[CHECK_FMT_MAX], ref[CHECK_FMT_MAX];
+	int			error, ref_len;
+
+	ref_len = check_fmt_ref(ref, sizeof(ref), fmt, type, vals, nvals,
+	    vmask);
+
+	bhnd_nvram_obuf_init(&ob, buf, sizeof(buf));
+	error = bhnd_nvram_fmt_value(&ob, fmt, type, vals, nvals, vmask);
+	if (ref_len < 0) {
+		CHECK(error != 0, "fmt %d accepted %zu values", fmt, nvals);
+		return;
+	}
+
+	CHECK(error == 0, "fmt %d type %d failed: %d", fmt, type, error);
+	CHECK(ob.ob_len == (size_t)ref_len &&
+	    memcmp(buf, ref, ob.ob_len) == 0,
+	    "fmt %d type %d value 0x%x: '%.*s' != '%s'", fmt, type, vals[0],
+	    (int)ob.ob_len, buf, ref);
+
+	/* A sizing pass must agree */
+	bhnd_nvram_obuf_init(&ob, NULL, 0);
+	bhnd_nvram_fmt_value(&ob, fmt, type, vals, nvals, vmask);
+	CHECK(ob.ob_len == (size_t)ref_len,
+	    "fmt %d type %d value 0x%x: sized %zu, formatted %d", fmt, type,
+	    vals[0], ob.ob_len, ref_len);
+
+	/* Truncated output must be a prefix of the full value, and must
+	 * still report the full length */
+	if (ref_len > 1) {
+		memset(buf, '\0', sizeof(buf));
+		bhnd_nvram_obuf_init(&ob, buf, ref_len / 2);
+		bhnd_nvram_fmt_value(&ob, fmt, type, vals, nvals, vmask);
+		CHECK(ob.ob_len == (size_t)ref_len &&
+		    !bhnd_nvram_obuf_fits(&ob) &&
+		    memcmp(buf, ref, ref_len / 2) == 0 &&
+		    buf[ref_len / 2] == '\0',
+		    "fmt %d type %d value 0x%x: bad truncation", fmt, type,
+		    vals[0]);
+	}
+}
+
+/** Check every format and type against the reference formatter */
+static void
+check_fmt_values (void)
+{
+	static const uint32_t edges[] = {
+		0, 1, 9, 10, 11, 15, 16, 99, 100, 101, 127, 128, 255, 256,
+		999, 1000, 9999, 10000, 65535, 65536, 99999, 100000, 999999,
+		1000000, 9999999, 10000000, 99999999, 100000000, 999999999,
+		1000000000, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFE, 0xFFFFFFFF
+	};
+	static const uint32_t vmasks[] = {
+		0xFF, 0xFFFF, 0x7F00, 0xFFFFFFFF
+	};
+	static const struct { bhnd_nvram_fmt fmt; bhnd_nvram_dt type; } fmts[] = {
+		{ BHND_NVRAM_VFMT_HEX,		BHND_NVRAM_DT_UINT },
+		{ BHND_NVRAM_VFMT_HEX,		BHND_NVRAM_DT_SINT },
+		{ BHND_NVRAM_VFMT_DEC,		BHND_NVRAM_DT_UINT },
+		{ BHND_NVRAM_VFMT_DEC,		BHND_NVRAM_DT_SINT },
+		{ BHND_NVRAM_VFMT_DEC,		BHND_NVRAM_DT_CHAR },
+		{ BHND_NVRAM_VFMT_MACADDR,	BHND_NVRAM_DT_UINT },
+		{ BHND_NVRAM_VFMT_LEDDC,	BHND_NVRAM_DT_UINT },
+		{ BHND_NVRAM_VFMT_CCODE,	BHND_NVRAM_DT_CHAR },
+	};
+	struct check_rng	rng;
+	uint32_t		vals[BHND_SPROM_ARRAY_MAX];
+
+	check_rng_init(&rng, 32);
+
+	for (size_t f = 0; f < sizeof(fmts) / sizeof(fmts[0]); f++) {
+		bhnd_nvram_fmt	fmt = fmts[f].fmt;
+		bhnd_nvram_dt	type = fmts[f].type;
+
+		/* Boundary values, as single values and as arrays */
+		for (size_t m = 0; m < sizeof(vmasks) / sizeof(vmasks[0]); m++) {
+			for (size_t e = 0; e < sizeof(edges) / sizeof(edges[0]); e++) {
+				if (type == BHND_NVRAM_DT_CHAR &&
+				    (edges[e] == 0 || edges[e] > 0x7F))
+					continue;
+
+				for (size_t n = 0; n < 6; n++)
+					vals[n] = edges[(e + n) %
+					    (sizeof(edges) / sizeof(edges[0]))];
+
+				if (type == BHND_NVRAM_DT_CHAR)
+					for (size_t n = 0; n < 6; n++)
+						vals[n] = 'A' + (vals[n] % 26);
+
+				for (size_t n = 1; n <= 6; n++)
+					check_fmt_one(fmt, type, vals, n,
+					    vmasks[m]);
+			}
+		}
+
+		/* Random values */
+		for (size_t i = 0; i < CHECK_FMT_RANDOM; i++) {
+			size_t nvals;
+
+			nvals = 1 + (check_rng_next(&rng) %
+			    BHND_SPROM_ARRAY_MAX);
+			for (size_t n = 0; n < nvals; n++) {
+				vals[n] = check_rng_next(&rng);
+				if (type == BHND_NVRAM_DT_CHAR)
+					vals[n] = ' ' + (vals[n] % 95);
+			}
+
+			check_fmt_one(fmt, type, vals, nvals,
+			    vmasks[i % (sizeof(vmasks) / sizeof(vmasks[0]))]);
+		}
+	}
+
+	/* An all-zero country code is formatted as an empty string */
+	memset(vals, 0, sizeof(vals));
+	check_fmt_one(BHND_NVRAM_VFMT_CCODE, BHND_NVRAM_DT_CHAR, vals, 2, 0xFF);
+}
+
+/** Decode and format @p nimages revision 11 images, returning the total
+ *  output length */
+static size_t
+check_fmt_bench_pass (uint8_t (*images)[BHND_SPROM_MAX_SIZE], size_t nimages,
+    size_t size, char *buf, size_t buf_size, bool reference)
+{
+	const struct bhnd_nvram_var	*vars;
+	size_t				 num_vars, total;
+
+	vars = bhnd_nvram_get_vars(&num_vars);
+	total = 0;
+
+	for (size_t i = 0; i < nimages; i++) {
+		struct bhnd_sprom_ctx	ctx;
+		struct bhnd_nvram_obuf	ob;
+		size_t			len;
+
+		if (bhnd_sprom_ctx_init(&ctx, images[i], size))
+			errx(EX_SOFTWARE, "benchmark image not identified");
+
+		bhnd_nvram_obuf_init(&ob, buf, buf_size);
+		len = 0;
+		for (size_t v = 0; v < num_vars; v++) {
+			const struct bhnd_nvram_var *nv = &vars[v];
+
+			if (bhnd_sprom_decode_var(&ctx, nv))
+				continue;
+
+			if ((nv->flags & BHND_NVRAM_VF_IGNALL1) && ctx.sp_all1)
+				continue;
+
+			if (!reference) {
+				bhnd_nvram_fmt_pair(&ob, nv, ctx.sp_vals,
+				    ctx.sp_nvals, ctx.sp_vmask);
+				continue;
+			}
+
+			len += snprintf(buf + len, buf_size - len, "%s=",
+			    nv->name);
+			len += check_fmt_ref(buf + len, buf_size - len, nv->fmt,
+			    nv->type, ctx.sp_vals, ctx.sp_nvals, ctx.sp_vmask);
+			len++;
+		}
+
+		total += reference ? len : ob.ob_len;
+	}
+
+	return (total);
+}
+
+/** Compare formatting of full revision 11 images against the
+ *  snprintf(3) reference */
+static void
+check_fmt_bench (void)
+{
+	uint8_t			(*images)[BHND_SPROM_MAX_SIZE];
+	struct check_rng	 rng;
+	size_t			 size, fmt_len, ref_len;
+	double			 start, fmt_secs, ref_secs;
+	char			*buf;
+	const size_t		 buf_size = 64 * 1024;
+
+	images = calloc(CHECK_FMT_BENCH_IMAGES, sizeof(*images));
+	buf = malloc(buf_size);
+	if (images == NULL || buf == NULL)
+		err(EX_OSERR, "malloc");
+
+	check_rng_init(&rng, 320);
+	for (size_t i = 0; i < CHECK_FMT_BENCH_IMAGES; i++) {
+		if (check_sprom_image(&rng, 11, images[i], &size))
+			errx(EX_SOFTWARE, "no layout for rev 11");
+	}
+
+	fmt_len = ref_len = 0;
+
+	start = check_now();
+	for (size_t p = 0; p < CHECK_FMT_BENCH_PASSES; p++)
+		fmt_len += check_fmt_bench_pass(images, CHECK_FMT_BENCH_IMAGES,
+		    size, buf, buf_size, false);
+	fmt_secs = check_now() - start;
+
+	start = check_now();
+	for (size_t p = 0; p < CHECK_FMT_BENCH_PASSES; p++)
+		ref_len += check_fmt_bench_pass(images, CHECK_FMT_BENCH_IMAGES,
+		    size, buf, buf_size, true);
+	ref_secs = check_now() - start;
+
+	CHECK(fmt_len == ref_len, "benchmark output length %zu != %zu",
+	    fmt_len, ref_len);
+
+	printf("format rev 11: fmt_pair %.0f ns/image, snprintf %.0f "
+	    "ns/image\n",
+	    fmt_secs * 1e9 / (CHECK_FMT_BENCH_PASSES * CHECK_FMT_BENCH_IMAGES),
+	    ref_secs * 1e9 / (CHECK_FMT_BENCH_PASSES * CHECK_FMT_BENCH_IMAGES));
+
+	free(images);
+	free(buf);
+}
+
+int
+main (int argc, char * const argv[])
+{
+	check_init(argc, argv);
+
+	check_fmt_values();
+
+	if (check_bench)
+		check_fmt_bench();
+
+	return (check_finish());
+}
@@ -0,0 +1,248 @@
+//
+//  check_gather.c
+//  ccmach
+//
+//  Created by Landon Fuller on 2/14/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+/*
+ * SPROM column gather checks.
+ *
+ * Every element of every variable is gathered from runs of random images
+ * of each supported revision, and compared against the same element
+ * decoded from each image by bhnd_sprom_decode_var(). Image counts that
+ * are not a multiple of the vector width, and strides larger than the
+ * layout size, are included so that the scalar tail and unaligned image
+ * paths are exercised. With -b, gathering is timed against per-image
+ * decoding.
+ *
+ * This file is also built with AVX2 enabled (check_gather_avx2).
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include "nvram_gather.h"
+#include "nvram_sprom.h"
+
+#include "check.h"
+
+/** Maximum images gathered per run */
+#define	CHECK_GATHER_IMAGES	67
+
+/** Maximum SPROM revision checked */
+#define	CHECK_GATHER_REV_MAX	11
+
+/** Images gathered per revision, with -b */
+#define	CHECK_GATHER_BENCH_IMAGES	(16 * 1024)
+
+/**
+ * Generate @p nimages random images of @p rev, @p stride bytes apart, in
+ * a newly allocated buffer.
+ */
+static uint8_t *
+check_gather_images (struct check_rng *rng, uint8_t rev, size_t stride,
+    size_t nimages)
+{
+	uint8_t	*images;
+	size_t	 size;
+
+	if ((images = calloc(nimages, stride)) == NULL)
+		err(EX_OSERR, "calloc");
+
+	for (size_t i = 0; i < nimages; i++) {
+		if (check_sprom_image(rng, rev, images + (i * stride), &size))
+			errx(EX_SOFTWARE, "no layout for rev %hhu", rev);
+	}
+
+	return (images);
+}
+
+/** Decode element @p elem of @p nv from @p image */
+static int
+check_gather_decode (const uint8_t *image, size_t size,
+    const struct bhnd_nvram_var *nv, size_t elem, uint32_t *value)
+{
+	struct bhnd_sprom_ctx	ctx;
+	int			error;
+
+	if ((error = bhnd_sprom_ctx_init(&ctx, image, size)))
+		return (error);
+
+	if ((error = bhnd_sprom_decode_var(&ctx, nv)))
+		return (error);
+
+	if (elem >= ctx.sp_nvals)
+		return (ENOENT);
+
+	*value = ctx.sp_vals[elem];
+	return (0);
+}
+
+/** Compare gathered columns of every element of @p rev against per-image
+ *  decoding, for image runs of 0 to CHECK_GATHER_IMAGES images */
+static void
+check_gather_rev (struct check_rng *rng, uint8_t rev, size_t pad)
+{
+	const struct bhnd_nvram_var	*vars;
+	uint8_t				*images;
+	uint32_t			 column[CHECK_GATHER_IMAGES + 1];
+	size_t				 num_vars, size, stride;
+
+	if (bhnd_sprom_layout_size(rev, &size))
+		errx(EX_SOFTWARE, "no layout for rev %hhu", rev);
+
+	stride = size + pad;
+	images = check_gather_images(rng, rev, stride, CHECK_GATHER_IMAGES);
+	vars = bhnd_nvram_get_vars(&num_vars);
+
+	for (size_t v = 0; v < num_vars; v++) {
+		const struct bhnd_nvram_var	*nv = &vars[v];
+		const struct bhnd_sprom_var	*sv;
+
+		if ((sv = bhnd_nvram_find_sprom_var(nv, rev)) == NULL)
+			continue;
+
+		for (size_t elem = 0;; elem++) {
+			struct bhnd_sprom_gather_plan	plan;
+			uint32_t			expect[CHECK_GATHER_IMAGES];
+			int				error;
+
+			error = bhnd_sprom_gather_resolve(&plan, sv, size, elem);
+			if (error == ENOENT)
+				break;
+
+			CHECK(error == 0, "rev %hhu %s[%zu]: resolve failed: %d",
+			    rev, nv->name, elem, error);
+			if (error)
+				break;
+
+			for (size_t i = 0; i < CHECK_GATHER_IMAGES; i++) {
+				error = check_gather_decode(images + (i * stride),
+				    size, nv, elem, &expect[i]);
+				CHECK(error == 0, "rev %hhu %s[%zu]: decode "
+				    "failed: %d", rev, nv->name, elem, error);
+			}
+
+			for (size_t n = 0; n <= CHECK_GATHER_IMAGES; n++) {
+				/* Guard against writes past the column */
+				column[n] = 0xDEADBEEF;
+				bhnd_sprom_gather(&plan, images, stride, n,
+				    column);
+
+				CHECK(column[n] == 0xDEADBEEF, "rev %hhu %s[%zu]: "
+				    "gather of %zu images overran", rev,
+				    nv->name, elem, n);
+
+				for (size_t i = 0; i < n; i++) {
+					CHECK(column[i] == expect[i],
+					    "rev %hhu %s[%zu] image %zu of %zu "
+					    "(stride %zu): 0x%x != 0x%x", rev,
+					    nv->name, elem, i, n, stride,
+					    column[i], expect[i]);
+				}
+			}
+		}
+	}
+
+	free(images);
+}
+
+/** Time gathering every element of every variable against decoding the
+ *  same variables image by image */
+static void
+check_gather_bench (void)
+{
+	const struct bhnd_nvram_var	*vars;
+	struct check_rng		 rng;
+	uint32_t			*column;
+	size_t				 num_vars;
+
+	vars = bhnd_nvram_get_vars(&num_vars);
+	check_rng_init(&rng, 4400);
+
+	column = calloc(CHECK_GATHER_BENCH_IMAGES, sizeof(*column));
+	if (column == NULL)
+		err(EX_OSERR, "calloc");
+
+	for (uint8_t rev = 1; rev <= CHECK_GATHER_REV_MAX; rev++) {
+		uint8_t	*images;
+		size_t	 size, nelems;
+		double	 start, gather_secs, decode_secs;
+
+		if (bhnd_sprom_layout_size(rev, &size))
+			continue;
+
+		images = check_gather_images(&rng, rev, size,
+		    CHECK_GATHER_BENCH_IMAGES);
+
+		nelems = 0;
+		start = check_now();
+		for (size_t v = 0; v < num_vars; v++) {
+			const struct bhnd_sprom_var	*sv;
+			struct bhnd_sprom_gather_plan	 plan;
+
+			if ((sv = bhnd_nvram_find_sprom_var(&vars[v], rev)) ==
+			    NULL)
+				continue;
+
+			for (size_t elem = 0; bhnd_sprom_gather_resolve(&plan,
+			    sv, size, elem) == 0; elem++) {
+				bhnd_sprom_gather(&plan, images, size,
+				    CHECK_GATHER_BENCH_IMAGES, column);
+				nelems++;
+			}
+		}
+		gather_secs = check_now() - start;
+
+		start = check_now();
+		for (size_t i = 0; i < CHECK_GATHER_BENCH_IMAGES; i++) {
+			struct bhnd_sprom_ctx ctx;
+
+			if (bhnd_sprom_ctx_init(&ctx, images + (i * size), size))
+				errx(EX_SOFTWARE, "image not identified");
+
+			for (size_t v = 0; v < num_vars; v++)
+				bhnd_sprom_decode_var(&ctx, &vars[v]);
+		}
+		decode_secs = check_now() - start;
+
+		printf("gather rev %2hhu: %zu elements, gather %.1f ns/image, "
+		    "decode %.1f ns/image\n", rev, nelems,
+		    gather_secs * 1e9 / CHECK_GATHER_BENCH_IMAGES,
+		    decode_secs * 1e9 / CHECK_GATHER_BENCH_IMAGES);
+
+		free(images);
+	}
+
+	free(column);
+}
+
+int
+main (int argc, char * const argv[])
+{
+	struct check_rng rng;
+
+	check_init(argc, argv);
+#ifdef __AVX2__
+	check_require_avx2();
+#endif
+	check_rng_init(&rng, 44);
+
+	/* Packed images, and images at odd strides */
+	for (uint8_t rev = 1; rev <= CHECK_GATHER_REV_MAX; rev++) {
+		check_gather_rev(&rng, rev, 0);
+		check_gather_rev(&rng, rev, 1);
+		check_gather_rev(&rng, rev, 6);
+	}
+
+	if (check_bench)
+		check_gather_bench();
+
+	return (check_finish());
+}
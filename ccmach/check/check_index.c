@@ -0,0 +1,327 @@
+//
+//  check_index.c
+//  ccmach
+//
+//  Created by Landon Fuller on 2/14/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+/*
+ * Environment index checks.
+ *
+ * The vectorized scanning primitives are compared against byte-at-a-time
+ * scans at every length and alignment, and index lookups over random
+ * environments are compared against a linear scan. With -b, index and
+ * linear lookups are timed over environments of 2 KB to 64 KB.
+ *
+ * This file is also built with AVX2 enabled (check_index_avx2).
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include "nvram_index.h"
+#include "nvram_scan.h"
+
+#include "check.h"
+
+/** Random environments checked */
+#define	CHECK_INDEX_ENVS	256
+
+/** Maximum environment size */
+#define	CHECK_INDEX_ENV_MAX	(64 * 1024)
+
+/** Lookups per benchmark */
+#define	CHECK_INDEX_BENCH_LOOKUPS	(1024 * 1024)
+
+/** Check bhnd_nvram_scan2() and bhnd_nvram_count() at every length and
+ *  alignment of a random buffer */
+static void
+check_index_scan (void)
+{
+	struct check_rng	rng;
+	char			buf[256];
+
+	check_rng_init(&rng, 34);
+
+	for (size_t iter = 0; iter < 64; iter++) {
+		/* Sparse and dense matches */
+		for (size_t i = 0; i < sizeof(buf); i++) {
+			uint32_t r = check_rng_next(&rng) % ((iter & 1) ? 8 : 96);
+
+			buf[i] = (r == 0) ? '=' : (r == 1) ? '\0' : 'a' + (r % 26);
+		}
+
+		for (size_t off = 0; off < 64; off++) {
+			for (size_t len = 0; off + len <= sizeof(buf); len++) {
+				const char	*p = buf + off, *end = p + len;
+				const char	*found, *expect;
+				size_t		 count, nexpect;
+
+				expect = end;
+				nexpect = 0;
+				for (const char *q = p; q < end; q++) {
+					if (expect == end && (*q == '=' || *q == '\0'))
+						expect = q;
+					if (*q == '=')
+						nexpect++;
+				}
+
+				found = bhnd_nvram_scan2(p, end, '=', '\0');
+				CHECK(found == expect,
+				    "scan2 at %zu+%zu: %td != %td", off, len,
+				    found - p, expect - p);
+
+				count = bhnd_nvram_count(p, end, '=');
+				CHECK(count == nexpect,
+				    "count at %zu+%zu: %zu != %zu", off, len,
+				    count, nexpect);
+			}
+		}
+	}
+}
+
+/** Find @p name by linear scan, as getvar() does; returns the first
+ *  definition */
+static const char *
+check_index_linear (const char *env, size_t size, const char *name,
+    size_t *value_len)
+{
+	const char	*p, *end;
+	size_t		 name_len;
+
+	name_len = strlen(name);
+	end = env + size;
+
+	for (p = env; p < end && *p != '\0';) {
+		const char	*nul;
+
+		nul = memchr(p, '\0', end - p);
+		if (nul == NULL)
+			nul = end;
+
+		if ((size_t)(nul - p) > name_len && p[name_len] == '=' &&
+		    memcmp(p, name, name_len) == 0) {
+			*value_len = nul - (p + name_len + 1);
+			return (p + name_len + 1);
+		}
+
+		p = nul + 1;
+	}
+
+	return (NULL);
+}
+
+/**
+ * Generate a random environment of approximately @p target bytes in
+ * @p env, including duplicate names and records without a '='. If
+ * @p terminated is false, the final record is not NUL terminated.
+ *
+ * Returns the environment size.
+ */
+static size_t
+check_index_env (struct check_rng *rng, char *env, size_t target,
+    bool terminated)
+{
+	size_t len, nrecs;
+
+	len = 0;
+	nrecs = 0;
+	while (len + 64 < target) {
+		size_t	name_len, value_len;
+
+		/* Reuse a recent name, sometimes */
+		if (nrecs > 0 && check_rng_next(rng) % 16 == 0) {
+			len += snprintf(env + len, target - len, "var%zu=dup",
+			    nrecs - 1 - (check_rng_next(rng) % nrecs));
+			env[len++] = '\0';
+			continue;
+		}
+
+		/* A record with no '=', sometimes */
+		if (check_rng_next(rng) % 32 == 0) {
+			len += snprintf(env + len, target - len, "malformed%zu",
+			    nrecs);
+			env[len++] = '\0';
+			continue;
+		}
+
+		name_len = snprintf(env + len, target - len, "var%zu=", nrecs);
+		len += name_len;
+
+		value_len = check_rng_next(rng) % 24;
+		for (size_t i = 0; i < value_len; i++)
+			env[len++] = '0' + (check_rng_next(rng) % 10);
+
+		env[len++] = '\0';
+		nrecs++;
+	}
+
+	if (terminated) {
+		env[len++] = '\0';
+	} else if (len > 0) {
+		/* Drop the final record's terminator */
+		len--;
+	}
+
+	return (len);
+}
+
+/** Compare index lookups over random environments against a linear
+ *  scan */
+static void
+check_index_lookups (void)
+{
+	struct check_rng	 rng;
+	char			*env;
+
+	if ((env = malloc(CHECK_INDEX_ENV_MAX)) == NULL)
+		err(EX_OSERR, "malloc");
+
+	check_rng_init(&rng, 340);
+
+	for (size_t i = 0; i < CHECK_INDEX_ENVS; i++) {
+		struct bhnd_nvram_index	 idx;
+		const char		*value;
+		size_t			 size, target, found, value_len;
+		bool			 terminated;
+		int			 error;
+
+		target = 64 + (check_rng_next(&rng) % (CHECK_INDEX_ENV_MAX - 64));
+		terminated = (i % 4 != 0);
+		size = check_index_env(&rng, env, target, terminated);
+
+		error = bhnd_nvram_index_init(&idx, env, size);
+		CHECK(error == 0, "index_init failed: %d", error);
+		if (error)
+			continue;
+
+		found = 0;
+		for (size_t n = 0;; n++) {
+			const char	*expect;
+			char		 name[32];
+			size_t		 expect_len;
+
+			snprintf(name, sizeof(name), "var%zu", n);
+			expect = check_index_linear(env, size, name, &expect_len);
+			error = bhnd_nvram_index_get(&idx, name, &value,
+			    &value_len);
+
+			if (expect == NULL) {
+				CHECK(error == ENOENT, "%s: found %d", name, error);
+				break;
+			}
+
+			CHECK(error == 0 && value == expect &&
+			    value_len == expect_len,
+			    "%s: lookup differs from linear scan", name);
+			found++;
+		}
+
+		CHECK(idx.ni_count == found, "indexed %zu of %zu variables",
+		    idx.ni_count, found);
+
+		/* Malformed records and missing names are not found */
+		CHECK(bhnd_nvram_index_get(&idx, "malformed0", &value,
+		    &value_len) == ENOENT, "malformed record indexed");
+		CHECK(bhnd_nvram_index_get(&idx, "", &value, &value_len) ==
+		    ENOENT, "empty name found");
+
+		bhnd_nvram_index_fini(&idx);
+	}
+
+	free(env);
+}
+
+/** Time index and linear lookups over environments of 2 KB to 64 KB */
+static void
+check_index_bench (void)
+{
+	struct check_rng	 rng;
+	char			*env;
+
+	if ((env = malloc(CHECK_INDEX_ENV_MAX)) == NULL)
+		err(EX_OSERR, "malloc");
+
+	check_rng_init(&rng, 3400);
+
+	for (size_t target = 2048; target <= CHECK_INDEX_ENV_MAX; target *= 2) {
+		struct bhnd_nvram_index	 idx;
+		const char		*value;
+		size_t			 size, nvars, value_len, hits;
+		size_t			 linear_lookups;
+		double			 start, build_secs, idx_secs, lin_secs;
+		char			 (*names)[32];
+
+		size = check_index_env(&rng, env, target, true);
+
+		start = check_now();
+		for (size_t i = 0; i < 64; i++) {
+			if (bhnd_nvram_index_init(&idx, env, size))
+				errx(EX_SOFTWARE, "index_init failed");
+			if (i < 63)
+				bhnd_nvram_index_fini(&idx);
+		}
+		build_secs = (check_now() - start) / 64;
+
+		nvars = idx.ni_count;
+		if ((names = calloc(nvars, sizeof(*names))) == NULL)
+			err(EX_OSERR, "calloc");
+		for (size_t i = 0; i < nvars; i++)
+			snprintf(names[i], sizeof(names[i]), "var%zu", i);
+
+		hits = 0;
+		start = check_now();
+		for (size_t i = 0; i < CHECK_INDEX_BENCH_LOOKUPS; i++) {
+			if (bhnd_nvram_index_get(&idx, names[i % nvars], &value,
+			    &value_len) == 0)
+				hits++;
+		}
+		idx_secs = check_now() - start;
+		CHECK(hits == CHECK_INDEX_BENCH_LOOKUPS, "benchmark misses");
+
+		/* Linear lookups are far slower; scale their count down */
+		linear_lookups = CHECK_INDEX_BENCH_LOOKUPS / (target / 1024);
+		hits = 0;
+		start = check_now();
+		for (size_t i = 0; i < linear_lookups; i++) {
+			if (check_index_linear(env, size, names[i % nvars],
+			    &value_len) != NULL)
+				hits++;
+		}
+		lin_secs = check_now() - start;
+		CHECK(hits == linear_lookups, "benchmark misses");
+
+		printf("index %6zu bytes, %4zu vars: build %.1f us, "
+		    "lookup %.1f ns, linear %.1f ns\n", size, nvars,
+		    build_secs * 1e6,
+		    idx_secs * 1e9 / CHECK_INDEX_BENCH_LOOKUPS,
+		    lin_secs * 1e9 / linear_lookups);
+
+		bhnd_nvram_index_fini(&idx);
+		free(names);
+	}
+
+	free(env);
+}
+
+int
+main (int argc, char * const argv[])
+{
+	check_init(argc, argv);
+#ifdef __AVX2__
+	check_require_avx2();
+#endif
+
+	check_index_scan();
+	check_index_lookups();
+
+	if (check_bench)
+		check_index_bench();
+
+	return (check_finish());
+}
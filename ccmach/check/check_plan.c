@@ -0,0 +1,282 @@
+//
+//  check_plan.c
+//  ccmach
+//
+//  Created by Landon Fuller on 2/14/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+/*
+ * SPROM write planner checks.
+ *
+ * Random assignments are planned against random images of every
+ * supported revision. The planned image, including its incrementally
+ * updated CRC, must match the same assignments encoded into a copy of the
+ * image with the CRC recomputed in full. The plan must write exactly the
+ * changed words, in ascending order, and applying it to a simulated SPROM
+ * device must produce the planned image.
+ *
+ * With -b, the number of words written and the cost of planning are
+ * reported per revision.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include "nvram_sprom.h"
+#include "nvram_sprom_plan.h"
+
+#include "check.h"
+
+/** Images planned per SPROM revision */
+#define	CHECK_PLAN_IMAGES	256
+
+/** Maximum assignments per plan */
+#define	CHECK_PLAN_MAX_SETS	4
+
+/** Maximum SPROM revision checked */
+#define	CHECK_PLAN_REV_MAX	11
+
+/** Simulated device that fails after a fixed number of writes */
+struct check_plan_faildev {
+	struct bhnd_sprom_sim	sim;
+	size_t			remaining;
+};
+
+static int
+check_plan_fail_write (void *dev, uint16_t word, uint16_t value)
+{
+	struct check_plan_faildev *fd = dev;
+
+	if (fd->remaining == 0)
+		return (EIO);
+
+	fd->remaining--;
+	return (bhnd_sprom_sim_write(&fd->sim, word, value));
+}
+
+/** Sign-extend @p v from the most significant bit set in @p vmask */
+static uint32_t
+check_plan_sext (uint32_t v, uint32_t vmask)
+{
+	uint32_t sign;
+
+	if (vmask == 0)
+		return (v);
+
+	for (sign = 1U << 31; (sign & vmask) == 0; sign >>= 1)
+		continue;
+
+	if (v & sign)
+		v |= ~(sign | (sign - 1));
+
+	return (v);
+}
+
+/**
+ * Generate random values for @p nv in a SPROM image of revision @p rev
+ * and @p size bytes.
+ *
+ * @retval 0 success
+ * @retval ENOENT if @p nv is not defined for @p rev.
+ */
+static int
+check_plan_values (struct check_rng *rng, const struct bhnd_nvram_var *nv,
+    uint8_t rev, size_t size, uint32_t *vals, size_t *nvals)
+{
+	const struct bhnd_sprom_var	*sv;
+	uint32_t			 vmask;
+
+	if ((sv = bhnd_nvram_find_sprom_var(nv, rev)) == NULL)
+		return (ENOENT);
+
+	if (bhnd_sprom_var_layout(sv, size, nvals, &vmask))
+		return (ENOENT);
+
+	for (size_t e = 0; e < *nvals; e++) {
+		vals[e] = check_rng_next(rng) & vmask;
+		if (nv->type == BHND_NVRAM_DT_SINT)
+			vals[e] = check_plan_sext(vals[e], vmask);
+	}
+
+	return (0);
+}
+
+/** Plan random assignments against one random image of @p rev */
+static void
+check_plan_one (struct check_rng *rng, uint8_t rev)
+{
+	const struct bhnd_nvram_var	*vars;
+	struct bhnd_sprom_plan		 plan;
+	struct bhnd_sprom_sim		 sim;
+	struct check_plan_faildev	 fd;
+	uint8_t				 image[BHND_SPROM_MAX_SIZE];
+	uint8_t				 full[BHND_SPROM_MAX_SIZE];
+	size_t				 size, num_vars, nsets, nchanged;
+	size_t				 w, nw;
+	int				 error;
+
+	vars = bhnd_nvram_get_vars(&num_vars);
+
+	if (check_sprom_image(rng, rev, image, &size))
+		errx(EX_SOFTWARE, "no layout for rev %hhu", rev);
+
+	error = bhnd_sprom_plan_init(&plan, image, size);
+	CHECK(error == 0, "rev %hhu plan_init failed: %d", rev, error);
+	if (error)
+		return;
+
+	/* Assign the same values to the plan, and to a copy of the image */
+	memcpy(full, image, size);
+	nsets = (num_vars > 0) ? check_rng_next(rng) % (CHECK_PLAN_MAX_SETS + 1) :
+	    0;
+	for (size_t i = 0; i < nsets; i++) {
+		const struct bhnd_nvram_var	*nv;
+		uint32_t			 vals[BHND_SPROM_ARRAY_MAX];
+		size_t				 nvals;
+
+		nv = &vars[check_rng_next(rng) % num_vars];
+		if (check_plan_values(rng, nv, rev, size, vals, &nvals))
+			continue;
+
+		error = bhnd_sprom_plan_set(&plan, nv, vals, nvals);
+		CHECK(error == 0, "rev %hhu %s: plan_set failed: %d", rev,
+		    nv->name, error);
+
+		error = bhnd_sprom_encode_var(full, size, rev, nv, vals, nvals);
+		CHECK(error == 0, "rev %hhu %s: encode_var failed: %d", rev,
+		    nv->name, error);
+	}
+
+	bhnd_sprom_plan_finish(&plan);
+
+	/* The incremental CRC must match a full recompute */
+	check_sprom_crc(full, size);
+	CHECK(memcmp(plan.sp_new, full, size) == 0,
+	    "rev %hhu: planned image differs (crc 0x%02hhx, expected 0x%02hhx)",
+	    rev, plan.sp_new[size - 1], full[size - 1]);
+
+	/* Exactly the changed words must be written, in ascending order; the
+	 * CRC word, if changed, is therefore written last */
+	nchanged = 0;
+	w = 0;
+	for (nw = 0; nw < size / 2; nw++) {
+		if (memcmp(&image[nw * 2], &full[nw * 2], 2) == 0)
+			continue;
+
+		nchanged++;
+		if (w < plan.sp_nwrites) {
+			CHECK(plan.sp_writes[w].word == nw &&
+			    plan.sp_writes[w].value ==
+			    (full[nw * 2] | (full[nw * 2 + 1] << 8)),
+			    "rev %hhu: write %zu is not word %zu", rev, w, nw);
+		}
+		w++;
+	}
+	CHECK(plan.sp_nwrites == nchanged, "rev %hhu: %zu writes, %zu changed "
+	    "words", rev, plan.sp_nwrites, nchanged);
+
+	/* Apply to a simulated device */
+	CHECK(bhnd_sprom_plan_verify(&plan) == 0, "rev %hhu: verify failed",
+	    rev);
+
+	bhnd_sprom_sim_init(&sim, image, size);
+	error = bhnd_sprom_plan_apply(&plan, bhnd_sprom_sim_write, &sim);
+	CHECK(error == 0 && sim.ss_writes == plan.sp_nwrites &&
+	    memcmp(sim.ss_image, full, size) == 0,
+	    "rev %hhu: simulated device differs", rev);
+
+	/* A device failure must stop the plan */
+	if (plan.sp_nwrites > 0) {
+		bhnd_sprom_sim_init(&fd.sim, image, size);
+		fd.remaining = plan.sp_nwrites - 1;
+		error = bhnd_sprom_plan_apply(&plan, check_plan_fail_write, &fd);
+		CHECK(error == EIO && fd.sim.ss_writes == plan.sp_nwrites - 1,
+		    "rev %hhu: write failure not reported", rev);
+	}
+}
+
+/** Report the number of words written, and the cost of planning a
+ *  single assignment against a full CRC recompute */
+static void
+check_plan_bench (void)
+{
+	const struct bhnd_nvram_var	*vars;
+	struct check_rng		 rng;
+	size_t				 num_vars;
+
+	vars = bhnd_nvram_get_vars(&num_vars);
+	check_rng_init(&rng, 4000);
+
+	for (uint8_t rev = 1; rev <= CHECK_PLAN_REV_MAX; rev++) {
+		struct bhnd_sprom_plan	plan;
+		uint8_t			image[BHND_SPROM_MAX_SIZE];
+		uint32_t		vals[BHND_SPROM_ARRAY_MAX];
+		size_t			size, nvals, words, nplans;
+		double			start, plan_secs, full_secs;
+		const size_t		iters = 100000;
+		uint8_t			crc;
+
+		if (check_sprom_image(&rng, rev, image, &size))
+			continue;
+
+		/* Plan single assignments of every variable */
+		words = nplans = 0;
+		start = check_now();
+		for (size_t i = 0; i < iters; i++) {
+			const struct bhnd_nvram_var *nv = &vars[i % num_vars];
+
+			if (check_plan_values(&rng, nv, rev, size, vals, &nvals))
+				continue;
+
+			bhnd_sprom_plan_init(&plan, image, size);
+			bhnd_sprom_plan_set(&plan, nv, vals, nvals);
+			bhnd_sprom_plan_finish(&plan);
+
+			words += plan.sp_nwrites;
+			nplans++;
+		}
+		plan_secs = check_now() - start;
+
+		if (nplans == 0)
+			continue;
+
+		/* A full-image CRC recompute, for comparison */
+		crc = 0;
+		start = check_now();
+		for (size_t i = 0; i < iters; i++) {
+			image[i % (size - 1)] ^= crc;
+			crc = bhnd_nvram_crc8(image, size - 1,
+			    BHND_NVRAM_CRC8_INITIAL);
+		}
+		full_secs = check_now() - start;
+
+		printf("plan rev %2hhu: %.2f of %zu words written per "
+		    "assignment, %.0f ns/plan, full CRC %.0f ns\n", rev,
+		    (double)words / nplans, size / 2,
+		    plan_secs * 1e9 / nplans, full_secs * 1e9 / iters);
+	}
+}
+
+int
+main (int argc, char * const argv[])
+{
+	struct check_rng rng;
+
+	check_init(argc, argv);
+	check_rng_init(&rng, 40);
+
+	for (uint8_t rev = 1; rev <= CHECK_PLAN_REV_MAX; rev++) {
+		for (size_t i = 0; i < CHECK_PLAN_IMAGES; i++)
+			check_plan_one(&rng, rev);
+	}
+
+	if (check_bench)
+		check_plan_bench();
+
+	return (check_finish());
+}
@@ -0,0 +1,216 @@
+//
+//  check_sprom.c
+//  ccmach
+//
+//  Created by Landon Fuller on 2/14/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+/*
+ * SPROM decoder checks.
+ *
+ * Random images of every supported revision are decoded once to produce
+ * reference environments; the same images are then decoded again by
+ * several threads at once, each with its own context, and every result
+ * must match its reference. With -b, decode throughput is measured for
+ * increasing thread counts.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "nvram_sprom.h"
+
+#include "check.h"
+
+/** Images generated per SPROM revision */
+#define	CHECK_SPROM_IMAGES	64
+
+/** Concurrent decode threads */
+#define	CHECK_SPROM_THREADS	8
+
+/** Decode passes over all images, per thread */
+#define	CHECK_SPROM_PASSES	16
+
+/** Maximum SPROM revision checked */
+#define	CHECK_SPROM_REV_MAX	11
+
+/** A generated image and its reference environment */
+struct check_sprom_img {
+	uint8_t	 image[BHND_SPROM_MAX_SIZE];
+	size_t	 size;
+	uint8_t	 rev;
+	char	*env;
+	size_t	 env_len;
+};
+
+/** Concurrent decode state */
+struct check_sprom_run {
+	struct check_sprom_img	*imgs;
+	size_t			 nimgs;
+	size_t			 passes;
+	atomic_size_t		 mismatches;
+	atomic_size_t		 decoded;
+};
+
+/** Decode every image @p run->passes times, comparing against the
+ *  reference environments */
+static void *
+check_sprom_thread (void *arg)
+{
+	struct check_sprom_run	*run = arg;
+	char			*buf;
+	size_t			 mismatches;
+
+	if ((buf = malloc(64 * 1024)) == NULL)
+		err(EX_OSERR, "malloc");
+
+	mismatches = 0;
+	for (size_t p = 0; p < run->passes; p++) {
+		for (size_t i = 0; i < run->nimgs; i++) {
+			struct check_sprom_img	*img = &run->imgs[i];
+			struct bhnd_sprom_ctx	 ctx;
+			size_t			 len;
+
+			len = 64 * 1024;
+			if (bhnd_sprom_ctx_init(&ctx, img->image, img->size) ||
+			    bhnd_sprom_decode(&ctx, buf, &len) ||
+			    len != img->env_len ||
+			    memcmp(buf, img->env, len) != 0)
+				mismatches++;
+		}
+	}
+
+	atomic_fetch_add(&run->mismatches, mismatches);
+	atomic_fetch_add(&run->decoded, run->passes * run->nimgs);
+
+	free(buf);
+	return (NULL);
+}
+
+/** Decode @p run's images on @p nthreads concurrent threads */
+static void
+check_sprom_concurrent (struct check_sprom_run *run, size_t nthreads)
+{
+	pthread_t	threads[CHECK_SPROM_THREADS];
+	int		error;
+
+	atomic_store(&run->mismatches, 0);
+	atomic_store(&run->decoded, 0);
+
+	for (size_t i = 0; i < nthreads; i++) {
+		error = pthread_create(&threads[i], NULL, check_sprom_thread,
+		    run);
+		if (error) {
+			errno = error;
+			err(EX_OSERR, "pthread_create");
+		}
+	}
+
+	for (size_t i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+}
+
+int
+main (int argc, char * const argv[])
+{
+	struct check_sprom_run	 run;
+	struct check_sprom_img	*imgs;
+	struct check_rng	 rng;
+	size_t			 nimgs;
+
+	check_init(argc, argv);
+	check_rng_init(&rng, 31);
+
+	imgs = calloc(CHECK_SPROM_REV_MAX * CHECK_SPROM_IMAGES, sizeof(*imgs));
+	if (imgs == NULL)
+		err(EX_OSERR, "calloc");
+
+	/* Generate images, and decode their reference environments */
+	nimgs = 0;
+	for (uint8_t rev = 1; rev <= CHECK_SPROM_REV_MAX; rev++) {
+		for (size_t i = 0; i < CHECK_SPROM_IMAGES; i++) {
+			struct check_sprom_img	*img = &imgs[nimgs];
+			struct bhnd_sprom_ctx	 ctx;
+			size_t			 len;
+			int			 error;
+
+			if (check_sprom_image(&rng, rev, img->image, &img->size))
+				errx(EX_SOFTWARE, "no layout for rev %hhu", rev);
+			img->rev = rev;
+
+			error = bhnd_sprom_ctx_init(&ctx, img->image, img->size);
+			CHECK(error == 0, "rev %hhu image not identified: %d", rev,
+			    error);
+			if (error)
+				continue;
+
+			CHECK(ctx.sp_rev == rev && ctx.sp_size == img->size,
+			    "rev %hhu image identified as rev %hhu (%zu bytes)",
+			    rev, ctx.sp_rev, ctx.sp_size);
+
+			error = bhnd_sprom_decode_alloc(&ctx, &img->env,
+			    &img->env_len);
+			CHECK(error == 0, "rev %hhu decode failed: %d", rev,
+			    error);
+			if (error)
+				continue;
+
+			/* The sizing pass must agree with the allocation */
+			len = 0;
+			error = bhnd_sprom_decode(&ctx, NULL, &len);
+			CHECK(error == 0 && len == img->env_len,
+			    "rev %hhu size %zu != %zu", rev, len, img->env_len);
+
+			nimgs++;
+		}
+	}
+
+	/* A corrupted CRC must be rejected */
+	if (nimgs > 0) {
+		struct bhnd_sprom_ctx	ctx;
+		uint8_t			image[BHND_SPROM_MAX_SIZE];
+
+		memcpy(image, imgs[0].image, imgs[0].size);
+		image[0] ^= 0x1;
+		CHECK(bhnd_sprom_ctx_init(&ctx, image, imgs[0].size) == EINVAL,
+		    "image with invalid CRC identified");
+	}
+
+	/* Decode concurrently, and compare against the references */
+	run.imgs = imgs;
+	run.nimgs = nimgs;
+	run.passes = CHECK_SPROM_PASSES;
+
+	check_sprom_concurrent(&run, CHECK_SPROM_THREADS);
+	CHECK(atomic_load(&run.mismatches) == 0,
+	    "%zu of %zu concurrent decodes differ from the reference",
+	    atomic_load(&run.mismatches), atomic_load(&run.decoded));
+
+	if (check_bench) {
+		run.passes = 2048;
+		for (size_t n = 1; n <= CHECK_SPROM_THREADS; n *= 2) {
+			double start, secs;
+
+			start = check_now();
+			check_sprom_concurrent(&run, n);
+			secs = check_now() - start;
+
+			printf("decode: %zu thread(s): %.0f images/sec\n", n,
+			    atomic_load(&run.decoded) / secs);
+		}
+	}
+
+	for (size_t i = 0; i < nimgs; i++)
+		free(imgs[i].env);
+	free(imgs);
+
+	return (check_finish());
+}
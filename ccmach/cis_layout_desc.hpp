@@ -27,7 +27,7 @@
 namespace nvram {
 
 PL_RECORD_STRUCT(cis_var_layout,
-    (string,    name),
+    (symbol,    name),
     (size_t,    offset),
     (size_t,    size),
     (prop_type,    type),
@@ -47,15 +47,15 @@ class cis_layout {
     );
 
 public:
-    vector<string> var_names () const {
-        vector<string> result;
+    vector<symbol> var_names () const {
+        vector<symbol> result;
         for (const auto &vl : _vars) {
             result.push_back(vl.name());
         }
         return result;
     }
     
-    string index_tag () const {
+    symbol index_tag () const {
         if (_hnbu_tag.is<symbolic_constant>())
             return ftl::get<symbolic_constant>(_hnbu_tag).name();
         return _code.name();
@@ -0,0 +1,41 @@
+//
+//  gencis.hpp
+//  ccmach
+//
+//  Created by Landon Fuller on 2/1/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef __ccmach__gencis__
+#define __ccmach__gencis__
+
+#include "nvram.hpp"
+#include "outbuf.hpp"
+
+namespace nvram {
+
+/**
+ * CIS tuple table generator.
+ *
+ * Emits the cis_hnbuvars tuple layouts as a sorted table of
+ * struct bhnd_cis_tuple records (see nvram_cis.h), for use by the generic
+ * table-driven CIS decoder. Tuples that cannot be described by their layout
+ * (strings, MAC addresses, and tuples without a layout) are marked
+ * BHND_CIS_TF_SPECIAL, and are left to custom decoder code.
+ */
+class gencis {
+private:
+    nvram_map _nv;
+
+    static bool is_special (const cis_layout &l, const unordered_map<string, var_view> &vtbl);
+    static void emit_var (outbuf &o, const cis_var_layout &vl, const unordered_map<string, var_view> &vtbl);
+
+public:
+    gencis (const nvram_map &nv) : _nv(nv) {}
+
+    void generate (const shared_ptr<out_sink> &sink);
+};
+
+}
+
+#endif /* defined(__ccmach__gencis__) */
@@ -0,0 +1,146 @@
+//
+//  gencis.mm
+//  ccmach
+//
+//  Created by Landon Fuller on 2/1/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#include "gencis.hpp"
+
+namespace nvram {
+
+/** Return the nvram_map.h data type constant for @p t */
+static const char *c_type (prop_type t) {
+    switch (t) {
+        case BHND_T_INT8:
+        case BHND_T_INT16:
+        case BHND_T_INT32:
+            return "BHND_NVRAM_DT_SINT";
+        case BHND_T_CHAR:
+            return "BHND_NVRAM_DT_CHAR";
+        default:
+            return "BHND_NVRAM_DT_UINT";
+    }
+}
+
+/** Return the nvram_map.h string format constant for @p sfmt, or NULL if unsupported */
+static const char *c_fmt (str_fmt sfmt) {
+    switch (sfmt) {
+        case SFMT_HEX:		return "BHND_NVRAM_VFMT_HEX";
+        case SFMT_DECIMAL:	return "BHND_NVRAM_VFMT_DEC";
+        case SFMT_MACADDR:	return "BHND_NVRAM_VFMT_MACADDR";
+        case SFMT_CCODE:	return "BHND_NVRAM_VFMT_CCODE";
+        case SFMT_LEDDC:	return "BHND_NVRAM_VFMT_LEDDC";
+        default:		return NULL;
+    }
+}
+
+/**
+ * Return true if @p l can't be decoded generically from its layout.
+ */
+bool gencis::is_special (const cis_layout &l, const unordered_map<string, var_view> &vtbl) {
+    if (l.vars().empty())
+        return true;
+
+    for (const auto &vl : l.vars()) {
+        if (vl.special_case() || vl.type() == BHND_T_CSTR)
+            return true;
+
+        if (vl.count() == 0 || vl.count() > UINT8_MAX || vl.offset() + vl.size() * vl.count() > UINT8_MAX)
+            return true;
+
+        auto it = vtbl.find(vl.name());
+        if (it != vtbl.end() && c_fmt(it->second.sfmt()) == NULL)
+            return true;
+    }
+
+    return false;
+}
+
+void gencis::emit_var (outbuf &o, const cis_var_layout &vl, const unordered_map<string, var_view> &vtbl) {
+    prop_type type = vl.type();
+    const char *fmt = "BHND_NVRAM_VFMT_HEX";
+
+    /* Prefer the variable's declared type and format */
+    auto it = vtbl.find(vl.name());
+    if (it != vtbl.end()) {
+        type = it->second.decoded_type();
+        fmt = c_fmt(it->second.sfmt());
+    }
+
+    o.indent().put("{\"").put(vl.name()).put("\", ").put(c_type(type)).put(", ").put(fmt).put(", ");
+    o.dec(vl.offset()).put(", ").dec(vl.size()).put(", ").dec(vl.count()).put(", ");
+    o.put("0x").hex(vl.mask()).put(", ").sdec(vl.shift()).put("},\n");
+}
+
+/**
+ * Write the tuple table to @p sink.
+ */
+void gencis::generate (const shared_ptr<out_sink> &sink) {
+    outbuf o(sink);
+    auto arena = _nv.arena();
+
+    /* Map variable names to their definitions */
+    unordered_map<string, var_view> vtbl;
+    for (const auto &vs : arena->var_sets()) {
+        for (const auto &v : vs.vars())
+            vtbl.emplace(v.name(), v);
+    }
+
+    /* Sort by (tag, hnbu tag); the decoder performs a binary search, and
+     * multiple revision-specific layouts for a tuple remain in table order */
+    auto layouts = _nv._cis_layouts;
+    auto key = [](const cis_layout &l) {
+        int64_t hnbu = -1;
+        if (l.hnbu_tag().is<symbolic_constant>())
+            hnbu = ftl::get<symbolic_constant>(l.hnbu_tag()).value();
+        return make_pair(l.code().value(), hnbu);
+    };
+    stable_sort(layouts.begin(), layouts.end(), [&](const cis_layout &lhs, const cis_layout &rhs) {
+        return (key(lhs) < key(rhs));
+    });
+
+    o.put("/*\n");
+    o.put(" * THIS FILE IS AUTOMATICALLY GENERATED. DO NOT EDIT.\n");
+    o.put(" *\n");
+    o.put(" * generated by ccmach from cis_hnbuvars\n");
+    o.put(" */\n\n");
+
+    o.put("static const struct bhnd_cis_tuple bhnd_cis_tuples[] = {\n");
+    o.push();
+
+    for (const auto &l : layouts) {
+        o.indent().put("{0x").hex(l.code().value(), 2).put(", ");
+        if (l.hnbu_tag().is<symbolic_constant>()) {
+            const auto &hnbu = ftl::get<symbolic_constant>(l.hnbu_tag());
+            o.put("0x").hex(hnbu.value(), 2).put(" /* ").put(hnbu.name()).put(" */");
+        } else {
+            o.put("BHND_CIS_HNBU_NONE /* ").put(l.code().name()).put(" */");
+        }
+
+        o.put(", {").dec(l.compat().first()).put(", ");
+        if (l.compat().last() == compat_range::MAX_SPROMREV)
+            o.put("BHND_SPROMREV_MAX");
+        else
+            o.dec(l.compat().last());
+        o.put("}, ");
+
+        if (is_special(l, vtbl)) {
+            o.put("BHND_CIS_TF_SPECIAL, NULL, 0},\n");
+            continue;
+        }
+
+        o.put("0, (struct bhnd_cis_var[]) {\n");
+        o.push();
+        for (const auto &vl : l.vars())
+            emit_var(o, vl, vtbl);
+        o.pop();
+        o.indent().put("}, ").dec(l.vars().size()).put("},\n");
+    }
+
+    o.pop();
+    o.put("};\n");
+}
+
+}
@@ -10,29 +10,43 @@
 #define __ccmach__genmap__
 
 #include "nvram.hpp"
+#include "outbuf.hpp"
 
 namespace nvram {
 
 class genmap {
+public:
+    /** Map output styles */
+    typedef enum {
+        STYLE_BLOCK,	/**< every variable in a { } block (FreeBSD nvram_map) */
+        STYLE_COMPACT	/**< single-offset variables on one line (v2 map) */
+    } style;
+
 private:
+    /** A map output */
+    struct target {
+        style	st;
+        outbuf	out;
+
+        target (style s, const shared_ptr<out_sink> &sink) : st(s), out(sink) {}
+    };
+
     nvram_map _nv;
-    int _depth = 0;
-    
-    void emit_offset (const string &src, const string &vtype, const nv_offset &sp, const compat_range &range, bool skip_rdesc, bool tnl);
-    void emit_var(const shared_ptr<var> &v, compat_range range, bool skip_rdesc);
-    shared_ptr<var_set> find_structvar_set(const shared_ptr<var> &v);
+    shared_ptr<const nv_arena> _arena;
+    unordered_map<string, uint32_t> _vset_idx;
+    vector<shared_ptr<target>> _targets;
 
-public:
-    int print(const char *fmt, ...);
-    int println(const char *fmt, ...);
-    int vprint(const char *fmt, va_list args);
-    int prints(const char *fmt, ...);
+    void emit_offset (outbuf &o, const char *src, const string &vtype, const offset_view &sp, bool skip_rdesc, bool tnl);
+    void emit_var(target &t, const var_view &v, compat_range range, bool skip_rdesc);
+    var_set_view find_structvar_set(const var_view &v);
 
+public:
     genmap (const nvram_map &nv) : _nv(nv) {}
 
+    void add_output (const shared_ptr<out_sink> &sink, style st);
     void generate(const compat_range &);
 };
-    
+
 }
 
 #endif /* defined(__ccmach__genmap__) */
@@ -12,114 +12,98 @@
 
 namespace nvram {
 
-int genmap::vprint (const char *fmt, va_list args) {
-    int cnt = 0;
-    for (int i = 0; i < _depth; i++)
-        cnt += printf("\t");
-    
-    cnt += vprintf(fmt, args);
-    return (cnt);
-}
-    
-int genmap::print (const char *fmt, ...) {
-    va_list ap;
-    
-    va_start(ap, fmt);
-    int cnt = vprint(fmt, ap);
-    va_end(ap);
-
-    return (cnt);
+/** Append the description of @p compat (equivalent to compat_range::description()) */
+static void put_compat (outbuf &o, const compat_range &compat) {
+    if (compat.last() == compat_range::MAX_SPROMREV) {
+        o.put(">= ").dec(compat.first());
+    } else if (compat.first() == compat.last()) {
+        o.dec(compat.first());
+    } else {
+        o.dec(compat.first()).put('-').dec(compat.last());
+    }
 }
 
-int genmap::println (const char *fmt, ...) {
-    va_list ap;
-    
-    va_start(ap, fmt);
-    int cnt = vprint(fmt, ap);
-    va_end(ap);
-    
-    cnt += printf("\n");
-    return (cnt);
+/** Append the description of @p seg (equivalent to value_seg::description()) */
+static void put_seg (outbuf &o, const seg_view &seg) {
+    auto vs = seg.to_value_seg();
+
+    o.put("0x").hex(vs.offset());
+    if (vs.has_defaults())
+        return;
+
+    o.put(" (");
+    if (!vs.has_default_mask()) {
+        o.put("&0x").hex(vs.mask());
+        if (!vs.has_default_shift())
+            o.put(", ");
+    }
+
+    if (!vs.has_default_shift()) {
+        if (vs.shift() < 0)
+            o.put("<<").sdec(-vs.shift());
+        else
+            o.put(">>").sdec(vs.shift());
+    }
+
+    o.put(')');
 }
 
-int genmap::prints(const char *fmt, ...) {
-    va_list ap;
-    void (^interior)(void);
-    
-    va_start(ap, fmt);
-    int cnt = vprint(fmt, ap);
-    cnt += printf(" {\n");
-    _depth++;
-    interior = va_arg(ap, void (^)(void));
-    va_end(ap);
-    
-    interior();
-
-    _depth--;
-    cnt += println("}");
-
-    return (cnt);
+void genmap::add_output (const shared_ptr<out_sink> &sink, style st) {
+    _targets.push_back(make_shared<target>(st, sink));
 }
-    
-void genmap::emit_offset (const string &src, const string &vtype, const nv_offset &sp, const compat_range &range, bool skip_rdesc, bool tnl) {
-    auto rdesc = sp.compat().description();
-    if (skip_rdesc)
-        rdesc = "";
-    else
-        rdesc = " " + rdesc;
 
+void genmap::emit_offset (outbuf &o, const char *src, const string &vtype, const offset_view &sp, bool skip_rdesc, bool tnl) {
     if (tnl)
-        print("%s%s\t", src.c_str(), rdesc.c_str());
-    else
-        printf("%s%s\t", src.c_str(), rdesc.c_str());
-
-    for (size_t vi = 0; vi < sp.values()->size(); vi++) {
-        const auto &val = sp.values()->at(vi);
-        auto segs = val.segments();
-        for (size_t seg = 0; seg < segs->size(); seg++) {
-            auto s = segs->at(seg);
-            
+        o.indent();
+
+    o.put(src);
+    if (!skip_rdesc) {
+        o.put(' ');
+        put_compat(o, sp.compat());
+    }
+    o.put('\t');
+
+    auto vals = sp.values();
+    for (size_t vi = 0; vi < vals.size(); vi++) {
+        auto segs = vals.at(vi).segments();
+        for (size_t seg = 0; seg < segs.size(); seg++) {
+            auto s = segs.at(seg);
+
             string type = to_string(s.type());
             if (s.count() > 1)
                 type += "[" + to_string(s.count()) + "]";
-            
-            if (type == vtype)
-                type = "";
-            else
-                type = type + " ";
-            
-            printf("%s%s", type.c_str(), s.description().c_str());
-            if (seg+1 < segs->size())
-                printf(" | ");
+
+            if (type != vtype)
+                o.put(type).put(' ');
+
+            put_seg(o, s);
+            if (seg+1 < segs.size())
+                o.put(" | ");
         }
-        
-        if (vi+1 < sp.values()->size())
-            printf(", ");
+
+        if (vi+1 < vals.size())
+            o.put(", ");
     }
-    
+
     if (tnl)
-        printf("\n");
+        o.nl();
 
 }
-	
-shared_ptr<var_set> genmap::find_structvar_set(const shared_ptr<var> &v) {
-	auto vsets = _nv.var_sets();
-	auto vset_vname = v->name() + "0";
-	
-	for (const auto &vs : vsets) {
-		for (const auto &vsvar : *vs->vars()) {
-			if (vsvar->name() == vset_vname)
-				return (vs);
-		}
-	}
+
+var_set_view genmap::find_structvar_set(const var_view &v) {
+	auto it = _vset_idx.find(string(v.name()) + "0");
 
 	/* var missing a vset! */
-	abort();
+	if (it == _vset_idx.end())
+		abort();
+
+	return _arena->var_sets().at(it->second);
 }
 
-void genmap::emit_var(const shared_ptr<var> &v, compat_range range, bool skip_rdesc) {
+void genmap::emit_var(target &t, const var_view &v, compat_range range, bool skip_rdesc) {
+	outbuf &o = t.out;
 	size_t num_offs = 0;
-	for (const auto &sp : *v->sprom_offsets()) {
+	for (const auto &sp : v.sprom_offsets()) {
 		if (sp.compat().overlaps(range))
 			num_offs++;
 	}
@@ -128,62 +112,83 @@ void genmap::emit_var(const shared_ptr<var> &v, compat_range range, bool skip_rd
 	if (num_offs == 0)
 		return;
 #endif
-	
-	string vtype = to_string(v->decoded_type());
-	if (v->decoded_count() > 1)
-		vtype += "[" + to_string(v->decoded_count()) + "]";
-	
-	if (v->flags() & nvram::FLAG_MFGINT)
+
+	string vtype = to_string(v.decoded_type());
+	if (v.decoded_count() > 1)
+		vtype += "[" + to_string(v.decoded_count()) + "]";
+
+	if (v.flags() & nvram::FLAG_MFGINT)
 		vtype = "private " + vtype;
-	
-	if ((1) /*always add newline*/|| num_offs > 1 || v->sfmt() != SFMT_HEX || v->flags() & FLAG_NOALL1) {
-		prints("%s %s", vtype.c_str(), v->name().c_str(), ^{
-			if (v->sfmt() != SFMT_HEX)
-				println("sfmt\t%s", to_string(v->sfmt()).c_str());
-			
-			if (v->flags() & FLAG_NOALL1)
-				println("all1\tignore");
-			
+
+	if (t.st == STYLE_BLOCK || num_offs > 1 || v.sfmt() != SFMT_HEX || v.flags() & FLAG_NOALL1) {
+		o.indent().put(vtype).put(' ').put(v.name()).put(" {\n");
+		o.push();
+
+		if (v.sfmt() != SFMT_HEX)
+			o.indent().put("sfmt\t").put(to_string(v.sfmt())).nl();
+
+		if (v.flags() & FLAG_NOALL1)
+			o.indent().put("all1\tignore\n");
+
 #if 0
-			for (const auto &cis : *v->cis_offsets())
-				emit_offset("cis\t", vtype, cis, range, skip_rdesc, true);
+		for (const auto &cis : v.cis_offsets())
+			emit_offset(o, "cis\t", vtype, cis, skip_rdesc, true);
 #endif
-			for (const auto &sp : *v->sprom_offsets()) {
-				if (!sp.compat().overlaps(range))
-					continue;
-				
-				emit_offset("srom", vtype, sp, range, skip_rdesc, true);
-			}
-		});
+		for (const auto &sp : v.sprom_offsets()) {
+			if (!sp.compat().overlaps(range))
+				continue;
+
+			emit_offset(o, "srom", vtype, sp, skip_rdesc, true);
+		}
+
+		o.pop();
+		o.indent().put("}\n");
 	} else {
-		print("%s\t%s\t\t{ ", vtype.c_str(), v->name().c_str());
-		
+		o.indent().put(vtype).put('\t').put(v.name()).put("\t\t{ ");
+
 #if 0
-		for (const auto &cis : *v->cis_offsets())
-			emit_offset("cis\t", vtype, cis, range, skip_rdesc, false);
+		for (const auto &cis : v.cis_offsets())
+			emit_offset(o, "cis\t", vtype, cis, skip_rdesc, false);
 #endif
-		for (const auto &sp : *v->sprom_offsets()) {
+		for (const auto &sp : v.sprom_offsets()) {
 			if (!sp.compat().overlaps(range))
 				continue;
-			
-			emit_offset("srom", vtype, sp, range, skip_rdesc, false);
+
+			emit_offset(o, "srom", vtype, sp, skip_rdesc, false);
 		}
-		
-		printf(" }\n");
+
+		o.put(" }\n");
 	}
 }
-	
+
 static string formatComment (const string &comment) {
 	return string("# ") + [@(comment.c_str()) stringByReplacingOccurrencesOfString:@"\n" withString:@"\n# "].UTF8String;
 }
 
+/**
+ * Emit the map for @p range to all registered outputs in a single pass,
+ * flushing each output once on completion. If no outputs have been
+ * registered, the block-style map is written to stdout.
+ */
 void genmap::generate(const compat_range &range) {
-    auto vsets = _nv.var_sets();
+    if (_targets.empty())
+        add_output(make_shared<fd_sink>(STDOUT_FILENO), STYLE_BLOCK);
+
+    _arena = _nv.arena();
+
+    /* Map struct variable names to their first containing vset */
+    _vset_idx.clear();
+    auto vsets = _arena->var_sets();
+    for (uint32_t i = 0; i < vsets.size(); i++) {
+        for (const auto &vsvar : vsets.at(i).vars())
+            _vset_idx.emplace(vsvar.name(), i);
+    }
+
     for (const auto &vs : vsets) {
         bool sprommmmed = false;
-        for (const auto &v : *vs->vars()) {
-            for (const auto &so : *v->sprom_offsets()) {
-                if (so.compat().overlaps(range) && _nv._struct_vars.count(v->name()) == 0) {
+        for (const auto &v : vs.vars()) {
+            for (const auto &so : v.sprom_offsets()) {
+                if (so.compat().overlaps(range) && !v.is_struct_member()) {
                     sprommmmed = true;
                     break;
                 }
@@ -195,7 +200,7 @@ void genmap::generate(const compat_range &range) {
 
 	/* XXX: CIS varsets that duplicate SROM variables defined more completely in
 	 * newer CIS varset */
-	if (vs->name() == "HNBU_ANT5G" || vs->name() == "HNBU_OFDMPO5G") {
+	if (strcmp(vs.name(), "HNBU_ANT5G") == 0 || strcmp(vs.name(), "HNBU_OFDMPO5G") == 0) {
 #ifdef EXCLUDE_NON_SROM
 		sprommmmed = false;
 #else
@@ -207,21 +212,17 @@ void genmap::generate(const compat_range &range) {
         if (!sprommmmed)
             continue;
 #endif
-	    
-        if (vs->hasUsefulComment())
-            println("%s", formatComment(vs->comment()).c_str());
-
-        NSString *sectName = @(vs->name().c_str());
-        if ([sectName hasPrefix: @"HNBU_"])
-            sectName = [[sectName substringFromIndex: 5] lowercaseString];
-        else if ([sectName hasPrefix: @"CISTPL_"])
-            sectName = [@"pcmcia_" stringByAppendingString: [[sectName substringFromIndex: 7] lowercaseString]];
-    
-        //prints("%s", sectName.UTF8String, ^{
+
+        if (vs.hasUsefulComment()) {
+            auto comment = formatComment(vs.comment());
+            for (const auto &t : _targets)
+                t->out.indent().put(comment).nl();
+        }
+
 #if 0
             if (vs->cis().is<var_set_cis>()) {
                 auto cis = ftl::get<var_set_cis>(vs->cis());
-                
+
                 if (cis.hnbu_tag().is<symbolic_constant>()) {
                     print("cis_tuple\t%s,%s\n", cis.tag().name().c_str(), ftl::get<symbolic_constant>(cis.hnbu_tag()).name().c_str());
                 } else {
@@ -229,7 +230,7 @@ void genmap::generate(const compat_range &range) {
                 }
             }
 #endif
-            
+
             bool skip_rdesc = false;
 #if 0
             if (vs->hasCommonCompatRange() && (vs->vars()->size() > 1 || (vs->vars()->size() == 1 && vs->vars()->at(0)->cis_offsets()->size() + vs->vars()->at(0)->sprom_offsets()->size() > 1))) {
@@ -237,81 +238,88 @@ void genmap::generate(const compat_range &range) {
                 skip_rdesc = true;
             }
 #endif
-      
-            for (const auto &v : *vs->vars()) {
+
+            for (const auto &v : vs.vars()) {
 		    /* Skip struct vars */
-		    if (_nv._struct_vars.count(v->name()) > 0) {
+		    if (v.is_struct_member()) {
 			    continue;
 		    }
-		    
+
 		    /* XXX: duplicated in the CIS HNBU_SUBBAND5GVER tuple */
-		    if (vs->name() == "HNBU_ACPA_C0" && v->name() == "subband5gver")
+		    if (strcmp(vs.name(), "HNBU_ACPA_C0") == 0 && strcmp(v.name(), "subband5gver") == 0)
 			    continue;
-		    
-		    emit_var(v, range, skip_rdesc);
+
+		    for (const auto &t : _targets)
+			    emit_var(*t, v, range, skip_rdesc);
             }
 
-        //});
-        printf("\n");
+        for (const auto &t : _targets)
+            t->out.nl();
     }
-	
-	
+
+
 	/* Emit structs */
-	for (const auto &sdef : _nv._struct_defs) {
+	for (const auto &sdef : _arena->structs()) {
 		bool skip_rdesc = false;
+		vector<string> vset_names;
+		unordered_map<string, var_set_view> vsets;
+		unordered_map<string, vector<var_view>> var_vset;
 
-		prints("struct %s[]", sdef.name().c_str(), ^{
-			vector<string> vset_names;
-			unordered_map<string, shared_ptr<var_set>> vsets;
-			unordered_map<string, shared_ptr<vector<shared_ptr<var>>>> var_vset;
-			
-			for (const auto &bas : *sdef.base_addrs()) {
-				const auto &compat = std::get<0>(bas);
-				const auto &addrs = std::get<1>(bas);
-				print("srom %s\t[", compat.description().c_str());
-				size_t addr_count = 0;
-				for (const auto &addr : addrs) {
-					printf("0x%03zX", addr);
-					addr_count++;
-					if (addr_count < addrs.size())
-						printf(", ");
-				}
-				printf("]\n");
+		/* Map struct variables to real variable sets */
+		for (const auto &v : sdef.variables()) {
+			auto vs = find_structvar_set(v);
+
+			if (vsets.count(vs.name()) == 0) {
+				vsets.insert({vs.name(), vs});
+				var_vset.insert({vs.name(), vector<var_view>()});
+				vset_names.push_back(vs.name());
 			}
-			printf("\n");
-
-			/* Map struct variables to real variable sets */
-			for (const auto &v : *sdef.variables()) {
-				const auto &vs = find_structvar_set(v);
-				
-				if (vsets.count(vs->name()) == 0) {
-					vsets.insert({vs->name(), vs});
-					var_vset.insert({vs->name(), make_shared<vector<shared_ptr<var>>>()});
-					vset_names.push_back(vs->name());
+
+			var_vset.at(vs.name()).push_back(v);
+		}
+		_nv.alpha_sort(vset_names);
+
+		for (const auto &t : _targets) {
+			outbuf &o = t->out;
+
+			o.indent().put("struct ").put(sdef.name()).put("[] {\n");
+			o.push();
+
+			for (const auto &bas : sdef.base_addrs()) {
+				o.indent().put("srom ");
+				put_compat(o, bas.compat());
+				o.put("\t[");
+				for (size_t i = 0; i < bas.size(); i++) {
+					o.put("0x").hex(bas.at(i), 3);
+					if (i+1 < bas.size())
+						o.put(", ");
 				}
-				
-				var_vset.at(vs->name())->push_back(v);
+				o.put("]\n");
 			}
+			o.nl();
 
 			/* Emit variables grouped by vset */
-			_nv.alpha_sort(vset_names);
 			for (const auto &vsname : vset_names) {
 				const auto &vs = vsets.at(vsname);
 				const auto &vars = var_vset.at(vsname);
-				
-				if (vs->hasUsefulComment())
-					println("%s", formatComment(vs->comment()).c_str());
-				
-				for (const auto &v : *vars) {
-					emit_var(v, range, skip_rdesc);
+
+				if (vs.hasUsefulComment())
+					o.indent().put(formatComment(vs.comment())).nl();
+
+				for (const auto &v : vars) {
+					emit_var(*t, v, range, skip_rdesc);
 				}
-				
-				println("\n");
-			}
 
-		});
+				o.indent().put("\n\n");
+			}
 
+			o.pop();
+			o.indent().put("}\n");
+		}
 	}
+
+	for (const auto &t : _targets)
+		t->out.flush();
 }
 
-}
\ No newline at end of file
+}
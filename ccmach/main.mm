@@ -9,11 +9,14 @@
 #include "nvram.hpp"
 #include "cc.hpp"
 #include "genmap.hpp"
+#include "gencis.hpp"
+#include "srom_overlap.hpp"
 
 #include <stdio.h>
 
 #include <err.h>
 #include <getopt.h>
+#include <sys/resource.h>
 
 #include <string>
 #include <vector>
@@ -260,7 +263,7 @@ private:
     }
     
     vector<shared_ptr<nvram::var>> convert_nvars (shared_ptr<vector<nvar>> &nvars) {
-        unordered_map<string, shared_ptr<nvram::var>> var_table;
+        unordered_map<nvram::symbol, shared_ptr<nvram::var>> var_table;
         vector<shared_ptr<nvram::var>> ret;
 
         for (size_t i = 0; i < nvars->size(); i++) {
@@ -383,7 +386,7 @@ private:
             }
 
             nvram::nv_offset sp_off(nvram::compat_range::from_revmask(revmask), vals);
-            v->sprom_offsets()->push_back(sp_off);
+            v->add_sprom_offset(sp_off);
             
             /* Sort by compat range */
             sort(v->sprom_offsets()->begin(), v->sprom_offsets()->end(), [](const nvram::nv_offset &lhs, const nvram::nv_offset &rhs) {
@@ -722,17 +725,34 @@ public:
     Extractor(int argc, char * const argv[]) {
         int optchar;
         bool diag = false;
+        bool stats = false;
+        const char *block_path = NULL;
+        const char *compact_path = NULL;
+        const char *cis_path = NULL;
+        NSDate *start = [NSDate date];
         
         static struct option longopts[] = {
             { "help",       no_argument,        NULL,          'h' },
             { NULL,           0,                NULL,           0  }
         };
         
-        while ((optchar = getopt_long(argc, argv, "hd", longopts, NULL)) != -1) {
+        while ((optchar = getopt_long(argc, argv, "hdso:c:t:", longopts, NULL)) != -1) {
             switch (optchar) {
                 case 'd':
                     diag = true;
                     break;
+                case 's':
+                    stats = true;
+                    break;
+                case 'o':
+                    block_path = optarg;
+                    break;
+                case 'c':
+                    compact_path = optarg;
+                    break;
+                case 't':
+                    cis_path = optarg;
+                    break;
                 case 'h':
                     // TODO
                     break;
@@ -770,10 +790,10 @@ public:
             { nil, nil, {0, 0}}
         };
         
-        unordered_map<string, shared_ptr<nvram::var>> path_var_tbl;
-        unordered_map<string, shared_ptr<nvram::var>> st_path_var_tbl;
-        unordered_set<string> struct_vars;
-        unordered_set<string> struct_vars_handled;
+        unordered_map<nvram::symbol, shared_ptr<nvram::var>> path_var_tbl;
+        unordered_map<nvram::symbol, shared_ptr<nvram::var>> st_path_var_tbl;
+        unordered_set<nvram::symbol> struct_vars;
+        unordered_set<nvram::symbol> struct_vars_handled;
         bool path_first_run = true;
         nvram::struct_defn phy_chains("phy_chains", make_shared<vector<tuple<nvram::compat_range, vector<size_t>>>>(), make_shared<vector<shared_ptr<nvram::var>>>());
         for (const auto &v : path_vars) {
@@ -826,10 +846,10 @@ public:
                                 newv = path_var_tbl.at(name);
                                 st_newv = st_path_var_tbl.at(v->name());
                             }
-                            newv->sprom_offsets()->emplace_back(sp.compat(), values);
+                            newv->add_sprom_offset(nvram::nv_offset(sp.compat(), values));
                             
                             if (path_cfg_first)
-                                st_newv->sprom_offsets()->emplace_back(sp.compat(), st_values);
+                                st_newv->add_sprom_offset(nvram::nv_offset(sp.compat(), st_values));
                         }
                     }
                     
@@ -993,9 +1013,58 @@ public:
         if (diag)
             m.emit_diagnostics();
 
-        /* Emit the map */
+        /* Flatten the map; the arena is shared with the genmap's copy */
+        auto arena = m.arena();
+
+        /* Check for overlapping SPROM variable layouts */
+        nvram::srom_overlap overlaps(*arena);
+        overlaps.report(stderr, diag);
+        if (overlaps.conflicts() > 0)
+            warnx("%zu conflicting SPROM variable layout(s)", overlaps.conflicts());
+
+        /* Emit the map(s); the block-style map is written to stdout unless
+         * an output path is provided */
         auto g = nvram::genmap(m);
+        vector<shared_ptr<nvram::out_sink>> sinks;
+        if (block_path != NULL)
+            sinks.push_back(make_shared<nvram::file_sink>(block_path));
+        else if (compact_path == NULL)
+            sinks.push_back(make_shared<nvram::fd_sink>(STDOUT_FILENO));
+
+        if (!sinks.empty())
+            g.add_output(sinks.back(), nvram::genmap::STYLE_BLOCK);
+
+        if (compact_path != NULL) {
+            sinks.push_back(make_shared<nvram::file_sink>(compact_path));
+            g.add_output(sinks.back(), nvram::genmap::STYLE_COMPACT);
+        }
+
         g.generate(nvram::compat_range(0, 31));
+
+        /* Emit the CIS tuple table */
+        if (cis_path != NULL) {
+            sinks.push_back(make_shared<nvram::file_sink>(cis_path));
+            nvram::gencis(m).generate(sinks.back());
+        }
+
+        /* Report any deferred output errors */
+        for (const auto &sink : sinks)
+            sink->finish();
+
+        /* Report generation time and peak RSS */
+        if (stats) {
+            struct rusage ru;
+            if (getrusage(RUSAGE_SELF, &ru) != 0)
+                err(EXIT_FAILURE, "getrusage");
+
+#ifdef __APPLE__
+            long maxrss_kb = ru.ru_maxrss / 1024; /* bytes */
+#else
+            long maxrss_kb = ru.ru_maxrss; /* kilobytes */
+#endif
+            fprintf(stderr, "generated in %.3fs, peak RSS %ld KiB, arena %zu bytes\n",
+                -[start timeIntervalSinceNow], maxrss_kb, arena->footprint());
+        }
     }
 };
 
@@ -0,0 +1,349 @@
+//
+//  nvarena.hpp
+//  ccmach
+//
+//  Created by Landon Fuller on 1/24/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef __ccmach__nvarena__
+#define __ccmach__nvarena__
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "nvtypes.h"
+
+namespace nvram {
+
+class nv_arena;
+
+/**
+ * A contiguous run of records within one of the nv_arena's typed record
+ * arrays.
+ */
+struct arena_range {
+    uint32_t first;	/**< index of the first record */
+    uint32_t count;	/**< number of records */
+};
+
+/**
+ * Read-only list view over an arena_range.
+ *
+ * If @p indir is non-NULL, the range refers to a run of 32-bit record
+ * indices rather than the records themselves.
+ */
+template <class V> class arena_list {
+private:
+    const nv_arena	*_a;
+    arena_range		 _r;
+    const uint32_t	*_indir;
+
+public:
+    class iterator {
+    private:
+        const arena_list	*_l;
+        uint32_t		 _i;
+    public:
+        iterator (const arena_list *l, uint32_t i) : _l(l), _i(i) {}
+        V operator* () const { return _l->at(_i); }
+        iterator &operator++ () { _i++; return *this; }
+        bool operator== (const iterator &other) const { return (_i == other._i); }
+        bool operator!= (const iterator &other) const { return (_i != other._i); }
+    };
+
+    arena_list (const nv_arena *a, arena_range r, const uint32_t *indir = NULL) : _a(a), _r(r), _indir(indir) {}
+
+    size_t size () const { return _r.count; }
+    bool empty () const { return (_r.count == 0); }
+
+    V at (size_t i) const {
+        if (i >= _r.count)
+            errx(EX_SOFTWARE, "arena index %zu out of range", i);
+
+        if (_indir != NULL)
+            return V(_a, _indir[_r.first + i]);
+
+        return V(_a, _r.first + (uint32_t)i);
+    }
+
+    V operator[] (size_t i) const { return at(i); }
+
+    iterator begin () const { return iterator(this, 0); }
+    iterator end () const { return iterator(this, _r.count); }
+};
+
+class seg_view;
+class value_view;
+class offset_view;
+class var_view;
+class var_set_view;
+class struct_view;
+class struct_base_view;
+
+/**
+ * Flat, index-linked NVRAM model.
+ *
+ * All segments, values, offsets, variables, and variable sets live in
+ * contiguous typed arrays and refer to each other by 32-bit index; names
+ * are stored once in a shared string table. Once built, the arena is
+ * immutable, and all access goes through the read-only *_view types.
+ */
+class nv_arena {
+    friend class seg_view;
+    friend class value_view;
+    friend class offset_view;
+    friend class var_view;
+    friend class var_set_view;
+    friend class struct_view;
+    friend class struct_base_view;
+
+public:
+    /** var_rec flags (in addition to the FLAG_* variable flags) */
+    enum {
+        VAR_STRUCT_MEMBER	= 0x80000000U	/**< variable is generated from a struct definition */
+    };
+
+private:
+    struct seg_rec {
+        uint32_t	offset;
+        uint32_t	count;
+        uint32_t	mask;
+        int16_t		shift;
+        uint8_t		type;
+    };
+
+    struct value_rec {
+        arena_range	segs;
+    };
+
+    struct offset_rec {
+        uint8_t		first;
+        uint8_t		last;
+        arena_range	values;
+    };
+
+    struct var_rec {
+        uint32_t	name;
+        uint8_t		type;
+        uint8_t		sfmt;
+        uint32_t	count;
+        uint32_t	flags;
+        arena_range	cis_offsets;
+        arena_range	sprom_offsets;
+    };
+
+    struct var_set_rec {
+        uint32_t	name;
+        uint32_t	comment;
+        arena_range	vars;		/**< range within _var_refs */
+    };
+
+    struct struct_base_rec {
+        uint8_t		first;
+        uint8_t		last;
+        arena_range	addrs;		/**< range within _addrs */
+    };
+
+    struct struct_rec {
+        uint32_t	name;
+        arena_range	bases;
+        arena_range	vars;		/**< range within _var_refs */
+    };
+
+    vector<seg_rec>		_segs;
+    vector<value_rec>		_values;
+    vector<offset_rec>		_offsets;
+    vector<var_rec>		_vars;
+    vector<uint32_t>		_var_refs;
+    vector<var_set_rec>		_var_sets;
+    vector<struct_base_rec>	_struct_bases;
+    vector<uint32_t>		_addrs;
+    vector<struct_rec>		_structs;
+    vector<char>		_strings;
+
+    /* Build-time state */
+    unordered_map<string, uint32_t>	_string_tbl;
+    unordered_map<const var *, uint32_t>	_var_tbl;
+
+    uint32_t intern (const string &str);
+    arena_range add_offsets (const vector<nv_offset> &offsets);
+    uint32_t add_var (const shared_ptr<var> &v, const unordered_set<symbol> &struct_vars);
+
+    const char *str (uint32_t idx) const { return &_strings[idx]; }
+
+public:
+    nv_arena (const vector<shared_ptr<var_set>> &var_sets,
+              const vector<struct_defn> &struct_defs,
+              const unordered_set<symbol> &struct_vars);
+
+    arena_list<var_set_view> var_sets () const;
+    arena_list<struct_view> structs () const;
+
+    /** Approximate heap footprint of the arena's record arrays, in bytes */
+    size_t footprint () const;
+};
+
+/** Read-only value segment view */
+class seg_view {
+private:
+    const nv_arena::seg_rec *_r;
+public:
+    seg_view (const nv_arena *a, uint32_t idx) : _r(&a->_segs[idx]) {}
+
+    size_t offset () const { return _r->offset; }
+    prop_type type () const { return (prop_type) _r->type; }
+    size_t count () const { return _r->count; }
+    uint32_t mask () const { return _r->mask; }
+    ssize_t shift () const { return _r->shift; }
+
+    value_seg to_value_seg () const { return value_seg(offset(), type(), count(), mask(), shift()); }
+    prop_type decoded_type () const { return to_value_seg().decoded_type(); }
+    string description () const { return to_value_seg().description(); }
+};
+
+/** Read-only value view */
+class value_view {
+private:
+    const nv_arena		*_a;
+    const nv_arena::value_rec	*_r;
+public:
+    value_view (const nv_arena *a, uint32_t idx) : _a(a), _r(&a->_values[idx]) {}
+
+    arena_list<seg_view> segments () const { return arena_list<seg_view>(_a, _r->segs); }
+
+    prop_type decoded_type () const {
+        auto segs = segments();
+        auto t = segs.at(0).decoded_type();
+        for (const auto &seg : segs)
+            t = prop_type_widen(t, seg.decoded_type());
+        return t;
+    }
+
+    size_t decoded_count () const { return segments().at(0).count(); }
+};
+
+/** Read-only variable offset view */
+class offset_view {
+private:
+    const nv_arena		*_a;
+    const nv_arena::offset_rec	*_r;
+public:
+    offset_view (const nv_arena *a, uint32_t idx) : _a(a), _r(&a->_offsets[idx]) {}
+
+    compat_range compat () const { return compat_range(_r->first, _r->last); }
+    arena_list<value_view> values () const { return arena_list<value_view>(_a, _r->values); }
+
+    prop_type decoded_type () const {
+        auto vals = values();
+        auto t = vals.at(0).decoded_type();
+        for (const auto &v : vals)
+            t = prop_type_widen(t, v.decoded_type());
+        return t;
+    }
+
+    size_t decoded_count () const {
+        size_t c = 0;
+        for (const auto &v : values())
+            c += v.decoded_count();
+        return c;
+    }
+};
+
+/** Read-only variable view */
+class var_view {
+private:
+    const nv_arena		*_a;
+    uint32_t			 _idx;
+    const nv_arena::var_rec	*_r;
+public:
+    var_view (const nv_arena *a, uint32_t idx) : _a(a), _idx(idx), _r(&a->_vars[idx]) {}
+
+    uint32_t index () const { return _idx; }
+    const char *name () const { return _a->str(_r->name); }
+    prop_type type () const { return (prop_type) _r->type; }
+    str_fmt sfmt () const { return (str_fmt) _r->sfmt; }
+    size_t count () const { return _r->count; }
+    uint32_t flags () const { return (_r->flags & ~nv_arena::VAR_STRUCT_MEMBER); }
+    bool is_struct_member () const { return ((_r->flags & nv_arena::VAR_STRUCT_MEMBER) != 0); }
+
+    arena_list<offset_view> cis_offsets () const { return arena_list<offset_view>(_a, _r->cis_offsets); }
+    arena_list<offset_view> sprom_offsets () const { return arena_list<offset_view>(_a, _r->sprom_offsets); }
+
+    size_t decoded_count () const {
+        size_t c = 0;
+        for (const auto &o : cis_offsets())
+            c = std::max(c, o.decoded_count());
+        for (const auto &o : sprom_offsets())
+            c = std::max(c, o.decoded_count());
+        return c;
+    }
+
+    prop_type decoded_type () const {
+        auto cis = cis_offsets();
+        auto sprom = sprom_offsets();
+        prop_type t = (cis.size() > 0) ? cis.at(0).decoded_type() : sprom.at(0).decoded_type();
+
+        for (const auto &o : cis)
+            t = prop_type_widen(t, o.decoded_type());
+        for (const auto &o : sprom)
+            t = prop_type_widen(t, o.decoded_type());
+
+        return t;
+    }
+};
+
+/** Read-only variable set view */
+class var_set_view {
+private:
+    const nv_arena			*_a;
+    const nv_arena::var_set_rec	*_r;
+public:
+    var_set_view (const nv_arena *a, uint32_t idx) : _a(a), _r(&a->_var_sets[idx]) {}
+
+    const char *name () const { return _a->str(_r->name); }
+    const char *comment () const { return _a->str(_r->comment); }
+    bool hasUsefulComment () const { return (*comment() != '\0'); }
+
+    arena_list<var_view> vars () const { return arena_list<var_view>(_a, _r->vars, _a->_var_refs.data()); }
+};
+
+/** Read-only struct base address view */
+class struct_base_view {
+private:
+    const nv_arena			*_a;
+    const nv_arena::struct_base_rec	*_r;
+public:
+    struct_base_view (const nv_arena *a, uint32_t idx) : _a(a), _r(&a->_struct_bases[idx]) {}
+
+    compat_range compat () const { return compat_range(_r->first, _r->last); }
+    size_t size () const { return _r->addrs.count; }
+    uint32_t at (size_t i) const { return _a->_addrs[_r->addrs.first + i]; }
+};
+
+/** Read-only struct definition view */
+class struct_view {
+private:
+    const nv_arena			*_a;
+    const nv_arena::struct_rec	*_r;
+public:
+    struct_view (const nv_arena *a, uint32_t idx) : _a(a), _r(&a->_structs[idx]) {}
+
+    const char *name () const { return _a->str(_r->name); }
+    arena_list<struct_base_view> base_addrs () const { return arena_list<struct_base_view>(_a, _r->bases); }
+    arena_list<var_view> variables () const { return arena_list<var_view>(_a, _r->vars, _a->_var_refs.data()); }
+};
+
+inline arena_list<var_set_view> nv_arena::var_sets () const {
+    return arena_list<var_set_view>(this, { 0, (uint32_t) _var_sets.size() });
+}
+
+inline arena_list<struct_view> nv_arena::structs () const {
+    return arena_list<struct_view>(this, { 0, (uint32_t) _structs.size() });
+}
+
+} /* namespace nvram */
+
+#endif /* defined(__ccmach__nvarena__) */
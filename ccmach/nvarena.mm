@@ -0,0 +1,187 @@
+//
+//  nvarena.mm
+//  ccmach
+//
+//  Created by Landon Fuller on 1/24/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#include "nvarena.hpp"
+
+namespace nvram {
+
+static uint32_t arena_index (size_t n) {
+    if (n > UINT32_MAX)
+        errx(EX_SOFTWARE, "arena overflow");
+    return ((uint32_t) n);
+}
+
+nv_arena::nv_arena (const vector<shared_ptr<var_set>> &var_sets,
+                    const vector<struct_defn> &struct_defs,
+                    const unordered_set<symbol> &struct_vars)
+{
+    /* Variable sets; each var set's variable references are appended to
+     * _var_refs contiguously *after* the referenced variables have been
+     * added, so we collect the indices first. */
+    for (const auto &vs : var_sets) {
+        vector<uint32_t> refs;
+        refs.reserve(vs->vars()->size());
+        for (const auto &v : *vs->vars())
+            refs.push_back(add_var(v, struct_vars));
+
+        var_set_rec r;
+        r.name = intern(vs->name());
+        r.comment = intern(vs->comment());
+        r.vars = { arena_index(_var_refs.size()), arena_index(refs.size()) };
+        _var_refs.insert(_var_refs.end(), refs.begin(), refs.end());
+        _var_sets.push_back(r);
+    }
+
+    /* Struct definitions */
+    for (const auto &sdef : struct_defs) {
+        struct_rec r;
+        r.name = intern(sdef.name());
+
+        r.bases.first = arena_index(_struct_bases.size());
+        for (const auto &bas : *sdef.base_addrs()) {
+            const auto &compat = std::get<0>(bas);
+            const auto &addrs = std::get<1>(bas);
+
+            struct_base_rec b;
+            b.first = compat.first();
+            b.last = compat.last();
+            b.addrs = { arena_index(_addrs.size()), arena_index(addrs.size()) };
+            for (const auto &addr : addrs)
+                _addrs.push_back(arena_index(addr));
+
+            _struct_bases.push_back(b);
+        }
+        r.bases.count = arena_index(_struct_bases.size() - r.bases.first);
+
+        vector<uint32_t> refs;
+        for (const auto &v : *sdef.variables())
+            refs.push_back(add_var(v, struct_vars));
+
+        r.vars = { arena_index(_var_refs.size()), arena_index(refs.size()) };
+        _var_refs.insert(_var_refs.end(), refs.begin(), refs.end());
+        _structs.push_back(r);
+    }
+
+    /* Drop build-time state */
+    unordered_map<string, uint32_t>().swap(_string_tbl);
+    unordered_map<const var *, uint32_t>().swap(_var_tbl);
+
+    _segs.shrink_to_fit();
+    _values.shrink_to_fit();
+    _offsets.shrink_to_fit();
+    _vars.shrink_to_fit();
+    _var_refs.shrink_to_fit();
+    _var_sets.shrink_to_fit();
+    _struct_bases.shrink_to_fit();
+    _addrs.shrink_to_fit();
+    _structs.shrink_to_fit();
+    _strings.shrink_to_fit();
+}
+
+/**
+ * Return the string table index of @p str, adding it if necessary.
+ */
+uint32_t nv_arena::intern (const string &str) {
+    auto it = _string_tbl.find(str);
+    if (it != _string_tbl.end())
+        return it->second;
+
+    auto idx = arena_index(_strings.size());
+    _strings.insert(_strings.end(), str.begin(), str.end());
+    _strings.push_back('\0');
+    _string_tbl.emplace(str, idx);
+
+    return idx;
+}
+
+/**
+ * Append all @p offsets (and their values and segments) to the arena,
+ * returning the range of the newly added offset records.
+ */
+arena_range nv_arena::add_offsets (const vector<nv_offset> &offsets) {
+    arena_range ret = { arena_index(_offsets.size()), arena_index(offsets.size()) };
+
+    /* Offset records must be contiguous; reserve them before appending
+     * their values */
+    _offsets.resize(_offsets.size() + offsets.size());
+
+    for (size_t i = 0; i < offsets.size(); i++) {
+        const auto &off = offsets[i];
+        const auto &vals = *off.values();
+
+        offset_rec &orec = _offsets[ret.first + i];
+        orec.first = off.compat().first();
+        orec.last = off.compat().last();
+        orec.values = { arena_index(_values.size()), arena_index(vals.size()) };
+
+        _values.resize(_values.size() + vals.size());
+        for (size_t vi = 0; vi < vals.size(); vi++) {
+            const auto &segs = *vals[vi].segments();
+
+            _values[orec.values.first + vi].segs = { arena_index(_segs.size()), arena_index(segs.size()) };
+            for (const auto &seg : segs) {
+                seg_rec s;
+
+                if (seg.shift() < INT16_MIN || seg.shift() > INT16_MAX)
+                    errx(EX_SOFTWARE, "segment shift %zd out of range", seg.shift());
+
+                s.offset = arena_index(seg.offset());
+                s.count = arena_index(seg.count());
+                s.mask = seg.mask();
+                s.shift = (int16_t) seg.shift();
+                s.type = (uint8_t) seg.type();
+                _segs.push_back(s);
+            }
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Add @p v to the arena (if it has not already been added), returning its
+ * variable index.
+ */
+uint32_t nv_arena::add_var (const shared_ptr<var> &v, const unordered_set<symbol> &struct_vars) {
+    auto it = _var_tbl.find(v.get());
+    if (it != _var_tbl.end())
+        return it->second;
+
+    var_rec r;
+    r.name = intern(v->name());
+    r.type = (uint8_t) v->type();
+    r.sfmt = (uint8_t) v->sfmt();
+    r.count = arena_index(v->count());
+    r.flags = v->flags();
+    if (struct_vars.count(v->name()) > 0)
+        r.flags |= VAR_STRUCT_MEMBER;
+
+    r.cis_offsets = add_offsets(*v->cis_offsets());
+    r.sprom_offsets = add_offsets(*v->sprom_offsets());
+
+    auto idx = arena_index(_vars.size());
+    _vars.push_back(r);
+    _var_tbl.emplace(v.get(), idx);
+
+    return idx;
+}
+
+size_t nv_arena::footprint () const {
+    return (_segs.capacity() * sizeof(_segs[0]) +
+            _values.capacity() * sizeof(_values[0]) +
+            _offsets.capacity() * sizeof(_offsets[0]) +
+            _vars.capacity() * sizeof(_vars[0]) +
+            _var_refs.capacity() * sizeof(_var_refs[0]) +
+            _var_sets.capacity() * sizeof(_var_sets[0]) +
+            _struct_bases.capacity() * sizeof(_struct_bases[0]) +
+            _addrs.capacity() * sizeof(_addrs[0]) +
+            _structs.capacity() * sizeof(_structs[0]) +
+            _strings.capacity());
+}
+
+} /* namespace nvram */
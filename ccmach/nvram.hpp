@@ -26,6 +26,7 @@ extern "C" {
 
 #include "nvtypes.h"
 #include "cis_layout_desc.hpp"
+#include "nvarena.hpp"
 
 using namespace std;
 using namespace pl;
@@ -40,27 +41,32 @@ struct grouping {
 	bool builtin () const { return (cis_tag != 0xFF); }
 };
 
-extern unordered_map<string, grouping&> srom_subst_groupings;
-extern unordered_map<string, nvram::value_seg> cis_subst_layout;
-extern unordered_set<string> cis_known_special_cases;
+extern unordered_map<symbol, grouping&> srom_subst_groupings;
+extern unordered_map<symbol, nvram::value_seg> cis_subst_layout;
+extern unordered_set<symbol> cis_known_special_cases;
 	
 class genmap;
+class gencis;
 
 class nvram_map {
 	friend class genmap;
+	friend class gencis;
 private:
 	vector<shared_ptr<var>> _srom_vars;
 	vector<shared_ptr<cis_vstr>> _cis_vstrs;
 	vector<nvram::cis_tag> _cis_consts;
 	vector<cis_layout> _cis_layouts;
 
-	unordered_map<string, shared_ptr<var>> _srom_tbl;
-	unordered_set<string> _struct_vars;
+	unordered_map<symbol, shared_ptr<var>> _srom_tbl;
+	unordered_set<symbol> _struct_vars;
 	vector<struct_defn> _struct_defs;
-	unordered_map<string, shared_ptr<cis_vstr>> _cis_vstr_tbl;
-	unordered_multimap<string, cis_layout> _cis_layout_tbl;
-	unordered_multimap<string, phy_chain> _pavars;
-	unordered_multimap<string, phy_band> _povars;
+	unordered_map<symbol, shared_ptr<cis_vstr>> _cis_vstr_tbl;
+	unordered_multimap<symbol, cis_layout> _cis_layout_tbl;
+	unordered_multimap<symbol, phy_chain> _pavars;
+	unordered_multimap<symbol, phy_band> _povars;
+
+	/** Lazily constructed flat representation of var_sets() and _struct_defs */
+	shared_ptr<const nv_arena> _arena;
 
 	void populate_pavars (const pavars_t *pas) {
 		for (const pavars_t *pa = pas; pa->phy_type != PHY_TYPE_NULL; pa++) {
@@ -81,34 +87,45 @@ private:
 		errx(EXIT_FAILURE, "layout for %s:%s not found", tag.name().c_str(), hnbu_tag.is<symbolic_constant>() ? ftl::get<symbolic_constant>(hnbu_tag).name().c_str() : "<none>");
 	}
 	
-	bool has_vstr (const string &vname) {
-		auto vn = vname;
-		
-		if (_cis_vstr_tbl.count(vname) == 0) {
-			char last = vn[vn.size() - 1];
-			if (isdigit(last) && last != '0')
-				vn[vn.size() - 1] = '0';
-		}
-		
-		return (_cis_vstr_tbl.count(vname) > 0);
+	/* Look up the vstr for @p vname, falling back on the '0' entry for
+	 * per-core names ending in 1-9; returns nullptr if not found */
+	shared_ptr<cis_vstr> find_vstr (const symbol &vname) {
+		auto iter = _cis_vstr_tbl.find(vname);
+		if (iter != _cis_vstr_tbl.end())
+			return iter->second;
+
+		string vn = vname;
+		if (vn.empty())
+			return nullptr;
+
+		char last = vn[vn.size() - 1];
+		if (!isdigit(last) || last == '0')
+			return nullptr;
+
+		vn[vn.size() - 1] = '0';
+		iter = _cis_vstr_tbl.find(vn);
+		if (iter == _cis_vstr_tbl.end())
+			return nullptr;
+
+		return iter->second;
+	}
+
+	bool has_vstr (const symbol &vname) {
+		return (find_vstr(vname) != nullptr);
 	}
 	
-	shared_ptr<cis_vstr> get_vstr (const string &vname) {
-		auto vn = vname;
+	shared_ptr<var_set> cis_var_set (const nvram::cis_tag &ct);
 
-		if (_cis_vstr_tbl.count(vname) == 0) {
-			char last = vn[vn.size() - 1];
-			if (isdigit(last) && last != '0')
-				vn[vn.size() - 1] = '0';
-		}
-		
-		if (_cis_vstr_tbl.count(vn) == 0)
+	shared_ptr<cis_vstr> get_vstr (const symbol &vname) {
+		auto vs = find_vstr(vname);
+		if (!vs)
 			errx(EXIT_FAILURE, "missing vstr for %s", vname.c_str());
 
-		return _cis_vstr_tbl.at(vn);
+		return vs;
 	}
 public:
 	vector<shared_ptr<var_set>> var_sets ();
+	shared_ptr<const nv_arena> arena ();
 	
 	static void alpha_sort (std::vector<string> &v) {
 		sort(v.begin(), v.end(), [](const string &lhs, string &rhs) {
@@ -118,7 +135,7 @@ public:
 	
 	nvram_map (const vector<shared_ptr<var>> &srom_vars,
 		   const vector<struct_defn> &struct_defs,
-		   const unordered_set<string> &struct_vars,
+		   const unordered_set<symbol> &struct_vars,
 		   const vector<shared_ptr<cis_vstr>> &cis_vstrs,
 		   const vector<nvram::cis_tag> &cis_consts,
 		   const vector<cis_layout> &cis_layouts) : _srom_vars(srom_vars), _struct_vars(struct_vars), _struct_defs(struct_defs), _cis_vstrs(cis_vstrs), _cis_consts(cis_consts), _cis_layouts(cis_layouts)
@@ -103,7 +103,7 @@ static nvram::grouping paparams_c3 =     { "HNBU_PAPARMS_C3",      NULL,  HNBU_P
 
 static nvram::grouping rxgainerr =       { "HNBU_RXGAIN_ERR",      NULL,  HNBU_RXGAIN_ERR };
 
-unordered_map<string, grouping&> nvram::srom_subst_groupings = {
+unordered_map<symbol, grouping&> nvram::srom_subst_groupings = {
     { "cckPwrOffset",       srom_misc },
     { "et1macaddr",         srom_misc },
     { "eu_edthresh2g",      srom_misc },
@@ -215,7 +215,7 @@ unordered_map<string, grouping&> nvram::srom_subst_groupings = {
 #endif
 };
 
-unordered_set<string> nvram::cis_known_special_cases = {
+unordered_set<symbol> nvram::cis_known_special_cases = {
     /* Standard CIS tuple */
     "manf",
     "productname",
@@ -224,13 +224,13 @@ unordered_set<string> nvram::cis_known_special_cases = {
     "macaddr",
 };
 
-static unordered_map<string, prop_type> cis_ptype_overrides = {
+static unordered_map<symbol, prop_type> cis_ptype_overrides = {
     {"rxpo2g",  BHND_T_INT8},
     {"rxpo5g",  BHND_T_INT8},
     {"ccode",   BHND_T_CHAR},
 };
 
-static unordered_map<string, str_fmt> sfmt_overrides = {
+static unordered_map<symbol, str_fmt> sfmt_overrides = {
     // CIS is wrong-ish here
     {"subband5gver", SFMT_HEX},
     {"boardnum", SFMT_HEX},
@@ -350,7 +350,7 @@ static unordered_map<string, str_fmt> sfmt_overrides = {
 
 namespace nvram {
 
-unordered_map<string, value_seg> cis_subst_layout = {
+unordered_map<symbol, value_seg> cis_subst_layout = {
     // HNBU_LEDDC
     { "leddc",  { 0, BHND_T_UINT8, 2, 0xFF, 0 }},
 
@@ -530,10 +530,9 @@ void nvram_map::emit_diagnostics () {
             continue;
         
         vector<nvram::compat_range> srom_compats;
-        if (_srom_tbl.count(vs->name()) > 0) {
-            const auto &svr = _srom_tbl.at(vs->name());
-            
-            for (const auto &sp : *svr->sprom_offsets())
+        auto svr = _srom_tbl.find(vs->name());
+        if (svr != _srom_tbl.end()) {
+            for (const auto &sp : *svr->second->sprom_offsets())
                 srom_compats.push_back(sp.compat());
         }
         
@@ -612,11 +611,11 @@ void nvram_map::emit_diagnostics () {
                 break;
         }
         
-        if (srom_subst_groupings.count(v) != 1) {
+        if (srom_subst_groupings.find(v) == srom_subst_groupings.end()) {
             if (!found_match) {
                 fprintf(stderr, "\t%s\n", v.c_str());
             } else {
-                const auto &entry = _cis_vstr_tbl.at(match);
+                const auto &entry = _cis_vstr_tbl.find(match)->second;
                 fprintf(stderr, "\t%s (found base %s family %s)\n", v.c_str(), match.c_str(), entry->cis_tag().name().c_str());
             }
             
@@ -647,8 +646,9 @@ void nvram_map::emit_diagnostics () {
                     fprintf(stderr, "# CIS vars requiring special case decoding:\n");
 
                 fprintf(stderr, "\t%s", v.name().c_str());
-                if (_srom_tbl.count(v.name()) > 0) {
-                    auto srom_offset = _srom_tbl.at(v.name())->sprom_offsets()->at(0);
+                auto srom = _srom_tbl.find(v.name());
+                if (srom != _srom_tbl.end()) {
+                    auto srom_offset = srom->second->sprom_offsets()->at(0);
                     if (srom_offset.values()->size() == 1 && srom_offset.values()->at(0).segments()->size() == 1) {
                         auto srom_seg = srom_offset.values()->at(0).segments()->at(0);
                         fprintf(stderr, " : { \"%s\", { <OFFSET>, %s, %zu, 0x%X, %zd }},\n",
@@ -675,8 +675,9 @@ void nvram_map::emit_diagnostics () {
             continue;
         
         fprintf(stderr, "\t%s", v.c_str());
-        if (_srom_tbl.count(v) > 0) {
-            auto srom_offset = _srom_tbl.at(v)->sprom_offsets()->at(0);
+        auto srom = _srom_tbl.find(v);
+        if (srom != _srom_tbl.end()) {
+            auto srom_offset = srom->second->sprom_offsets()->at(0);
             if (srom_offset.values()->size() == 1 && srom_offset.values()->at(0).segments()->size() == 1) {
                 auto srom_seg = srom_offset.values()->at(0).segments()->at(0);
                 fprintf(stderr, " : { \"%s\", { <OFFSET>, %s, %zu, 0x%X, %zd }},\n",
@@ -697,174 +698,249 @@ void nvram_map::emit_diagnostics () {
 
 }
     
-vector<shared_ptr<var_set>> nvram_map::var_sets () {
-    unordered_map<string, shared_ptr<var_set>> sets;
-
-    /*
-     * Construct the CIS var sets
-     */
-    for (const auto &ct : _cis_consts) {
-        symbolic_constant tag = ct.constant();
-        ftl::maybe<symbolic_constant> hnbu_tag = ftl::nothing<symbolic_constant>();
-        string name = ct.constant().name();
-        
-        if (strncmp(ct.constant().name().c_str(), "CISTPL_", strlen("CISTPL_")) == 0) {
-            tag = ct.constant();
+/**
+ * Construct the var set for CIS tuple @p ct, populated with the tuple's
+ * CIS variables.
+ *
+ * This only reads the map's tables, and may be called concurrently.
+ */
+shared_ptr<var_set> nvram_map::cis_var_set (const nvram::cis_tag &ct) {
+    symbolic_constant tag = ct.constant();
+    ftl::maybe<symbolic_constant> hnbu_tag = ftl::nothing<symbolic_constant>();
+    string name = ct.constant().name();
+    
+    if (strncmp(ct.constant().name().c_str(), "CISTPL_", strlen("CISTPL_")) == 0) {
+        tag = ct.constant();
+    } else {
+        tag = symbolic_constant("CISTPL_BRCM_HNBU", CISTPL_BRCM_HNBU);
+        hnbu_tag = ftl::just(ct.constant());
+    }
+    const auto &layout = get_layout(tag, hnbu_tag);
+    
+    NSString *comment = ct.comment();
+    if (comment == nil)
+        comment = @"";
+    
+    auto vars = make_shared<vector<shared_ptr<var>>>();
+    vars->reserve(layout.vars().size());
+    for (const auto &v : layout.vars()) {
+        str_fmt sfmt = SFMT_HEX;
+        uint32_t flags = 0;
+        prop_type ptype = v.type();
+        auto srom = _srom_tbl.find(v.name());
+
+        if (has_vstr(v.name())) {
+            sfmt = get_vstr(v.name())->sfmt();
+        } else if (srom != _srom_tbl.end()) {
+            sfmt = srom->second->sfmt();
+        } else if (v.name() == "usbmanfid" || v.name() == "muxenab") {
+            sfmt = SFMT_HEX;
         } else {
-            tag = symbolic_constant("CISTPL_BRCM_HNBU", CISTPL_BRCM_HNBU);
-            hnbu_tag = ftl::just(ct.constant());
+            errx(EXIT_FAILURE, "no known format for CIS var %s", v.name().c_str());
         }
-        auto layout = get_layout(tag, hnbu_tag);
+
+        auto sfmt_ovr = sfmt_overrides.find(v.name());
+        if (sfmt_ovr != sfmt_overrides.end())
+            sfmt = sfmt_ovr->second;
         
-        NSString *comment = ct.comment();
-        if (comment == nil)
-            comment = @"";
+        auto ptype_ovr = cis_ptype_overrides.find(v.name());
+        if (ptype_ovr != cis_ptype_overrides.end())
+            ptype = ptype_ovr->second;
         
-        auto vars = make_shared<vector<shared_ptr<var>>>();
-        for (const auto &v : layout.vars()) {
-            str_fmt sfmt = SFMT_HEX;
-            uint32_t flags = 0;
-            prop_type ptype = v.type();
-    
-            if (has_vstr(v.name())) {
-                sfmt = get_vstr(v.name())->sfmt();
-            } else if (_srom_tbl.count(v.name()) > 0) {
-                sfmt = _srom_tbl.at(v.name())->sfmt();
-            } else if (v.name() == "usbmanfid" || v.name() == "muxenab") {
-                sfmt = SFMT_HEX;
-            } else {
-                errx(EXIT_FAILURE, "no known format for CIS var %s", v.name().c_str());
-            }
-
-            if (sfmt_overrides.count(v.name()) > 0) {
-                sfmt = sfmt_overrides.at(v.name());
-            }
-            
-            if (cis_ptype_overrides.count(v.name()) > 0) {
-                ptype = cis_ptype_overrides.at(v.name());
-            }
-            
-            switch (v.type()) {
-                case BHND_T_INT8:
-                case BHND_T_INT16:
-                case BHND_T_INT32:
-                    if (sfmt != SFMT_DECIMAL)
-                        errx(EX_DATAERR, "CIS '%s' defines a non-decimal SFMT for a signed integer", v.name().c_str());
-                    break;
-                default:
-                    break;
-            }
-            
-            auto count = v.count();
-            if (v.name() == "ccode" && ptype == BHND_T_CHAR)
-                count = 2;
-            
-            /* Try to find a SROM var we can borrow flags from */
-            if (_srom_tbl.count(v.name()) > 0) {
-                flags = _srom_tbl.at(v.name())->flags();
-            }
-            
-            value val(make_shared<vector<nvram::value_seg>>());
-            val.segments()->emplace_back(v.offset(), ptype, count, v.mask(), v.shift());
-            auto vals = make_shared<vector<value>>();
-            vals->push_back(val);
-
-            auto vl = make_shared<vector<nv_offset>>();
-            vl->push_back(nv_offset(layout.compat(), vals));
-            vars->push_back(make_shared<var>(
-                v.name(),
-                ptype,
-                sfmt,
-                count,
-                flags,
-                vl,
-                make_shared<vector<nv_offset>>()
-            ));
+        switch (v.type()) {
+            case BHND_T_INT8:
+            case BHND_T_INT16:
+            case BHND_T_INT32:
+                if (sfmt != SFMT_DECIMAL)
+                    errx(EX_DATAERR, "CIS '%s' defines a non-decimal SFMT for a signed integer", v.name().c_str());
+                break;
+            default:
+                break;
         }
         
-        auto vs = make_shared<var_set>(
-            name,
-            ftl::just(var_set_cis(tag, hnbu_tag, layout.compat())),
-            comment.UTF8String,
-            vars
-        );
-        sets.insert({ct.constant().name(), vs});
+        auto count = v.count();
+        if (v.name() == "ccode" && ptype == BHND_T_CHAR)
+            count = 2;
+        
+        /* Try to find a SROM var we can borrow flags from */
+        if (srom != _srom_tbl.end())
+            flags = srom->second->flags();
+        
+        value val(make_shared<vector<nvram::value_seg>>());
+        val.segments()->emplace_back(v.offset(), ptype, count, v.mask(), v.shift());
+        auto vals = make_shared<vector<value>>();
+        vals->push_back(val);
+
+        auto vl = make_shared<vector<nv_offset>>();
+        vl->push_back(nv_offset(layout.compat(), vals));
+        vars->push_back(make_shared<var>(
+            v.name(),
+            ptype,
+            sfmt,
+            count,
+            flags,
+            vl,
+            make_shared<vector<nv_offset>>()
+        ));
     }
     
+    return make_shared<var_set>(
+        name,
+        ftl::just(var_set_cis(tag, hnbu_tag, layout.compat())),
+        comment.UTF8String,
+        vars
+    );
+}
+
+/**
+ * Construct the var sets.
+ *
+ * The CIS var sets, the SROM variable placements, and the population of
+ * each var set with its SROM variables are computed as independent tasks on
+ * the global concurrent queue; the results are merged in _cis_consts and
+ * _srom_vars order, and the warnings emitted in the order the equivalent
+ * serial construction would have produced them.
+ */
+vector<shared_ptr<var_set>> nvram_map::var_sets () {
+    auto queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+    nvram_map *map = this;
+    unordered_map<symbol, shared_ptr<var_set>> sets;
+
+    /*
+     * Construct the CIS var sets
+     */
+    vector<shared_ptr<var_set>> cis_sets(_cis_consts.size());
+    auto *cis_setp = cis_sets.data();
+    const auto *cis_constp = _cis_consts.data();
+
+    dispatch_apply(cis_sets.size(), queue, ^(size_t i) {
+        cis_setp[i] = map->cis_var_set(cis_constp[i]);
+    });
+
+    for (const auto &vs : cis_sets)
+        sets.insert({vs->name(), vs});
+    
     /*
      * Construct the SROM's stand-in varsets, unpopulated with SROM vars.
      */
     for (const auto &grtuple : srom_subst_groupings) {
         const auto gr = grtuple.second;
     
-        shared_ptr<var_set> vs;
-        if (sets.count(gr.name) == 0) {
-            auto vsc = ftl::nothing<var_set_cis>();
-            if (gr.builtin()) {
-                auto tag = symbolic_constant("CISTPL_BRCM_HNBU", CISTPL_BRCM_HNBU);
-                auto hnbu_tag = ftl::just(symbolic_constant(gr.name, gr.cis_tag));
-                auto layout = get_layout(tag, hnbu_tag);
-                vsc = ftl::just(var_set_cis(tag, hnbu_tag, layout.compat()));
-            }
-            
-            vs = make_shared<var_set>(
-                gr.name,
-                vsc,
-                gr.desc,
-                make_shared<vector<shared_ptr<var>>>()
-            );
-            sets.insert({gr.name, vs});
+        if (sets.find(gr.name) != sets.end())
+            continue;
+
+        auto vsc = ftl::nothing<var_set_cis>();
+        if (gr.builtin()) {
+            auto tag = symbolic_constant("CISTPL_BRCM_HNBU", CISTPL_BRCM_HNBU);
+            auto hnbu_tag = ftl::just(symbolic_constant(gr.name, gr.cis_tag));
+            auto layout = get_layout(tag, hnbu_tag);
+            vsc = ftl::just(var_set_cis(tag, hnbu_tag, layout.compat()));
         }
+        
+        auto vs = make_shared<var_set>(
+            gr.name,
+            vsc,
+            gr.desc,
+            make_shared<vector<shared_ptr<var>>>()
+        );
+        sets.insert({gr.name, vs});
     }
 
     /*
-     * Populate SROM vars
+     * Find the var set(s) and string format of each SROM var
      */
-    for (const auto &sv : _srom_vars) {
-        /* Find the appropriate var set(s) */
-        vector<shared_ptr<var_set>> vss;
-    
-        if (_cis_layout_tbl.count(sv->name()) == 0) {
-            if (srom_subst_groupings.count(sv->name()) == 0) {
+    struct placement {
+        vector<var_set *>	sets;
+        str_fmt			sfmt;
+    };
+    vector<placement> placements(_srom_vars.size());
+    auto *placementp = placements.data();
+    const auto *srom_varp = _srom_vars.data();
+    const auto *setsp = &sets;
+
+    dispatch_apply(placements.size(), queue, ^(size_t i) {
+        const auto &sv = srom_varp[i];
+        auto &p = placementp[i];
+
+        auto iter = map->_cis_layout_tbl.equal_range(sv->name());
+        if (iter.first == iter.second) {
+            auto gr = srom_subst_groupings.find(sv->name());
+            if (gr == srom_subst_groupings.end())
                 errx(EX_DATAERR, "Missing group name for %s", sv->name().c_str());
-            }
-            const auto &gr = srom_subst_groupings.at(sv->name());
-            vss.push_back(sets.at(gr.name));
-        } else if (_cis_layout_tbl.count(sv->name()) > 0) {
-            auto iter = _cis_layout_tbl.equal_range(sv->name());
-            std::for_each(iter.first, iter.second, [&](decltype(_cis_layout_tbl)::value_type &cl){
-                vss.push_back(sets.at(cl.second.index_tag()));
-            });
+
+            p.sets.push_back(setsp->at(gr->second.name).get());
+        } else {
+            for (auto cl = iter.first; cl != iter.second; cl++)
+                p.sets.push_back(setsp->at(cl->second.index_tag()).get());
         }
+
+        p.sfmt = sv->sfmt();
+        auto sfmt_ovr = sfmt_overrides.find(sv->name());
+        if (sfmt_ovr != sfmt_overrides.end())
+            p.sfmt = sfmt_ovr->second;
         
-        /* Populate the var sets */
-        for (auto &vs : vss) {
-            shared_ptr<var> v;
-            str_fmt sfmt = sv->sfmt();
-            
-            if (sfmt_overrides.count(sv->name()) > 0) {
-                sfmt = sfmt_overrides.at(sv->name());
-            }
-            
-            switch (sv->type()) {
-                case BHND_T_INT8:
-                case BHND_T_INT16:
-                case BHND_T_INT32:
-                    if (sfmt != SFMT_DECIMAL)
-                        errx(EX_DATAERR, "SROM '%s' defines a non-decimal SFMT for a signed integer", sv->name().c_str());
-                    break;
-                default:
-                    break;
-            }
-    
-            for (auto &ventry : *vs->vars()) {
-                if (ventry->name() != sv->name())
-                    continue;
-                
-                v = ventry;
+        switch (sv->type()) {
+            case BHND_T_INT8:
+            case BHND_T_INT16:
+            case BHND_T_INT32:
+                if (p.sfmt != SFMT_DECIMAL)
+                    errx(EX_DATAERR, "SROM '%s' defines a non-decimal SFMT for a signed integer", sv->name().c_str());
+                break;
+            default:
                 break;
+        }
+    });
+
+    /*
+     * Invert the placements into per-set (SROM var, placement position)
+     * lists, in _srom_vars order.
+     */
+    struct member {
+        size_t	srom_idx;
+        size_t	pos;
+    };
+    struct target {
+        var_set		*vs;
+        vector<member>	 members;
+        vector<tuple<size_t, size_t, string>> warnings;
+    };
+    vector<target> targets;
+    unordered_map<var_set *, size_t> target_idx;
+
+    for (size_t i = 0; i < placements.size(); i++) {
+        for (size_t pos = 0; pos < placements[i].sets.size(); pos++) {
+            auto *vs = placements[i].sets[pos];
+            auto ti = target_idx.find(vs);
+            if (ti == target_idx.end()) {
+                ti = target_idx.insert({vs, targets.size()}).first;
+                targets.push_back({vs, {}, {}});
             }
-            if (!v) {
+
+            targets[ti->second].members.push_back({i, pos});
+        }
+    }
+
+    /*
+     * Populate each var set with its SROM vars
+     */
+    auto *targetp = targets.data();
+    dispatch_apply(targets.size(), queue, ^(size_t ti) {
+        auto &t = targetp[ti];
+        auto &vars = *t.vs->vars();
+
+        /* Index the set's existing vars; the first definition of a name
+         * takes precedence. */
+        unordered_map<symbol, shared_ptr<var>> index;
+        for (const auto &ventry : vars)
+            index.insert({ventry->name(), ventry});
+
+        for (const auto &m : t.members) {
+            const auto &sv = srom_varp[m.srom_idx];
+            str_fmt sfmt = placementp[m.srom_idx].sfmt;
+            shared_ptr<var> v;
+
+            auto existing = index.find(sv->name());
+            if (existing == index.end()) {
                 v = make_shared<var>(
                     sv->name(),
                     sv->type(),
@@ -874,16 +950,21 @@ vector<shared_ptr<var_set>> nvram_map::var_sets () {
                     make_shared<vector<nv_offset>>(),
                     make_shared<vector<nv_offset>>()
                 );
-                vs->vars()->push_back(v);
+                vars.push_back(v);
+                index.insert({v->name(), v});
             } else {
+                v = existing->second;
+
                 if (v->type() != sv->type()) {
                     if (v->name() == "ccode" && sv->type() == BHND_T_CHAR) {
                         // CIS is wrong-ish here
                         *v = v->type(BHND_T_CHAR);
                         *v = v->count(2);
                     } else {
-                        if (!prop_type_compat(v->type(), sv->type()))
-                            warnx("%s cis/srom mismatch: %s(cis) != %s(srom)", v->name().c_str(), to_string(v->type()).c_str(), to_string(sv->type()).c_str());
+                        if (!prop_type_compat(v->type(), sv->type())) {
+                            NSString *w = [NSString stringWithFormat: @"%s cis/srom mismatch: %s(cis) != %s(srom)", v->name().c_str(), to_string(v->type()).c_str(), to_string(sv->type()).c_str()];
+                            t.warnings.emplace_back(m.srom_idx, m.pos, w.UTF8String);
+                        }
 
                         /* Widen the type */
                         *v = v->type(prop_type_widen(v->type(), sv->type()));
@@ -895,7 +976,8 @@ vector<shared_ptr<var_set>> nvram_map::var_sets () {
                 }
                 
                 if (v->count() != sv->count()) {
-                    warnx("'%s' cis/srom mismatch: count %zu(cis) != %zu(srom)", v->name().c_str(), v->count(), sv->count());
+                    NSString *w = [NSString stringWithFormat: @"'%s' cis/srom mismatch: count %zu(cis) != %zu(srom)", v->name().c_str(), v->count(), sv->count()];
+                    t.warnings.emplace_back(m.srom_idx, m.pos, w.UTF8String);
                     *v = v->count(max(v->count(), sv->count()));
                 }
                 
@@ -904,24 +986,33 @@ vector<shared_ptr<var_set>> nvram_map::var_sets () {
                 }
             }
 
-            v->sprom_offsets()->insert(v->sprom_offsets()->end(), sv->sprom_offsets()->begin(), sv->sprom_offsets()->end());
+            v->add_sprom_offsets(*sv->sprom_offsets());
         }
-    }
-    
+    });
+
+    /* Emit the buffered warnings in (SROM var, placement position) order */
+    vector<tuple<size_t, size_t, string>> warnings;
+    for (auto &t : targets)
+        std::move(t.warnings.begin(), t.warnings.end(), back_inserter(warnings));
+
+    stable_sort(warnings.begin(), warnings.end(), [](const tuple<size_t, size_t, string> &lhs, const tuple<size_t, size_t, string> &rhs) {
+        return (make_pair(get<0>(lhs), get<1>(lhs)) < make_pair(get<0>(rhs), get<1>(rhs)));
+    });
+
+    for (const auto &w : warnings)
+        warnx("%s", get<2>(w).c_str());
+
     vector<shared_ptr<var_set>> result;
+    result.reserve(sets.size());
     for (const auto &kv : sets)
         result.push_back(kv.second);
     
 
     /* Report vars that live in multiple var sets */
-    unordered_map<string, unordered_set<string>> vars_seen;
+    unordered_map<symbol, unordered_set<string>> vars_seen;
     for (const auto &vs : result) {
-        for (const auto &v : *vs->vars()) {
-            if (vars_seen.count(v->name()) == 0)
-                vars_seen.insert({v->name(), unordered_set<string>()});
-            
-            vars_seen.at(v->name()).insert(vs->name());
-        }
+        for (const auto &v : *vs->vars())
+            vars_seen[v->name()].insert(vs->name());
     }
     
     for (const auto &vpair : vars_seen) {
@@ -944,39 +1035,72 @@ vector<shared_ptr<var_set>> nvram_map::var_sets () {
     
     return result;
 }
+
+/**
+ * Return the flat, read-only arena representation of this map's variable
+ * sets and struct definitions.
+ *
+ * The arena is built on first use; the shared_ptr-linked var_sets() result
+ * is discarded once it has been flattened.
+ */
+shared_ptr<const nv_arena> nvram_map::arena () {
+    if (!_arena)
+        _arena = make_shared<const nv_arena>(var_sets(), _struct_defs, _struct_vars);
+
+    return _arena;
+}
     
     
-bool var::hasCommonCompatRange () {
-    compat_range r(0, 0);
-    if (_cis_offsets->size() > 0)
-        r = _cis_offsets->at(0).compat();
-    else if (_sprom_offsets->size() > 0)
-        r = _sprom_offsets->at(0).compat();
-    else
-        return false;
-
-    for (const auto &o : *_cis_offsets)
-        if (r != o.compat())
-            return false;
-    
-    for (const auto &o : *_sprom_offsets)
-        if (r != o.compat())
-            return false;
+/**
+ * Compute (or return the memoized) common compat range of this variable's
+ * offsets.
+ *
+ * @param[out] range On success, the common compat range. May be NULL.
+ *
+ * @retval true if all offsets share a common compat range.
+ * @retval false otherwise.
+ */
+bool var::common_compat (compat_range *range) const {
+    auto &m = _compat_memo;
+    std::lock_guard<std::mutex> guard(m.lock);
+
+    if (!m.valid) {
+        m.valid = true;
+        m.common = false;
+
+        if (_cis_offsets->size() > 0 || _sprom_offsets->size() > 0) {
+            compat_range r = _cis_offsets->size() > 0 ? _cis_offsets->at(0).compat() : _sprom_offsets->at(0).compat();
+
+            m.common = true;
+            for (const auto &o : *_cis_offsets)
+                if (r != o.compat())
+                    m.common = false;
+
+            for (const auto &o : *_sprom_offsets)
+                if (r != o.compat())
+                    m.common = false;
+
+            m.first = r.first();
+            m.last = r.last();
+        }
+    }
 
-    return true;
+    if (m.common && range != NULL)
+        *range = compat_range(m.first, m.last);
+
+    return m.common;
 }
 
-compat_range var::getCommonCompatRange () {
-    if (!hasCommonCompatRange())
+bool var::hasCommonCompatRange () const {
+    return common_compat(NULL);
+}
+
+compat_range var::getCommonCompatRange () const {
+    compat_range r(0, 0);
+    if (!common_compat(&r))
         errx(EX_USAGE, "can't request common compat range if there isn't one");
     
-    for (const auto &o : *_cis_offsets)
-        return o.compat();
-    
-    for (const auto &o : *_sprom_offsets)
-        return o.compat();
-
-    __builtin_unreachable();
+    return r;
 }
     
     
@@ -0,0 +1,710 @@
+//
+//  nvram_batch.c
+//  ccmach
+//
+//  Created by Landon Fuller on 2/5/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+/*
+ * Batch decoder for SPROM and CIS/OTP dumps.
+ *
+ * Images are read from directories, manifest files (one path per line), or
+ * are synthesized in memory (-s) for benchmarking. Each image's format and
+ * SPROM revision are detected, and the decoded variables are streamed to
+ * the output as NDJSON, one object per image; output order is unspecified.
+ *
+ * With -c, decoded SPROM images are instead written to the output as a
+ * single column store (see nvram_colstore.h); CIS images have no fixed
+ * column layout, and are skipped.
+ *
+ * With -C, SPROM decode results are looked up in (and added to) a
+ * persistent decode cache (see nvram_dcache.h); images already present in
+ * the cache are not decoded again.
+ *
+ * Decoding is performed by a fixed number of workers (-j) that claim small
+ * batches of images from a shared cursor, balancing load across workers
+ * regardless of per-image cost. Throughput is reported on stderr.
+ *
+ * Image files are read by a loader (see nvram_loader.h) into a shared
+ * buffer pool, and decoded in place; on Linux, the loader batches the
+ * open, read, and close of every file through io_uring. With -P, or where
+ * io_uring is unavailable, each worker reads its own images with pread(2).
+ */
+
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include <dispatch/dispatch.h>
+
+#include "nvram_cis.h"
+#include "nvram_colstore.h"
+#include "nvram_dcache.h"
+#include "nvram_loader.h"
+#include "nvram_sprom.h"
+
+/** Maximum supported image size */
+#define	BATCH_IMAGE_MAX		(64 * 1024)
+
+/** Number of images claimed by a worker at a time */
+#define	BATCH_CHUNK		64
+
+/** Loader buffers per worker; loading may run ahead of decoding by one
+ *  chunk per worker */
+#define	BATCH_LOAD_SLOTS	(BATCH_CHUNK * 2)
+
+/** Worker output is flushed once it exceeds this size */
+#define	BATCH_FLUSH_SIZE	(256 * 1024)
+
+/** Decode cache limits (if -C) */
+#define	BATCH_DCACHE_ENTRIES	(4 * 1024 * 1024)
+#define	BATCH_DCACHE_SIZE	((size_t)16 * 1024 * 1024 * 1024)
+
+/** Growable output buffer */
+struct batch_buf {
+	char	*data;
+	size_t	 len;
+	size_t	 cap;
+};
+
+/** Batch decoding state, shared by all workers */
+struct batch {
+	char		**paths;	/**< input paths (NULL if synthetic) */
+	size_t		  count;	/**< number of images */
+	atomic_size_t	  next;		/**< next unclaimed image */
+	atomic_size_t	  failed;	/**< number of images that failed to decode */
+	atomic_size_t	  skipped;	/**< number of images omitted from columnar output */
+
+	int		  out_fd;	/**< output file descriptor */
+	pthread_mutex_t	  out_lock;	/**< serializes output writes */
+
+	const struct bhnd_colstore_schema	*schema;	/**< column schema (if -c) */
+	struct bhnd_colstore_writer		*colw;		/**< column writer (if -c) */
+	struct bhnd_dcache			*dcache;	/**< decode cache (if -C) */
+	struct bhnd_loader			*loader;	/**< image loader (NULL if
+								     synthetic) */
+};
+
+/** Per-worker state */
+struct batch_worker {
+	uint8_t			image[BATCH_IMAGE_MAX];	/**< synthetic image buffer */
+	char			env[BATCH_IMAGE_MAX];	/**< decoded environment */
+	char			path[32];		/**< synthetic image path */
+	struct batch_buf	out;			/**< pending output */
+	uint32_t		*row_vals;		/**< columnar row values */
+	uint8_t			*row_valid;		/**< columnar row validity */
+};
+
+static void
+batch_reserve (struct batch_buf *b, size_t len)
+{
+	if (b->len + len <= b->cap)
+		return;
+
+	while (b->len + len > b->cap)
+		b->cap = (b->cap == 0) ? 4096 : b->cap * 2;
+
+	if ((b->data = realloc(b->data, b->cap)) == NULL)
+		err(EX_OSERR, "realloc");
+}
+
+static void
+batch_put (struct batch_buf *b, const char *p, size_t len)
+{
+	batch_reserve(b, len);
+	memcpy(b->data + b->len, p, len);
+	b->len += len;
+}
+
+static void
+batch_puts (struct batch_buf *b, const char *str)
+{
+	batch_put(b, str, strlen(str));
+}
+
+/** Append @p len bytes of @p p as a quoted JSON string */
+static void
+batch_put_json (struct batch_buf *b, const char *p, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	batch_reserve(b, (len * 6) + 2);
+	b->data[b->len++] = '"';
+
+	for (size_t i = 0; i < len; i++) {
+		uint8_t c = (uint8_t)p[i];
+
+		if (c == '"' || c == '\\') {
+			b->data[b->len++] = '\\';
+			b->data[b->len++] = c;
+		} else if (c < 0x20 || c >= 0x7F) {
+			/* Non-ASCII bytes are escaped as Latin-1 code points */
+			memcpy(b->data + b->len, "\\u00", 4);
+			b->data[b->len + 4] = hex[c >> 4];
+			b->data[b->len + 5] = hex[c & 0xF];
+			b->len += 6;
+		} else {
+			b->data[b->len++] = c;
+		}
+	}
+
+	b->data[b->len++] = '"';
+}
+
+static void
+batch_put_udec (struct batch_buf *b, unsigned long v)
+{
+	char tmp[24];
+	int n = snprintf(tmp, sizeof(tmp), "%lu", v);
+	batch_put(b, tmp, n);
+}
+
+/** Write and discard all pending output for @p w */
+static void
+batch_flush (struct batch *bt, struct batch_worker *w)
+{
+	const char	*p;
+	size_t		 resid;
+
+	pthread_mutex_lock(&bt->out_lock);
+
+	p = w->out.data;
+	resid = w->out.len;
+	while (resid > 0) {
+		ssize_t n = write(bt->out_fd, p, resid);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			err(EX_IOERR, "write");
+		}
+
+		p += n;
+		resid -= n;
+	}
+
+	pthread_mutex_unlock(&bt->out_lock);
+	w->out.len = 0;
+}
+
+/** Synthesize SPROM image @p idx */
+static size_t
+batch_synthesize (size_t idx, uint8_t *buf)
+{
+	const size_t	size = 468;
+	size_t		sig_off;
+	uint16_t	sig;
+
+	for (size_t i = 0; i < size - 2; i++)
+		buf[i] = (uint8_t)((i * (idx | 1)) + (idx >> 8));
+
+	/* bhnd_sprom_identify() requires the rev 11 signature */
+	if (bhnd_sprom_layout_sig(11, &sig_off, &sig) == 0) {
+		buf[sig_off] = sig & 0xFF;
+		buf[sig_off + 1] = sig >> 8;
+	}
+
+	buf[size - 2] = 11;
+	buf[size - 1] = ~bhnd_nvram_crc8(buf, size - 1,
+	    BHND_NVRAM_CRC8_INITIAL);
+
+	return (size);
+}
+
+/** Append the decoded SPROM @p image to the column store */
+static int
+batch_column_one (struct batch *bt, struct batch_worker *w, const char *path,
+    const uint8_t *image, size_t size)
+{
+	struct bhnd_sprom_ctx	ctx;
+	int			error;
+
+	if (bhnd_sprom_ctx_init(&ctx, image, size) != 0) {
+		atomic_fetch_add(&bt->skipped, 1);
+		return (0);
+	}
+
+	error = bhnd_colstore_row_decode(bt->schema, &ctx, w->row_vals,
+	    w->row_valid);
+	if (error) {
+		atomic_fetch_add(&bt->failed, 1);
+		errno = error;
+		warn("%s", path);
+		return (error);
+	}
+
+	pthread_mutex_lock(&bt->out_lock);
+	error = bhnd_colstore_writer_append(bt->colw, w->row_vals, w->row_valid);
+	pthread_mutex_unlock(&bt->out_lock);
+
+	if (error) {
+		errno = error;
+		err(EX_IOERR, "column store");
+	}
+
+	return (0);
+}
+
+/**
+ * Append the NDJSON record for @p image to @p w's output; if @p error is
+ * non-zero, the image could not be read, and the error is recorded
+ * instead.
+ */
+static int
+batch_decode_one (struct batch *bt, struct batch_worker *w, const char *path,
+    const uint8_t *image, size_t size, int error)
+{
+	struct bhnd_sprom_ctx	 ctx;
+	struct bhnd_dcache_rec	 rec;
+	struct batch_buf	*out;
+	const char		*fmt, *p;
+	size_t			 len;
+	uint8_t			 rev;
+	bool			 first;
+
+	out = &w->out;
+	rev = 0;
+	if (error)
+		goto failed;
+
+	if (bt->colw != NULL)
+		return (batch_column_one(bt, w, path, image, size));
+
+	/* SPROM images are identified by their CRC and revision; anything
+	 * else is tried as a CIS tuple chain */
+	len = sizeof(w->env);
+	if (bt->dcache != NULL &&
+	    bhnd_dcache_decode(bt->dcache, image, size, &rec) == 0)
+	{
+		/* Cached; a cache that is full or unwritable falls back on
+		 * decoding the image */
+		fmt = "sprom";
+		rev = rec.dr_rev;
+		error = bhnd_dcache_rec_env(&rec, w->env, &len);
+	} else if (bhnd_sprom_ctx_init(&ctx, image, size) == 0) {
+		fmt = "sprom";
+		rev = ctx.sp_rev;
+		error = bhnd_sprom_decode(&ctx, w->env, &len);
+	} else {
+		fmt = "cis";
+		error = bhnd_cis_decode(image, size, w->env, &len);
+	}
+
+	if (error)
+		goto failed;
+
+	batch_puts(out, "{\"path\":");
+	batch_put_json(out, path, strlen(path));
+	batch_puts(out, ",\"format\":\"");
+	batch_puts(out, fmt);
+	batch_puts(out, "\"");
+
+	if (strcmp(fmt, "sprom") == 0) {
+		batch_puts(out, ",\"sromrev\":");
+		batch_put_udec(out, rev);
+	}
+
+	batch_puts(out, ",\"vars\":{");
+	first = true;
+	for (p = w->env; *p != '\0'; p += strlen(p) + 1) {
+		const char *eq = strchr(p, '=');
+		if (eq == NULL)
+			continue;
+
+		if (!first)
+			batch_puts(out, ",");
+		first = false;
+
+		batch_put_json(out, p, eq - p);
+		batch_puts(out, ":");
+		batch_put_json(out, eq + 1, strlen(eq + 1));
+	}
+	batch_puts(out, "}}\n");
+
+	return (0);
+
+failed:
+	atomic_fetch_add(&bt->failed, 1);
+
+	if (bt->colw != NULL) {
+		errno = error;
+		warn("%s", path);
+		return (error);
+	}
+
+	batch_puts(out, "{\"path\":");
+	batch_put_json(out, path, strlen(path));
+	batch_puts(out, ",\"error\":");
+	batch_put_json(out, strerror(error), strlen(strerror(error)));
+	batch_puts(out, "}\n");
+
+	return (error);
+}
+
+/** Worker; claims and decodes batches of images until none remain */
+static void
+batch_work (void *context, size_t n)
+{
+	struct batch		*bt = context;
+	struct batch_worker	*w;
+
+	(void)n;
+
+	if ((w = calloc(1, sizeof(*w))) == NULL)
+		err(EX_OSERR, "calloc");
+
+	if (bt->schema != NULL) {
+		w->row_vals = calloc(bt->schema->sc_ncols,
+		    sizeof(w->row_vals[0]));
+		w->row_valid = calloc(bt->schema->sc_ncols,
+		    sizeof(w->row_valid[0]));
+		if (w->row_vals == NULL || w->row_valid == NULL)
+			err(EX_OSERR, "calloc");
+	}
+
+	/* Decode loaded images in place */
+	while (bt->loader != NULL) {
+		struct bhnd_loader_img	imgs[BATCH_CHUNK];
+		size_t			count;
+		int			error;
+
+		error = bhnd_loader_next(bt->loader, imgs, BATCH_CHUNK, &count);
+		if (error == ENOENT)
+			break;
+		else if (error) {
+			errno = error;
+			err(EX_IOERR, "image loader");
+		}
+
+		for (size_t i = 0; i < count; i++) {
+			batch_decode_one(bt, w, bt->paths[imgs[i].li_index],
+			    imgs[i].li_data, imgs[i].li_size, imgs[i].li_error);
+		}
+
+		bhnd_loader_release(bt->loader, imgs, count);
+
+		if (w->out.len >= BATCH_FLUSH_SIZE)
+			batch_flush(bt, w);
+	}
+
+	/* Synthesize and decode images */
+	while (bt->loader == NULL) {
+		size_t first, last;
+
+		first = atomic_fetch_add(&bt->next, BATCH_CHUNK);
+		if (first >= bt->count)
+			break;
+
+		last = first + BATCH_CHUNK;
+		if (last > bt->count)
+			last = bt->count;
+
+		for (size_t i = first; i < last; i++) {
+			size_t size;
+
+			snprintf(w->path, sizeof(w->path), "synthetic/%zu", i);
+			size = batch_synthesize(i, w->image);
+			batch_decode_one(bt, w, w->path, w->image, size, 0);
+		}
+
+		if (w->out.len >= BATCH_FLUSH_SIZE)
+			batch_flush(bt, w);
+	}
+
+	batch_flush(bt, w);
+	free(w->out.data);
+	free(w->row_vals);
+	free(w->row_valid);
+	free(w);
+}
+
+/** Input path list */
+struct batch_paths {
+	char	**paths;
+	size_t	  count;
+	size_t	  cap;
+};
+
+static void
+batch_add_path (struct batch_paths *pl, char *path)
+{
+	if (pl->count == pl->cap) {
+		pl->cap = (pl->cap == 0) ? 1024 : pl->cap * 2;
+		pl->paths = realloc(pl->paths, pl->cap * sizeof(pl->paths[0]));
+		if (pl->paths == NULL)
+			err(EX_OSERR, "realloc");
+	}
+
+	pl->paths[pl->count++] = path;
+}
+
+/** Add all regular files in @p dir */
+static void
+batch_add_dir (struct batch_paths *pl, const char *dir)
+{
+	struct dirent	*de;
+	DIR		*d;
+
+	if ((d = opendir(dir)) == NULL)
+		err(EX_NOINPUT, "%s", dir);
+
+	while ((de = readdir(d)) != NULL) {
+		struct stat	 sb;
+		char		*path;
+		size_t		 path_size;
+
+		if (de->d_name[0] == '.')
+			continue;
+
+		path_size = strlen(dir) + strlen(de->d_name) + sizeof("/");
+		if ((path = malloc(path_size)) == NULL)
+			err(EX_OSERR, "malloc");
+
+		snprintf(path, path_size, "%s/%s", dir, de->d_name);
+
+		if (stat(path, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+			free(path);
+			continue;
+		}
+
+		batch_add_path(pl, path);
+	}
+
+	closedir(d);
+}
+
+/** Add all paths listed in the manifest @p manifest */
+static void
+batch_add_manifest (struct batch_paths *pl, const char *manifest)
+{
+	FILE	*fp;
+	char	*line;
+	size_t	 cap;
+	ssize_t	 len;
+
+	if ((fp = fopen(manifest, "r")) == NULL)
+		err(EX_NOINPUT, "%s", manifest);
+
+	line = NULL;
+	cap = 0;
+	while ((len = getline(&line, &cap, fp)) > 0) {
+		while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+			line[--len] = '\0';
+
+		if (len == 0 || line[0] == '#')
+			continue;
+
+		if ((line = strdup(line)) == NULL)
+			err(EX_OSERR, "strdup");
+
+		batch_add_path(pl, line);
+		line = NULL;
+		cap = 0;
+	}
+
+	free(line);
+	fclose(fp);
+}
+
+static void
+batch_usage (void)
+{
+	fprintf(stderr, "usage: nvram_batch [-cP] [-C cache] [-j jobs] "
+	    "[-o output] [-m manifest] [-s count] [path ...]\n");
+	exit(EX_USAGE);
+}
+
+#ifdef NVRAM_BATCH_MAIN
+int main (int argc, char * const argv[]) {
+#else
+int nvram_batch_main (int argc, char * const argv[]) {
+#endif
+	struct bhnd_colstore_schema	 schema;
+	struct bhnd_colstore_writer	 colw;
+	struct bhnd_dcache		 dcache;
+	struct bhnd_loader		 loader;
+	struct batch_paths		 pl;
+	struct batch			 bt;
+	struct timespec			 start, end;
+	const char			*output, *cache;
+	size_t				 jobs, synthetic;
+	double				 secs;
+	long				 ncpu;
+	bool				 columnar;
+	int				 ch, error, load_flags;
+
+	memset(&pl, 0, sizeof(pl));
+	output = NULL;
+	cache = NULL;
+	synthetic = 0;
+	columnar = false;
+	load_flags = 0;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	jobs = (ncpu > 0) ? (size_t)ncpu : 1;
+
+	while ((ch = getopt(argc, argv, "cC:j:o:m:Ps:")) != -1) {
+		switch (ch) {
+		case 'c':
+			columnar = true;
+			break;
+		case 'C':
+			cache = optarg;
+			break;
+		case 'j':
+			if ((jobs = strtoul(optarg, NULL, 10)) == 0)
+				batch_usage();
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'm':
+			batch_add_manifest(&pl, optarg);
+			break;
+		case 'P':
+			load_flags |= BHND_LOADER_NO_URING;
+			break;
+		case 's':
+			synthetic = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			batch_usage();
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	for (int i = 0; i < argc; i++) {
+		struct stat sb;
+
+		if (stat(argv[i], &sb) != 0)
+			err(EX_NOINPUT, "%s", argv[i]);
+
+		if (S_ISDIR(sb.st_mode)) {
+			batch_add_dir(&pl, argv[i]);
+		} else {
+			char *path = strdup(argv[i]);
+			if (path == NULL)
+				err(EX_OSERR, "strdup");
+			batch_add_path(&pl, path);
+		}
+	}
+
+	if (synthetic > 0 && pl.count > 0)
+		errx(EX_USAGE, "-s may not be combined with input paths");
+	else if (synthetic == 0 && pl.count == 0)
+		batch_usage();
+
+	if (columnar && output == NULL)
+		errx(EX_USAGE, "-c requires an output file");
+
+	memset(&bt, 0, sizeof(bt));
+	bt.paths = (synthetic > 0) ? NULL : pl.paths;
+	bt.count = (synthetic > 0) ? synthetic : pl.count;
+	atomic_init(&bt.next, 0);
+	atomic_init(&bt.failed, 0);
+	atomic_init(&bt.skipped, 0);
+	pthread_mutex_init(&bt.out_lock, NULL);
+
+	bt.out_fd = STDOUT_FILENO;
+	if (output != NULL) {
+		bt.out_fd = open(output, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		if (bt.out_fd < 0)
+			err(EX_CANTCREAT, "%s", output);
+	}
+
+	if (columnar) {
+		if ((error = bhnd_colstore_schema_init(&schema))) {
+			errno = error;
+			err(EX_OSERR, "column schema");
+		}
+
+		if ((error = bhnd_colstore_writer_init(&colw, &schema, bt.out_fd))) {
+			errno = error;
+			err(EX_IOERR, "%s", output);
+		}
+
+		bt.schema = &schema;
+		bt.colw = &colw;
+	}
+
+	if (cache != NULL) {
+		error = bhnd_dcache_open(&dcache, cache, BHND_DCACHE_WRITE,
+		    BATCH_DCACHE_ENTRIES, BATCH_DCACHE_SIZE);
+		if (error) {
+			errno = error;
+			err(EX_CANTCREAT, "%s", cache);
+		}
+
+		bt.dcache = &dcache;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (synthetic == 0) {
+		error = bhnd_loader_init(&loader, pl.paths, pl.count,
+		    BATCH_IMAGE_MAX, jobs * BATCH_LOAD_SLOTS, load_flags);
+		if (error) {
+			errno = error;
+			err(EX_OSERR, "image loader");
+		}
+
+		bt.loader = &loader;
+	}
+
+	dispatch_apply_f(jobs,
+	    dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+	    &bt, batch_work);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (bt.loader != NULL) {
+		fprintf(stderr, "images loaded with %s\n",
+		    bhnd_loader_backend_name(loader.ld_backend));
+		bhnd_loader_fini(&loader);
+	}
+
+	secs = (end.tv_sec - start.tv_sec) +
+	    (end.tv_nsec - start.tv_nsec) / 1e9;
+	fprintf(stderr, "%zu images (%zu failed) in %.3fs with %zu jobs: "
+	    "%.0f images/sec\n", bt.count, atomic_load(&bt.failed), secs, jobs,
+	    (secs > 0) ? bt.count / secs : 0.0);
+
+	if (columnar) {
+		if ((error = bhnd_colstore_writer_finish(&colw))) {
+			errno = error;
+			err(EX_IOERR, "%s", output);
+		}
+
+		bhnd_colstore_writer_fini(&colw);
+		bhnd_colstore_schema_fini(&schema);
+
+		if (atomic_load(&bt.skipped) > 0) {
+			fprintf(stderr, "%zu non-SPROM images omitted from "
+			    "column store\n", atomic_load(&bt.skipped));
+		}
+	}
+
+	if (cache != NULL)
+		bhnd_dcache_close(&dcache);
+
+	if (output != NULL)
+		close(bt.out_fd);
+
+	pthread_mutex_destroy(&bt.out_lock);
+	for (size_t i = 0; i < pl.count; i++)
+		free(pl.paths[i]);
+	free(pl.paths);
+
+	return (atomic_load(&bt.failed) > 0) ? EX_DATAERR : EX_OK;
+}
@@ -0,0 +1,966 @@
+//
+//  nvram_cis.c
+//  ccmach
+//
+//  Created by Landon Fuller on 2/1/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dispatch/dispatch.h>
+
+#include "nvram_cis.h"
+
+#ifdef NVRAM_MAIN
+#include "../cis_map.h"
+#else
+static const struct bhnd_cis_tuple bhnd_cis_tuples[] = {};
+#endif
+
+#define	nitems(x)	(sizeof((x)) / sizeof((x)[0]))
+
+/**
+ * Return the CIS tuple layout table, writing the number of entries to
+ * @p num_tuples. The table is sorted by (tag, hnbu_tag).
+ */
+const struct bhnd_cis_tuple *
+bhnd_cis_get_tuples (size_t *num_tuples)
+{
+	*num_tuples = nitems(bhnd_cis_tuples);
+	return (bhnd_cis_tuples);
+}
+
+/** Compare a tuple layout's (tag, hnbu_tag) key */
+static int
+bhnd_cis_tuple_cmp (const struct bhnd_cis_tuple *t, uint8_t tag, int hnbu_tag)
+{
+	if (t->tag != tag)
+		return ((t->tag < tag) ? -1 : 1);
+
+	if (t->hnbu_tag != hnbu_tag)
+		return ((t->hnbu_tag < hnbu_tag) ? -1 : 1);
+
+	return (0);
+}
+
+/**
+ * Find the layout for the tuple identified by @p tag and @p hnbu_tag.
+ *
+ * If multiple layouts are defined, the first layout compatible with
+ * @p sromrev is returned.
+ *
+ * @retval NULL if no layout for the tuple is compatible with @p sromrev.
+ */
+const struct bhnd_cis_tuple *
+bhnd_cis_find_tuple (uint8_t tag, int hnbu_tag, uint8_t sromrev)
+{
+	size_t lo, hi;
+
+	/* Find the first entry with a matching key */
+	lo = 0;
+	hi = nitems(bhnd_cis_tuples);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (bhnd_cis_tuple_cmp(&bhnd_cis_tuples[mid], tag, hnbu_tag) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == nitems(bhnd_cis_tuples) ||
+	    bhnd_cis_tuple_cmp(&bhnd_cis_tuples[lo], tag, hnbu_tag) != 0)
+		return (NULL);
+
+	for (size_t i = lo; i < nitems(bhnd_cis_tuples); i++) {
+		const struct bhnd_cis_tuple *t = &bhnd_cis_tuples[i];
+
+		if (bhnd_cis_tuple_cmp(t, tag, hnbu_tag) != 0)
+			break;
+
+		if (sromrev >= t->compat.first && sromrev <= t->compat.last)
+			return (t);
+	}
+
+	return (NULL);
+}
+
+void
+bhnd_cis_ctx_init (struct bhnd_cis_ctx *ctx, struct bhnd_nvram_obuf *out)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->cc_sromrev = 1;
+	ctx->cc_out = out;
+}
+
+/** Read a little-endian value of @p width bytes */
+static uint32_t
+bhnd_cis_read (const uint8_t *p, size_t width)
+{
+	switch (width) {
+	case 1:
+		return (p[0]);
+	case 2:
+		return (p[0] | (p[1] << 8));
+	default:
+		return (p[0] | (p[1] << 8) | (p[2] << 16) |
+		    ((uint32_t)p[3] << 24));
+	}
+}
+
+/** Apply a layout's shift to @p v */
+static uint32_t
+bhnd_cis_shift (uint32_t v, int shift)
+{
+	if (shift >= 0)
+		return (v >> shift);
+	else
+		return (v << -shift);
+}
+
+/** Write a "name=value\0" pair for a NUL-terminated string within @p len bytes */
+static int
+bhnd_cis_put_string (struct bhnd_cis_ctx *ctx, const char *name,
+    const uint8_t *p, size_t len)
+{
+	const uint8_t *nul;
+
+	if ((nul = memchr(p, '\0', len)) == NULL)
+		return (EINVAL);
+
+	bhnd_nvram_put_str(ctx->cc_out, name);
+	bhnd_nvram_put_char(ctx->cc_out, '=');
+	bhnd_nvram_put_bytes(ctx->cc_out, (const char *)p, nul - p);
+	bhnd_nvram_put_char(ctx->cc_out, '\0');
+
+	return (0);
+}
+
+/** Write @p len bytes as two hex @p digits each */
+static void
+bhnd_cis_put_hexbytes (struct bhnd_cis_ctx *ctx, const uint8_t *p,
+    size_t len, const char *digits)
+{
+	for (size_t i = 0; i < len; i++) {
+		bhnd_nvram_put_char(ctx->cc_out, digits[p[i] >> 4]);
+		bhnd_nvram_put_char(ctx->cc_out, digits[p[i] & 0xF]);
+	}
+}
+
+/**
+ * Decode a tuple that cannot be represented by a layout, following
+ * bcmsrom's srom_parsecis():
+ *
+ * - VERS_1: the "manf" and "productname" strings.
+ * - HNBU_MACADDR: deferred; see bhnd_cis_put_deferred(). Null and
+ *   multicast addresses are ignored.
+ * - HNBU_OEM: "oem", eight bytes as lower-case hex digits.
+ * - HNBU_UUID: "uuid", sixteen bytes as an upper-case UUID string.
+ *
+ * Short tuples are ignored, as are VERS_1 tuples with an unsupported
+ * version.
+ *
+ * @retval 0 success
+ * @retval EINVAL if the tuple is malformed.
+ * @retval EOPNOTSUPP if the tuple layout table marks a tuple as special
+ * that has no handler here.
+ */
+static int
+bhnd_cis_decode_special (struct bhnd_cis_ctx *ctx,
+    const struct bhnd_cis_tuple *t, const uint8_t *body, size_t len)
+{
+	static const uint8_t null_mac[6] = { 0 };
+	static const size_t uuid_groups[] = { 4, 2, 2, 2, 6 };
+	const uint8_t *p;
+	size_t n;
+	int error;
+
+	if (t->tag == BHND_CIS_TPL_VERS_1) {
+		/* Only trust the strings if the version field checks out */
+		if (len < 2 || (body[0] | (body[1] << 8)) < 0x0008)
+			return (0);
+
+		p = body + 2;
+		n = len - 2;
+		if ((error = bhnd_cis_put_string(ctx, "manf", p, n)))
+			return (error);
+
+		n -= strlen((const char *)p) + 1;
+		p += strlen((const char *)p) + 1;
+		return (bhnd_cis_put_string(ctx, "productname", p, n));
+	}
+
+	if (t->tag != BHND_CIS_TPL_BRCM_HNBU)
+		return (EOPNOTSUPP);
+
+	switch (t->hnbu_tag) {
+	case BHND_CIS_HNBU_MACADDR:
+		/* Ignore null and multicast addresses */
+		if (len < 6 || memcmp(body, null_mac, 6) == 0 || (body[0] & 0x1))
+			return (0);
+
+		memcpy(ctx->cc_mac, body, sizeof(ctx->cc_mac));
+		ctx->cc_have_mac = true;
+
+		/* Like bcmsrom, derive the boardnum from the first valid MAC
+		 * address; it is only used if no HNBU_BOARDNUM is found */
+		if (!ctx->cc_have_mac_boardnum) {
+			ctx->cc_mac_boardnum = (body[4] << 8) | body[5];
+			ctx->cc_have_mac_boardnum = true;
+		}
+		return (0);
+
+	case BHND_CIS_HNBU_OEM:
+		if (len < 8)
+			return (0);
+
+		bhnd_nvram_put_str(ctx->cc_out, "oem=");
+		bhnd_cis_put_hexbytes(ctx, body, 8, "0123456789abcdef");
+		bhnd_nvram_put_char(ctx->cc_out, '\0');
+		return (0);
+
+	case BHND_CIS_HNBU_UUID:
+		if (len < 16)
+			return (0);
+
+		/* 12345678-1234-5678-1234-567812345678 */
+		bhnd_nvram_put_str(ctx->cc_out, "uuid=");
+		p = body;
+		for (size_t g = 0; g < nitems(uuid_groups); g++) {
+			if (g > 0)
+				bhnd_nvram_put_char(ctx->cc_out, '-');
+
+			bhnd_cis_put_hexbytes(ctx, p, uuid_groups[g],
+			    "0123456789ABCDEF");
+			p += uuid_groups[g];
+		}
+		bhnd_nvram_put_char(ctx->cc_out, '\0');
+		return (0);
+
+	default:
+		return (EOPNOTSUPP);
+	}
+}
+
+/**
+ * Decode a single CIS tuple.
+ *
+ * Standard tuples are decoded generically from the tuple layout table;
+ * variables that extend beyond the end of a (short) tuple are omitted.
+ * Tuples without a layout are ignored.
+ *
+ * @param ctx decoding state.
+ * @param tag tuple code.
+ * @param body tuple body, including the HNBU subtag (if any).
+ * @param len length of @p body.
+ *
+ * @retval 0 success
+ * @retval EINVAL if the tuple is malformed.
+ * @retval EOPNOTSUPP if the tuple requires special-case decoding that is
+ * not implemented.
+ */
+int
+bhnd_cis_decode_tuple (struct bhnd_cis_ctx *ctx, uint8_t tag,
+    const uint8_t *body, size_t len)
+{
+	const struct bhnd_cis_tuple	*t;
+	int				 hnbu_tag;
+	int				 error;
+
+	hnbu_tag = BHND_CIS_HNBU_NONE;
+	if (tag == BHND_CIS_TPL_BRCM_HNBU) {
+		if (len < 1)
+			return (EINVAL);
+
+		hnbu_tag = body[0];
+		body++;
+		len--;
+
+		/* Layout selection depends on the SROM revision */
+		if (hnbu_tag == BHND_CIS_HNBU_SROMREV && len >= 1)
+			ctx->cc_sromrev = body[0];
+	}
+
+	if ((t = bhnd_cis_find_tuple(tag, hnbu_tag, ctx->cc_sromrev)) == NULL)
+		return (0);
+
+	if (t->flags & BHND_CIS_TF_SPECIAL)
+		return (bhnd_cis_decode_special(ctx, t, body, len));
+
+	/* An explicit boardnum overrides any derived from the MAC address */
+	if (hnbu_tag == BHND_CIS_HNBU_BOARDNUM && len >= 2)
+		ctx->cc_have_boardnum = true;
+
+	for (size_t i = 0; i < t->num_vars; i++) {
+		const struct bhnd_cis_var	*v = &t->vars[i];
+		uint32_t			 vals[UINT8_MAX];
+
+		if ((size_t)v->offset + ((size_t)v->width * v->count) > len)
+			continue;
+
+		for (size_t e = 0; e < v->count; e++) {
+			vals[e] = bhnd_cis_read(body + v->offset + (e * v->width),
+			    v->width) & v->mask;
+			vals[e] = bhnd_cis_shift(vals[e], v->shift);
+		}
+
+		bhnd_nvram_put_str(ctx->cc_out, v->name);
+		bhnd_nvram_put_char(ctx->cc_out, '=');
+
+		error = bhnd_nvram_fmt_value(ctx->cc_out, v->fmt, v->type, vals,
+		    v->count, bhnd_cis_shift(v->mask, v->shift));
+		if (error)
+			return (error);
+
+		bhnd_nvram_put_char(ctx->cc_out, '\0');
+	}
+
+	return (0);
+}
+
+/**
+ * Advance to the next tuple in the CIS tuple chain @p cis.
+ *
+ * @param cis CIS data.
+ * @param size size of @p cis.
+ * @param[in,out] i on input, the offset of the next tuple code; on return,
+ * the offset of the tuple body.
+ * @param[out] tag tuple code.
+ * @param[out] len length of the tuple body.
+ *
+ * @retval 0 success
+ * @retval ENOENT if the end of the tuple chain has been reached.
+ * @retval EINVAL if the tuple chain is malformed.
+ */
+int
+bhnd_cis_next (const uint8_t *cis, size_t size, size_t *i, uint8_t *tag,
+    uint8_t *len)
+{
+	while (*i < size) {
+		*tag = cis[(*i)++];
+		if (*tag == BHND_CIS_TPL_END)
+			return (ENOENT);
+		else if (*tag == BHND_CIS_TPL_NULL)
+			continue;
+
+		if (*i == size)
+			return (EINVAL);
+
+		*len = cis[(*i)++];
+		if (*len > size - *i)
+			return (EINVAL);
+
+		/* HNBU tuples must contain at least their subtag */
+		if (*tag == BHND_CIS_TPL_BRCM_HNBU && *len < 1)
+			return (EINVAL);
+
+		return (0);
+	}
+
+	return (ENOENT);
+}
+
+/**
+ * Write the boardnum derived from the first MAC address (if any, and if no
+ * HNBU_BOARDNUM tuple was decoded) as a "boardnum=...\0" pair, formatted
+ * as the HNBU_BOARDNUM tuple's variable would be.
+ */
+static void
+bhnd_cis_put_boardnum (struct bhnd_cis_ctx *ctx)
+{
+	const struct bhnd_cis_tuple	*t;
+	bhnd_nvram_fmt			 fmt;
+	uint32_t			 val;
+
+	if (ctx->cc_have_boardnum || !ctx->cc_have_mac_boardnum)
+		return;
+
+	fmt = BHND_NVRAM_VFMT_DEC;
+	t = bhnd_cis_find_tuple(BHND_CIS_TPL_BRCM_HNBU, BHND_CIS_HNBU_BOARDNUM,
+	    ctx->cc_sromrev);
+	if (t != NULL && t->num_vars == 1)
+		fmt = t->vars[0].fmt;
+
+	val = ctx->cc_mac_boardnum;
+	bhnd_nvram_put_str(ctx->cc_out, "boardnum=");
+	bhnd_nvram_fmt_value(ctx->cc_out, fmt, BHND_NVRAM_DT_UINT, &val, 1,
+	    0xFFFF);
+	bhnd_nvram_put_char(ctx->cc_out, '\0');
+}
+
+/** Write the decoded MAC address (if any) as a "macaddr=...\0" pair */
+static void
+bhnd_cis_put_macaddr (struct bhnd_cis_ctx *ctx)
+{
+	uint32_t mac[6];
+
+	if (!ctx->cc_have_mac)
+		return;
+
+	for (size_t n = 0; n < 6; n++)
+		mac[n] = ctx->cc_mac[n];
+
+	bhnd_nvram_put_str(ctx->cc_out, "macaddr=");
+	bhnd_nvram_fmt_value(ctx->cc_out, BHND_NVRAM_VFMT_MACADDR,
+	    BHND_NVRAM_DT_UINT, mac, 6, 0xFF);
+	bhnd_nvram_put_char(ctx->cc_out, '\0');
+}
+
+/**
+ * Write the variables deferred until the full chain has been seen: the
+ * derived boardnum (if any), followed by the MAC address, as bcmsrom
+ * orders them.
+ */
+static void
+bhnd_cis_put_deferred (struct bhnd_cis_ctx *ctx)
+{
+	bhnd_cis_put_boardnum(ctx);
+	bhnd_cis_put_macaddr(ctx);
+}
+
+/**
+ * Decode all tuples in the CIS tuple chain @p cis using @p ctx.
+ *
+ * Deferred variables (e.g. macaddr) and the environment terminator are
+ * not written.
+ */
+static int
+bhnd_cis_decode_chain (struct bhnd_cis_ctx *ctx, const uint8_t *cis,
+    size_t size)
+{
+	size_t	i;
+	uint8_t	tag, tlen;
+	int	error;
+
+	i = 0;
+	while ((error = bhnd_cis_next(cis, size, &i, &tag, &tlen)) == 0) {
+		if ((error = bhnd_cis_decode_tuple(ctx, tag, &cis[i], tlen)))
+			return (error);
+
+		i += tlen;
+	}
+
+	if (error != ENOENT)
+		return (error);
+
+	return (0);
+}
+
+/**
+ * Decode the CIS tuple chain @p cis, writing a packed
+ * "name=value\0...\0\0" environment to @p buf.
+ *
+ * @param cis CIS data.
+ * @param size size of @p cis.
+ * @param buf output buffer, or NULL to compute the required size.
+ * @param[in,out] len on input, the capacity of @p buf; on return, the
+ * number of bytes written (or required, if @p buf is NULL or too small).
+ *
+ * @retval 0 success
+ * @retval ENOMEM if @p buf is non-NULL and too small.
+ * @retval EINVAL if the tuple chain is malformed.
+ * @retval EOPNOTSUPP if a tuple requires special-case decoding that is
+ * not implemented.
+ */
+int
+bhnd_cis_decode (const uint8_t *cis, size_t size, char *buf, size_t *len)
+{
+	struct bhnd_nvram_obuf	out;
+	struct bhnd_cis_ctx	ctx;
+	int			error;
+
+	bhnd_nvram_obuf_init(&out, buf, *len);
+	bhnd_cis_ctx_init(&ctx, &out);
+
+	if ((error = bhnd_cis_decode_chain(&ctx, cis, size)))
+		return (error);
+
+	/* The MAC address and derived boardnum are emitted once the full
+	 * chain has been seen */
+	bhnd_cis_put_deferred(&ctx);
+
+	/* Terminate the environment */
+	bhnd_nvram_put_char(&out, '\0');
+
+	*len = out.ob_len;
+	if (buf != NULL && !bhnd_nvram_obuf_fits(&out))
+		return (ENOMEM);
+
+	return (0);
+}
+
+/** Per-block state for bhnd_cis_decode_multi() */
+struct bhnd_cis_block {
+	const uint8_t	*cis;		/**< CIS data */
+	size_t		 size;		/**< CIS data size */
+	uint8_t		 sromrev;	/**< SROM revision in effect at the
+					     start of the block */
+	char		*env;		/**< decoded variables */
+	size_t		 len;		/**< length of env */
+	bool		 have_mac;	/**< block defines a MAC address */
+	uint8_t		 mac[6];	/**< block's MAC address */
+	bool		 have_boardnum;	/**< block defines HNBU_BOARDNUM */
+	bool		 have_mac_boardnum; /**< mac_boardnum is valid */
+	uint16_t	 mac_boardnum;	/**< boardnum derived from the block's
+					     first MAC address */
+	int		 error;		/**< decoding error, if any */
+};
+
+/**
+ * Find the SROM revision in effect at the end of the CIS tuple chain @p cis,
+ * given the revision @p sromrev in effect at its start.
+ */
+static int
+bhnd_cis_scan_sromrev (const uint8_t *cis, size_t size, uint8_t *sromrev)
+{
+	size_t	i;
+	uint8_t	tag, tlen;
+	int	error;
+
+	i = 0;
+	while ((error = bhnd_cis_next(cis, size, &i, &tag, &tlen)) == 0) {
+		if (tag == BHND_CIS_TPL_BRCM_HNBU &&
+		    cis[i] == BHND_CIS_HNBU_SROMREV && tlen >= 2)
+			*sromrev = cis[i + 1];
+
+		i += tlen;
+	}
+
+	if (error != ENOENT)
+		return (error);
+
+	return (0);
+}
+
+/** Decode a single block into a private buffer */
+static void
+bhnd_cis_decode_block (void *context, size_t n)
+{
+	struct bhnd_cis_block	*b;
+	struct bhnd_nvram_obuf	 out;
+	struct bhnd_cis_ctx	 ctx;
+	size_t			 size;
+
+	b = &((struct bhnd_cis_block *)context)[n];
+
+	/* Size the block's variables */
+	bhnd_nvram_obuf_init(&out, NULL, 0);
+	bhnd_cis_ctx_init(&ctx, &out);
+	ctx.cc_sromrev = b->sromrev;
+	if ((b->error = bhnd_cis_decode_chain(&ctx, b->cis, b->size)))
+		return;
+
+	b->have_mac = ctx.cc_have_mac;
+	memcpy(b->mac, ctx.cc_mac, sizeof(b->mac));
+	b->have_boardnum = ctx.cc_have_boardnum;
+	b->have_mac_boardnum = ctx.cc_have_mac_boardnum;
+	b->mac_boardnum = ctx.cc_mac_boardnum;
+
+	size = out.ob_len;
+	if (size == 0)
+		return;
+
+	if ((b->env = malloc(size)) == NULL) {
+		b->error = ENOMEM;
+		return;
+	}
+
+	/* Format the block's variables */
+	bhnd_nvram_obuf_init(&out, b->env, size);
+	bhnd_cis_ctx_init(&ctx, &out);
+	ctx.cc_sromrev = b->sromrev;
+	if ((b->error = bhnd_cis_decode_chain(&ctx, b->cis, b->size)))
+		return;
+
+	/* The formatting pass must agree with the sizing pass */
+	if (out.ob_len != size) {
+		b->error = EINVAL;
+		return;
+	}
+
+	b->len = size;
+}
+
+/**
+ * Decode @p count CIS tuple chains, allocating and returning a packed
+ * "name=value\0...\0\0" environment in @p env.
+ *
+ * The result is identical to decoding the chains one after another with a
+ * single decoding context: variables are written in block order, the SROM
+ * revision declared by an earlier block applies to later blocks, the
+ * last MAC address found is used, and any derived boardnum comes from the
+ * first. Each block is decoded concurrently into
+ * a private buffer, and the buffers are then merged in block order.
+ *
+ * @param cis CIS data for each block.
+ * @param sizes size of each block.
+ * @param count number of blocks.
+ * @param[out] env on success, the decoded environment; the caller is
+ * responsible for deallocating it with free().
+ * @param[out] len on success, the length of @p env.
+ *
+ * @retval 0 success
+ * @retval ENOMEM if allocation fails.
+ * @retval EINVAL if a tuple chain is malformed.
+ * @retval EOPNOTSUPP if a tuple requires special-case decoding that is
+ * not implemented.
+ */
+int
+bhnd_cis_decode_multi (const uint8_t *const cis[], const size_t sizes[],
+    size_t count, char **env, size_t *len)
+{
+	struct bhnd_cis_block	*blocks;
+	struct bhnd_nvram_obuf	 out;
+	struct bhnd_cis_ctx	 ctx;
+	uint8_t			 sromrev;
+	size_t			 size;
+	char			*buf;
+	int			 error;
+
+	/* No blocks; calloc(0) may legitimately return NULL */
+	if (count == 0) {
+		if ((buf = malloc(1)) == NULL)
+			return (ENOMEM);
+
+		buf[0] = '\0';
+		*env = buf;
+		*len = 1;
+		return (0);
+	}
+
+	if ((blocks = calloc(count, sizeof(blocks[0]))) == NULL)
+		return (ENOMEM);
+
+	/* Only the SROM revision is carried between blocks; find the revision
+	 * in effect at the start of each block with a fast scan */
+	sromrev = 1;
+	for (size_t i = 0; i < count; i++) {
+		blocks[i].cis = cis[i];
+		blocks[i].size = sizes[i];
+		blocks[i].sromrev = sromrev;
+
+		if ((error = bhnd_cis_scan_sromrev(cis[i], sizes[i], &sromrev)))
+			goto cleanup;
+	}
+
+	if (count > 1) {
+		dispatch_apply_f(count,
+		    dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+		    blocks, bhnd_cis_decode_block);
+	} else {
+		for (size_t i = 0; i < count; i++)
+			bhnd_cis_decode_block(blocks, i);
+	}
+
+	/* Merge in block order */
+	bhnd_nvram_obuf_init(&out, NULL, 0);
+	bhnd_cis_ctx_init(&ctx, &out);
+	for (size_t i = 0; i < count; i++) {
+		if ((error = blocks[i].error))
+			goto cleanup;
+
+		out.ob_len += blocks[i].len;
+		if (blocks[i].have_mac) {
+			ctx.cc_have_mac = true;
+			memcpy(ctx.cc_mac, blocks[i].mac, sizeof(ctx.cc_mac));
+		}
+
+		ctx.cc_have_boardnum |= blocks[i].have_boardnum;
+		if (blocks[i].have_mac_boardnum && !ctx.cc_have_mac_boardnum) {
+			ctx.cc_have_mac_boardnum = true;
+			ctx.cc_mac_boardnum = blocks[i].mac_boardnum;
+		}
+	}
+
+	/* The derived boardnum's format depends on the final SROM revision */
+	ctx.cc_sromrev = sromrev;
+	bhnd_cis_put_deferred(&ctx);
+	bhnd_nvram_put_char(&out, '\0');
+	size = out.ob_len;
+
+	if ((buf = malloc(size)) == NULL) {
+		error = ENOMEM;
+		goto cleanup;
+	}
+
+	bhnd_nvram_obuf_init(&out, buf, size);
+	for (size_t i = 0; i < count; i++)
+		bhnd_nvram_put_bytes(&out, blocks[i].env, blocks[i].len);
+
+	bhnd_cis_put_deferred(&ctx);
+	bhnd_nvram_put_char(&out, '\0');
+
+	*env = buf;
+	*len = size;
+	error = 0;
+
+cleanup:
+	for (size_t i = 0; i < count; i++)
+		free(blocks[i].env);
+	free(blocks);
+
+	return (error);
+}
+
+/**
+ * Initialize an incremental CIS parser, writing the packed
+ * "name=value\0...\0\0" environment to @p out.
+ *
+ * Variables are appended to @p out as each tuple is decoded; the caller
+ * may drain and reset @p out between calls to bhnd_cis_stream_push().
+ */
+void
+bhnd_cis_stream_init (struct bhnd_cis_stream *cs, struct bhnd_nvram_obuf *out)
+{
+	cs->cs_state = BHND_CIS_STREAM_TAG;
+	cs->cs_have = 0;
+	bhnd_cis_ctx_init(&cs->cs_ctx, out);
+}
+
+/** Decode a complete tuple body */
+static int
+bhnd_cis_stream_tuple (struct bhnd_cis_stream *cs, const uint8_t *body)
+{
+	/* HNBU tuples must contain at least their subtag */
+	if (cs->cs_tag == BHND_CIS_TPL_BRCM_HNBU && cs->cs_len < 1)
+		return (EINVAL);
+
+	cs->cs_state = BHND_CIS_STREAM_TAG;
+	cs->cs_have = 0;
+	return (bhnd_cis_decode_tuple(&cs->cs_ctx, cs->cs_tag, body, cs->cs_len));
+}
+
+/**
+ * Push the next @p len bytes of CIS data to @p cs.
+ *
+ * Data following the end of the tuple chain is ignored; the caller may
+ * use bhnd_cis_stream_done() to stop reading once the end is reached.
+ *
+ * @retval 0 success
+ * @retval EINVAL if the tuple chain is malformed.
+ */
+int
+bhnd_cis_stream_push (struct bhnd_cis_stream *cs, const void *data,
+    size_t len)
+{
+	const uint8_t	*p, *end;
+	size_t		 n;
+	int		 error;
+
+	p = data;
+	end = p + len;
+
+	while (p < end) {
+		switch (cs->cs_state) {
+		case BHND_CIS_STREAM_TAG:
+			cs->cs_tag = *p++;
+			if (cs->cs_tag == BHND_CIS_TPL_END)
+				cs->cs_state = BHND_CIS_STREAM_END;
+			else if (cs->cs_tag != BHND_CIS_TPL_NULL)
+				cs->cs_state = BHND_CIS_STREAM_LEN;
+			break;
+
+		case BHND_CIS_STREAM_LEN:
+			cs->cs_len = *p++;
+			cs->cs_state = BHND_CIS_STREAM_BODY;
+
+			/* Decode directly from the caller's data if the
+			 * body is not split across chunks */
+			if (cs->cs_len <= (size_t)(end - p)) {
+				if ((error = bhnd_cis_stream_tuple(cs, p)))
+					return (error);
+				p += cs->cs_len;
+			}
+			break;
+
+		case BHND_CIS_STREAM_BODY:
+			n = cs->cs_len - cs->cs_have;
+			if (n > (size_t)(end - p))
+				n = end - p;
+
+			memcpy(&cs->cs_body[cs->cs_have], p, n);
+			cs->cs_have += n;
+			p += n;
+
+			if (cs->cs_have == cs->cs_len) {
+				if ((error = bhnd_cis_stream_tuple(cs, cs->cs_body)))
+					return (error);
+			}
+			break;
+
+		case BHND_CIS_STREAM_END:
+			return (0);
+		}
+	}
+
+	return (0);
+}
+
+/**
+ * Complete parsing, writing any deferred variables and terminating the
+ * environment.
+ *
+ * @retval 0 success
+ * @retval EINVAL if the data ended within a tuple.
+ */
+int
+bhnd_cis_stream_finish (struct bhnd_cis_stream *cs)
+{
+	switch (cs->cs_state) {
+	case BHND_CIS_STREAM_TAG:
+	case BHND_CIS_STREAM_END:
+		break;
+	default:
+		return (EINVAL);
+	}
+
+	/* The MAC address and derived boardnum are emitted once the full
+	 * chain has been seen */
+	bhnd_cis_put_deferred(&cs->cs_ctx);
+	bhnd_nvram_put_char(cs->cs_ctx.cc_out, '\0');
+
+	return (0);
+}
+
+/**
+ * Index the CIS tuple chain @p cis in a single pass.
+ *
+ * The full chain is validated; if a tuple occurs more than once, the first
+ * occurrence is indexed.
+ *
+ * @param idx the index to initialize.
+ * @param cis CIS data.
+ * @param size size of @p cis.
+ *
+ * @retval 0 success
+ * @retval EINVAL if the tuple chain is malformed.
+ */
+int
+bhnd_cis_index_init (struct bhnd_cis_index *idx, const uint8_t *cis,
+    size_t size)
+{
+	size_t	i;
+	uint8_t	tag, tlen;
+	int	error;
+
+	memset(idx, 0, sizeof(*idx));
+	idx->ci_cis = cis;
+	idx->ci_size = size;
+	idx->ci_sromrev = 1;
+
+	/* Offsets are stored as uint32_t */
+	if (size >= UINT32_MAX)
+		return (EINVAL);
+
+	i = 0;
+	while ((error = bhnd_cis_next(cis, size, &i, &tag, &tlen)) == 0) {
+		uint32_t *slot;
+
+		if (tag == BHND_CIS_TPL_BRCM_HNBU)
+			slot = &idx->ci_hnbu[cis[i]];
+		else
+			slot = &idx->ci_tuples[tag];
+
+		if (*slot == 0) {
+			*slot = (uint32_t)i + 1;
+
+			if (tag == BHND_CIS_TPL_BRCM_HNBU &&
+			    cis[i] == BHND_CIS_HNBU_SROMREV && tlen >= 2)
+				idx->ci_sromrev = cis[i + 1];
+		}
+
+		i += tlen;
+	}
+
+	if (error != ENOENT)
+		return (error);
+
+	return (0);
+}
+
+/**
+ * Find the first tuple identified by @p tag and @p hnbu_tag.
+ *
+ * @param idx the CIS index.
+ * @param tag tuple code.
+ * @param hnbu_tag HNBU subtag, or BHND_CIS_HNBU_NONE.
+ * @param[out] body tuple body, including the HNBU subtag (if any).
+ * @param[out] len length of @p body.
+ *
+ * @retval 0 success
+ * @retval ENOENT if the tuple is not present.
+ */
+int
+bhnd_cis_index_get (const struct bhnd_cis_index *idx, uint8_t tag,
+    int hnbu_tag, const uint8_t **body, size_t *len)
+{
+	uint32_t off;
+
+	if (tag == BHND_CIS_TPL_BRCM_HNBU) {
+		if (hnbu_tag < 0 || hnbu_tag > UINT8_MAX)
+			return (ENOENT);
+		off = idx->ci_hnbu[hnbu_tag];
+	} else {
+		if (hnbu_tag != BHND_CIS_HNBU_NONE)
+			return (ENOENT);
+		off = idx->ci_tuples[tag];
+	}
+
+	if (off == 0)
+		return (ENOENT);
+
+	*body = &idx->ci_cis[off - 1];
+	*len = idx->ci_cis[off - 2];
+	return (0);
+}
+
+/**
+ * Decode the single tuple identified by @p tag and @p hnbu_tag, writing a
+ * packed "name=value\0...\0\0" environment to @p buf.
+ *
+ * The tuple layout is selected using the SROM revision recorded by the
+ * index.
+ *
+ * @param idx the CIS index.
+ * @param tag tuple code.
+ * @param hnbu_tag HNBU subtag, or BHND_CIS_HNBU_NONE.
+ * @param buf output buffer, or NULL to compute the required size.
+ * @param[in,out] len on input, the capacity of @p buf; on return, the
+ * number of bytes written (or required, if @p buf is NULL or too small).
+ *
+ * @retval 0 success
+ * @retval ENOENT if the tuple is not present.
+ * @retval ENOMEM if @p buf is non-NULL and too small.
+ * @retval EINVAL if the tuple is malformed.
+ */
+int
+bhnd_cis_index_decode (const struct bhnd_cis_index *idx, uint8_t tag,
+    int hnbu_tag, char *buf, size_t *len)
+{
+	struct bhnd_nvram_obuf	 out;
+	struct bhnd_cis_ctx	 ctx;
+	const uint8_t		*body;
+	size_t			 tlen;
+	int			 error;
+
+	if ((error = bhnd_cis_index_get(idx, tag, hnbu_tag, &body, &tlen)))
+		return (error);
+
+	bhnd_nvram_obuf_init(&out, buf, *len);
+	bhnd_cis_ctx_init(&ctx, &out);
+	ctx.cc_sromrev = idx->ci_sromrev;
+
+	if ((error = bhnd_cis_decode_tuple(&ctx, tag, body, tlen)))
+		return (error);
+
+	bhnd_cis_put_macaddr(&ctx);
+	bhnd_nvram_put_char(&out, '\0');
+
+	*len = out.ob_len;
+	if (buf != NULL && !bhnd_nvram_obuf_fits(&out))
+		return (ENOMEM);
+
+	return (0);
+}
@@ -0,0 +1,159 @@
+//
+//  nvram_cis.h
+//  ccmach
+//
+//  Created by Landon Fuller on 2/1/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef _NVRAM_CIS_H_
+#define _NVRAM_CIS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nvram_fmt.h"
+#include "nvram_map.h"
+
+/* CIS tuple codes */
+#define	BHND_CIS_TPL_NULL	0x00	/**< null tuple (no length byte) */
+#define	BHND_CIS_TPL_VERS_1	0x15	/**< version, manufacturer and product strings */
+#define	BHND_CIS_TPL_MANFID	0x20	/**< manufacturer and device id */
+#define	BHND_CIS_TPL_BRCM_HNBU	0x80	/**< Broadcom HNBU tuple */
+#define	BHND_CIS_TPL_END	0xFF	/**< end of the tuple chain */
+
+/* HNBU subtags requiring special handling */
+#define	BHND_CIS_HNBU_SROMREV	0x00	/**< SROM revision */
+#define	BHND_CIS_HNBU_OEM	0x04	/**< OEM data */
+#define	BHND_CIS_HNBU_BOARDNUM	0x18	/**< board serial number */
+#define	BHND_CIS_HNBU_MACADDR	0x19	/**< MAC address override */
+#define	BHND_CIS_HNBU_UUID	0x3B	/**< board UUID */
+
+#define	BHND_CIS_HNBU_NONE	-1	/**< tuple has no HNBU subtag */
+
+/** CIS tuple flags */
+enum {
+	BHND_CIS_TF_SPECIAL	= (1<<0),	/**< tuple cannot be decoded from its
+						     layout, and requires custom code */
+};
+
+/** CIS tuple variable layout */
+struct bhnd_cis_var {
+	const char	*name;		/**< variable name */
+	bhnd_nvram_dt	 type;		/**< base data type */
+	bhnd_nvram_fmt	 fmt;		/**< string format */
+	uint8_t		 offset;	/**< byte offset within the tuple body
+					     (following the HNBU subtag, if any) */
+	uint8_t		 width;		/**< element width: 1, 2, or 4 bytes */
+	uint8_t		 count;		/**< number of consecutive elements */
+	uint32_t	 mask;		/**< mask to be applied to each element */
+	int		 shift;		/**< right shift to be applied to each element
+					     (negative values shift left) */
+};
+
+/** CIS tuple layout */
+struct bhnd_cis_tuple {
+	uint8_t				 tag;		/**< tuple code */
+	int				 hnbu_tag;	/**< HNBU subtag, or BHND_CIS_HNBU_NONE */
+	struct bhnd_sprom_compat	 compat;	/**< sprom compatibility declaration */
+	uint32_t			 flags;		/**< BHND_CIS_TF_* flags */
+	const struct bhnd_cis_var	*vars;		/**< variable layouts */
+	size_t				 num_vars;	/**< number of variable layouts */
+};
+
+/** CIS decoding state */
+struct bhnd_cis_ctx {
+	uint8_t			 cc_sromrev;	/**< SROM revision (1 until an
+						     HNBU_SROMREV tuple is seen) */
+	bool			 cc_have_mac;	/**< MAC address has been decoded */
+	uint8_t			 cc_mac[6];	/**< decoded MAC address */
+	bool			 cc_have_boardnum; /**< HNBU_BOARDNUM has been
+						     decoded */
+	bool			 cc_have_mac_boardnum; /**< cc_mac_boardnum is
+							  valid */
+	uint16_t		 cc_mac_boardnum; /**< boardnum derived from the
+						     first MAC address seen */
+	struct bhnd_nvram_obuf	*cc_out;	/**< output buffer */
+};
+
+/**
+ * Index over a CIS tuple chain, mapping each (tag, HNBU subtag) to the
+ * offset of its first occurrence.
+ *
+ * The index references the CIS data in place; the data must not be
+ * modified or deallocated while the index is in use. Lookups do not
+ * modify the index, and may be performed concurrently.
+ */
+struct bhnd_cis_index {
+	const uint8_t	*ci_cis;		/**< indexed CIS data */
+	size_t		 ci_size;		/**< CIS data size */
+	uint8_t		 ci_sromrev;		/**< SROM revision (1 if no
+						     HNBU_SROMREV tuple was found) */
+	uint32_t	 ci_tuples[256];	/**< tuple body offset + 1, by tag
+						     (0 if not present) */
+	uint32_t	 ci_hnbu[256];		/**< HNBU tuple body offset + 1, by
+						     subtag (0 if not present) */
+};
+
+/** CIS stream parser states */
+typedef enum {
+	BHND_CIS_STREAM_TAG,	/**< awaiting a tuple code */
+	BHND_CIS_STREAM_LEN,	/**< awaiting a tuple length */
+	BHND_CIS_STREAM_BODY,	/**< accumulating a tuple body */
+	BHND_CIS_STREAM_END,	/**< end of the tuple chain was reached */
+} bhnd_cis_stream_state;
+
+/**
+ * Incremental CIS parser.
+ *
+ * Data is pushed in arbitrarily sized chunks; each tuple is decoded as soon
+ * as it is complete. Only a tuple split across chunk boundaries is copied,
+ * bounding the parser's memory use to a single maximum-length tuple body.
+ */
+struct bhnd_cis_stream {
+	struct bhnd_cis_ctx	cs_ctx;			/**< decoding state */
+	bhnd_cis_stream_state	cs_state;		/**< parser state */
+	uint8_t			cs_tag;			/**< current tuple code */
+	uint8_t			cs_len;			/**< current tuple length */
+	uint8_t			cs_have;		/**< bytes of cs_body read */
+	uint8_t			cs_body[UINT8_MAX];	/**< partial tuple body */
+};
+
+/** Return true if the end of the tuple chain has been reached */
+static inline bool
+bhnd_cis_stream_done (const struct bhnd_cis_stream *cs)
+{
+	return (cs->cs_state == BHND_CIS_STREAM_END);
+}
+
+const struct bhnd_cis_tuple	*bhnd_cis_get_tuples(size_t *num_tuples);
+const struct bhnd_cis_tuple	*bhnd_cis_find_tuple(uint8_t tag, int hnbu_tag,
+				     uint8_t sromrev);
+
+int	bhnd_cis_next(const uint8_t *cis, size_t size, size_t *i,
+	    uint8_t *tag, uint8_t *len);
+
+void	bhnd_cis_ctx_init(struct bhnd_cis_ctx *ctx,
+	    struct bhnd_nvram_obuf *out);
+int	bhnd_cis_decode_tuple(struct bhnd_cis_ctx *ctx, uint8_t tag,
+	    const uint8_t *body, size_t len);
+int	bhnd_cis_decode(const uint8_t *cis, size_t size, char *buf,
+	    size_t *len);
+
+int	bhnd_cis_decode_multi(const uint8_t *const cis[],
+	    const size_t sizes[], size_t count, char **env, size_t *len);
+
+void	bhnd_cis_stream_init(struct bhnd_cis_stream *cs,
+	    struct bhnd_nvram_obuf *out);
+int	bhnd_cis_stream_push(struct bhnd_cis_stream *cs, const void *data,
+	    size_t len);
+int	bhnd_cis_stream_finish(struct bhnd_cis_stream *cs);
+
+int	bhnd_cis_index_init(struct bhnd_cis_index *idx, const uint8_t *cis,
+	    size_t size);
+int	bhnd_cis_index_get(const struct bhnd_cis_index *idx, uint8_t tag,
+	    int hnbu_tag, const uint8_t **body, size_t *len);
+int	bhnd_cis_index_decode(const struct bhnd_cis_index *idx, uint8_t tag,
+	    int hnbu_tag, char *buf, size_t *len);
+
+#endif /* _NVRAM_CIS_H_ */
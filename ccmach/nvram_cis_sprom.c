@@ -0,0 +1,322 @@
+//
+//  nvram_cis_sprom.c
+//  ccmach
+//
+//  Created by Landon Fuller on 2/4/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nvram_cis_sprom.h"
+
+/**
+ * Initialize a transcoder from the generated CIS tuple table to the SPROM
+ * revision targeted by @p enc.
+ *
+ * CIS variables are resolved against @p enc once; @p enc must remain valid
+ * for the lifetime of @p xc.
+ *
+ * @retval 0 success
+ * @retval ENOMEM if allocation fails.
+ */
+int
+bhnd_cis_xcode_init (struct bhnd_cis_xcode *xc,
+    const struct bhnd_sprom_encoder *enc)
+{
+	size_t ntargets;
+
+	memset(xc, 0, sizeof(*xc));
+	xc->xc_enc = enc;
+	xc->xc_tuples = bhnd_cis_get_tuples(&xc->xc_ntuples);
+	xc->xc_macaddr = bhnd_sprom_encoder_find(enc, "macaddr",
+	    strlen("macaddr"));
+	xc->xc_boardnum = bhnd_sprom_encoder_find(enc, "boardnum",
+	    strlen("boardnum"));
+
+	xc->xc_first = calloc(xc->xc_ntuples + 1, sizeof(xc->xc_first[0]));
+	if (xc->xc_first == NULL)
+		return (ENOMEM);
+
+	ntargets = 0;
+	for (size_t i = 0; i < xc->xc_ntuples; i++) {
+		xc->xc_first[i] = ntargets;
+		ntargets += xc->xc_tuples[i].num_vars;
+	}
+	xc->xc_first[xc->xc_ntuples] = ntargets;
+
+	xc->xc_targets = calloc(ntargets + 1, sizeof(xc->xc_targets[0]));
+	if (xc->xc_targets == NULL) {
+		bhnd_cis_xcode_fini(xc);
+		return (ENOMEM);
+	}
+
+	for (size_t i = 0; i < xc->xc_ntuples; i++) {
+		const struct bhnd_cis_tuple *t = &xc->xc_tuples[i];
+
+		for (size_t v = 0; v < t->num_vars; v++) {
+			const char *name = t->vars[v].name;
+			xc->xc_targets[xc->xc_first[i] + v] =
+			    bhnd_sprom_encoder_find(enc, name, strlen(name));
+		}
+	}
+
+	return (0);
+}
+
+/** Release all resources held by @p xc */
+void
+bhnd_cis_xcode_fini (struct bhnd_cis_xcode *xc)
+{
+	free(xc->xc_first);
+	free(xc->xc_targets);
+
+	xc->xc_first = NULL;
+	xc->xc_targets = NULL;
+}
+
+/** Read a little-endian value of @p width bytes */
+static uint32_t
+bhnd_cis_xcode_read (const uint8_t *p, size_t width)
+{
+	switch (width) {
+	case 1:
+		return (p[0]);
+	case 2:
+		return (p[0] | (p[1] << 8));
+	default:
+		return (p[0] | (p[1] << 8) | (p[2] << 16) |
+		    ((uint32_t)p[3] << 24));
+	}
+}
+
+/** Apply a layout's shift to @p v */
+static uint32_t
+bhnd_cis_xcode_shift (uint32_t v, int shift)
+{
+	if (shift >= 0)
+		return (v >> shift);
+	else
+		return (v << -shift);
+}
+
+/** Sign-extend @p v from the most significant bit set in @p vmask */
+static uint32_t
+bhnd_cis_xcode_sext (uint32_t v, uint32_t vmask)
+{
+	uint32_t sign;
+
+	if (vmask == 0)
+		return (v);
+
+	for (sign = 1U << 31; (sign & vmask) == 0; sign >>= 1)
+		continue;
+
+	if (v & sign)
+		v |= ~(sign | (sign - 1));
+
+	return (v);
+}
+
+/**
+ * Write the variables of a single standard tuple to @p image.
+ *
+ * @retval 0 success
+ * @retval ERANGE if a value cannot be represented in the SPROM encoding.
+ */
+static int
+bhnd_cis_xcode_tuple (const struct bhnd_cis_xcode *xc,
+    const struct bhnd_cis_tuple *t, const uint8_t *body, size_t len,
+    uint8_t *image, size_t *nskipped)
+{
+	const struct bhnd_sprom_enc_var **targets;
+
+	targets = &xc->xc_targets[xc->xc_first[t - xc->xc_tuples]];
+	for (size_t i = 0; i < t->num_vars; i++) {
+		const struct bhnd_cis_var	*v = &t->vars[i];
+		const struct bhnd_sprom_enc_var	*ev = targets[i];
+		uint32_t			 vals[BHND_SPROM_ARRAY_MAX];
+		uint32_t			 vmask;
+
+		/* Variables omitted from a short tuple are left unset */
+		if ((size_t)v->offset + ((size_t)v->width * v->count) > len)
+			continue;
+
+		/* Variables without an equivalent SPROM encoding */
+		if (ev == NULL || ev->nvals != v->count) {
+			(*nskipped)++;
+			continue;
+		}
+
+		vmask = bhnd_cis_xcode_shift(v->mask, v->shift);
+		for (size_t e = 0; e < v->count; e++) {
+			uint32_t val;
+
+			val = bhnd_cis_xcode_read(body + v->offset +
+			    (e * v->width), v->width) & v->mask;
+			val = bhnd_cis_xcode_shift(val, v->shift);
+
+			if (ev->nv->type == BHND_NVRAM_DT_SINT)
+				val = bhnd_cis_xcode_sext(val, vmask);
+
+			if (!bhnd_sprom_value_fits(ev->nv->type, val,
+			    ev->vmask))
+				return (ERANGE);
+
+			vals[e] = val;
+		}
+
+		bhnd_sprom_write_var(image, ev->sv, vals);
+	}
+
+	return (0);
+}
+
+/**
+ * Transcode the CIS tuple chain @p cis to a SPROM image.
+ *
+ * The result is equivalent to decoding @p cis with bhnd_cis_decode() and
+ * encoding the resulting environment, other than for variables that have
+ * no SPROM encoding in the target revision; these are skipped. CIS string
+ * tuples have no SPROM encoding, and are ignored.
+ *
+ * The image is built on the target encoder's base image, and so carries
+ * the target revision's revision and signature words; no SPROM variable
+ * overlaps either.
+ *
+ * @param xc an initialized transcoder.
+ * @param cis CIS data.
+ * @param size size of @p cis.
+ * @param[out] image output buffer, of at least the target encoder's
+ * se_size bytes. On success, a SPROM image of the target revision that
+ * bhnd_sprom_identify() accepts.
+ * @param[out] nskipped if non-NULL, the number of CIS variables that could
+ * not be represented in the target SPROM revision.
+ *
+ * @retval 0 success
+ * @retval EINVAL if the tuple chain is malformed.
+ * @retval ERANGE if a value cannot be represented in the SPROM encoding.
+ */
+int
+bhnd_cis_transcode (const struct bhnd_cis_xcode *xc, const uint8_t *cis,
+    size_t size, uint8_t *image, size_t *nskipped)
+{
+	const struct bhnd_sprom_encoder	*enc;
+	uint32_t			 mac[6], boardnum;
+	size_t				 i, skipped;
+	uint8_t				 sromrev, tag, tlen;
+	bool				 have_mac, have_boardnum;
+	bool				 have_mac_boardnum;
+	int				 error;
+
+	enc = xc->xc_enc;
+	memcpy(image, enc->se_base, enc->se_size);
+
+	sromrev = 1;
+	skipped = 0;
+	have_mac = false;
+	have_boardnum = false;
+	have_mac_boardnum = false;
+	boardnum = 0;
+
+	i = 0;
+	while ((error = bhnd_cis_next(cis, size, &i, &tag, &tlen)) == 0) {
+		const struct bhnd_cis_tuple	*t;
+		const uint8_t			*body;
+		size_t				 len;
+		int				 hnbu_tag;
+
+		body = &cis[i];
+		len = tlen;
+		i += tlen;
+
+		hnbu_tag = BHND_CIS_HNBU_NONE;
+		if (tag == BHND_CIS_TPL_BRCM_HNBU) {
+			hnbu_tag = *body++;
+			len--;
+
+			/* CIS layout selection depends on the CIS's own
+			 * SROM revision; the SPROM image always uses the
+			 * target revision */
+			if (hnbu_tag == BHND_CIS_HNBU_SROMREV) {
+				if (len >= 1)
+					sromrev = body[0];
+				continue;
+			}
+		}
+
+		if ((t = bhnd_cis_find_tuple(tag, hnbu_tag, sromrev)) == NULL)
+			continue;
+
+		if (!(t->flags & BHND_CIS_TF_SPECIAL)) {
+			error = bhnd_cis_xcode_tuple(xc, t, body, len, image,
+			    &skipped);
+			if (error)
+				return (error);
+
+			if (hnbu_tag == BHND_CIS_HNBU_BOARDNUM && len >= 2)
+				have_boardnum = true;
+
+			continue;
+		}
+
+		switch (hnbu_tag) {
+		case BHND_CIS_HNBU_MACADDR:
+			/* Ignore null and multicast addresses */
+			if (len < 6 || (body[0] & 0x1) ||
+			    (body[0] | body[1] | body[2] | body[3] | body[4] |
+			    body[5]) == 0)
+				break;
+
+			for (size_t n = 0; n < 6; n++)
+				mac[n] = body[n];
+			have_mac = true;
+
+			/* The boardnum is derived from the first MAC address */
+			if (!have_mac_boardnum) {
+				boardnum = (body[4] << 8) | body[5];
+				have_mac_boardnum = true;
+			}
+			break;
+
+		case BHND_CIS_HNBU_OEM:
+		case BHND_CIS_HNBU_UUID:
+			/* No SPROM encoding */
+			if (len >= ((hnbu_tag == BHND_CIS_HNBU_OEM) ? 8 : 16))
+				skipped++;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	if (error != ENOENT)
+		return (error);
+
+	/* As in bhnd_cis_decode(), the derived boardnum precedes the MAC
+	 * address */
+	if (have_mac_boardnum && !have_boardnum) {
+		if (xc->xc_boardnum != NULL && xc->xc_boardnum->nvals == 1)
+			bhnd_sprom_write_var(image, xc->xc_boardnum->sv, &boardnum);
+		else
+			skipped++;
+	}
+
+	if (have_mac) {
+		if (xc->xc_macaddr != NULL && xc->xc_macaddr->nvals == 6)
+			bhnd_sprom_write_var(image, xc->xc_macaddr->sv, mac);
+		else
+			skipped++;
+	}
+
+	image[enc->se_size - 1] = ~bhnd_nvram_crc8(image, enc->se_size - 1,
+	    BHND_NVRAM_CRC8_INITIAL);
+
+	if (nskipped != NULL)
+		*nskipped = skipped;
+
+	return (0);
+}
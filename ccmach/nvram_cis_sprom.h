@@ -0,0 +1,46 @@
+//
+//  nvram_cis_sprom.h
+//  ccmach
+//
+//  Created by Landon Fuller on 2/4/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef _NVRAM_CIS_SPROM_H_
+#define _NVRAM_CIS_SPROM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nvram_cis.h"
+#include "nvram_sprom_enc.h"
+
+/**
+ * CIS to SPROM transcoder.
+ *
+ * Each variable in the generated CIS tuple table is linked, by name, to its
+ * SPROM encoding for the target revision; bit fields are then moved
+ * directly from CIS tuples into the SPROM image, without formatting or
+ * parsing any strings.
+ */
+struct bhnd_cis_xcode {
+	const struct bhnd_sprom_encoder	 *xc_enc;	/**< target SPROM encoder */
+	const struct bhnd_cis_tuple	 *xc_tuples;	/**< CIS tuple table */
+	size_t				  xc_ntuples;	/**< number of CIS tuples */
+	size_t				 *xc_first;	/**< index of each tuple's first
+							     entry in xc_targets */
+	const struct bhnd_sprom_enc_var	**xc_targets;	/**< SPROM encoding of each
+							     CIS variable, or NULL */
+	const struct bhnd_sprom_enc_var	 *xc_macaddr;	/**< SPROM encoding of the
+							     macaddr variable, or NULL */
+	const struct bhnd_sprom_enc_var	 *xc_boardnum;	/**< SPROM encoding of the
+							     boardnum variable, or NULL */
+};
+
+int	bhnd_cis_xcode_init(struct bhnd_cis_xcode *xc,
+	    const struct bhnd_sprom_encoder *enc);
+void	bhnd_cis_xcode_fini(struct bhnd_cis_xcode *xc);
+int	bhnd_cis_transcode(const struct bhnd_cis_xcode *xc,
+	    const uint8_t *cis, size_t size, uint8_t *image, size_t *nskipped);
+
+#endif /* _NVRAM_CIS_SPROM_H_ */
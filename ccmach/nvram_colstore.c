@@ -0,0 +1,882 @@
+//
+//  nvram_colstore.c
+//  ccmach
+//
+//  Created by Landon Fuller on 2/7/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nvram_colstore.h"
+
+/** Maximum number of distinct values in a dictionary-encoded chunk */
+#define	BHND_COLSTORE_DICT_MAX	256
+
+/** Dictionary hash table size; must be a power of two */
+#define	BHND_COLSTORE_DICT_SLOTS	(BHND_COLSTORE_DICT_MAX * 2)
+
+/** Round @p v up to a multiple of @p align */
+#define	BHND_COLSTORE_ALIGN(v, align)	(((v) + ((align) - 1)) & ~((uint64_t)(align) - 1))
+
+static const char bhnd_colstore_sromrev_name[] = "sromrev";
+
+/**
+ * Initialize a column schema from the generated variable table.
+ *
+ * Column 0 holds the SPROM revision; each variable is then assigned one
+ * column per element, sized for the largest of its revision-specific
+ * SPROM layouts.
+ *
+ * @retval 0 success
+ * @retval ENOMEM if allocation fails.
+ */
+int
+bhnd_colstore_schema_init (struct bhnd_colstore_schema *schema)
+{
+	size_t ncols;
+
+	memset(schema, 0, sizeof(*schema));
+	schema->sc_vars = bhnd_nvram_get_vars(&schema->sc_nvars);
+
+	schema->sc_first = calloc(schema->sc_nvars + 1,
+	    sizeof(schema->sc_first[0]));
+	if (schema->sc_first == NULL)
+		return (ENOMEM);
+
+	ncols = 1;
+	for (size_t i = 0; i < schema->sc_nvars; i++) {
+		const struct bhnd_nvram_var	*nv = &schema->sc_vars[i];
+		size_t				 nelem = 0;
+
+		for (size_t d = 0; d < nv->num_sp_descs; d++) {
+			const struct bhnd_sprom_var	*sv = &nv->sprom_descs[d];
+			size_t				 nvals = 0;
+
+			for (size_t o = 0; o < sv->num_offsets; o++) {
+				if (!sv->offsets[o].cont)
+					nvals += sv->offsets[o].count;
+			}
+
+			if (nvals > nelem)
+				nelem = nvals;
+		}
+
+		if (nelem > BHND_SPROM_ARRAY_MAX)
+			nelem = BHND_SPROM_ARRAY_MAX;
+
+		schema->sc_first[i] = ncols;
+		ncols += nelem;
+	}
+	schema->sc_first[schema->sc_nvars] = ncols;
+
+	schema->sc_cols = calloc(ncols, sizeof(schema->sc_cols[0]));
+	if (schema->sc_cols == NULL) {
+		bhnd_colstore_schema_fini(schema);
+		return (ENOMEM);
+	}
+	schema->sc_ncols = ncols;
+
+	schema->sc_cols[0].nv = NULL;
+	schema->sc_cols[0].var_id = BHND_COLSTORE_SROMREV_ID;
+	schema->sc_cols[0].elem = 0;
+
+	for (size_t i = 0; i < schema->sc_nvars; i++) {
+		for (size_t c = schema->sc_first[i]; c < schema->sc_first[i+1];
+		    c++)
+		{
+			schema->sc_cols[c].nv = &schema->sc_vars[i];
+			schema->sc_cols[c].var_id = (uint32_t)i;
+			schema->sc_cols[c].elem = c - schema->sc_first[i];
+		}
+	}
+
+	return (0);
+}
+
+/** Release all resources held by @p schema */
+void
+bhnd_colstore_schema_fini (struct bhnd_colstore_schema *schema)
+{
+	free(schema->sc_cols);
+	free(schema->sc_first);
+
+	schema->sc_cols = NULL;
+	schema->sc_first = NULL;
+	schema->sc_ncols = 0;
+}
+
+/** Sign-extend @p v from the most significant bit set in @p vmask */
+static uint32_t
+bhnd_colstore_sext (uint32_t v, uint32_t vmask)
+{
+	uint32_t sign;
+
+	if (vmask == 0)
+		return (v);
+
+	for (sign = 1U << 31; (sign & vmask) == 0; sign >>= 1)
+		continue;
+
+	if (v & sign)
+		v |= ~(sign | (sign - 1));
+
+	return (v);
+}
+
+/**
+ * Decode the SPROM image held by @p ctx into a single row of
+ * @p schema->sc_ncols values.
+ *
+ * Elements that are not defined by the image's revision, and IGNALL1
+ * variables that are unset, are marked invalid. SINT values are
+ * sign-extended.
+ *
+ * @param schema column schema.
+ * @param ctx an initialized decoding context.
+ * @param[out] vals row values.
+ * @param[out] valid row validity; non-zero if the value is set.
+ *
+ * @retval 0 success
+ * @retval EINVAL if a variable's offset descriptors are invalid.
+ */
+int
+bhnd_colstore_row_decode (const struct bhnd_colstore_schema *schema,
+    struct bhnd_sprom_ctx *ctx, uint32_t *vals, uint8_t *valid)
+{
+	int error;
+
+	vals[0] = ctx->sp_rev;
+	valid[0] = 1;
+
+	for (size_t i = 0; i < schema->sc_nvars; i++) {
+		const struct bhnd_nvram_var	*nv = &schema->sc_vars[i];
+		size_t				 first, nelem, nvals;
+
+		first = schema->sc_first[i];
+		nelem = schema->sc_first[i+1] - first;
+		nvals = 0;
+
+		error = bhnd_sprom_decode_var(ctx, nv);
+		if (error && error != ENOENT)
+			return (error);
+
+		if (!error && !((nv->flags & BHND_NVRAM_VF_IGNALL1) &&
+		    ctx->sp_all1))
+		{
+			nvals = ctx->sp_nvals;
+			if (nvals > nelem)
+				nvals = nelem;
+		}
+
+		for (size_t e = 0; e < nvals; e++) {
+			uint32_t v = ctx->sp_vals[e];
+
+			if (nv->type == BHND_NVRAM_DT_SINT)
+				v = bhnd_colstore_sext(v, ctx->sp_vmask);
+
+			vals[first + e] = v;
+			valid[first + e] = 1;
+		}
+
+		for (size_t e = nvals; e < nelem; e++) {
+			vals[first + e] = 0;
+			valid[first + e] = 0;
+		}
+	}
+
+	return (0);
+}
+
+/** Write all of @p len bytes to @p fd */
+static int
+bhnd_colstore_write (struct bhnd_colstore_writer *w, const void *buf,
+    size_t len)
+{
+	const uint8_t *p = buf;
+
+	while (len > 0) {
+		ssize_t n;
+
+		if ((n = write(w->cw_fd, p, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return (errno);
+		}
+
+		p += n;
+		len -= (size_t)n;
+		w->cw_off += (uint64_t)n;
+	}
+
+	return (0);
+}
+
+/**
+ * Initialize a column store writer, writing the file header to @p fd.
+ *
+ * @param w the writer to initialize.
+ * @param schema column schema; must remain valid for the lifetime of @p w.
+ * @param fd output file, positioned at offset 0.
+ *
+ * @retval 0 success
+ * @retval ENOMEM if allocation fails.
+ * @retval non-zero if writing to @p fd fails, a regular unix error code
+ * will be returned.
+ */
+int
+bhnd_colstore_writer_init (struct bhnd_colstore_writer *w,
+    const struct bhnd_colstore_schema *schema, int fd)
+{
+	struct bhnd_colstore_hdr	hdr;
+	size_t				ncells;
+	int				error;
+
+	memset(w, 0, sizeof(*w));
+	w->cw_schema = schema;
+	w->cw_fd = fd;
+
+	ncells = schema->sc_ncols * BHND_COLSTORE_CHUNK_ROWS;
+	w->cw_vals = malloc(ncells * sizeof(w->cw_vals[0]));
+	w->cw_valid = malloc(ncells * sizeof(w->cw_valid[0]));
+	w->cw_scratch = malloc((BHND_COLSTORE_CHUNK_ROWS / 8) + sizeof(uint32_t) +
+	    (BHND_COLSTORE_CHUNK_ROWS * sizeof(uint32_t) * 2));
+
+	if (w->cw_vals == NULL || w->cw_valid == NULL ||
+	    w->cw_scratch == NULL)
+	{
+		bhnd_colstore_writer_fini(w);
+		return (ENOMEM);
+	}
+
+	hdr.magic = BHND_COLSTORE_MAGIC;
+	hdr.version = BHND_COLSTORE_VERSION;
+	if ((error = bhnd_colstore_write(w, &hdr, sizeof(hdr)))) {
+		bhnd_colstore_writer_fini(w);
+		return (error);
+	}
+
+	return (0);
+}
+
+/** Release all resources held by @p w. The output file is not closed. */
+void
+bhnd_colstore_writer_fini (struct bhnd_colstore_writer *w)
+{
+	free(w->cw_vals);
+	free(w->cw_valid);
+	free(w->cw_chunks);
+	free(w->cw_scratch);
+
+	w->cw_vals = NULL;
+	w->cw_valid = NULL;
+	w->cw_chunks = NULL;
+	w->cw_scratch = NULL;
+}
+
+/** Return true if @p a sorts before @p b in a column of @p type */
+static bool
+bhnd_colstore_lt (bhnd_nvram_dt type, uint32_t a, uint32_t b)
+{
+	if (type == BHND_NVRAM_DT_SINT)
+		return ((int32_t)a < (int32_t)b);
+
+	return (a < b);
+}
+
+/** Locate or insert @p v in a dictionary; returns its code, or -1 if full */
+static int
+bhnd_colstore_dict_code (uint16_t *slots, uint32_t *dict, size_t *ndict,
+    uint32_t v)
+{
+	size_t h;
+
+	h = (v * 0x9E3779B1U) >> 23;
+	for (;; h = (h + 1) & (BHND_COLSTORE_DICT_SLOTS - 1)) {
+		if (slots[h] == 0)
+			break;
+
+		if (dict[slots[h] - 1] == v)
+			return (slots[h] - 1);
+	}
+
+	if (*ndict == BHND_COLSTORE_DICT_MAX)
+		return (-1);
+
+	dict[*ndict] = v;
+	slots[h] = (uint16_t)++(*ndict);
+	return (slots[h] - 1);
+}
+
+/**
+ * Encode @p nrows values of a single column chunk to the writer's scratch
+ * buffer, selecting whichever of the RLE, dictionary, and plain encodings
+ * is smallest, and populate @p ck's encoding, size, and zone map.
+ */
+static void
+bhnd_colstore_encode (struct bhnd_colstore_writer *w, bhnd_nvram_dt type,
+    const uint32_t *vals, const uint8_t *valid, size_t nrows,
+    struct bhnd_colstore_chunk *ck)
+{
+	uint16_t	slots[BHND_COLSTORE_DICT_SLOTS];
+	uint32_t	dict[BHND_COLSTORE_DICT_MAX];
+	uint8_t		codes[BHND_COLSTORE_CHUNK_ROWS];
+	uint8_t		*p;
+	size_t		ndict, nruns, nnull;
+	size_t		plain_size, rle_size, dict_size;
+	bool		dict_ok;
+
+	memset(ck, 0, sizeof(*ck));
+	memset(slots, 0, sizeof(slots));
+
+	/* Zone map, run count, and dictionary, in a single pass */
+	ndict = 0;
+	nruns = 0;
+	nnull = 0;
+	dict_ok = true;
+	for (size_t i = 0; i < nrows; i++) {
+		if (i == 0 || vals[i] != vals[i-1])
+			nruns++;
+
+		if (dict_ok) {
+			int code = bhnd_colstore_dict_code(slots, dict, &ndict,
+			    vals[i]);
+			if (code < 0)
+				dict_ok = false;
+			else
+				codes[i] = (uint8_t)code;
+		}
+
+		if (!valid[i]) {
+			nnull++;
+			continue;
+		}
+
+		if (nnull == i || bhnd_colstore_lt(type, vals[i], ck->min))
+			ck->min = vals[i];
+		if (nnull == i || bhnd_colstore_lt(type, ck->max, vals[i]))
+			ck->max = vals[i];
+	}
+
+	plain_size = nrows * sizeof(uint32_t);
+	rle_size = sizeof(uint32_t) + (nruns * sizeof(uint32_t) * 2);
+	dict_size = SIZE_MAX;
+	if (dict_ok)
+		dict_size = sizeof(uint32_t) + (ndict * sizeof(uint32_t)) + nrows;
+
+	ck->nrows = (uint32_t)nrows;
+	ck->nnull = (uint32_t)nnull;
+
+	/* Validity bitmap */
+	p = w->cw_scratch;
+	if (nnull > 0) {
+		memset(p, 0, (nrows + 7) / 8);
+		for (size_t i = 0; i < nrows; i++) {
+			if (valid[i])
+				p[i / 8] |= (1 << (i % 8));
+		}
+		p += (nrows + 7) / 8;
+	}
+
+	if (rle_size <= dict_size && rle_size < plain_size) {
+		uint32_t n = (uint32_t)nruns;
+
+		ck->enc = BHND_COLSTORE_ENC_RLE;
+		memcpy(p, &n, sizeof(n));
+		p += sizeof(n);
+
+		for (size_t i = 0; i < nrows;) {
+			uint32_t run[2];
+			size_t start = i;
+
+			while (i < nrows && vals[i] == vals[start])
+				i++;
+
+			run[0] = vals[start];
+			run[1] = (uint32_t)(i - start);
+			memcpy(p, run, sizeof(run));
+			p += sizeof(run);
+		}
+	} else if (dict_size < plain_size) {
+		uint32_t n = (uint32_t)ndict;
+
+		ck->enc = BHND_COLSTORE_ENC_DICT;
+		memcpy(p, &n, sizeof(n));
+		p += sizeof(n);
+		memcpy(p, dict, ndict * sizeof(dict[0]));
+		p += ndict * sizeof(dict[0]);
+		memcpy(p, codes, nrows);
+		p += nrows;
+	} else {
+		ck->enc = BHND_COLSTORE_ENC_PLAIN;
+		memcpy(p, vals, plain_size);
+		p += plain_size;
+	}
+
+	ck->size = (uint32_t)(p - w->cw_scratch);
+}
+
+/** Encode and write all columns of the current chunk */
+static int
+bhnd_colstore_flush (struct bhnd_colstore_writer *w)
+{
+	const struct bhnd_colstore_schema	*schema = w->cw_schema;
+	struct bhnd_colstore_chunk		*chunks;
+	int					 error;
+
+	if (w->cw_rows == 0)
+		return (0);
+
+	if (w->cw_nchunks == w->cw_chunks_cap) {
+		size_t cap = w->cw_chunks_cap ? w->cw_chunks_cap * 2 : 16;
+
+		chunks = realloc(w->cw_chunks,
+		    cap * schema->sc_ncols * sizeof(chunks[0]));
+		if (chunks == NULL)
+			return (ENOMEM);
+
+		w->cw_chunks = chunks;
+		w->cw_chunks_cap = cap;
+	}
+
+	chunks = &w->cw_chunks[w->cw_nchunks * schema->sc_ncols];
+	for (size_t c = 0; c < schema->sc_ncols; c++) {
+		const struct bhnd_nvram_var	*nv = schema->sc_cols[c].nv;
+		size_t				 base;
+
+		base = c * BHND_COLSTORE_CHUNK_ROWS;
+		bhnd_colstore_encode(w,
+		    nv != NULL ? nv->type : BHND_NVRAM_DT_UINT,
+		    &w->cw_vals[base], &w->cw_valid[base], w->cw_rows,
+		    &chunks[c]);
+
+		chunks[c].offset = w->cw_off;
+		error = bhnd_colstore_write(w, w->cw_scratch, chunks[c].size);
+		if (error)
+			return (error);
+	}
+
+	w->cw_nchunks++;
+	w->cw_rows = 0;
+	return (0);
+}
+
+/**
+ * Append a single row, as produced by bhnd_colstore_row_decode().
+ *
+ * @retval 0 success
+ * @retval non-zero if encoding or writing the completed chunk fails, a
+ * regular unix error code will be returned.
+ */
+int
+bhnd_colstore_writer_append (struct bhnd_colstore_writer *w,
+    const uint32_t *vals, const uint8_t *valid)
+{
+	const struct bhnd_colstore_schema	*schema = w->cw_schema;
+	size_t					 row = w->cw_rows;
+
+	/* Unset values are stored as zero, to keep them out of runs and
+	 * dictionaries */
+	for (size_t c = 0; c < schema->sc_ncols; c++) {
+		size_t idx = (c * BHND_COLSTORE_CHUNK_ROWS) + row;
+
+		w->cw_valid[idx] = valid[c] ? 1 : 0;
+		w->cw_vals[idx] = valid[c] ? vals[c] : 0;
+	}
+
+	w->cw_nrows++;
+	if (++w->cw_rows == BHND_COLSTORE_CHUNK_ROWS)
+		return (bhnd_colstore_flush(w));
+
+	return (0);
+}
+
+/**
+ * Write any buffered rows, followed by the footer index and trailer.
+ *
+ * @retval 0 success
+ * @retval ENOMEM if allocation fails.
+ * @retval non-zero if writing fails, a regular unix error code will be
+ * returned.
+ */
+int
+bhnd_colstore_writer_finish (struct bhnd_colstore_writer *w)
+{
+	const struct bhnd_colstore_schema	*schema = w->cw_schema;
+	struct bhnd_colstore_footer		 footer;
+	struct bhnd_colstore_trailer		 trailer;
+	struct bhnd_colstore_col		*cols;
+	uint32_t				 names_size;
+	uint64_t				 pad;
+	int					 error;
+
+	if ((error = bhnd_colstore_flush(w)))
+		return (error);
+
+	/* Column descriptors; elements of a variable share its name */
+	cols = calloc(schema->sc_ncols, sizeof(cols[0]));
+	if (cols == NULL)
+		return (ENOMEM);
+
+	names_size = sizeof(bhnd_colstore_sromrev_name);
+	for (size_t c = 0; c < schema->sc_ncols; c++) {
+		const struct bhnd_colstore_scol *sc = &schema->sc_cols[c];
+
+		cols[c].var_id = sc->var_id;
+		cols[c].elem = sc->elem;
+
+		if (sc->nv == NULL) {
+			cols[c].type = BHND_NVRAM_DT_UINT;
+			cols[c].fmt = BHND_NVRAM_VFMT_DEC;
+			cols[c].name_off = 0;
+			continue;
+		}
+
+		cols[c].type = sc->nv->type;
+		cols[c].fmt = sc->nv->fmt;
+
+		if (sc->elem == 0) {
+			cols[c].name_off = names_size;
+			names_size += strlen(sc->nv->name) + 1;
+		} else {
+			cols[c].name_off = cols[c-1].name_off;
+		}
+	}
+
+	/* Footer */
+	pad = BHND_COLSTORE_ALIGN(w->cw_off, 8) - w->cw_off;
+	if ((error = bhnd_colstore_write(w, "\0\0\0\0\0\0\0", pad)))
+		goto cleanup;
+
+	trailer.footer_off = w->cw_off;
+	trailer.magic = BHND_COLSTORE_MAGIC;
+
+	footer.nrows = w->cw_nrows;
+	footer.ncols = (uint32_t)schema->sc_ncols;
+	footer.nchunks = (uint32_t)w->cw_nchunks;
+	footer.chunk_rows = BHND_COLSTORE_CHUNK_ROWS;
+	footer.names_size = names_size;
+	if ((error = bhnd_colstore_write(w, &footer, sizeof(footer))))
+		goto cleanup;
+
+	/* Chunk index, transposed to column-major order */
+	for (size_t c = 0; c < schema->sc_ncols; c++) {
+		for (size_t k = 0; k < w->cw_nchunks; k++) {
+			const struct bhnd_colstore_chunk *ck;
+
+			ck = &w->cw_chunks[(k * schema->sc_ncols) + c];
+			if ((error = bhnd_colstore_write(w, ck, sizeof(*ck))))
+				goto cleanup;
+		}
+	}
+
+	error = bhnd_colstore_write(w, cols, schema->sc_ncols * sizeof(cols[0]));
+	if (error)
+		goto cleanup;
+
+	/* Names */
+	error = bhnd_colstore_write(w, bhnd_colstore_sromrev_name,
+	    sizeof(bhnd_colstore_sromrev_name));
+	if (error)
+		goto cleanup;
+
+	for (size_t i = 0; i < schema->sc_nvars; i++) {
+		const char *name = schema->sc_vars[i].name;
+
+		if (schema->sc_first[i] == schema->sc_first[i+1])
+			continue;
+
+		if ((error = bhnd_colstore_write(w, name, strlen(name) + 1)))
+			goto cleanup;
+	}
+
+	trailer.footer_size = (uint32_t)(w->cw_off - trailer.footer_off);
+	error = bhnd_colstore_write(w, &trailer, sizeof(trailer));
+
+cleanup:
+	free(cols);
+	return (error);
+}
+
+/**
+ * Map and validate the column store at @p path.
+ *
+ * @retval 0 success
+ * @retval EINVAL if the file is not a valid column store.
+ * @retval non-zero if opening or mapping the file fails, a regular unix
+ * error code will be returned.
+ */
+int
+bhnd_colstore_open (struct bhnd_colstore *cs, const char *path)
+{
+	struct bhnd_colstore_hdr		 hdr;
+	struct bhnd_colstore_trailer		 trailer;
+	const struct bhnd_colstore_footer	*footer;
+	struct stat				 sb;
+	uint64_t				 nchunks, need;
+	void					*base;
+	int					 fd, error;
+
+	memset(cs, 0, sizeof(*cs));
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return (errno);
+
+	if (fstat(fd, &sb) != 0) {
+		error = errno;
+		close(fd);
+		return (error);
+	}
+
+	if ((uint64_t)sb.st_size < sizeof(hdr) + sizeof(*footer) +
+	    sizeof(trailer) || (uint64_t)sb.st_size > SIZE_MAX)
+	{
+		close(fd);
+		return (EINVAL);
+	}
+
+	base = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	error = errno;
+	close(fd);
+
+	if (base == MAP_FAILED)
+		return (error);
+
+	cs->cs_base = base;
+	cs->cs_size = (size_t)sb.st_size;
+
+	/* Header and trailer */
+	memcpy(&hdr, cs->cs_base, sizeof(hdr));
+	memcpy(&trailer, cs->cs_base + cs->cs_size - sizeof(trailer),
+	    sizeof(trailer));
+
+	if (hdr.magic != BHND_COLSTORE_MAGIC ||
+	    hdr.version != BHND_COLSTORE_VERSION ||
+	    trailer.magic != BHND_COLSTORE_MAGIC)
+		goto failed;
+
+	if (trailer.footer_off % 8 != 0 ||
+	    trailer.footer_off < sizeof(hdr) ||
+	    trailer.footer_size < sizeof(*footer) ||
+	    trailer.footer_off + trailer.footer_size !=
+	    cs->cs_size - sizeof(trailer))
+		goto failed;
+
+	/* Footer */
+	footer = (const struct bhnd_colstore_footer *)
+	    (cs->cs_base + trailer.footer_off);
+
+	nchunks = (uint64_t)footer->ncols * footer->nchunks;
+	need = sizeof(*footer) +
+	    (nchunks * sizeof(struct bhnd_colstore_chunk)) +
+	    ((uint64_t)footer->ncols * sizeof(struct bhnd_colstore_col)) +
+	    footer->names_size;
+
+	if (need != trailer.footer_size || footer->names_size == 0 ||
+	    footer->chunk_rows == 0 || footer->chunk_rows > UINT32_MAX / 8)
+		goto failed;
+
+	if (footer->nrows > (uint64_t)footer->nchunks * footer->chunk_rows)
+		goto failed;
+
+	cs->cs_footer = footer;
+	cs->cs_chunks = (const struct bhnd_colstore_chunk *)(footer + 1);
+	cs->cs_cols = (const struct bhnd_colstore_col *)(cs->cs_chunks +
+	    nchunks);
+	cs->cs_names = (const char *)(cs->cs_cols + footer->ncols);
+
+	if (cs->cs_names[footer->names_size - 1] != '\0')
+		goto failed;
+
+	for (size_t c = 0; c < footer->ncols; c++) {
+		if (cs->cs_cols[c].name_off >= footer->names_size)
+			goto failed;
+	}
+
+	for (uint64_t i = 0; i < nchunks; i++) {
+		const struct bhnd_colstore_chunk *ck = &cs->cs_chunks[i];
+
+		if (ck->offset < sizeof(hdr) ||
+		    ck->offset > trailer.footer_off ||
+		    ck->size > trailer.footer_off - ck->offset ||
+		    ck->nrows > footer->chunk_rows || ck->nnull > ck->nrows ||
+		    ck->enc > BHND_COLSTORE_ENC_DICT)
+			goto failed;
+	}
+
+	return (0);
+
+failed:
+	bhnd_colstore_close(cs);
+	return (EINVAL);
+}
+
+/** Unmap a column store previously opened with bhnd_colstore_open() */
+void
+bhnd_colstore_close (struct bhnd_colstore *cs)
+{
+	if (cs->cs_base != NULL)
+		munmap((void *)cs->cs_base, cs->cs_size);
+
+	memset(cs, 0, sizeof(*cs));
+}
+
+/**
+ * Find the column holding element @p elem of the variable @p name.
+ *
+ * @retval 0 success
+ * @retval ENOENT if no such column exists.
+ */
+int
+bhnd_colstore_find (const struct bhnd_colstore *cs, const char *name,
+    uint16_t elem, size_t *col)
+{
+	for (size_t c = 0; c < cs->cs_footer->ncols; c++) {
+		const struct bhnd_colstore_col *cd = &cs->cs_cols[c];
+
+		if (cd->elem != elem)
+			continue;
+
+		if (strcmp(cs->cs_names + cd->name_off, name) != 0)
+			continue;
+
+		*col = c;
+		return (0);
+	}
+
+	return (ENOENT);
+}
+
+/**
+ * Return the index entry and zone map for chunk @p chunk of column @p col,
+ * or NULL if either is out of range.
+ */
+const struct bhnd_colstore_chunk *
+bhnd_colstore_get_chunk (const struct bhnd_colstore *cs, size_t col,
+    size_t chunk)
+{
+	if (col >= cs->cs_footer->ncols || chunk >= cs->cs_footer->nchunks)
+		return (NULL);
+
+	return (&cs->cs_chunks[(col * cs->cs_footer->nchunks) + chunk]);
+}
+
+/**
+ * Decode chunk @p chunk of column @p col.
+ *
+ * @param cs an open column store.
+ * @param col column index.
+ * @param chunk chunk index.
+ * @param[out] vals decoded values, of at least the file's chunk_rows
+ * entries. Unset rows are decoded as zero.
+ * @param[out] valid if non-NULL, per-row validity (0 or 1), of at least the
+ * file's chunk_rows entries.
+ *
+ * @retval 0 success
+ * @retval ENOENT if @p col or @p chunk is out of range.
+ * @retval EINVAL if the chunk data is malformed.
+ */
+int
+bhnd_colstore_read (const struct bhnd_colstore *cs, size_t col, size_t chunk,
+    uint32_t *vals, uint8_t *valid)
+{
+	const struct bhnd_colstore_chunk	*ck;
+	const uint8_t				*p, *end;
+	uint32_t				 n;
+	size_t				 nrows;
+
+	if ((ck = bhnd_colstore_get_chunk(cs, col, chunk)) == NULL)
+		return (ENOENT);
+
+	p = cs->cs_base + ck->offset;
+	end = p + ck->size;
+	nrows = ck->nrows;
+
+	/* Validity bitmap */
+	if (ck->nnull > 0) {
+		if ((size_t)(end - p) < (nrows + 7) / 8)
+			return (EINVAL);
+
+		if (valid != NULL) {
+			for (size_t i = 0; i < nrows; i++)
+				valid[i] = (p[i / 8] >> (i % 8)) & 1;
+		}
+
+		p += (nrows + 7) / 8;
+	} else if (valid != NULL) {
+		memset(valid, 1, nrows);
+	}
+
+	switch (ck->enc) {
+	case BHND_COLSTORE_ENC_PLAIN:
+		if ((size_t)(end - p) != nrows * sizeof(uint32_t))
+			return (EINVAL);
+
+		memcpy(vals, p, nrows * sizeof(uint32_t));
+		return (0);
+
+	case BHND_COLSTORE_ENC_RLE: {
+		size_t row = 0;
+
+		if ((size_t)(end - p) < sizeof(n))
+			return (EINVAL);
+		memcpy(&n, p, sizeof(n));
+		p += sizeof(n);
+
+		if ((size_t)(end - p) != (size_t)n * sizeof(uint32_t) * 2)
+			return (EINVAL);
+
+		for (uint32_t r = 0; r < n; r++) {
+			uint32_t run[2];
+
+			memcpy(run, p, sizeof(run));
+			p += sizeof(run);
+
+			if (run[1] > nrows - row)
+				return (EINVAL);
+
+			for (uint32_t i = 0; i < run[1]; i++)
+				vals[row++] = run[0];
+		}
+
+		if (row != nrows)
+			return (EINVAL);
+
+		return (0);
+	}
+
+	case BHND_COLSTORE_ENC_DICT: {
+		uint32_t dict[BHND_COLSTORE_DICT_MAX];
+
+		if ((size_t)(end - p) < sizeof(n))
+			return (EINVAL);
+		memcpy(&n, p, sizeof(n));
+		p += sizeof(n);
+
+		if (n > BHND_COLSTORE_DICT_MAX ||
+		    (size_t)(end - p) != (n * sizeof(dict[0])) + nrows)
+			return (EINVAL);
+
+		memcpy(dict, p, n * sizeof(dict[0]));
+		p += n * sizeof(dict[0]);
+
+		for (size_t i = 0; i < nrows; i++) {
+			if (p[i] >= n)
+				return (EINVAL);
+			vals[i] = dict[p[i]];
+		}
+
+		return (0);
+	}
+
+	default:
+		return (EINVAL);
+	}
+}
@@ -0,0 +1,162 @@
+//
+//  nvram_colstore.h
+//  ccmach
+//
+//  Created by Landon Fuller on 2/7/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef _NVRAM_COLSTORE_H_
+#define _NVRAM_COLSTORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nvram_map.h"
+#include "nvram_sprom.h"
+
+/*
+ * Columnar store for decoded SPROM corpora.
+ *
+ * Each row is a decoded image; each column holds one element of one
+ * variable from the generated variable table, plus a leading "sromrev"
+ * column. Rows are grouped into chunks of BHND_COLSTORE_CHUNK_ROWS; each
+ * column chunk is independently RLE, dictionary, or plain encoded, and
+ * carries a validity bitmap if any of its rows are unset.
+ *
+ * File layout (little-endian):
+ *
+ *	header		struct bhnd_colstore_hdr
+ *	chunks		encoded column chunks, in chunk-major order
+ *	footer		struct bhnd_colstore_footer (8-byte aligned)
+ *			struct bhnd_colstore_chunk[ncols * nchunks] (column-major)
+ *			struct bhnd_colstore_col[ncols]
+ *			column name strings
+ *	trailer		struct bhnd_colstore_trailer
+ *
+ * The footer indexes every column chunk, along with its zone map (row
+ * count, unset count, and min/max value), allowing any single column to be
+ * read from a mapped file without touching the others.
+ */
+
+#define	BHND_COLSTORE_MAGIC		0x43564E42	/**< 'BNVC' */
+#define	BHND_COLSTORE_VERSION		1
+#define	BHND_COLSTORE_CHUNK_ROWS	8192		/**< rows per chunk */
+#define	BHND_COLSTORE_SROMREV_ID	UINT32_MAX	/**< sromrev column var_id */
+
+/** Column chunk encodings */
+typedef enum {
+	BHND_COLSTORE_ENC_PLAIN	= 0,	/**< uint32_t per row */
+	BHND_COLSTORE_ENC_RLE	= 1,	/**< uint32_t nruns; (value, length) pairs */
+	BHND_COLSTORE_ENC_DICT	= 2,	/**< uint32_t ndict; values; uint8_t code per row */
+} bhnd_colstore_enc;
+
+/** File header */
+struct bhnd_colstore_hdr {
+	uint32_t	magic;		/**< BHND_COLSTORE_MAGIC */
+	uint32_t	version;	/**< BHND_COLSTORE_VERSION */
+};
+
+/** Footer */
+struct bhnd_colstore_footer {
+	uint64_t	nrows;		/**< total row count */
+	uint32_t	ncols;		/**< column count */
+	uint32_t	nchunks;	/**< chunks per column */
+	uint32_t	chunk_rows;	/**< rows per chunk (excluding the last) */
+	uint32_t	names_size;	/**< size of the column name strings */
+};
+
+/** Column descriptor */
+struct bhnd_colstore_col {
+	uint32_t	name_off;	/**< offset of the NUL-terminated name */
+	uint32_t	var_id;		/**< variable table index, or
+					     BHND_COLSTORE_SROMREV_ID */
+	uint16_t	elem;		/**< array element */
+	uint8_t		type;		/**< bhnd_nvram_dt */
+	uint8_t		fmt;		/**< bhnd_nvram_fmt */
+};
+
+/** Column chunk descriptor and zone map */
+struct bhnd_colstore_chunk {
+	uint64_t	offset;		/**< file offset of the encoded chunk */
+	uint32_t	size;		/**< encoded size */
+	uint32_t	nrows;		/**< row count */
+	uint32_t	nnull;		/**< number of unset rows */
+	uint32_t	min;		/**< minimum set value (signed if SINT) */
+	uint32_t	max;		/**< maximum set value (signed if SINT) */
+	uint8_t		enc;		/**< bhnd_colstore_enc */
+	uint8_t		pad[3];
+};
+
+/** Trailer */
+struct bhnd_colstore_trailer {
+	uint64_t	footer_off;	/**< file offset of the footer */
+	uint32_t	footer_size;	/**< footer size */
+	uint32_t	magic;		/**< BHND_COLSTORE_MAGIC */
+};
+
+/** Schema column */
+struct bhnd_colstore_scol {
+	const struct bhnd_nvram_var	*nv;		/**< variable, or NULL for sromrev */
+	uint32_t			 var_id;	/**< variable table index */
+	uint16_t			 elem;		/**< array element */
+};
+
+/** Column schema derived from the generated variable table */
+struct bhnd_colstore_schema {
+	struct bhnd_colstore_scol	*sc_cols;	/**< columns */
+	size_t				 sc_ncols;	/**< column count */
+	size_t				*sc_first;	/**< first column of each variable,
+							     and the column count */
+	const struct bhnd_nvram_var	*sc_vars;	/**< variable table */
+	size_t				 sc_nvars;	/**< variable count */
+};
+
+/** Column store writer */
+struct bhnd_colstore_writer {
+	const struct bhnd_colstore_schema	*cw_schema;
+	int					 cw_fd;		/**< output file */
+	uint64_t				 cw_off;	/**< current file offset */
+	uint64_t				 cw_nrows;	/**< rows written */
+	size_t					 cw_rows;	/**< rows in the current chunk */
+	uint32_t				*cw_vals;	/**< chunk values (column-major) */
+	uint8_t					*cw_valid;	/**< chunk validity (column-major) */
+	struct bhnd_colstore_chunk		*cw_chunks;	/**< chunk index (chunk-major) */
+	size_t					 cw_nchunks;	/**< completed chunks */
+	size_t					 cw_chunks_cap;	/**< cw_chunks capacity, in chunks */
+	uint8_t					*cw_scratch;	/**< encoding buffer */
+};
+
+/** Mapped column store */
+struct bhnd_colstore {
+	const uint8_t				*cs_base;	/**< mapped file */
+	size_t					 cs_size;	/**< file size */
+	const struct bhnd_colstore_footer	*cs_footer;
+	const struct bhnd_colstore_col		*cs_cols;
+	const struct bhnd_colstore_chunk	*cs_chunks;
+	const char				*cs_names;
+};
+
+int	bhnd_colstore_schema_init(struct bhnd_colstore_schema *schema);
+void	bhnd_colstore_schema_fini(struct bhnd_colstore_schema *schema);
+int	bhnd_colstore_row_decode(const struct bhnd_colstore_schema *schema,
+	    struct bhnd_sprom_ctx *ctx, uint32_t *vals, uint8_t *valid);
+
+int	bhnd_colstore_writer_init(struct bhnd_colstore_writer *w,
+	    const struct bhnd_colstore_schema *schema, int fd);
+int	bhnd_colstore_writer_append(struct bhnd_colstore_writer *w,
+	    const uint32_t *vals, const uint8_t *valid);
+int	bhnd_colstore_writer_finish(struct bhnd_colstore_writer *w);
+void	bhnd_colstore_writer_fini(struct bhnd_colstore_writer *w);
+
+int	bhnd_colstore_open(struct bhnd_colstore *cs, const char *path);
+void	bhnd_colstore_close(struct bhnd_colstore *cs);
+int	bhnd_colstore_find(const struct bhnd_colstore *cs, const char *name,
+	    uint16_t elem, size_t *col);
+const struct bhnd_colstore_chunk	*bhnd_colstore_get_chunk(
+					     const struct bhnd_colstore *cs,
+					     size_t col, size_t chunk);
+int	bhnd_colstore_read(const struct bhnd_colstore *cs, size_t col,
+	    size_t chunk, uint32_t *vals, uint8_t *valid);
+
+#endif /* _NVRAM_COLSTORE_H_ */
@@ -0,0 +1,870 @@
+//
+//  nvram_dcache.c
+//  ccmach
+//
+//  Created by Landon Fuller on 2/11/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "nvram_dcache.h"
+
+#define	BHND_DCACHE_FNV_INIT	14695981039346656037ULL
+#define	BHND_DCACHE_FNV_PRIME	1099511628211ULL
+
+/** Round @p len up to the record alignment */
+#define	BHND_DCACHE_ALIGN(len)	(((len) + 7) & ~(size_t)7)
+
+/** Size of the payload header preceding the cached variables */
+#define	BHND_DCACHE_PAYLOAD_HDR	4
+
+/** FNV-1a hash of @p len bytes at @p p, continuing from @p h */
+static uint64_t
+bhnd_dcache_fnv (uint64_t h, const void *p, size_t len)
+{
+	const uint8_t *b = p;
+
+	for (size_t i = 0; i < len; i++) {
+		h ^= b[i];
+		h *= BHND_DCACHE_FNV_PRIME;
+	}
+
+	return (h);
+}
+
+/** FNV-1a hash of the integer @p v, continuing from @p h */
+static uint64_t
+bhnd_dcache_fnv_int (uint64_t h, uint64_t v)
+{
+	for (size_t i = 0; i < sizeof(v); i++) {
+		h ^= (v >> (i * 8)) & 0xFF;
+		h *= BHND_DCACHE_FNV_PRIME;
+	}
+
+	return (h);
+}
+
+/** 32-bit record checksum of @p len bytes at @p p */
+static uint32_t
+bhnd_dcache_check (const void *p, size_t len)
+{
+	uint64_t h = bhnd_dcache_fnv(BHND_DCACHE_FNV_INIT, p, len);
+	return ((uint32_t)(h ^ (h >> 32)));
+}
+
+/** Final avalanche of a digest lane */
+static uint64_t
+bhnd_dcache_fmix (uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+
+	return (h);
+}
+
+/**
+ * Compute the 128-bit digest of @p image.
+ *
+ * The image is consumed as little-endian 64-bit words by two independent
+ * multiply-rotate lanes, using distinct constants; the lanes have no data
+ * dependency on each other, and run in parallel.
+ */
+static void
+bhnd_dcache_digest (const uint8_t *image, size_t size, uint64_t digest[2])
+{
+	uint64_t	h0, h1;
+	size_t		i;
+
+	h0 = size ^ 0x9E3779B97F4A7C15ULL;
+	h1 = size ^ 0xC2B2AE3D27D4EB4FULL;
+
+	for (i = 0; i < size; i += 8) {
+		uint64_t w = 0;
+
+		for (size_t n = 0; n < 8 && i + n < size; n++)
+			w |= (uint64_t)image[i + n] << (n * 8);
+
+		h0 = (h0 ^ w) * 0x87C37B91114253D5ULL;
+		h0 = (h0 << 31) | (h0 >> 33);
+		h1 = (h1 ^ w) * 0x4CF5AD432745937FULL;
+		h1 = (h1 << 27) | (h1 >> 37);
+	}
+
+	digest[0] = bhnd_dcache_fmix(h0 + h1);
+	digest[1] = bhnd_dcache_fmix(h1 ^ (h0 >> 1));
+}
+
+/**
+ * Return a digest of the generated variable table.
+ *
+ * Every field that affects decoding (variable names, types, formats,
+ * flags, revision ranges, and offset descriptors) is hashed; cached
+ * results are only used if they were produced with an identical table.
+ */
+uint64_t
+bhnd_dcache_map_hash (void)
+{
+	const struct bhnd_nvram_var	*vars;
+	size_t				 num_vars;
+	uint64_t			 h;
+
+	vars = bhnd_nvram_get_vars(&num_vars);
+
+	h = bhnd_dcache_fnv_int(BHND_DCACHE_FNV_INIT, num_vars);
+	for (size_t i = 0; i < num_vars; i++) {
+		const struct bhnd_nvram_var *nv = &vars[i];
+
+		h = bhnd_dcache_fnv(h, nv->name, strlen(nv->name) + 1);
+		h = bhnd_dcache_fnv_int(h, nv->type);
+		h = bhnd_dcache_fnv_int(h, nv->fmt);
+		h = bhnd_dcache_fnv_int(h, nv->flags);
+		h = bhnd_dcache_fnv_int(h, nv->num_sp_descs);
+
+		for (size_t d = 0; d < nv->num_sp_descs; d++) {
+			const struct bhnd_sprom_var *sv = &nv->sprom_descs[d];
+
+			h = bhnd_dcache_fnv_int(h, sv->compat.first);
+			h = bhnd_dcache_fnv_int(h, sv->compat.last);
+			h = bhnd_dcache_fnv_int(h, sv->num_offsets);
+
+			for (size_t o = 0; o < sv->num_offsets; o++) {
+				const struct bhnd_sprom_offset *sp;
+
+				sp = &sv->offsets[o];
+				h = bhnd_dcache_fnv_int(h, sp->offset);
+				h = bhnd_dcache_fnv_int(h, sp->width);
+				h = bhnd_dcache_fnv_int(h, sp->count);
+				h = bhnd_dcache_fnv_int(h, sp->mask);
+				h = bhnd_dcache_fnv_int(h, (uint64_t)sp->shift);
+				h = bhnd_dcache_fnv_int(h, sp->cont);
+			}
+		}
+	}
+
+	return (h);
+}
+
+/**
+ * Return the valid record at offset @p off of the @p size byte cache file
+ * mapped at @p base, or NULL if no complete, valid record is found there.
+ */
+static const struct bhnd_dcache_rec_hdr *
+bhnd_dcache_rec_at (const uint8_t *base, uint64_t size, uint64_t off)
+{
+	const struct bhnd_dcache_rec_hdr *rh;
+
+	if (off > size || size - off < sizeof(*rh))
+		return (NULL);
+
+	rh = (const struct bhnd_dcache_rec_hdr *)(base + off);
+	if (rh->magic != BHND_DCACHE_REC_MAGIC)
+		return (NULL);
+
+	if (rh->len < BHND_DCACHE_PAYLOAD_HDR ||
+	    rh->len > size - off - sizeof(*rh))
+		return (NULL);
+
+	if (rh->check != bhnd_dcache_check(rh + 1, rh->len))
+		return (NULL);
+
+	return (rh);
+}
+
+/** Return the index key of @p digest; keys are never zero */
+static uint64_t
+bhnd_dcache_key (const uint64_t digest[2])
+{
+	return (digest[0] != 0 ? digest[0] : 1);
+}
+
+/**
+ * Publish the record at @p off with @p digest in @p dc's index.
+ *
+ * The caller must hold dc_lock, or otherwise have exclusive access to
+ * @p dc.
+ */
+static int
+bhnd_dcache_index (struct bhnd_dcache *dc, const uint64_t digest[2],
+    uint64_t off)
+{
+	uint64_t	key;
+	size_t		mask, h;
+
+	/* Keep the table at most three quarters full */
+	if (atomic_load_explicit(&dc->dc_count, memory_order_relaxed) >=
+	    dc->dc_nslots - dc->dc_nslots / 4)
+		return (ENOSPC);
+
+	key = bhnd_dcache_key(digest);
+	mask = dc->dc_nslots - 1;
+	for (h = key & mask; ; h = (h + 1) & mask) {
+		struct bhnd_dcache_slot *slot = &dc->dc_slots[h];
+
+		if (atomic_load_explicit(&slot->key, memory_order_relaxed) != 0)
+			continue;
+
+		/* The offset must be visible before the key is */
+		atomic_store_explicit(&slot->off, off, memory_order_relaxed);
+		atomic_store_explicit(&slot->key, key, memory_order_release);
+		atomic_fetch_add_explicit(&dc->dc_count, 1,
+		    memory_order_relaxed);
+
+		return (0);
+	}
+}
+
+/** Initialize @p rec from the record header @p rh */
+static void
+bhnd_dcache_rec_init (struct bhnd_dcache_rec *rec,
+    const struct bhnd_dcache_rec_hdr *rh)
+{
+	const uint8_t *payload = (const uint8_t *)(rh + 1);
+
+	rec->dr_rev = payload[0];
+	rec->dr_nvars = payload[2] | (payload[3] << 8);
+	rec->dr_data = payload + BHND_DCACHE_PAYLOAD_HDR;
+	rec->dr_len = rh->len - BHND_DCACHE_PAYLOAD_HDR;
+}
+
+/** Look up @p digest of an @p size byte image in @p dc's index */
+static const struct bhnd_dcache_rec_hdr *
+bhnd_dcache_find (struct bhnd_dcache *dc, const uint64_t digest[2],
+    size_t size)
+{
+	uint64_t	key;
+	size_t		mask, h;
+
+	key = bhnd_dcache_key(digest);
+	mask = dc->dc_nslots - 1;
+	for (h = key & mask; ; h = (h + 1) & mask) {
+		const struct bhnd_dcache_rec_hdr	*rh;
+		struct bhnd_dcache_slot			*slot;
+		uint64_t				 k, off;
+
+		slot = &dc->dc_slots[h];
+		k = atomic_load_explicit(&slot->key, memory_order_acquire);
+		if (k == 0)
+			return (NULL);
+		else if (k != key)
+			continue;
+
+		off = atomic_load_explicit(&slot->off, memory_order_relaxed);
+		rh = (const struct bhnd_dcache_rec_hdr *)(dc->dc_base + off);
+		if (rh->digest[0] == digest[0] && rh->digest[1] == digest[1] &&
+		    rh->image_size == size)
+			return (rh);
+	}
+}
+
+/**
+ * Open the decode cache at @p path.
+ *
+ * The cache file is mapped, and its records for the current variable
+ * table are indexed. A partially written record at the end of the file
+ * (e.g. from an interrupted writer) ends the scan, and is truncated when
+ * the cache is opened for writing.
+ *
+ * @param dc the cache to initialize.
+ * @param path cache file path.
+ * @param flags BHND_DCACHE_* flags.
+ * @param max_entries maximum number of records that may be indexed.
+ * @param max_size maximum cache file size; this much address space is
+ * reserved for the file mapping.
+ *
+ * @retval 0 success
+ * @retval EBUSY if @p flags includes BHND_DCACHE_WRITE, and the cache is
+ * open for writing by another process.
+ * @retval EINVAL if @p path is not a valid cache file.
+ * @retval EFBIG if the cache file exceeds @p max_size.
+ * @retval ENOSPC if the cache holds more than @p max_entries records.
+ * @retval ENOMEM if allocation fails.
+ * @retval non-zero if opening or mapping the file otherwise fails, a
+ * regular unix error code will be returned.
+ */
+int
+bhnd_dcache_open (struct bhnd_dcache *dc, const char *path, int flags,
+    size_t max_entries, size_t max_size)
+{
+	const struct bhnd_dcache_hdr	*hdr;
+	struct stat			 sb;
+	void				*base;
+	uint64_t			 off;
+	int				 error;
+
+	memset(dc, 0, sizeof(*dc));
+	dc->dc_fd = -1;
+	dc->dc_flags = flags;
+	dc->dc_max_size = max_size;
+	dc->dc_map_hash = bhnd_dcache_map_hash();
+
+	if (max_size < sizeof(*hdr) || max_entries == 0)
+		return (EINVAL);
+
+	if (flags & BHND_DCACHE_WRITE)
+		dc->dc_fd = open(path, O_RDWR|O_CREAT, 0644);
+	else
+		dc->dc_fd = open(path, O_RDONLY);
+
+	if (dc->dc_fd < 0)
+		return (errno);
+
+	if ((flags & BHND_DCACHE_WRITE) &&
+	    flock(dc->dc_fd, LOCK_EX|LOCK_NB) != 0)
+	{
+		error = (errno == EWOULDBLOCK) ? EBUSY : errno;
+		goto failed;
+	}
+
+	if (fstat(dc->dc_fd, &sb) != 0) {
+		error = errno;
+		goto failed;
+	}
+
+	/* Initialize a new cache file */
+	if (sb.st_size == 0 && (flags & BHND_DCACHE_WRITE)) {
+		struct bhnd_dcache_hdr h;
+
+		memset(&h, 0, sizeof(h));
+		h.magic = BHND_DCACHE_MAGIC;
+		h.version = BHND_DCACHE_VERSION;
+
+		if (pwrite(dc->dc_fd, &h, sizeof(h), 0) != sizeof(h)) {
+			error = errno ? errno : EIO;
+			goto failed;
+		}
+
+		sb.st_size = sizeof(h);
+	}
+
+	if ((uint64_t)sb.st_size < sizeof(*hdr)) {
+		error = EINVAL;
+		goto failed;
+	}
+
+	if ((uint64_t)sb.st_size > max_size) {
+		error = EFBIG;
+		goto failed;
+	}
+
+	base = mmap(NULL, max_size, PROT_READ, MAP_SHARED, dc->dc_fd, 0);
+	if (base == MAP_FAILED) {
+		error = errno;
+		goto failed;
+	}
+	dc->dc_base = base;
+
+	hdr = (const struct bhnd_dcache_hdr *)dc->dc_base;
+	if (hdr->magic != BHND_DCACHE_MAGIC ||
+	    hdr->version != BHND_DCACHE_VERSION)
+	{
+		error = EINVAL;
+		goto failed;
+	}
+
+	for (dc->dc_nslots = 16; dc->dc_nslots / 4 * 3 <= max_entries;)
+		dc->dc_nslots *= 2;
+
+	dc->dc_slots = calloc(dc->dc_nslots, sizeof(dc->dc_slots[0]));
+	if (dc->dc_slots == NULL) {
+		error = ENOMEM;
+		goto failed;
+	}
+	atomic_init(&dc->dc_count, 0);
+
+	/* Index the valid records of the current variable table */
+	for (off = sizeof(*hdr); ; ) {
+		const struct bhnd_dcache_rec_hdr *rh;
+
+		rh = bhnd_dcache_rec_at(dc->dc_base, sb.st_size, off);
+		if (rh == NULL)
+			break;
+
+		if (rh->map_hash == dc->dc_map_hash &&
+		    bhnd_dcache_find(dc, rh->digest, rh->image_size) == NULL)
+		{
+			if ((error = bhnd_dcache_index(dc, rh->digest, off)))
+				goto failed;
+		}
+
+		off += BHND_DCACHE_ALIGN(sizeof(*rh) + rh->len);
+	}
+
+	/* Discard any partially written record */
+	if (off < (uint64_t)sb.st_size && (flags & BHND_DCACHE_WRITE)) {
+		if (ftruncate(dc->dc_fd, off) != 0) {
+			error = errno;
+			goto failed;
+		}
+	}
+
+	dc->dc_end = off;
+	pthread_mutex_init(&dc->dc_lock, NULL);
+
+	return (0);
+
+failed:
+	if (dc->dc_base != NULL)
+		munmap((void *)dc->dc_base, max_size);
+
+	if (dc->dc_fd >= 0)
+		close(dc->dc_fd);
+
+	free(dc->dc_slots);
+	memset(dc, 0, sizeof(*dc));
+	dc->dc_fd = -1;
+
+	return (error);
+}
+
+/**
+ * Close @p dc, releasing all associated resources.
+ *
+ * No lookups may be in progress, and records returned by @p dc may no
+ * longer be used.
+ */
+void
+bhnd_dcache_close (struct bhnd_dcache *dc)
+{
+	if (dc->dc_fd < 0)
+		return;
+
+	pthread_mutex_destroy(&dc->dc_lock);
+	munmap((void *)dc->dc_base, dc->dc_max_size);
+	close(dc->dc_fd);
+	free(dc->dc_slots);
+
+	memset(dc, 0, sizeof(*dc));
+	dc->dc_fd = -1;
+}
+
+/**
+ * Look up the cached decode result of @p image.
+ *
+ * Lookups do not block, and may be performed concurrently with each other
+ * and with bhnd_dcache_decode().
+ *
+ * @param dc decode cache.
+ * @param image SPROM image.
+ * @param size size of @p image.
+ * @param[out] rec on success, the cached result. The result remains valid
+ * until @p dc is closed.
+ *
+ * @retval 0 success
+ * @retval ENOENT if @p image is not cached.
+ */
+int
+bhnd_dcache_lookup (struct bhnd_dcache *dc, const void *image, size_t size,
+    struct bhnd_dcache_rec *rec)
+{
+	const struct bhnd_dcache_rec_hdr	*rh;
+	uint64_t				 digest[2];
+
+	bhnd_dcache_digest(image, size, digest);
+	if ((rh = bhnd_dcache_find(dc, digest, size)) == NULL)
+		return (ENOENT);
+
+	bhnd_dcache_rec_init(rec, rh);
+	return (0);
+}
+
+/**
+ * Decode the typed values of @p ctx's image into a newly allocated record
+ * buffer, leaving space for the record header.
+ */
+static int
+bhnd_dcache_encode (struct bhnd_sprom_ctx *ctx, uint8_t **buf, size_t *len)
+{
+	const struct bhnd_nvram_var	*vars;
+	uint8_t				*p;
+	size_t				 num_vars, cap, pos, nvars;
+	int				 error;
+
+	vars = bhnd_nvram_get_vars(&num_vars);
+	if (num_vars > UINT16_MAX)
+		return (EINVAL);
+
+	cap = sizeof(struct bhnd_dcache_rec_hdr) + BHND_DCACHE_PAYLOAD_HDR +
+	    num_vars * (sizeof(struct bhnd_dcache_var) +
+	    BHND_SPROM_ARRAY_MAX * sizeof(uint32_t)) + 8;
+	if ((p = calloc(1, cap)) == NULL)
+		return (ENOMEM);
+
+	pos = sizeof(struct bhnd_dcache_rec_hdr) + BHND_DCACHE_PAYLOAD_HDR;
+	nvars = 0;
+	for (size_t i = 0; i < num_vars; i++) {
+		const struct bhnd_nvram_var	*nv = &vars[i];
+		struct bhnd_dcache_var		 cv;
+
+		error = bhnd_sprom_decode_var(ctx, nv);
+		if (error == ENOENT)
+			continue;
+		else if (error)
+			goto failed;
+
+		if ((nv->flags & BHND_NVRAM_VF_IGNALL1) && ctx->sp_all1)
+			continue;
+
+		if (ctx->sp_nvals > UINT8_MAX) {
+			error = EINVAL;
+			goto failed;
+		}
+
+		memset(&cv, 0, sizeof(cv));
+		cv.var_id = (uint16_t)i;
+		cv.nvals = (uint8_t)ctx->sp_nvals;
+		cv.vmask = ctx->sp_vmask;
+
+		memcpy(p + pos, &cv, sizeof(cv));
+		pos += sizeof(cv);
+		memcpy(p + pos, ctx->sp_vals, ctx->sp_nvals * sizeof(uint32_t));
+		pos += ctx->sp_nvals * sizeof(uint32_t);
+		nvars++;
+	}
+
+	p[sizeof(struct bhnd_dcache_rec_hdr) + 0] = ctx->sp_rev;
+	p[sizeof(struct bhnd_dcache_rec_hdr) + 2] = nvars & 0xFF;
+	p[sizeof(struct bhnd_dcache_rec_hdr) + 3] = nvars >> 8;
+
+	*buf = p;
+	*len = pos;
+	return (0);
+
+failed:
+	free(p);
+	return (error);
+}
+
+/** Write @p len bytes of @p buf to @p fd at @p off */
+static int
+bhnd_dcache_pwrite (int fd, const uint8_t *buf, size_t len, uint64_t off)
+{
+	while (len > 0) {
+		ssize_t n = pwrite(fd, buf, len, off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return (errno);
+		}
+
+		buf += n;
+		len -= n;
+		off += n;
+	}
+
+	return (0);
+}
+
+/**
+ * Return the cached decode result of @p image, decoding @p image and
+ * appending the result to the cache if it is not already cached.
+ *
+ * A warm cache returns results without decoding (or identifying) the
+ * image. Concurrent misses are serialized; each image is decoded and
+ * appended at most once.
+ *
+ * @param dc decode cache.
+ * @param image SPROM image.
+ * @param size size of @p image.
+ * @param[out] rec on success, the cached result. The result remains valid
+ * until @p dc is closed.
+ *
+ * @retval 0 success
+ * @retval ENOENT if @p image is not cached, and @p dc is not open for
+ * writing.
+ * @retval EINVAL if @p image is not a valid SPROM image.
+ * @retval ENOSPC if the cache has reached its maximum size or number of
+ * entries.
+ * @retval ENOMEM if allocation fails.
+ * @retval non-zero if writing the cache file otherwise fails, a regular
+ * unix error code will be returned.
+ */
+int
+bhnd_dcache_decode (struct bhnd_dcache *dc, const void *image, size_t size,
+    struct bhnd_dcache_rec *rec)
+{
+	const struct bhnd_dcache_rec_hdr	*rh;
+	struct bhnd_dcache_rec_hdr		 hdr;
+	struct bhnd_sprom_ctx			 ctx;
+	uint64_t				 digest[2];
+	uint8_t					*buf;
+	size_t					 len, reclen;
+	int					 error;
+
+	bhnd_dcache_digest(image, size, digest);
+	if ((rh = bhnd_dcache_find(dc, digest, size)) != NULL) {
+		bhnd_dcache_rec_init(rec, rh);
+		return (0);
+	}
+
+	if (!(dc->dc_flags & BHND_DCACHE_WRITE))
+		return (ENOENT);
+
+	if (size > UINT32_MAX)
+		return (EINVAL);
+
+	if ((error = bhnd_sprom_ctx_init(&ctx, image, size)))
+		return (error);
+
+	if ((error = bhnd_dcache_encode(&ctx, &buf, &len)))
+		return (error);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = BHND_DCACHE_REC_MAGIC;
+	hdr.len = (uint32_t)(len - sizeof(hdr));
+	hdr.digest[0] = digest[0];
+	hdr.digest[1] = digest[1];
+	hdr.map_hash = dc->dc_map_hash;
+	hdr.check = bhnd_dcache_check(buf + sizeof(hdr), hdr.len);
+	hdr.image_size = (uint32_t)size;
+	memcpy(buf, &hdr, sizeof(hdr));
+
+	reclen = BHND_DCACHE_ALIGN(len);
+
+	pthread_mutex_lock(&dc->dc_lock);
+
+	/* Another thread may have appended this image in the meantime */
+	if ((rh = bhnd_dcache_find(dc, digest, size)) != NULL) {
+		error = 0;
+		goto done;
+	}
+
+	if (reclen > dc->dc_max_size - dc->dc_end) {
+		error = ENOSPC;
+		goto done;
+	}
+
+	if ((error = bhnd_dcache_pwrite(dc->dc_fd, buf, reclen, dc->dc_end)))
+		goto done;
+
+	if ((error = bhnd_dcache_index(dc, digest, dc->dc_end))) {
+		/* Unindexed records are ignored until the next open */
+		dc->dc_end += reclen;
+		goto done;
+	}
+
+	rh = (const struct bhnd_dcache_rec_hdr *)(dc->dc_base + dc->dc_end);
+	dc->dc_end += reclen;
+
+done:
+	pthread_mutex_unlock(&dc->dc_lock);
+	free(buf);
+
+	if (error)
+		return (error);
+
+	bhnd_dcache_rec_init(rec, rh);
+	return (0);
+}
+
+/**
+ * Compact the cache file at @p path.
+ *
+ * The cache is rewritten to contain a single record for each image cached
+ * with the current variable table; duplicate records, and records of other
+ * variable tables, are dropped. The compacted file replaces @p path
+ * atomically; processes that have the cache open for reading continue to
+ * see the previous file.
+ *
+ * @param path cache file path.
+ *
+ * @retval 0 success
+ * @retval EBUSY if the cache is open for writing.
+ * @retval EINVAL if @p path is not a valid cache file.
+ * @retval ENOMEM if allocation fails.
+ * @retval non-zero if reading or writing the cache files otherwise fails,
+ * a regular unix error code will be returned.
+ */
+int
+bhnd_dcache_compact (const char *path)
+{
+	struct bhnd_dcache	 dc, out;
+	struct stat		 sb;
+	char			*tmp;
+	size_t			 max_entries, tmp_size;
+	int			 error;
+
+	if (stat(path, &sb) != 0)
+		return (errno);
+
+	if ((uint64_t)sb.st_size < sizeof(struct bhnd_dcache_hdr))
+		return (EINVAL);
+
+	/* Opening the source for writing excludes any other writer */
+	max_entries = sb.st_size / sizeof(struct bhnd_dcache_rec_hdr) + 1;
+	error = bhnd_dcache_open(&dc, path, BHND_DCACHE_WRITE, max_entries,
+	    sb.st_size);
+	if (error)
+		return (error);
+
+	tmp_size = strlen(path) + sizeof(".compact");
+	if ((tmp = malloc(tmp_size)) == NULL) {
+		bhnd_dcache_close(&dc);
+		return (ENOMEM);
+	}
+	snprintf(tmp, tmp_size, "%s.compact", path);
+
+	unlink(tmp);
+	error = bhnd_dcache_open(&out, tmp, BHND_DCACHE_WRITE, max_entries,
+	    sb.st_size);
+	if (error) {
+		bhnd_dcache_close(&dc);
+		free(tmp);
+		return (error);
+	}
+
+	/* Copy the indexed records, in file order */
+	for (uint64_t off = sizeof(struct bhnd_dcache_hdr); off < dc.dc_end; ) {
+		const struct bhnd_dcache_rec_hdr	*rh;
+		size_t					 reclen;
+
+		rh = bhnd_dcache_rec_at(dc.dc_base, dc.dc_end, off);
+		if (rh == NULL) {
+			error = EINVAL;
+			break;
+		}
+
+		reclen = BHND_DCACHE_ALIGN(sizeof(*rh) + rh->len);
+		if (rh->map_hash == dc.dc_map_hash &&
+		    bhnd_dcache_find(&dc, rh->digest, rh->image_size) ==
+		    (const void *)(dc.dc_base + off))
+		{
+			error = bhnd_dcache_pwrite(out.dc_fd,
+			    (const uint8_t *)rh, reclen, out.dc_end);
+			if (error)
+				break;
+
+			out.dc_end += reclen;
+		}
+
+		off += reclen;
+	}
+
+	if (!error && fsync(out.dc_fd) != 0)
+		error = errno;
+
+	if (!error && rename(tmp, path) != 0)
+		error = errno;
+
+	if (error)
+		unlink(tmp);
+
+	bhnd_dcache_close(&out);
+	bhnd_dcache_close(&dc);
+	free(tmp);
+
+	return (error);
+}
+
+/**
+ * Iterate over the variables of a cached result.
+ *
+ * @param rec cached result.
+ * @param[in,out] pos iteration state; initialize to 0.
+ * @param[out] nv on success, the variable definition.
+ * @param[out] vals on success, the variable's decoded elements, as
+ * produced by bhnd_sprom_decode_var().
+ * @param[out] nvals on success, the number of elements in @p vals.
+ * @param[out] vmask on success, the combined value mask.
+ *
+ * @retval 0 success
+ * @retval ENOENT if no variables remain.
+ * @retval EINVAL if the record is malformed.
+ */
+int
+bhnd_dcache_rec_next (const struct bhnd_dcache_rec *rec, size_t *pos,
+    const struct bhnd_nvram_var **nv, const uint32_t **vals, size_t *nvals,
+    uint32_t *vmask)
+{
+	const struct bhnd_nvram_var	*vars;
+	struct bhnd_dcache_var		 cv;
+	size_t				 num_vars;
+
+	if (*pos >= rec->dr_len)
+		return (ENOENT);
+
+	if (rec->dr_len - *pos < sizeof(cv))
+		return (EINVAL);
+
+	memcpy(&cv, rec->dr_data + *pos, sizeof(cv));
+	if (cv.nvals * sizeof(uint32_t) > rec->dr_len - *pos - sizeof(cv))
+		return (EINVAL);
+
+	vars = bhnd_nvram_get_vars(&num_vars);
+	if (cv.var_id >= num_vars)
+		return (EINVAL);
+
+	*nv = &vars[cv.var_id];
+	*vals = (const uint32_t *)(rec->dr_data + *pos + sizeof(cv));
+	*nvals = cv.nvals;
+	*vmask = cv.vmask;
+
+	*pos += sizeof(cv) + cv.nvals * sizeof(uint32_t);
+	return (0);
+}
+
+/**
+ * Format a cached result as an NVRAM environment.
+ *
+ * The output is identical to that of bhnd_sprom_decode() on the cached
+ * image.
+ *
+ * @param rec cached result.
+ * @param buf output buffer, or NULL to determine the required size.
+ * @param[in,out] len on input, the size of @p buf. On output, the
+ * size of the environment, including the terminating NUL.
+ *
+ * @retval 0 success
+ * @retval ENOMEM if @p buf is non-NULL and too small.
+ * @retval EINVAL if the record is malformed.
+ */
+int
+bhnd_dcache_rec_env (const struct bhnd_dcache_rec *rec, char *buf,
+    size_t *len)
+{
+	const struct bhnd_nvram_var	*nv;
+	const uint32_t			*vals;
+	struct bhnd_nvram_obuf		 ob;
+	size_t				 pos, nvals;
+	uint32_t			 vmask;
+	int				 error;
+
+	bhnd_nvram_obuf_init(&ob, buf, *len);
+
+	bhnd_nvram_put_str(&ob, "sromrev=");
+	bhnd_nvram_put_udec(&ob, rec->dr_rev);
+	bhnd_nvram_put_char(&ob, '\0');
+
+	pos = 0;
+	while ((error = bhnd_dcache_rec_next(rec, &pos, &nv, &vals, &nvals,
+	    &vmask)) == 0)
+	{
+		if ((error = bhnd_nvram_fmt_pair(&ob, nv, vals, nvals, vmask)))
+			return (error);
+	}
+
+	if (error != ENOENT)
+		return (error);
+
+	/* Terminate the environment */
+	bhnd_nvram_put_char(&ob, '\0');
+
+	*len = ob.ob_len;
+	if (buf != NULL && !bhnd_nvram_obuf_fits(&ob))
+		return (ENOMEM);
+
+	return (0);
+}
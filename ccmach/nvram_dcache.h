@@ -0,0 +1,123 @@
+//
+//  nvram_dcache.h
+//  ccmach
+//
+//  Created by Landon Fuller on 2/11/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef _NVRAM_DCACHE_H_
+#define _NVRAM_DCACHE_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nvram_map.h"
+#include "nvram_sprom.h"
+
+/*
+ * Persistent SPROM decode cache.
+ *
+ * The typed values decoded from a SPROM image are cached on disk, keyed by
+ * a 128-bit digest of the image and a digest of the generated variable
+ * table; a change to the table invalidates all previously cached results.
+ *
+ * The cache file is an append-only log of checksummed records:
+ *
+ *	header		struct bhnd_dcache_hdr
+ *	records		struct bhnd_dcache_rec_hdr, payload, padding to 8 bytes
+ *
+ * A record's payload is the SPROM revision and variable count, followed
+ * by one struct bhnd_dcache_var and its values for each variable, in
+ * variable table order.
+ *
+ * The file is mapped once, with the address space for its maximum size
+ * reserved up front, and indexed in memory when opened. Lookups are
+ * lock-free; inserts are serialized, appended to the file, and then
+ * published to the index. At most one process may open a cache for
+ * writing; readers in other processes see the records present when they
+ * opened the cache. bhnd_dcache_compact() rewrites a cache, dropping
+ * duplicate records and records of other variable tables.
+ */
+
+#define	BHND_DCACHE_MAGIC	0x43444E42	/**< 'BNDC' */
+#define	BHND_DCACHE_REC_MAGIC	0x52434E42	/**< 'BNCR' */
+#define	BHND_DCACHE_VERSION	1
+
+/** bhnd_dcache_open() flags */
+#define	BHND_DCACHE_WRITE	(1<<0)	/**< open for writing, creating the
+					     cache if necessary */
+
+/** Cache file header */
+struct bhnd_dcache_hdr {
+	uint32_t	magic;		/**< BHND_DCACHE_MAGIC */
+	uint32_t	version;	/**< BHND_DCACHE_VERSION */
+	uint64_t	reserved;
+};
+
+/** Record header */
+struct bhnd_dcache_rec_hdr {
+	uint32_t	magic;		/**< BHND_DCACHE_REC_MAGIC */
+	uint32_t	len;		/**< payload length */
+	uint64_t	digest[2];	/**< image digest */
+	uint64_t	map_hash;	/**< variable table digest */
+	uint32_t	check;		/**< FNV-1a hash of the payload */
+	uint32_t	image_size;	/**< image size */
+};
+
+/** Cached variable */
+struct bhnd_dcache_var {
+	uint16_t	var_id;		/**< variable table index */
+	uint8_t		nvals;		/**< number of values that follow */
+	uint8_t		reserved;
+	uint32_t	vmask;		/**< combined value mask */
+};
+
+/** Index slot */
+struct bhnd_dcache_slot {
+	_Atomic uint64_t	key;	/**< non-zero key; published last */
+	_Atomic uint64_t	off;	/**< record offset */
+};
+
+/** Decode cache */
+struct bhnd_dcache {
+	int			 dc_fd;		/**< cache file */
+	int			 dc_flags;	/**< BHND_DCACHE_* flags */
+	const uint8_t		*dc_base;	/**< file mapping */
+	size_t			 dc_max_size;	/**< mapping (maximum file) size */
+	uint64_t		 dc_end;	/**< end of the last valid record */
+	uint64_t		 dc_map_hash;	/**< variable table digest */
+	struct bhnd_dcache_slot	*dc_slots;	/**< index */
+	size_t			 dc_nslots;	/**< index size; a power of two */
+	atomic_size_t		 dc_count;	/**< indexed records */
+	pthread_mutex_t		 dc_lock;	/**< serializes inserts */
+};
+
+/** A cached decode result */
+struct bhnd_dcache_rec {
+	const uint8_t	*dr_data;	/**< payload */
+	size_t		 dr_len;	/**< payload length */
+	uint8_t		 dr_rev;	/**< SPROM revision */
+	size_t		 dr_nvars;	/**< variable count */
+};
+
+uint64_t	bhnd_dcache_map_hash(void);
+
+int	bhnd_dcache_open(struct bhnd_dcache *dc, const char *path, int flags,
+	    size_t max_entries, size_t max_size);
+void	bhnd_dcache_close(struct bhnd_dcache *dc);
+int	bhnd_dcache_lookup(struct bhnd_dcache *dc, const void *image,
+	    size_t size, struct bhnd_dcache_rec *rec);
+int	bhnd_dcache_decode(struct bhnd_dcache *dc, const void *image,
+	    size_t size, struct bhnd_dcache_rec *rec);
+int	bhnd_dcache_compact(const char *path);
+
+int	bhnd_dcache_rec_next(const struct bhnd_dcache_rec *rec, size_t *pos,
+	    const struct bhnd_nvram_var **nv, const uint32_t **vals,
+	    size_t *nvals, uint32_t *vmask);
+int	bhnd_dcache_rec_env(const struct bhnd_dcache_rec *rec, char *buf,
+	    size_t *len);
+
+#endif /* _NVRAM_DCACHE_H_ */
@@ -0,0 +1,535 @@
+//
+//  nvram_dedup.c
+//  ccmach
+//
+//  Created by Landon Fuller on 2/9/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nvram_dedup.h"
+
+#define	nitems(x)	(sizeof((x)) / sizeof((x)[0]))
+
+/** Default per-device variables */
+static const char *const bhnd_sprom_dedup_default_fields[] = {
+	"macaddr",
+	"boardnum",
+};
+
+/**
+ * Initialize a deduplication table.
+ *
+ * @param dd the table to initialize.
+ * @param fields per-device variable names, or NULL to use the defaults
+ * (macaddr and boardnum). The array must remain valid for the lifetime of
+ * @p dd.
+ * @param nfields number of entries in @p fields.
+ *
+ * @retval 0 success
+ * @retval ENOMEM if allocation fails.
+ */
+int
+bhnd_sprom_dedup_init (struct bhnd_sprom_dedup *dd, const char *const fields[],
+    size_t nfields)
+{
+	memset(dd, 0, sizeof(*dd));
+
+	if (fields == NULL) {
+		fields = bhnd_sprom_dedup_default_fields;
+		nfields = nitems(bhnd_sprom_dedup_default_fields);
+	}
+
+	dd->dd_fields = fields;
+	dd->dd_nfields = nfields;
+
+	dd->dd_nslots = 1024;
+	dd->dd_slots = calloc(dd->dd_nslots, sizeof(dd->dd_slots[0]));
+	if (dd->dd_slots == NULL)
+		return (ENOMEM);
+
+	return (0);
+}
+
+/** Release all resources held by @p dd */
+void
+bhnd_sprom_dedup_fini (struct bhnd_sprom_dedup *dd)
+{
+	for (size_t i = 0; i < nitems(dd->dd_layouts); i++) {
+		if (dd->dd_layouts[i] == NULL)
+			continue;
+
+		free(dd->dd_layouts[i]->dl_vars);
+		free(dd->dd_layouts[i]);
+		dd->dd_layouts[i] = NULL;
+	}
+
+	for (size_t i = 0; i < dd->dd_ntmpls; i++) {
+		free(dd->dd_tmpls[i].st_env);
+		free(dd->dd_tmpls[i].st_splice);
+	}
+
+	free(dd->dd_tmpls);
+	free(dd->dd_slots);
+
+	dd->dd_tmpls = NULL;
+	dd->dd_slots = NULL;
+	dd->dd_ntmpls = 0;
+}
+
+/** Return the byte mask of byte @p b of a @p sp element */
+static uint8_t
+bhnd_sprom_dedup_bmask (const struct bhnd_sprom_offset *sp, size_t b)
+{
+	return ((sp->mask >> (b * 8)) & 0xFF);
+}
+
+/**
+ * Build the masking layout for SPROM revision @p rev.
+ *
+ * Bits of the per-device variables are masked, along with the CRC byte.
+ * Any other variable sharing a masked bit would decode differently across
+ * the images of a template, and is treated as per-device as well.
+ */
+static int
+bhnd_sprom_dedup_layout_init (const struct bhnd_sprom_dedup *dd, uint8_t rev,
+    size_t size, struct bhnd_sprom_dedup_layout **layout)
+{
+	struct bhnd_sprom_dedup_layout	*dl;
+	const struct bhnd_nvram_var	*vars;
+	size_t				 num_vars;
+	bool				*pdev;
+
+	vars = bhnd_nvram_get_vars(&num_vars);
+
+	if ((dl = calloc(1, sizeof(*dl))) == NULL)
+		return (ENOMEM);
+
+	if ((pdev = calloc(num_vars + 1, sizeof(pdev[0]))) == NULL) {
+		free(dl);
+		return (ENOMEM);
+	}
+
+	dl->dl_rev = rev;
+	dl->dl_size = size;
+	memset(dl->dl_mask, 0xFF, size);
+	dl->dl_mask[size - 1] = 0;
+
+	/* Mask the per-device variables */
+	for (size_t f = 0; f < dd->dd_nfields; f++) {
+		const struct bhnd_nvram_var	*nv;
+		const struct bhnd_sprom_var	*sv;
+
+		if ((nv = bhnd_nvram_find_var(dd->dd_fields[f])) == NULL)
+			continue;
+
+		if ((sv = bhnd_nvram_find_sprom_var(nv, rev)) == NULL)
+			continue;
+
+		pdev[nv - vars] = true;
+		for (size_t i = 0; i < sv->num_offsets; i++) {
+			const struct bhnd_sprom_offset *sp = &sv->offsets[i];
+
+			for (size_t n = 0; n < sp->count * sp->width; n++) {
+				size_t off = sp->offset + n;
+
+				if (off >= size)
+					break;
+
+				dl->dl_mask[off] &= ~bhnd_sprom_dedup_bmask(sp,
+				    n % sp->width);
+			}
+		}
+	}
+
+	/* Variables overlapping a masked bit */
+	for (size_t v = 0; v < num_vars; v++) {
+		const struct bhnd_sprom_var *sv;
+
+		if (pdev[v])
+			continue;
+
+		if ((sv = bhnd_nvram_find_sprom_var(&vars[v], rev)) == NULL)
+			continue;
+
+		for (size_t i = 0; i < sv->num_offsets && !pdev[v]; i++) {
+			const struct bhnd_sprom_offset *sp = &sv->offsets[i];
+
+			for (size_t n = 0; n < sp->count * sp->width; n++) {
+				size_t off = sp->offset + n;
+
+				if (off >= size)
+					break;
+
+				if (bhnd_sprom_dedup_bmask(sp, n % sp->width) &
+				    ~dl->dl_mask[off])
+				{
+					pdev[v] = true;
+					break;
+				}
+			}
+		}
+	}
+
+	for (size_t v = 0; v < num_vars; v++) {
+		if (pdev[v])
+			dl->dl_nvars++;
+	}
+
+	if ((dl->dl_vars = calloc(dl->dl_nvars + 1, sizeof(size_t))) == NULL) {
+		free(pdev);
+		free(dl);
+		return (ENOMEM);
+	}
+
+	dl->dl_nvars = 0;
+	for (size_t v = 0; v < num_vars; v++) {
+		if (pdev[v])
+			dl->dl_vars[dl->dl_nvars++] = v;
+	}
+
+	free(pdev);
+	*layout = dl;
+	return (0);
+}
+
+/** FNV-1a hash of @p image, masked by @p dl */
+static uint64_t
+bhnd_sprom_dedup_hash (const struct bhnd_sprom_dedup_layout *dl,
+    const uint8_t *image)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < dl->dl_size; i++) {
+		h ^= image[i] & dl->dl_mask[i];
+		h *= 1099511628211ULL;
+	}
+
+	return (h);
+}
+
+/** Return true if @p image matches the masked image of @p st */
+static bool
+bhnd_sprom_dedup_match (const struct bhnd_sprom_tmpl *st, const uint8_t *image)
+{
+	const struct bhnd_sprom_dedup_layout *dl = st->st_layout;
+
+	for (size_t i = 0; i < dl->dl_size; i++) {
+		if ((image[i] & dl->dl_mask[i]) != st->st_image[i])
+			return (false);
+	}
+
+	return (true);
+}
+
+/** Format a single variable pair, as in bhnd_sprom_decode() */
+static int
+bhnd_sprom_dedup_fmt_var (struct bhnd_sprom_ctx *ctx,
+    const struct bhnd_nvram_var *nv, struct bhnd_nvram_obuf *ob)
+{
+	int error;
+
+	error = bhnd_sprom_decode_var(ctx, nv);
+	if (error == ENOENT)
+		return (0);
+	else if (error)
+		return (error);
+
+	if ((nv->flags & BHND_NVRAM_VF_IGNALL1) && ctx->sp_all1)
+		return (0);
+
+	return (bhnd_nvram_fmt_pair(ob, nv, ctx->sp_vals, ctx->sp_nvals,
+	    ctx->sp_vmask));
+}
+
+/**
+ * Format the environment of @p ctx's image, excluding the per-device
+ * variables of @p dl and the terminating NUL, recording the offset at
+ * which each per-device variable would appear in @p splice.
+ */
+static int
+bhnd_sprom_dedup_fmt_tmpl (const struct bhnd_sprom_dedup_layout *dl,
+    struct bhnd_sprom_ctx *ctx, struct bhnd_nvram_obuf *ob, size_t *splice)
+{
+	const struct bhnd_nvram_var	*vars;
+	size_t				 num_vars, n;
+	int				 error;
+
+	bhnd_nvram_put_str(ob, "sromrev=");
+	bhnd_nvram_put_udec(ob, ctx->sp_rev);
+	bhnd_nvram_put_char(ob, '\0');
+
+	vars = bhnd_nvram_get_vars(&num_vars);
+	n = 0;
+	for (size_t i = 0; i < num_vars; i++) {
+		if (n < dl->dl_nvars && dl->dl_vars[n] == i) {
+			splice[n++] = ob->ob_len;
+			continue;
+		}
+
+		if ((error = bhnd_sprom_dedup_fmt_var(ctx, &vars[i], ob)))
+			return (error);
+	}
+
+	return (0);
+}
+
+/** Decode the template environment of @p st from the image in @p ctx */
+static int
+bhnd_sprom_dedup_tmpl_decode (struct bhnd_sprom_tmpl *st,
+    struct bhnd_sprom_ctx *ctx)
+{
+	const struct bhnd_sprom_dedup_layout	*dl = st->st_layout;
+	struct bhnd_nvram_obuf			 ob;
+	int					 error;
+
+	st->st_splice = calloc(dl->dl_nvars + 1, sizeof(st->st_splice[0]));
+	if (st->st_splice == NULL)
+		return (ENOMEM);
+
+	/* Sizing pass */
+	bhnd_nvram_obuf_init(&ob, NULL, 0);
+	if ((error = bhnd_sprom_dedup_fmt_tmpl(dl, ctx, &ob, st->st_splice)))
+		return (error);
+
+	st->st_env_len = ob.ob_len;
+	if ((st->st_env = malloc(st->st_env_len + 1)) == NULL)
+		return (ENOMEM);
+
+	/* Formatting pass */
+	bhnd_nvram_obuf_init(&ob, st->st_env, st->st_env_len);
+	if ((error = bhnd_sprom_dedup_fmt_tmpl(dl, ctx, &ob, st->st_splice)))
+		return (error);
+
+	if (ob.ob_len != st->st_env_len)
+		return (EINVAL);
+
+	return (0);
+}
+
+/** Double the size of the template hash table */
+static int
+bhnd_sprom_dedup_grow (struct bhnd_sprom_dedup *dd)
+{
+	size_t	*slots;
+	size_t	 nslots;
+
+	nslots = dd->dd_nslots * 2;
+	if ((slots = calloc(nslots, sizeof(slots[0]))) == NULL)
+		return (ENOMEM);
+
+	for (size_t i = 0; i < dd->dd_ntmpls; i++) {
+		size_t h = dd->dd_tmpls[i].st_hash & (nslots - 1);
+
+		while (slots[h] != 0)
+			h = (h + 1) & (nslots - 1);
+
+		slots[h] = i + 1;
+	}
+
+	free(dd->dd_slots);
+	dd->dd_slots = slots;
+	dd->dd_nslots = nslots;
+	return (0);
+}
+
+/**
+ * Add a SPROM image to @p dd, returning the index of the template it
+ * shares with all images of identical masked content.
+ *
+ * If no such template exists, one is created and decoded from @p image.
+ *
+ * @param dd deduplication table.
+ * @param image SPROM image.
+ * @param size size of @p image.
+ * @param[out] tmpl on success, the template index.
+ *
+ * @retval 0 success
+ * @retval EINVAL if @p image is not a valid SPROM image.
+ * @retval ENOMEM if allocation fails.
+ */
+int
+bhnd_sprom_dedup_add (struct bhnd_sprom_dedup *dd, const void *image,
+    size_t size, size_t *tmpl)
+{
+	struct bhnd_sprom_ctx		 ctx;
+	struct bhnd_sprom_dedup_layout	*dl;
+	struct bhnd_sprom_tmpl		*st;
+	uint64_t			 hash;
+	size_t				 h;
+	int				 error;
+
+	if ((error = bhnd_sprom_ctx_init(&ctx, image, size)))
+		return (error);
+
+	if ((dl = dd->dd_layouts[ctx.sp_rev]) == NULL) {
+		error = bhnd_sprom_dedup_layout_init(dd, ctx.sp_rev,
+		    ctx.sp_size, &dl);
+		if (error)
+			return (error);
+
+		dd->dd_layouts[ctx.sp_rev] = dl;
+	}
+
+	/* Identified images of a given revision share a single layout size */
+	if (dl->dl_size != ctx.sp_size)
+		return (EINVAL);
+
+	hash = bhnd_sprom_dedup_hash(dl, ctx.sp_image);
+	for (h = hash & (dd->dd_nslots - 1); dd->dd_slots[h] != 0;
+	    h = (h + 1) & (dd->dd_nslots - 1))
+	{
+		st = &dd->dd_tmpls[dd->dd_slots[h] - 1];
+		if (st->st_hash == hash && st->st_layout == dl &&
+		    bhnd_sprom_dedup_match(st, ctx.sp_image))
+		{
+			st->st_count++;
+			dd->dd_nimages++;
+			*tmpl = dd->dd_slots[h] - 1;
+			return (0);
+		}
+	}
+
+	/* New template */
+	if (dd->dd_ntmpls == dd->dd_tmpls_cap) {
+		size_t cap = dd->dd_tmpls_cap ? dd->dd_tmpls_cap * 2 : 64;
+
+		st = realloc(dd->dd_tmpls, cap * sizeof(st[0]));
+		if (st == NULL)
+			return (ENOMEM);
+
+		dd->dd_tmpls = st;
+		dd->dd_tmpls_cap = cap;
+	}
+
+	st = &dd->dd_tmpls[dd->dd_ntmpls];
+	memset(st, 0, sizeof(*st));
+	st->st_hash = hash;
+	st->st_layout = dl;
+	st->st_count = 1;
+	for (size_t i = 0; i < dl->dl_size; i++)
+		st->st_image[i] = ctx.sp_image[i] & dl->dl_mask[i];
+
+	if ((error = bhnd_sprom_dedup_tmpl_decode(st, &ctx))) {
+		free(st->st_env);
+		free(st->st_splice);
+		return (error);
+	}
+
+	dd->dd_slots[h] = ++dd->dd_ntmpls;
+	dd->dd_nimages++;
+	*tmpl = dd->dd_ntmpls - 1;
+
+	/* Keep the table at most half full */
+	if (dd->dd_ntmpls * 2 > dd->dd_nslots) {
+		if ((error = bhnd_sprom_dedup_grow(dd)))
+			return (error);
+	}
+
+	return (0);
+}
+
+/** Splice the per-device variables of @p ctx into @p st's environment */
+static int
+bhnd_sprom_dedup_fmt_patch (const struct bhnd_sprom_tmpl *st,
+    struct bhnd_sprom_ctx *ctx, struct bhnd_nvram_obuf *ob)
+{
+	const struct bhnd_sprom_dedup_layout	*dl = st->st_layout;
+	const struct bhnd_nvram_var		*vars;
+	size_t					 num_vars, pos;
+	int					 error;
+
+	vars = bhnd_nvram_get_vars(&num_vars);
+
+	pos = 0;
+	for (size_t n = 0; n < dl->dl_nvars; n++) {
+		bhnd_nvram_put_bytes(ob, st->st_env + pos,
+		    st->st_splice[n] - pos);
+		pos = st->st_splice[n];
+
+		error = bhnd_sprom_dedup_fmt_var(ctx, &vars[dl->dl_vars[n]],
+		    ob);
+		if (error)
+			return (error);
+	}
+
+	bhnd_nvram_put_bytes(ob, st->st_env + pos, st->st_env_len - pos);
+	bhnd_nvram_put_char(ob, '\0');
+
+	return (0);
+}
+
+/**
+ * Produce the decoded environment of @p image from template @p tmpl,
+ * decoding only its per-device variables.
+ *
+ * @p image must be one of the images for which bhnd_sprom_dedup_add()
+ * returned @p tmpl; the result is then identical to that of
+ * bhnd_sprom_decode_alloc(). The image was identified and its CRC
+ * verified when it was added, and neither is repeated here.
+ *
+ * @param dd deduplication table.
+ * @param tmpl template index.
+ * @param image SPROM image.
+ * @param size size of @p image.
+ * @param[out] env on success, the packed "name=value\0...\0\0"
+ * environment. The caller is responsible for deallocating this buffer
+ * via free(3).
+ * @param[out] len on success, the size of @p env.
+ *
+ * @retval 0 success
+ * @retval EINVAL if @p image is smaller than the template's SPROM layout,
+ * or @p tmpl is out of range.
+ * @retval ENOMEM if allocation fails.
+ */
+int
+bhnd_sprom_dedup_decode (const struct bhnd_sprom_dedup *dd, size_t tmpl,
+    const void *image, size_t size, char **env, size_t *len)
+{
+	const struct bhnd_sprom_tmpl	*st;
+	struct bhnd_sprom_ctx		 ctx;
+	struct bhnd_nvram_obuf		 ob;
+	char				*buf;
+	size_t				 total;
+	int				 error;
+
+	if (tmpl >= dd->dd_ntmpls)
+		return (EINVAL);
+
+	st = &dd->dd_tmpls[tmpl];
+	if (size < st->st_layout->dl_size)
+		return (EINVAL);
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.sp_image = image;
+	ctx.sp_size = st->st_layout->dl_size;
+	ctx.sp_rev = st->st_layout->dl_rev;
+
+	/* Sizing pass */
+	bhnd_nvram_obuf_init(&ob, NULL, 0);
+	if ((error = bhnd_sprom_dedup_fmt_patch(st, &ctx, &ob)))
+		return (error);
+
+	total = ob.ob_len;
+	if ((buf = malloc(total)) == NULL)
+		return (ENOMEM);
+
+	/* Formatting pass */
+	bhnd_nvram_obuf_init(&ob, buf, total);
+	if ((error = bhnd_sprom_dedup_fmt_patch(st, &ctx, &ob))) {
+		free(buf);
+		return (error);
+	}
+
+	if (ob.ob_len != total) {
+		free(buf);
+		return (EINVAL);
+	}
+
+	*env = buf;
+	*len = total;
+	return (0);
+}
@@ -0,0 +1,77 @@
+//
+//  nvram_dedup.h
+//  ccmach
+//
+//  Created by Landon Fuller on 2/9/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef _NVRAM_DEDUP_H_
+#define _NVRAM_DEDUP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nvram_sprom.h"
+
+/*
+ * Content-addressed deduplication of SPROM images.
+ *
+ * Images are hashed with their per-device fields (by default, macaddr and
+ * boardnum) and CRC masked out, using the per-revision offsets from the
+ * generated variable table. Images with identical masked content share a
+ * single template; each template is decoded once, and the environment of
+ * any image sharing it is produced by splicing that image's per-device
+ * variables into the template's environment. The result is identical to
+ * bhnd_sprom_decode() of the image itself.
+ */
+
+/** Per-revision masking layout */
+struct bhnd_sprom_dedup_layout {
+	uint8_t		 dl_rev;		/**< SPROM revision */
+	size_t		 dl_size;		/**< SPROM image size */
+	uint8_t		 dl_mask[BHND_SPROM_MAX_SIZE];	/**< per-byte mask; clear
+							     bits are per-device */
+	size_t		*dl_vars;		/**< per-device variable table
+						     indices, ascending */
+	size_t		 dl_nvars;		/**< per-device variable count */
+};
+
+/** Deduplicated image template */
+struct bhnd_sprom_tmpl {
+	uint64_t				 st_hash;	/**< masked image hash */
+	const struct bhnd_sprom_dedup_layout	*st_layout;	/**< masking layout */
+	uint8_t					 st_image[BHND_SPROM_MAX_SIZE];	/**< masked image */
+	uint64_t				 st_count;	/**< images sharing this template */
+	char					*st_env;	/**< environment, excluding
+								     per-device variables and
+								     the terminating NUL */
+	size_t					 st_env_len;	/**< st_env length */
+	size_t					*st_splice;	/**< st_env offset of each
+								     per-device variable */
+};
+
+/** Deduplication table */
+struct bhnd_sprom_dedup {
+	const char *const		*dd_fields;	/**< per-device variable names */
+	size_t				 dd_nfields;	/**< per-device variable count */
+	struct bhnd_sprom_dedup_layout	*dd_layouts[UINT8_MAX + 1];	/**< by revision */
+
+	struct bhnd_sprom_tmpl		*dd_tmpls;	/**< templates */
+	size_t				 dd_ntmpls;	/**< template count */
+	size_t				 dd_tmpls_cap;	/**< dd_tmpls capacity */
+	size_t				*dd_slots;	/**< hash table; template index + 1 */
+	size_t				 dd_nslots;	/**< hash table size; a power of two */
+	uint64_t			 dd_nimages;	/**< images added */
+};
+
+int	bhnd_sprom_dedup_init(struct bhnd_sprom_dedup *dd,
+	    const char *const fields[], size_t nfields);
+void	bhnd_sprom_dedup_fini(struct bhnd_sprom_dedup *dd);
+int	bhnd_sprom_dedup_add(struct bhnd_sprom_dedup *dd, const void *image,
+	    size_t size, size_t *tmpl);
+int	bhnd_sprom_dedup_decode(const struct bhnd_sprom_dedup *dd,
+	    size_t tmpl, const void *image, size_t size, char **env,
+	    size_t *len);
+
+#endif /* _NVRAM_DEDUP_H_ */
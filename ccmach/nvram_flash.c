@@ -0,0 +1,157 @@
+//
+//  nvram_flash.c
+//  ccmach
+//
+//  Created by Landon Fuller on 1/31/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nvram_flash.h"
+#include "nvram_scan.h"
+#include "nvram_sprom.h"
+
+/** Read a little-endian 32-bit header field */
+static uint32_t
+bhnd_nvram_flash_le32 (const uint8_t *p)
+{
+	return (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+/**
+ * Parse and validate a flash NVRAM image.
+ *
+ * The header magic, length, and CRC-8 are validated, and the variable data
+ * is split into records in a single pass. If a variable is defined more
+ * than once, the last definition wins; the record retains the position of
+ * the first definition.
+ *
+ * @param fl the parsed image.
+ * @param image flash NVRAM image, beginning with its header.
+ * @param size size of @p image; may be larger than the header's length.
+ *
+ * @retval 0 success
+ * @retval EINVAL if @p image is not a valid flash NVRAM image.
+ * @retval ENOMEM if allocation fails.
+ */
+int
+bhnd_nvram_flash_parse (struct bhnd_nvram_flash *fl, const void *image,
+    size_t size)
+{
+	const uint8_t	*hdr;
+	const char	*data, *end, *p;
+	uint32_t	*slots;
+	uint32_t	 len, crc_ver_init;
+	size_t		 nmax, tblmask;
+	uint8_t		 crc;
+	int		 error;
+
+	memset(fl, 0, sizeof(*fl));
+	hdr = (const uint8_t *)image;
+
+	if (size < BHND_NVRAM_FLASH_HDR_SIZE)
+		return (EINVAL);
+
+	if (bhnd_nvram_flash_le32(hdr) != BHND_NVRAM_FLASH_MAGIC)
+		return (EINVAL);
+
+	len = bhnd_nvram_flash_le32(hdr + 4);
+	if (len < BHND_NVRAM_FLASH_HDR_SIZE || len > size)
+		return (EINVAL);
+
+	/* The CRC covers the trailing header fields and the variable data */
+	crc_ver_init = bhnd_nvram_flash_le32(hdr + 8);
+	crc = bhnd_nvram_crc8(hdr + BHND_NVRAM_FLASH_CRC_START,
+	    BHND_NVRAM_FLASH_HDR_SIZE - BHND_NVRAM_FLASH_CRC_START,
+	    BHND_NVRAM_CRC8_INITIAL);
+	crc = bhnd_nvram_crc8(hdr + BHND_NVRAM_FLASH_HDR_SIZE,
+	    len - BHND_NVRAM_FLASH_HDR_SIZE, crc);
+	if (crc != (crc_ver_init & 0xFF))
+		return (EINVAL);
+
+	fl->nf_version = (crc_ver_init >> 8) & 0xFF;
+	fl->nf_sdram_init = (crc_ver_init >> 16) & 0xFFFF;
+
+	data = (const char *)hdr + BHND_NVRAM_FLASH_HDR_SIZE;
+	end = (const char *)hdr + len;
+	if (data == end)
+		return (0);
+
+	/* The final record must be NUL terminated */
+	if (end[-1] != '\0')
+		return (EINVAL);
+
+	/* Every record is NUL terminated; this bounds the record count */
+	nmax = bhnd_nvram_count(data, end, '\0');
+
+	fl->nf_recs = malloc(nmax * sizeof(fl->nf_recs[0]));
+	if (fl->nf_recs == NULL)
+		return (ENOMEM);
+
+	/* Name hash table, mapping to record index + 1 (0 if unused) */
+	for (tblmask = 7; tblmask + 1 < nmax * 2; tblmask = (tblmask << 1) | 1)
+		continue;
+
+	if ((slots = calloc(tblmask + 1, sizeof(slots[0]))) == NULL) {
+		bhnd_nvram_flash_fini(fl);
+		return (ENOMEM);
+	}
+
+	error = 0;
+	for (p = data; p < end && *p != '\0';) {
+		struct bhnd_nvram_flash_rec	*rec;
+		const char			*eq, *nul;
+		size_t				 name_len, i;
+
+		eq = bhnd_nvram_scan2(p, end, '=', '\0');
+		if (*eq != '=') {
+			error = EINVAL;
+			break;
+		}
+
+		nul = bhnd_nvram_scan2(eq + 1, end, '\0', '\0');
+		name_len = eq - p;
+
+		/* Find the existing record, or an unused slot */
+		i = bhnd_nvram_hash(p, name_len) & tblmask;
+		for (; slots[i] != 0; i = (i + 1) & tblmask) {
+			rec = &fl->nf_recs[slots[i] - 1];
+			if (rec->name_len == name_len &&
+			    memcmp(rec->name, p, name_len) == 0)
+				break;
+		}
+
+		if (slots[i] == 0) {
+			slots[i] = (uint32_t)++fl->nf_count;
+			rec = &fl->nf_recs[fl->nf_count - 1];
+			rec->name = p;
+			rec->name_len = name_len;
+		} else {
+			rec = &fl->nf_recs[slots[i] - 1];
+		}
+
+		rec->value = eq + 1;
+		rec->value_len = nul - (eq + 1);
+
+		p = nul + 1;
+	}
+
+	free(slots);
+
+	if (error)
+		bhnd_nvram_flash_fini(fl);
+
+	return (error);
+}
+
+/** Release all resources held by @p fl */
+void
+bhnd_nvram_flash_fini (struct bhnd_nvram_flash *fl)
+{
+	free(fl->nf_recs);
+	fl->nf_recs = NULL;
+	fl->nf_count = 0;
+}
@@ -0,0 +1,45 @@
+//
+//  nvram_flash.h
+//  ccmach
+//
+//  Created by Landon Fuller on 1/31/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef _NVRAM_FLASH_H_
+#define _NVRAM_FLASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define	BHND_NVRAM_FLASH_MAGIC		0x48534C46	/**< 'FLSH' */
+#define	BHND_NVRAM_FLASH_HDR_SIZE	20		/**< header size */
+#define	BHND_NVRAM_FLASH_CRC_START	9		/**< CRC-8 coverage begins after
+							     the magic, len, and crc */
+
+/** A flash NVRAM record */
+struct bhnd_nvram_flash_rec {
+	const char	*name;		/**< variable name (not NUL terminated) */
+	size_t		 name_len;	/**< name length */
+	const char	*value;		/**< variable value (NUL terminated) */
+	size_t		 value_len;	/**< value length */
+};
+
+/**
+ * Parsed flash NVRAM image.
+ *
+ * Records reference the parsed image in place; the image must not be
+ * modified or deallocated while the records are in use.
+ */
+struct bhnd_nvram_flash {
+	uint8_t				 nf_version;	/**< header format version */
+	uint16_t			 nf_sdram_init;	/**< header sdram_init value */
+	struct bhnd_nvram_flash_rec	*nf_recs;	/**< records, in image order */
+	size_t				 nf_count;	/**< number of records */
+};
+
+int	bhnd_nvram_flash_parse(struct bhnd_nvram_flash *fl, const void *image,
+	    size_t size);
+void	bhnd_nvram_flash_fini(struct bhnd_nvram_flash *fl);
+
+#endif /* _NVRAM_FLASH_H_ */
@@ -0,0 +1,502 @@
+//
+//  nvram_fmt.c
+//  ccmach
+//
+//  Created by Landon Fuller on 1/29/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#include <errno.h>
+#include <string.h>
+
+#include "nvram_fmt.h"
+
+/*
+ * Table-driven integer formatting.
+ *
+ * Values are converted directly into the output buffer; no format strings
+ * are parsed, and no intermediate buffers beyond a single digit scratch
+ * area are used.
+ */
+
+static const char bhnd_nvram_hex_digits[] = "0123456789abcdef";
+
+static const char bhnd_nvram_dec_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/** Return the number of digits required to represent @p v in base 16 */
+static size_t
+bhnd_nvram_hex_len (uint32_t v)
+{
+	size_t n = 1;
+	while (v >>= 4)
+		n++;
+
+	return (n);
+}
+
+/** Return the number of digits required to represent @p v in base 10 */
+static size_t
+bhnd_nvram_dec_len (uint32_t v)
+{
+	static const uint32_t pow10[] = {
+		10U, 100U, 1000U, 10000U, 100000U, 1000000U, 10000000U,
+		100000000U, 1000000000U
+	};
+
+	size_t n = 1;
+	while (n <= sizeof(pow10) / sizeof(pow10[0]) && v >= pow10[n-1])
+		n++;
+
+	return (n);
+}
+
+void
+bhnd_nvram_put_bytes (struct bhnd_nvram_obuf *ob, const char *p, size_t len)
+{
+	if (ob->ob_len < ob->ob_size) {
+		size_t avail = ob->ob_size - ob->ob_len;
+		memcpy(ob->ob_buf + ob->ob_len, p, (len < avail) ? len : avail);
+	}
+
+	ob->ob_len += len;
+}
+
+void
+bhnd_nvram_put_str (struct bhnd_nvram_obuf *ob, const char *str)
+{
+	bhnd_nvram_put_bytes(ob, str, strlen(str));
+}
+
+/** Write @p v as a '0x'-prefixed, lower-case hex string */
+void
+bhnd_nvram_put_hex (struct bhnd_nvram_obuf *ob, uint32_t v)
+{
+	char	 tmp[2 + 8];
+	char	*p = tmp + sizeof(tmp);
+
+	/* Sizing only */
+	if (ob->ob_buf == NULL) {
+		ob->ob_len += 2 + bhnd_nvram_hex_len(v);
+		return;
+	}
+
+	do {
+		*--p = bhnd_nvram_hex_digits[v & 0xF];
+		v >>= 4;
+	} while (v != 0);
+
+	*--p = 'x';
+	*--p = '0';
+
+	bhnd_nvram_put_bytes(ob, p, (tmp + sizeof(tmp)) - p);
+}
+
+/** Write @p v as an unsigned decimal string */
+void
+bhnd_nvram_put_udec (struct bhnd_nvram_obuf *ob, uint32_t v)
+{
+	char	 tmp[10];
+	char	*p = tmp + sizeof(tmp);
+
+	/* Sizing only */
+	if (ob->ob_buf == NULL) {
+		ob->ob_len += bhnd_nvram_dec_len(v);
+		return;
+	}
+
+	while (v >= 100) {
+		const char *d = &bhnd_nvram_dec_pairs[(v % 100) * 2];
+		v /= 100;
+
+		*--p = d[1];
+		*--p = d[0];
+	}
+
+	if (v >= 10) {
+		const char *d = &bhnd_nvram_dec_pairs[v * 2];
+		*--p = d[1];
+		*--p = d[0];
+	} else {
+		*--p = '0' + v;
+	}
+
+	bhnd_nvram_put_bytes(ob, p, (tmp + sizeof(tmp)) - p);
+}
+
+/** Write @p v as a signed decimal string */
+void
+bhnd_nvram_put_sdec (struct bhnd_nvram_obuf *ob, int32_t v)
+{
+	if (v < 0) {
+		bhnd_nvram_put_char(ob, '-');
+		bhnd_nvram_put_udec(ob, -(uint32_t)v);
+	} else {
+		bhnd_nvram_put_udec(ob, (uint32_t)v);
+	}
+}
+
+/** Sign-extend @p v from the most significant bit set in @p vmask */
+static int32_t
+bhnd_nvram_sext (uint32_t v, uint32_t vmask)
+{
+	uint32_t sign;
+
+	if (vmask == 0)
+		return (v);
+
+	sign = 1U << 31;
+	while ((vmask & sign) == 0)
+		sign >>= 1;
+
+	if (v & sign)
+		v |= ~(sign | (sign - 1));
+
+	return ((int32_t)v);
+}
+
+/** Write a MAC address (six octets) in canonical ':'-separated form */
+static int
+bhnd_nvram_fmt_macaddr (struct bhnd_nvram_obuf *ob, const uint32_t *vals,
+    size_t nvals)
+{
+	char	tmp[17];
+	char	*p = tmp;
+
+	if (nvals != 6)
+		return (EINVAL);
+
+	for (size_t i = 0; i < 6; i++) {
+		if (i > 0)
+			*p++ = ':';
+
+		*p++ = bhnd_nvram_hex_digits[(vals[i] >> 4) & 0xF];
+		*p++ = bhnd_nvram_hex_digits[vals[i] & 0xF];
+	}
+
+	bhnd_nvram_put_bytes(ob, tmp, sizeof(tmp));
+	return (0);
+}
+
+/** Write an LED duty cycle (off, on) as (oncount << 24) | (offcount << 8) */
+static int
+bhnd_nvram_fmt_leddc (struct bhnd_nvram_obuf *ob, const uint32_t *vals,
+    size_t nvals)
+{
+	if (nvals != 2)
+		return (EINVAL);
+
+	bhnd_nvram_put_sdec(ob,
+	    (int32_t)(((vals[1] & 0xFF) << 24) | ((vals[0] & 0xFF) << 8)));
+	return (0);
+}
+
+/** Write a country code; an unset (all-zero) code is written as "" */
+static int
+bhnd_nvram_fmt_ccode (struct bhnd_nvram_obuf *ob, const uint32_t *vals,
+    size_t nvals)
+{
+	bool empty = true;
+	for (size_t i = 0; i < nvals; i++)
+		empty &= (vals[i] == 0);
+
+	if (empty)
+		return (0);
+
+	for (size_t i = 0; i < nvals; i++)
+		bhnd_nvram_put_char(ob, (char)vals[i]);
+
+	return (0);
+}
+
+/** Write @p nvals comma-separated integer (or character) values */
+static int
+bhnd_nvram_fmt_ints (struct bhnd_nvram_obuf *ob, bhnd_nvram_fmt fmt,
+    bhnd_nvram_dt type, const uint32_t *vals, size_t nvals, uint32_t vmask)
+{
+	for (size_t i = 0; i < nvals; i++) {
+		if (i > 0)
+			bhnd_nvram_put_char(ob, ',');
+
+		if (type == BHND_NVRAM_DT_CHAR)
+			bhnd_nvram_put_char(ob, (char)vals[i]);
+		else if (fmt == BHND_NVRAM_VFMT_HEX)
+			bhnd_nvram_put_hex(ob, vals[i]);
+		else if (type == BHND_NVRAM_DT_SINT)
+			bhnd_nvram_put_sdec(ob, bhnd_nvram_sext(vals[i], vmask));
+		else
+			bhnd_nvram_put_udec(ob, vals[i]);
+	}
+
+	return (0);
+}
+
+/**
+ * Format @p nvals decoded values according to @p fmt.
+ *
+ * Signed decimal output is selected by a @p type of BHND_NVRAM_DT_SINT;
+ * values are sign-extended from the most significant bit of @p vmask.
+ *
+ * @retval 0 success
+ * @retval EINVAL if the value count is invalid for @p fmt.
+ */
+int
+bhnd_nvram_fmt_value (struct bhnd_nvram_obuf *ob, bhnd_nvram_fmt fmt,
+    bhnd_nvram_dt type, const uint32_t *vals, size_t nvals, uint32_t vmask)
+{
+	switch (fmt) {
+	case BHND_NVRAM_VFMT_MACADDR:
+		return (bhnd_nvram_fmt_macaddr(ob, vals, nvals));
+	case BHND_NVRAM_VFMT_LEDDC:
+		return (bhnd_nvram_fmt_leddc(ob, vals, nvals));
+	case BHND_NVRAM_VFMT_CCODE:
+		return (bhnd_nvram_fmt_ccode(ob, vals, nvals));
+	case BHND_NVRAM_VFMT_HEX:
+	case BHND_NVRAM_VFMT_DEC:
+		return (bhnd_nvram_fmt_ints(ob, fmt, type, vals, nvals, vmask));
+	}
+
+	return (EINVAL);
+}
+
+/**
+ * Format a "name=value\0" pair for @p nv.
+ *
+ * @retval 0 success
+ * @retval EINVAL if the value count is invalid for @p nv's format.
+ */
+int
+bhnd_nvram_fmt_pair (struct bhnd_nvram_obuf *ob,
+    const struct bhnd_nvram_var *nv, const uint32_t *vals, size_t nvals,
+    uint32_t vmask)
+{
+	int error;
+
+	bhnd_nvram_put_str(ob, nv->name);
+	bhnd_nvram_put_char(ob, '=');
+
+	error = bhnd_nvram_fmt_value(ob, nv->fmt, nv->type, vals, nvals, vmask);
+	if (error)
+		return (error);
+
+	bhnd_nvram_put_char(ob, '\0');
+	return (0);
+}
+
+/*
+ * String parsing; the inverse of bhnd_nvram_fmt_value().
+ */
+
+/** Return the value of hex digit @p c, or -1 if @p c is not a hex digit */
+static int
+bhnd_nvram_hex_digit (char c)
+{
+	if (c >= '0' && c <= '9')
+		return (c - '0');
+	else if (c >= 'a' && c <= 'f')
+		return (c - 'a' + 10);
+	else if (c >= 'A' && c <= 'F')
+		return (c - 'A' + 10);
+
+	return (-1);
+}
+
+/**
+ * Parse an integer from @p str; a '0x' prefix selects base 16, and a '-'
+ * prefix produces the (32-bit) two's complement of a decimal value.
+ */
+static int
+bhnd_nvram_parse_int (const char *str, size_t len, uint32_t *v)
+{
+	const char	*p, *end;
+	uint64_t	 n;
+	bool		 neg;
+
+	p = str;
+	end = str + len;
+	n = 0;
+
+	neg = (p < end && *p == '-');
+	if (neg)
+		p++;
+
+	if (p == end)
+		return (EINVAL);
+
+	if (!neg && end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+		for (p += 2; p < end; p++) {
+			int d = bhnd_nvram_hex_digit(*p);
+			if (d < 0)
+				return (EINVAL);
+
+			n = (n << 4) | d;
+			if (n > UINT32_MAX)
+				return (ERANGE);
+		}
+	} else {
+		for (; p < end; p++) {
+			if (*p < '0' || *p > '9')
+				return (EINVAL);
+
+			n = (n * 10) + (*p - '0');
+			if (n > UINT32_MAX)
+				return (ERANGE);
+		}
+	}
+
+	if (neg) {
+		if (n > (uint64_t)INT32_MAX + 1)
+			return (ERANGE);
+		*v = -(uint32_t)n;
+	} else {
+		*v = (uint32_t)n;
+	}
+
+	return (0);
+}
+
+/** Parse a MAC address (six ':'-separated hex octets) */
+static int
+bhnd_nvram_parse_macaddr (const char *str, size_t len, uint32_t *vals,
+    size_t count)
+{
+	if (count != 6 || len != 17)
+		return (EINVAL);
+
+	for (size_t i = 0; i < 6; i++) {
+		const char	*p = str + (i * 3);
+		int		 hi, lo;
+
+		if (i > 0 && p[-1] != ':')
+			return (EINVAL);
+
+		hi = bhnd_nvram_hex_digit(p[0]);
+		lo = bhnd_nvram_hex_digit(p[1]);
+		if (hi < 0 || lo < 0)
+			return (EINVAL);
+
+		vals[i] = (hi << 4) | lo;
+	}
+
+	return (0);
+}
+
+/** Parse an LED duty cycle, written as (oncount << 24) | (offcount << 8) */
+static int
+bhnd_nvram_parse_leddc (const char *str, size_t len, uint32_t *vals,
+    size_t count)
+{
+	uint32_t	v;
+	int		error;
+
+	if (count != 2)
+		return (EINVAL);
+
+	if ((error = bhnd_nvram_parse_int(str, len, &v)))
+		return (error);
+
+	vals[0] = (v >> 8) & 0xFF;
+	vals[1] = (v >> 24) & 0xFF;
+	return (0);
+}
+
+/** Parse a country code; an empty string is an unset (all-zero) code */
+static int
+bhnd_nvram_parse_ccode (const char *str, size_t len, uint32_t *vals,
+    size_t count)
+{
+	if (len > count)
+		return (EINVAL);
+
+	for (size_t i = 0; i < count; i++)
+		vals[i] = (i < len) ? (uint8_t)str[i] : 0;
+
+	return (0);
+}
+
+/** Parse @p count comma-separated integer (or character) values */
+static int
+bhnd_nvram_parse_ints (bhnd_nvram_dt type, const char *str, size_t len,
+    uint32_t *vals, size_t count)
+{
+	const char	*p, *end;
+	int		 error;
+
+	p = str;
+	end = str + len;
+	for (size_t i = 0; i < count; i++) {
+		const char *sep;
+
+		if (i > 0) {
+			if (p == end || *p != ',')
+				return (EINVAL);
+			p++;
+		}
+
+		if (type == BHND_NVRAM_DT_CHAR) {
+			if (p == end)
+				return (EINVAL);
+			vals[i] = (uint8_t)*p++;
+			continue;
+		}
+
+		if ((sep = memchr(p, ',', end - p)) == NULL)
+			sep = end;
+
+		if ((error = bhnd_nvram_parse_int(p, sep - p, &vals[i])))
+			return (error);
+
+		p = sep;
+	}
+
+	if (p != end)
+		return (EINVAL);
+
+	return (0);
+}
+
+/**
+ * Parse a value string formatted according to @p fmt.
+ *
+ * Signed values are returned sign-extended to 32 bits; range checking
+ * against a variable's encoding is left to the caller.
+ *
+ * @param fmt string format.
+ * @param type base data type.
+ * @param str value string (need not be NUL terminated).
+ * @param len length of @p str.
+ * @param[out] vals parsed values.
+ * @param count the required number of values.
+ *
+ * @retval 0 success
+ * @retval EINVAL if @p str is malformed, or does not contain @p count
+ * values.
+ * @retval ERANGE if a value exceeds 32 bits.
+ */
+int
+bhnd_nvram_parse_value (bhnd_nvram_fmt fmt, bhnd_nvram_dt type,
+    const char *str, size_t len, uint32_t *vals, size_t count)
+{
+	switch (fmt) {
+	case BHND_NVRAM_VFMT_MACADDR:
+		return (bhnd_nvram_parse_macaddr(str, len, vals, count));
+	case BHND_NVRAM_VFMT_LEDDC:
+		return (bhnd_nvram_parse_leddc(str, len, vals, count));
+	case BHND_NVRAM_VFMT_CCODE:
+		return (bhnd_nvram_parse_ccode(str, len, vals, count));
+	case BHND_NVRAM_VFMT_HEX:
+	case BHND_NVRAM_VFMT_DEC:
+		return (bhnd_nvram_parse_ints(type, str, len, vals, count));
+	}
+
+	return (EINVAL);
+}
@@ -0,0 +1,70 @@
+//
+//  nvram_fmt.h
+//  ccmach
+//
+//  Created by Landon Fuller on 1/29/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef _NVRAM_FMT_H_
+#define _NVRAM_FMT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nvram_map.h"
+
+/**
+ * NVRAM string output buffer.
+ *
+ * Output beyond the buffer's capacity is discarded, but is still counted
+ * in ob_len; a NULL buffer may be used to determine the required size.
+ */
+struct bhnd_nvram_obuf {
+	char	*ob_buf;	/**< output buffer, or NULL */
+	size_t	 ob_size;	/**< output buffer capacity */
+	size_t	 ob_len;	/**< total output length; may exceed ob_size */
+};
+
+static inline void
+bhnd_nvram_obuf_init (struct bhnd_nvram_obuf *ob, char *buf, size_t size)
+{
+	ob->ob_buf = buf;
+	ob->ob_size = (buf != NULL) ? size : 0;
+	ob->ob_len = 0;
+}
+
+/** Return true if all output written to @p ob fit within its buffer */
+static inline bool
+bhnd_nvram_obuf_fits (const struct bhnd_nvram_obuf *ob)
+{
+	return (ob->ob_len <= ob->ob_size);
+}
+
+static inline void
+bhnd_nvram_put_char (struct bhnd_nvram_obuf *ob, char c)
+{
+	if (ob->ob_len < ob->ob_size)
+		ob->ob_buf[ob->ob_len] = c;
+
+	ob->ob_len++;
+}
+
+void	bhnd_nvram_put_bytes(struct bhnd_nvram_obuf *ob, const char *p,
+	    size_t len);
+void	bhnd_nvram_put_str(struct bhnd_nvram_obuf *ob, const char *str);
+void	bhnd_nvram_put_hex(struct bhnd_nvram_obuf *ob, uint32_t v);
+void	bhnd_nvram_put_udec(struct bhnd_nvram_obuf *ob, uint32_t v);
+void	bhnd_nvram_put_sdec(struct bhnd_nvram_obuf *ob, int32_t v);
+
+int	bhnd_nvram_fmt_value(struct bhnd_nvram_obuf *ob, bhnd_nvram_fmt fmt,
+	    bhnd_nvram_dt type, const uint32_t *vals, size_t nvals,
+	    uint32_t vmask);
+int	bhnd_nvram_fmt_pair(struct bhnd_nvram_obuf *ob,
+	    const struct bhnd_nvram_var *nv, const uint32_t *vals,
+	    size_t nvals, uint32_t vmask);
+
+int	bhnd_nvram_parse_value(bhnd_nvram_fmt fmt, bhnd_nvram_dt type,
+	    const char *str, size_t len, uint32_t *vals, size_t count);
+
+#endif /* _NVRAM_FMT_H_ */
@@ -0,0 +1,184 @@
+//
+//  nvram_gather.c
+//  ccmach
+//
+//  Created by Landon Fuller on 2/6/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "nvram_gather.h"
+
+/**
+ * Resolve element @p elem of the SPROM variable @p sv to the reads
+ * required to assemble it.
+ *
+ * @param plan the plan to initialize.
+ * @param sv revision-specific SPROM variable definition.
+ * @param sprom_size SPROM layout size.
+ * @param elem element index (0 for non-array variables).
+ *
+ * @retval 0 success
+ * @retval ENOENT if @p elem exceeds the variable's element count.
+ * @retval EINVAL if the variable's offset descriptors are invalid.
+ */
+int
+bhnd_sprom_gather_resolve (struct bhnd_sprom_gather_plan *plan,
+    const struct bhnd_sprom_var *sv, size_t sprom_size, size_t elem)
+{
+	size_t group, total;
+
+	memset(plan, 0, sizeof(*plan));
+	plan->gp_size = sprom_size;
+
+	group = 0;
+	total = 0;
+	for (size_t i = 0; i < sv->num_offsets; i++) {
+		const struct bhnd_sprom_offset	*sp = &sv->offsets[i];
+		struct bhnd_sprom_gather_op	*op;
+
+		if (sp->width != 1 && sp->width != 2 && sp->width != 4)
+			return (EINVAL);
+
+		if (sp->offset + (sp->count * sp->width) > sprom_size)
+			return (EINVAL);
+
+		if (!sp->cont) {
+			group = total;
+			total += sp->count;
+		} else if (i == 0 || group + sp->count > total) {
+			return (EINVAL);
+		}
+
+		/* Skip descriptors that don't contribute to this element */
+		if (elem < group || elem >= group + sp->count)
+			continue;
+
+		if (plan->gp_nops == BHND_SPROM_GATHER_MAX_OPS)
+			return (EINVAL);
+
+		op = &plan->gp_ops[plan->gp_nops++];
+		op->offset = sp->offset + ((elem - group) * sp->width);
+		op->width = sp->width;
+		op->mask = sp->mask;
+		if (sp->width < 4)
+			op->mask &= (1U << (sp->width * 8)) - 1;
+		op->shift = sp->shift;
+	}
+
+	if (plan->gp_nops == 0)
+		return (ENOENT);
+
+	return (0);
+}
+
+/** Read a little-endian value of @p width bytes */
+static uint32_t
+bhnd_sprom_gather_read (const uint8_t *p, size_t width)
+{
+	switch (width) {
+	case 1:
+		return (p[0]);
+	case 2:
+		return (p[0] | (p[1] << 8));
+	default:
+		return (p[0] | (p[1] << 8) | (p[2] << 16) |
+		    ((uint32_t)p[3] << 24));
+	}
+}
+
+/** Assemble the planned element from a single image */
+static uint32_t
+bhnd_sprom_gather_one (const struct bhnd_sprom_gather_plan *plan,
+    const uint8_t *image)
+{
+	uint32_t v = 0;
+
+	for (size_t i = 0; i < plan->gp_nops; i++) {
+		const struct bhnd_sprom_gather_op	*op = &plan->gp_ops[i];
+		uint32_t				 raw;
+
+		raw = bhnd_sprom_gather_read(image + op->offset, op->width) &
+		    op->mask;
+		if (op->shift >= 0)
+			v |= raw >> op->shift;
+		else
+			v |= raw << -op->shift;
+	}
+
+	return (v);
+}
+
+/**
+ * Extract the planned element from each of @p nimages SPROM images,
+ * writing one value per image to @p column.
+ *
+ * All images must share the revision for which @p plan was resolved; no
+ * validation of the images is performed.
+ *
+ * @param plan a resolved element plan.
+ * @param images the first image.
+ * @param stride distance between images, in bytes; at least the plan's
+ * SPROM layout size.
+ * @param nimages number of images.
+ * @param[out] column output values, of at least @p nimages entries.
+ */
+void
+bhnd_sprom_gather (const struct bhnd_sprom_gather_plan *plan,
+    const uint8_t *images, size_t stride, size_t nimages, uint32_t *column)
+{
+	size_t i = 0;
+
+#ifdef __AVX2__
+	bool vector = (stride <= INT32_MAX / 8);
+
+	/* Every element is read with a 4-byte gather (and masked down to its
+	 * width); that read must not extend past the end of the image */
+	for (size_t n = 0; n < plan->gp_nops; n++) {
+		if (plan->gp_ops[n].offset + 4u > plan->gp_size)
+			vector = false;
+	}
+
+	if (vector) {
+		const __m256i vidx = _mm256_mullo_epi32(
+		    _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+		    _mm256_set1_epi32((int)stride));
+
+		for (; i + 8 <= nimages; i += 8) {
+			const uint8_t	*base = images + (i * stride);
+			__m256i		 acc = _mm256_setzero_si256();
+
+			for (size_t n = 0; n < plan->gp_nops; n++) {
+				const struct bhnd_sprom_gather_op *op;
+				__m256i v;
+
+				op = &plan->gp_ops[n];
+				v = _mm256_i32gather_epi32(
+				    (const int *)(base + op->offset), vidx, 1);
+				v = _mm256_and_si256(v,
+				    _mm256_set1_epi32((int)op->mask));
+
+				if (op->shift >= 0)
+					v = _mm256_srl_epi32(v,
+					    _mm_cvtsi32_si128(op->shift));
+				else
+					v = _mm256_sll_epi32(v,
+					    _mm_cvtsi32_si128(-op->shift));
+
+				acc = _mm256_or_si256(acc, v);
+			}
+
+			_mm256_storeu_si256((__m256i *)&column[i], acc);
+		}
+	}
+#endif
+
+	for (; i < nimages; i++)
+		column[i] = bhnd_sprom_gather_one(plan, images + (i * stride));
+}
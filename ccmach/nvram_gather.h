@@ -0,0 +1,45 @@
+//
+//  nvram_gather.h
+//  ccmach
+//
+//  Created by Landon Fuller on 2/6/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef _NVRAM_GATHER_H_
+#define _NVRAM_GATHER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nvram_map.h"
+
+/** Maximum number of offset descriptors contributing to a single element */
+#define	BHND_SPROM_GATHER_MAX_OPS	8
+
+/** A single resolved read within a SPROM image */
+struct bhnd_sprom_gather_op {
+	uint16_t	offset;		/**< byte offset of the element */
+	uint8_t		width;		/**< 1, 2, or 4 bytes */
+	uint32_t	mask;		/**< mask to be applied to the value */
+	int		shift;		/**< right shift to be applied to the value
+					     (negative values shift left) */
+};
+
+/**
+ * A single variable element, resolved to the reads required to assemble
+ * it from a SPROM image of a given revision.
+ */
+struct bhnd_sprom_gather_plan {
+	struct bhnd_sprom_gather_op	gp_ops[BHND_SPROM_GATHER_MAX_OPS];	/**< reads, OR'd together */
+	size_t				gp_nops;	/**< number of reads */
+	size_t				gp_size;	/**< SPROM layout size, in bytes */
+};
+
+int	bhnd_sprom_gather_resolve(struct bhnd_sprom_gather_plan *plan,
+	    const struct bhnd_sprom_var *sv, size_t sprom_size, size_t elem);
+void	bhnd_sprom_gather(const struct bhnd_sprom_gather_plan *plan,
+	    const uint8_t *images, size_t stride, size_t nimages,
+	    uint32_t *column);
+
+#endif /* _NVRAM_GATHER_H_ */
@@ -0,0 +1,159 @@
+//
+//  nvram_index.c
+//  ccmach
+//
+//  Created by Landon Fuller on 1/30/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nvram_index.h"
+#include "nvram_scan.h"
+
+/**
+ * Find the slot for @p name, returning either the matching entry or the
+ * first unused slot in its probe sequence.
+ */
+static struct bhnd_nvram_index_ent *
+bhnd_nvram_index_slot (const struct bhnd_nvram_index *idx, const char *name,
+    size_t name_len, uint32_t hash)
+{
+	for (size_t i = hash & idx->ni_mask;; i = (i + 1) & idx->ni_mask) {
+		struct bhnd_nvram_index_ent *ent = &idx->ni_ents[i];
+
+		if (ent->name_len == 0)
+			return (ent);
+
+		if (ent->hash == hash && ent->name_len == name_len &&
+		    memcmp(idx->ni_env + ent->offset, name, name_len) == 0)
+			return (ent);
+	}
+}
+
+/**
+ * Build an index over the packed environment @p env.
+ *
+ * Parsing stops at the first empty record (the environment's terminating
+ * "\0\0") or at @p size, whichever comes first. Records without a '='
+ * are ignored. If a name is defined more than once, the first definition
+ * is indexed, matching the result of a linear scan.
+ *
+ * @retval 0 success
+ * @retval ENOMEM if allocation fails.
+ * @retval EINVAL if @p env is too large, or contains a name or value
+ * longer than UINT16_MAX.
+ */
+int
+bhnd_nvram_index_init (struct bhnd_nvram_index *idx, const char *env,
+    size_t size)
+{
+	const char	*p, *end;
+	size_t		 nrecs, tblsize;
+
+	memset(idx, 0, sizeof(*idx));
+
+	if (size > UINT32_MAX)
+		return (EINVAL);
+
+	idx->ni_env = env;
+	idx->ni_size = size;
+	end = env + size;
+
+	/* Size the table for a load factor of at most 1/2; every record is
+	 * NUL terminated, except (possibly) the last */
+	nrecs = bhnd_nvram_count(env, end, '\0') + 1;
+	for (tblsize = 8; tblsize < nrecs * 2; tblsize <<= 1)
+		continue;
+
+	idx->ni_ents = calloc(tblsize, sizeof(idx->ni_ents[0]));
+	if (idx->ni_ents == NULL)
+		return (ENOMEM);
+	idx->ni_mask = tblsize - 1;
+
+	for (p = env; p < end && *p != '\0';) {
+		struct bhnd_nvram_index_ent	*ent;
+		const char			*eq, *nul;
+		size_t				 name_len, value_len;
+		uint32_t			 hash;
+
+		eq = bhnd_nvram_scan2(p, end, '=', '\0');
+		if (eq == end)
+			break;
+
+		/* Skip malformed records */
+		if (*eq == '\0') {
+			p = eq + 1;
+			continue;
+		}
+
+		nul = bhnd_nvram_scan2(eq + 1, end, '\0', '\0');
+		name_len = eq - p;
+		value_len = nul - (eq + 1);
+
+		if (name_len > UINT16_MAX || value_len > UINT16_MAX) {
+			bhnd_nvram_index_fini(idx);
+			return (EINVAL);
+		}
+
+		hash = bhnd_nvram_hash(p, name_len);
+		ent = bhnd_nvram_index_slot(idx, p, name_len, hash);
+		if (ent->name_len == 0) {
+			ent->hash = hash;
+			ent->offset = (uint32_t)(p - env);
+			ent->name_len = (uint16_t)name_len;
+			ent->value_len = (uint16_t)value_len;
+			idx->ni_count++;
+		}
+
+		p = nul + 1;
+	}
+
+	return (0);
+}
+
+/** Release all resources held by @p idx */
+void
+bhnd_nvram_index_fini (struct bhnd_nvram_index *idx)
+{
+	free(idx->ni_ents);
+	idx->ni_ents = NULL;
+	idx->ni_mask = 0;
+	idx->ni_count = 0;
+}
+
+/**
+ * Look up @p name.
+ *
+ * @param idx the index to search.
+ * @param name the variable name.
+ * @param[out] value on success, a pointer to the variable's value within
+ * the indexed environment. The value is not NUL terminated if it is the
+ * environment's final, unterminated record.
+ * @param[out] value_len on success, the length of @p value.
+ *
+ * @retval 0 success
+ * @retval ENOENT if @p name is not defined.
+ */
+int
+bhnd_nvram_index_get (const struct bhnd_nvram_index *idx, const char *name,
+    const char **value, size_t *value_len)
+{
+	const struct bhnd_nvram_index_ent	*ent;
+	size_t					 name_len;
+
+	name_len = strlen(name);
+	if (name_len == 0 || name_len > UINT16_MAX)
+		return (ENOENT);
+
+	ent = bhnd_nvram_index_slot(idx, name, name_len,
+	    bhnd_nvram_hash(name, name_len));
+	if (ent->name_len == 0)
+		return (ENOENT);
+
+	*value = idx->ni_env + ent->offset + ent->name_len + 1;
+	*value_len = ent->value_len;
+	return (0);
+}
@@ -0,0 +1,44 @@
+//
+//  nvram_index.h
+//  ccmach
+//
+//  Created by Landon Fuller on 1/30/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef _NVRAM_INDEX_H_
+#define _NVRAM_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** NVRAM index entry */
+struct bhnd_nvram_index_ent {
+	uint32_t	hash;		/**< name hash */
+	uint32_t	offset;		/**< offset of the record's name */
+	uint16_t	name_len;	/**< name length; 0 if the slot is unused */
+	uint16_t	value_len;	/**< value length */
+};
+
+/**
+ * Hashed index over a packed "name=value\0...\0\0" environment.
+ *
+ * The index references the environment in place; the environment must
+ * not be modified or deallocated while the index is in use. Lookups do
+ * not modify the index, and may be performed concurrently.
+ */
+struct bhnd_nvram_index {
+	const char			*ni_env;	/**< indexed environment */
+	size_t				 ni_size;	/**< environment size */
+	struct bhnd_nvram_index_ent	*ni_ents;	/**< open-addressed hash table */
+	size_t				 ni_mask;	/**< table size - 1 (power of two) */
+	size_t				 ni_count;	/**< number of indexed variables */
+};
+
+int	bhnd_nvram_index_init(struct bhnd_nvram_index *idx, const char *env,
+	    size_t size);
+void	bhnd_nvram_index_fini(struct bhnd_nvram_index *idx);
+int	bhnd_nvram_index_get(const struct bhnd_nvram_index *idx,
+	    const char *name, const char **value, size_t *value_len);
+
+#endif /* _NVRAM_INDEX_H_ */
@@ -0,0 +1,792 @@
+//
+//  nvram_loader.c
+//  ccmach
+//
+//  Created by Landon Fuller on 2/12/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "nvram_loader.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+
+/*
+ * Older io_uring headers lack the direct-descriptor sqe fields and the
+ * feature bits we rely on; IORING_FEAT_CQE_SKIP is the most recent of
+ * these (Linux 5.17), and implies the others.
+ */
+#ifdef IORING_FEAT_CQE_SKIP
+#define	BHND_LOADER_HAVE_URING	1
+
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#endif
+
+static int	bhnd_loader_uring_init(struct bhnd_loader *ld);
+static void	bhnd_loader_uring_fini(struct bhnd_loader *ld);
+static void	*bhnd_loader_uring_thread(void *arg);
+
+/** Return a human-readable name for @p backend */
+const char *
+bhnd_loader_backend_name (bhnd_loader_backend backend)
+{
+	switch (backend) {
+	case BHND_LOADER_URING:
+		return ("io_uring");
+	case BHND_LOADER_PREAD:
+		return ("pread");
+	}
+
+	return ("unknown");
+}
+
+/**
+ * Initialize a loader for @p count image files, and begin loading.
+ *
+ * @param ld the loader to initialize.
+ * @param paths image file paths. The array must remain valid for the
+ * lifetime of @p ld.
+ * @param count number of entries in @p paths.
+ * @param slot_size buffer size; files larger than this are truncated to
+ * @p slot_size bytes.
+ * @param nslots number of buffers. At least as many buffers as the
+ * maximum number of images held by all decode workers at a time should be
+ * provided; additional buffers allow loading to run ahead of decoding.
+ * @param flags BHND_LOADER_* flags.
+ *
+ * @retval 0 success
+ * @retval EINVAL if @p slot_size or @p nslots is zero.
+ * @retval ENOMEM if allocation fails.
+ * @retval non-zero if starting the loader thread otherwise fails, a
+ * regular unix error code will be returned.
+ */
+int
+bhnd_loader_init (struct bhnd_loader *ld, char *const paths[], size_t count,
+    size_t slot_size, uint32_t nslots, int flags)
+{
+	void	*pool;
+	int	 error;
+
+	memset(ld, 0, sizeof(*ld));
+	ld->ld_paths = paths;
+	ld->ld_count = count;
+	ld->ld_slot_size = slot_size;
+	ld->ld_nslots = nslots;
+	atomic_init(&ld->ld_next, 0);
+
+	if (slot_size == 0 || nslots == 0 || slot_size > SIZE_MAX / nslots)
+		return (EINVAL);
+
+	/* Page-aligned, as required for buffer registration */
+	ld->ld_pool_size = slot_size * nslots;
+	pool = mmap(NULL, ld->ld_pool_size, PROT_READ|PROT_WRITE,
+	    MAP_ANON|MAP_PRIVATE, -1, 0);
+	if (pool == MAP_FAILED)
+		return (ENOMEM);
+	ld->ld_pool = pool;
+
+	ld->ld_slots = calloc(nslots, sizeof(ld->ld_slots[0]));
+	ld->ld_free = calloc(nslots, sizeof(ld->ld_free[0]));
+	ld->ld_ready = calloc(nslots, sizeof(ld->ld_ready[0]));
+	if (ld->ld_slots == NULL || ld->ld_free == NULL ||
+	    ld->ld_ready == NULL)
+	{
+		error = ENOMEM;
+		goto failed;
+	}
+
+	for (uint32_t i = 0; i < nslots; i++)
+		ld->ld_free[i] = nslots - i - 1;
+	ld->ld_nfree = nslots;
+
+	pthread_mutex_init(&ld->ld_lock, NULL);
+	pthread_cond_init(&ld->ld_ready_cv, NULL);
+	pthread_cond_init(&ld->ld_free_cv, NULL);
+
+	/* Prefer io_uring, falling back on pread(2) in the decode workers */
+	ld->ld_backend = BHND_LOADER_PREAD;
+	if (!(flags & BHND_LOADER_NO_URING) && bhnd_loader_uring_init(ld) == 0)
+	{
+		error = pthread_create(&ld->ld_thread, NULL,
+		    bhnd_loader_uring_thread, ld);
+		if (error) {
+			bhnd_loader_uring_fini(ld);
+			pthread_cond_destroy(&ld->ld_free_cv);
+			pthread_cond_destroy(&ld->ld_ready_cv);
+			pthread_mutex_destroy(&ld->ld_lock);
+			goto failed;
+		}
+
+		ld->ld_backend = BHND_LOADER_URING;
+	}
+
+	return (0);
+
+failed:
+	munmap(ld->ld_pool, ld->ld_pool_size);
+	free(ld->ld_slots);
+	free(ld->ld_free);
+	free(ld->ld_ready);
+	memset(ld, 0, sizeof(*ld));
+
+	return (error);
+}
+
+/**
+ * Release all resources held by @p ld.
+ *
+ * All images must have been released, and no decode worker may be waiting
+ * in bhnd_loader_next().
+ */
+void
+bhnd_loader_fini (struct bhnd_loader *ld)
+{
+	if (ld->ld_pool == NULL)
+		return;
+
+	if (ld->ld_backend == BHND_LOADER_URING) {
+		/* Wake the loader thread, if waiting on free slots */
+		pthread_mutex_lock(&ld->ld_lock);
+		ld->ld_eof = true;
+		pthread_cond_broadcast(&ld->ld_free_cv);
+		pthread_mutex_unlock(&ld->ld_lock);
+
+		pthread_join(ld->ld_thread, NULL);
+		bhnd_loader_uring_fini(ld);
+	}
+
+	pthread_cond_destroy(&ld->ld_free_cv);
+	pthread_cond_destroy(&ld->ld_ready_cv);
+	pthread_mutex_destroy(&ld->ld_lock);
+
+	munmap(ld->ld_pool, ld->ld_pool_size);
+	free(ld->ld_slots);
+	free(ld->ld_free);
+	free(ld->ld_ready);
+	memset(ld, 0, sizeof(*ld));
+}
+
+/** Return slot @p slot's image as @p img */
+static void
+bhnd_loader_img_init (struct bhnd_loader *ld, uint32_t slot,
+    struct bhnd_loader_img *img)
+{
+	struct bhnd_loader_slot *ls = &ld->ld_slots[slot];
+
+	img->li_index = ls->ls_index;
+	img->li_data = ld->ld_pool + (size_t)slot * ld->ld_slot_size;
+	img->li_size = ls->ls_error ? 0 : ls->ls_size;
+	img->li_error = ls->ls_error;
+	img->li_slot = slot;
+}
+
+/** Read the file at @p path into @p buf, using open/pread/close */
+static int
+bhnd_loader_pread (const char *path, uint8_t *buf, size_t cap, size_t *size)
+{
+	size_t	len;
+	int	fd, error;
+
+	if ((fd = open(path, O_RDONLY|O_CLOEXEC)) < 0)
+		return (errno);
+
+	len = 0;
+	while (len < cap) {
+		ssize_t n = pread(fd, buf + len, cap - len, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			error = errno;
+			close(fd);
+			return (error);
+		}
+
+		if (n == 0)
+			break;
+
+		len += n;
+	}
+
+	close(fd);
+	*size = len;
+	return (0);
+}
+
+/** bhnd_loader_next() for BHND_LOADER_PREAD */
+static int
+bhnd_loader_next_pread (struct bhnd_loader *ld, struct bhnd_loader_img *imgs,
+    size_t max, size_t *count)
+{
+	uint32_t	slots[max];
+	size_t		n, taken, first;
+
+	pthread_mutex_lock(&ld->ld_lock);
+	while (ld->ld_nfree == 0)
+		pthread_cond_wait(&ld->ld_free_cv, &ld->ld_lock);
+
+	taken = (max < ld->ld_nfree) ? max : ld->ld_nfree;
+	for (size_t i = 0; i < taken; i++)
+		slots[i] = ld->ld_free[--ld->ld_nfree];
+	pthread_mutex_unlock(&ld->ld_lock);
+
+	/* Claim the next paths, one per slot */
+	n = taken;
+	first = atomic_fetch_add(&ld->ld_next, n);
+	if (first >= ld->ld_count)
+		n = 0;
+	else if (n > ld->ld_count - first)
+		n = ld->ld_count - first;
+
+	for (size_t i = 0; i < n; i++) {
+		struct bhnd_loader_slot *ls = &ld->ld_slots[slots[i]];
+
+		ls->ls_index = first + i;
+		ls->ls_error = bhnd_loader_pread(ld->ld_paths[ls->ls_index],
+		    ld->ld_pool + (size_t)slots[i] * ld->ld_slot_size,
+		    ld->ld_slot_size, &ls->ls_size);
+
+		bhnd_loader_img_init(ld, slots[i], &imgs[i]);
+	}
+
+	/* Return any unused slots */
+	if (n < taken) {
+		pthread_mutex_lock(&ld->ld_lock);
+		for (size_t i = n; i < taken; i++)
+			ld->ld_free[ld->ld_nfree++] = slots[i];
+
+		pthread_cond_broadcast(&ld->ld_free_cv);
+		pthread_mutex_unlock(&ld->ld_lock);
+	}
+
+	*count = n;
+	return (n > 0 ? 0 : ENOENT);
+}
+
+/** bhnd_loader_next() for BHND_LOADER_URING */
+static int
+bhnd_loader_next_uring (struct bhnd_loader *ld, struct bhnd_loader_img *imgs,
+    size_t max, size_t *count)
+{
+	size_t	n;
+	int	error;
+
+	pthread_mutex_lock(&ld->ld_lock);
+	while (ld->ld_nready == 0 && !ld->ld_eof)
+		pthread_cond_wait(&ld->ld_ready_cv, &ld->ld_lock);
+
+	if (ld->ld_nready == 0) {
+		error = ld->ld_thread_error ? ld->ld_thread_error : ENOENT;
+		pthread_mutex_unlock(&ld->ld_lock);
+		return (error);
+	}
+
+	n = (max < ld->ld_nready) ? max : ld->ld_nready;
+	for (size_t i = 0; i < n; i++) {
+		uint32_t slot;
+
+		slot = ld->ld_ready[ld->ld_ready_head];
+		ld->ld_ready_head = (ld->ld_ready_head + 1) % ld->ld_nslots;
+		ld->ld_nready--;
+
+		bhnd_loader_img_init(ld, slot, &imgs[i]);
+	}
+	pthread_mutex_unlock(&ld->ld_lock);
+
+	*count = n;
+	return (0);
+}
+
+/**
+ * Fetch up to @p max loaded images.
+ *
+ * Images are returned in no particular order. The returned buffers remain
+ * valid until they are returned to the pool with bhnd_loader_release(),
+ * which must be done before bhnd_loader_next() is called again.
+ *
+ * @param ld loader.
+ * @param[out] imgs on success, the loaded images. An image that could not
+ * be read has a non-zero li_error.
+ * @param max maximum number of images to return.
+ * @param[out] count on success, the number of images returned.
+ *
+ * @retval 0 success
+ * @retval ENOENT if all images have been returned.
+ * @retval non-zero if the loader thread failed, a regular unix error code
+ * will be returned.
+ */
+int
+bhnd_loader_next (struct bhnd_loader *ld, struct bhnd_loader_img *imgs,
+    size_t max, size_t *count)
+{
+	if (max == 0)
+		return (EINVAL);
+
+	if (ld->ld_backend == BHND_LOADER_URING)
+		return (bhnd_loader_next_uring(ld, imgs, max, count));
+	else
+		return (bhnd_loader_next_pread(ld, imgs, max, count));
+}
+
+/** Return @p count images' buffers to the pool */
+void
+bhnd_loader_release (struct bhnd_loader *ld,
+    const struct bhnd_loader_img *imgs, size_t count)
+{
+	if (count == 0)
+		return;
+
+	pthread_mutex_lock(&ld->ld_lock);
+	for (size_t i = 0; i < count; i++)
+		ld->ld_free[ld->ld_nfree++] = imgs[i].li_slot;
+
+	pthread_cond_broadcast(&ld->ld_free_cv);
+	pthread_mutex_unlock(&ld->ld_lock);
+}
+
+#ifdef BHND_LOADER_HAVE_URING
+
+/** io_uring state */
+struct bhnd_loader_uring {
+	int			 ur_fd;		/**< io_uring instance */
+	void			*ur_ring;	/**< SQ/CQ ring mapping */
+	size_t			 ur_ring_size;	/**< ur_ring size */
+	struct io_uring_sqe	*ur_sqes;	/**< SQE array */
+	size_t			 ur_sqes_size;	/**< ur_sqes size */
+
+	_Atomic uint32_t	*ur_sq_head;
+	_Atomic uint32_t	*ur_sq_tail;
+	uint32_t		 ur_sq_mask;
+	uint32_t		*ur_sq_array;
+
+	_Atomic uint32_t	*ur_cq_head;
+	_Atomic uint32_t	*ur_cq_tail;
+	uint32_t		 ur_cq_mask;
+	struct io_uring_cqe	*ur_cqes;
+};
+
+/* Request types, encoded in the low bits of each request's user_data */
+#define	BHND_LOADER_OP_OPEN	0
+#define	BHND_LOADER_OP_READ	1
+#define	BHND_LOADER_OP_CLOSE	2
+#define	BHND_LOADER_OP_MASK	3
+#define	BHND_LOADER_OP_SHIFT	2
+
+/** Requests per file */
+#define	BHND_LOADER_OPS		3
+
+/** Return true if all operations required by the loader are supported */
+static bool
+bhnd_loader_uring_probe (int fd)
+{
+	static const uint8_t		 ops[] = {
+		IORING_OP_OPENAT, IORING_OP_READ_FIXED, IORING_OP_CLOSE
+	};
+	struct io_uring_probe		*probe;
+	size_t				 len;
+	bool				 supported;
+
+	len = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+	if ((probe = calloc(1, len)) == NULL)
+		return (false);
+
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe,
+	    256) < 0)
+	{
+		free(probe);
+		return (false);
+	}
+
+	supported = true;
+	for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+		if (ops[i] > probe->last_op ||
+		    !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+			supported = false;
+	}
+
+	free(probe);
+	return (supported);
+}
+
+/**
+ * Set up an io_uring instance for @p ld, registering its buffer pool and
+ * a fixed file slot per buffer.
+ *
+ * Opening and closing files in fixed file slots requires Linux 5.15; the
+ * skip-on-success feature (5.17) is used to detect it, as unsupported
+ * fields of otherwise-supported operations cannot be probed.
+ */
+static int
+bhnd_loader_uring_init (struct bhnd_loader *ld)
+{
+	struct bhnd_loader_uring	*ur;
+	struct io_uring_params		 p;
+	struct iovec			 iov;
+	uint8_t				*ring;
+	size_t				 sq_size, cq_size;
+	uint32_t			 entries;
+	int				*fds;
+	int				 error;
+
+	if ((ur = calloc(1, sizeof(*ur))) == NULL)
+		return (ENOMEM);
+
+	for (entries = 1; entries < ld->ld_nslots * BHND_LOADER_OPS;)
+		entries *= 2;
+
+	memset(&p, 0, sizeof(p));
+	ur->ur_fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ur->ur_fd < 0) {
+		error = errno;
+		free(ur);
+		return (error);
+	}
+
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+	    !(p.features & IORING_FEAT_CQE_SKIP) ||
+	    !bhnd_loader_uring_probe(ur->ur_fd))
+	{
+		error = ENOTSUP;
+		goto failed;
+	}
+
+	/* Map the SQ and CQ rings, and the SQE array */
+	sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ur->ur_ring_size = (sq_size > cq_size) ? sq_size : cq_size;
+	ur->ur_ring = mmap(NULL, ur->ur_ring_size, PROT_READ|PROT_WRITE,
+	    MAP_SHARED|MAP_POPULATE, ur->ur_fd, IORING_OFF_SQ_RING);
+	if (ur->ur_ring == MAP_FAILED) {
+		ur->ur_ring = NULL;
+		error = errno;
+		goto failed;
+	}
+
+	ur->ur_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ur->ur_sqes = mmap(NULL, ur->ur_sqes_size, PROT_READ|PROT_WRITE,
+	    MAP_SHARED|MAP_POPULATE, ur->ur_fd, IORING_OFF_SQES);
+	if (ur->ur_sqes == MAP_FAILED) {
+		ur->ur_sqes = NULL;
+		error = errno;
+		goto failed;
+	}
+
+	ring = ur->ur_ring;
+	ur->ur_sq_head = (_Atomic uint32_t *)(ring + p.sq_off.head);
+	ur->ur_sq_tail = (_Atomic uint32_t *)(ring + p.sq_off.tail);
+	ur->ur_sq_mask = *(uint32_t *)(ring + p.sq_off.ring_mask);
+	ur->ur_sq_array = (uint32_t *)(ring + p.sq_off.array);
+	ur->ur_cq_head = (_Atomic uint32_t *)(ring + p.cq_off.head);
+	ur->ur_cq_tail = (_Atomic uint32_t *)(ring + p.cq_off.tail);
+	ur->ur_cq_mask = *(uint32_t *)(ring + p.cq_off.ring_mask);
+	ur->ur_cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+
+	/* Register the buffer pool */
+	iov.iov_base = ld->ld_pool;
+	iov.iov_len = ld->ld_pool_size;
+	if (syscall(__NR_io_uring_register, ur->ur_fd, IORING_REGISTER_BUFFERS,
+	    &iov, 1) < 0)
+	{
+		error = errno;
+		goto failed;
+	}
+
+	/* Register an (initially empty) fixed file slot per buffer */
+	if ((fds = malloc(ld->ld_nslots * sizeof(fds[0]))) == NULL) {
+		error = ENOMEM;
+		goto failed;
+	}
+
+	for (uint32_t i = 0; i < ld->ld_nslots; i++)
+		fds[i] = -1;
+
+	if (syscall(__NR_io_uring_register, ur->ur_fd, IORING_REGISTER_FILES,
+	    fds, ld->ld_nslots) < 0)
+	{
+		error = errno;
+		free(fds);
+		goto failed;
+	}
+
+	free(fds);
+	ld->ld_uring = ur;
+	return (0);
+
+failed:
+	if (ur->ur_sqes != NULL)
+		munmap(ur->ur_sqes, ur->ur_sqes_size);
+
+	if (ur->ur_ring != NULL)
+		munmap(ur->ur_ring, ur->ur_ring_size);
+
+	close(ur->ur_fd);
+	free(ur);
+
+	return (error);
+}
+
+static void
+bhnd_loader_uring_fini (struct bhnd_loader *ld)
+{
+	struct bhnd_loader_uring *ur = ld->ld_uring;
+
+	if (ur == NULL)
+		return;
+
+	munmap(ur->ur_sqes, ur->ur_sqes_size);
+	munmap(ur->ur_ring, ur->ur_ring_size);
+	close(ur->ur_fd);
+	free(ur);
+
+	ld->ld_uring = NULL;
+}
+
+/** Return the next free SQE; the caller ensures that the SQ has space */
+static struct io_uring_sqe *
+bhnd_loader_uring_sqe (struct bhnd_loader_uring *ur, uint32_t *tail)
+{
+	struct io_uring_sqe	*sqe;
+	uint32_t		 idx;
+
+	idx = (*tail)++ & ur->ur_sq_mask;
+	ur->ur_sq_array[idx] = idx;
+
+	sqe = &ur->ur_sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	return (sqe);
+}
+
+/**
+ * Queue the open, read, and close requests for the file in @p slot.
+ *
+ * The file is opened into the slot's fixed file index, and read into the
+ * slot's buffer. The read is hard-linked to the close, so that the file
+ * is closed even when the read is short; a failed open cancels both.
+ */
+static void
+bhnd_loader_uring_queue (struct bhnd_loader *ld, uint32_t slot,
+    uint32_t *tail)
+{
+	struct bhnd_loader_uring	*ur = ld->ld_uring;
+	struct bhnd_loader_slot		*ls = &ld->ld_slots[slot];
+	struct io_uring_sqe		*sqe;
+	uint64_t			 ud;
+
+	ud = (uint64_t)slot << BHND_LOADER_OP_SHIFT;
+
+	sqe = bhnd_loader_uring_sqe(ur, tail);
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)ld->ld_paths[ls->ls_index];
+	/* Direct descriptors are never inherited; O_CLOEXEC is rejected */
+	sqe->open_flags = O_RDONLY;
+	sqe->file_index = slot + 1;
+	sqe->user_data = ud | BHND_LOADER_OP_OPEN;
+
+	sqe = bhnd_loader_uring_sqe(ur, tail);
+	sqe->opcode = IORING_OP_READ_FIXED;
+	sqe->flags = IOSQE_FIXED_FILE|IOSQE_IO_HARDLINK;
+	sqe->fd = slot;
+	sqe->addr = (uintptr_t)(ld->ld_pool + (size_t)slot * ld->ld_slot_size);
+	sqe->len = ld->ld_slot_size;
+	sqe->off = 0;
+	sqe->buf_index = 0;
+	sqe->user_data = ud | BHND_LOADER_OP_READ;
+
+	sqe = bhnd_loader_uring_sqe(ur, tail);
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->file_index = slot + 1;
+	sqe->user_data = ud | BHND_LOADER_OP_CLOSE;
+
+	ls->ls_size = 0;
+	ls->ls_error = 0;
+	ls->ls_pending = BHND_LOADER_OPS;
+}
+
+/**
+ * Apply a completion to its slot, returning true if all of the slot's
+ * requests have completed.
+ */
+static bool
+bhnd_loader_uring_complete (struct bhnd_loader *ld,
+    const struct io_uring_cqe *cqe, uint32_t *slot)
+{
+	struct bhnd_loader_slot	*ls;
+	int			 op;
+
+	*slot = (uint32_t)(cqe->user_data >> BHND_LOADER_OP_SHIFT);
+	op = cqe->user_data & BHND_LOADER_OP_MASK;
+	ls = &ld->ld_slots[*slot];
+
+	switch (op) {
+	case BHND_LOADER_OP_OPEN:
+		/* An open error takes precedence over the cancelled read */
+		if (cqe->res < 0)
+			ls->ls_error = -cqe->res;
+		break;
+
+	case BHND_LOADER_OP_READ:
+		if (cqe->res >= 0)
+			ls->ls_size = cqe->res;
+		else if (ls->ls_error == 0)
+			ls->ls_error = -cqe->res;
+		break;
+
+	case BHND_LOADER_OP_CLOSE:
+		break;
+	}
+
+	return (--ls->ls_pending == 0);
+}
+
+/**
+ * Loader thread.
+ *
+ * Free slots are filled with the next files, all queued requests are
+ * submitted with a single io_uring_enter() call that also waits for a
+ * completion, and completed slots are handed to the decode workers.
+ */
+static void *
+bhnd_loader_uring_thread (void *arg)
+{
+	struct bhnd_loader		*ld = arg;
+	struct bhnd_loader_uring	*ur = ld->ld_uring;
+	uint32_t			*done;
+	size_t				 next;
+	uint32_t			 inflight, submit, tail;
+	int				 error;
+
+	if ((done = calloc(ld->ld_nslots, sizeof(done[0]))) == NULL) {
+		error = ENOMEM;
+		goto finished;
+	}
+
+	error = 0;
+	next = 0;
+	inflight = 0;
+	submit = 0;
+	tail = atomic_load_explicit(ur->ur_sq_tail, memory_order_relaxed);
+
+	while (next < ld->ld_count || inflight > 0) {
+		uint32_t	ndone, head, cq_tail;
+		int		ret;
+
+		/* Fill free slots */
+		pthread_mutex_lock(&ld->ld_lock);
+		while (ld->ld_nfree == 0 && inflight == 0 && !ld->ld_eof &&
+		    next < ld->ld_count)
+			pthread_cond_wait(&ld->ld_free_cv, &ld->ld_lock);
+
+		if (ld->ld_eof && inflight == 0) {
+			/* Shut down before all images were consumed */
+			pthread_mutex_unlock(&ld->ld_lock);
+			break;
+		}
+
+		while (ld->ld_nfree > 0 && next < ld->ld_count && !ld->ld_eof) {
+			uint32_t slot = ld->ld_free[--ld->ld_nfree];
+
+			ld->ld_slots[slot].ls_index = next++;
+			bhnd_loader_uring_queue(ld, slot, &tail);
+			submit += BHND_LOADER_OPS;
+			inflight++;
+		}
+		pthread_mutex_unlock(&ld->ld_lock);
+
+		/* Submit, and wait for at least one completion */
+		atomic_store_explicit(ur->ur_sq_tail, tail,
+		    memory_order_release);
+
+		ret = syscall(__NR_io_uring_enter, ur->ur_fd, submit,
+		    (inflight > 0) ? 1 : 0, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+				continue;
+
+			error = errno;
+			break;
+		}
+		submit -= ret;
+
+		/* Reap completions */
+		ndone = 0;
+		head = atomic_load_explicit(ur->ur_cq_head,
+		    memory_order_relaxed);
+		cq_tail = atomic_load_explicit(ur->ur_cq_tail,
+		    memory_order_acquire);
+		for (; head != cq_tail; head++) {
+			const struct io_uring_cqe	*cqe;
+			uint32_t			 slot;
+
+			cqe = &ur->ur_cqes[head & ur->ur_cq_mask];
+			if (bhnd_loader_uring_complete(ld, cqe, &slot)) {
+				done[ndone++] = slot;
+				inflight--;
+			}
+		}
+		atomic_store_explicit(ur->ur_cq_head, head,
+		    memory_order_release);
+
+		if (ndone == 0)
+			continue;
+
+		/* Hand completed slots to the decode workers */
+		pthread_mutex_lock(&ld->ld_lock);
+		for (uint32_t i = 0; i < ndone; i++) {
+			uint32_t idx;
+
+			idx = (ld->ld_ready_head + ld->ld_nready) %
+			    ld->ld_nslots;
+			ld->ld_ready[idx] = done[i];
+			ld->ld_nready++;
+		}
+		pthread_cond_broadcast(&ld->ld_ready_cv);
+		pthread_mutex_unlock(&ld->ld_lock);
+	}
+
+	free(done);
+
+finished:
+	pthread_mutex_lock(&ld->ld_lock);
+	ld->ld_eof = true;
+	ld->ld_thread_error = error;
+	pthread_cond_broadcast(&ld->ld_ready_cv);
+	pthread_mutex_unlock(&ld->ld_lock);
+
+	return (NULL);
+}
+
+#else /* !BHND_LOADER_HAVE_URING */
+
+static int
+bhnd_loader_uring_init (struct bhnd_loader *ld)
+{
+	(void)ld;
+	return (ENOTSUP);
+}
+
+static void
+bhnd_loader_uring_fini (struct bhnd_loader *ld)
+{
+	(void)ld;
+}
+
+static void *
+bhnd_loader_uring_thread (void *arg)
+{
+	(void)arg;
+	return (NULL);
+}
+
+#endif /* BHND_LOADER_HAVE_URING */
@@ -0,0 +1,109 @@
+//
+//  nvram_loader.h
+//  ccmach
+//
+//  Created by Landon Fuller on 2/12/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef _NVRAM_LOADER_H_
+#define _NVRAM_LOADER_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Batched image loader.
+ *
+ * The loader reads a list of image files into a fixed pool of buffers,
+ * and hands the loaded buffers to decode workers; images are decoded in
+ * place, and each buffer is returned to the pool once its image has been
+ * decoded.
+ *
+ * On Linux, files are loaded by a single loader thread using io_uring.
+ * Each file is opened, read, and closed by a linked chain of requests;
+ * files are opened into registered (fixed) file slots, and read directly
+ * into the registered buffer pool, so that loading any number of files
+ * requires only a small number of io_uring_enter() calls.
+ *
+ * Where io_uring is unavailable (or lacks the required operations), the
+ * decode workers themselves read each file with open(2), pread(2), and
+ * close(2) before decoding it.
+ */
+
+/** Loader backend */
+typedef enum {
+	BHND_LOADER_URING,	/**< io_uring loader thread */
+	BHND_LOADER_PREAD,	/**< pread(2) in the decode workers */
+} bhnd_loader_backend;
+
+/** bhnd_loader_init() flags */
+#define	BHND_LOADER_NO_URING	(1<<0)	/**< always use BHND_LOADER_PREAD */
+
+/** A loaded image */
+struct bhnd_loader_img {
+	size_t		 li_index;	/**< path index */
+	const uint8_t	*li_data;	/**< image data */
+	size_t		 li_size;	/**< image size */
+	int		 li_error;	/**< load error, or 0 on success */
+	uint32_t	 li_slot;	/**< buffer pool slot */
+};
+
+/** Per-slot loader state */
+struct bhnd_loader_slot {
+	size_t		ls_index;	/**< path index */
+	size_t		ls_size;	/**< image size */
+	int		ls_error;	/**< load error */
+	int		ls_pending;	/**< outstanding requests */
+};
+
+struct bhnd_loader_uring;
+
+/** Batched image loader */
+struct bhnd_loader {
+	char *const		*ld_paths;	/**< input paths */
+	size_t			 ld_count;	/**< number of paths */
+	bhnd_loader_backend	 ld_backend;	/**< loader backend */
+
+	uint8_t			*ld_pool;	/**< buffer pool */
+	size_t			 ld_pool_size;	/**< ld_pool size, in bytes */
+	size_t			 ld_slot_size;	/**< buffer size; larger files
+						     are truncated */
+	struct bhnd_loader_slot	*ld_slots;	/**< per-slot state */
+	uint32_t		 ld_nslots;	/**< number of buffers */
+
+	pthread_mutex_t		 ld_lock;	/**< protects the queues below */
+	pthread_cond_t		 ld_ready_cv;	/**< signaled on ready slots,
+						     or end of input */
+	pthread_cond_t		 ld_free_cv;	/**< signaled on free slots */
+	uint32_t		*ld_free;	/**< free slot stack */
+	uint32_t		 ld_nfree;	/**< free slot count */
+	uint32_t		*ld_ready;	/**< ready slot queue */
+	uint32_t		 ld_ready_head;	/**< first ready slot */
+	uint32_t		 ld_nready;	/**< ready slot count */
+	bool			 ld_eof;	/**< all images have been queued */
+
+	atomic_size_t		 ld_next;	/**< next unclaimed path
+						     (BHND_LOADER_PREAD) */
+
+	struct bhnd_loader_uring *ld_uring;	/**< io_uring state
+						     (BHND_LOADER_URING) */
+	pthread_t		 ld_thread;	/**< loader thread
+						     (BHND_LOADER_URING) */
+	int			 ld_thread_error; /**< loader thread error */
+};
+
+int	bhnd_loader_init(struct bhnd_loader *ld, char *const paths[],
+	    size_t count, size_t slot_size, uint32_t nslots, int flags);
+void	bhnd_loader_fini(struct bhnd_loader *ld);
+int	bhnd_loader_next(struct bhnd_loader *ld, struct bhnd_loader_img *imgs,
+	    size_t max, size_t *count);
+void	bhnd_loader_release(struct bhnd_loader *ld,
+	    const struct bhnd_loader_img *imgs, size_t count);
+
+const char	*bhnd_loader_backend_name(bhnd_loader_backend backend);
+
+#endif /* _NVRAM_LOADER_H_ */
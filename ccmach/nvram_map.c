@@ -20,7 +20,18 @@ static struct bhnd_nvram_var nvram_vars[] = {};
 
 #define	nitems(x)	(sizeof((x)) / sizeof((x)[0]))
 
-static const struct bhnd_nvram_var *
+/**
+ * Return the variable definition table, writing the number of entries
+ * to @p num_vars.
+ */
+const struct bhnd_nvram_var *
+bhnd_nvram_get_vars (size_t *num_vars)
+{
+	*num_vars = nitems(nvram_vars);
+	return (nvram_vars);
+}
+
+const struct bhnd_nvram_var *
 bhnd_nvram_find_var (const char *name)
 {
 	for (size_t i = 0; i < nitems(nvram_vars); i++) {
@@ -31,7 +42,7 @@ bhnd_nvram_find_var (const char *name)
 	return (NULL);
 }
 
-static const struct bhnd_sprom_var *
+const struct bhnd_sprom_var *
 bhnd_nvram_find_sprom_var (const struct bhnd_nvram_var *nv, uint16_t sprom_ver)
 {
 	for (size_t sp = 0; sp < nv->num_sp_descs; sp++) {
@@ -49,7 +60,7 @@ bhnd_nvram_type_width (bhnd_nvram_dt type)
     return 0; // TODO
 }
 
-#ifdef NVRAM_MAIN
+#if defined(NVRAM_MAIN) && !defined(NVRAM_NO_MAIN)
 int main (int argc, char * const argv[]) {
 #else
 int nvram_main (int argc, char * const argv[]) {
@@ -6,6 +6,9 @@
 //  Copyright (c) 2016 Landon Fuller. All rights reserved.
 //
 
+#ifndef _NVRAM_MAP_H_
+#define _NVRAM_MAP_H_
+
 #include <stdio.h>
 #include <unistd.h>
 #include <stdint.h>
@@ -50,9 +53,10 @@ struct bhnd_sprom_offset {
 	size_t		width;	/**< 1, 2, or 4 bytes */
 	size_t		count;	/**< the number of consecutive readable elements */
 	uint32_t	mask;	/**< mask to be applied to the value(s) */
-	size_t		shift;	/**< shift to be applied to the value */
-	bool		cont;	/**< value should be bitwise OR'd with the next offset
-				  *  descriptor */
+	int		shift;	/**< right shift to be applied to the value (negative
+				  *  values shift left) */
+	bool		cont;	/**< value should be bitwise OR'd with the previous
+				  *  offset descriptor */
 };
 
 /** SPROM-specific variable definition */
@@ -72,3 +76,11 @@ struct bhnd_nvram_var {
 	const struct bhnd_sprom_var	*sprom_descs;	/**< SPROM-specific variable descriptors */
 	size_t				 num_sp_descs;	/**< number of sprom descriptors */
 };
+
+const struct bhnd_nvram_var	*bhnd_nvram_get_vars(size_t *num_vars);
+const struct bhnd_nvram_var	*bhnd_nvram_find_var(const char *name);
+const struct bhnd_sprom_var	*bhnd_nvram_find_sprom_var(
+				     const struct bhnd_nvram_var *nv,
+				     uint16_t sprom_ver);
+
+#endif /* _NVRAM_MAP_H_ */
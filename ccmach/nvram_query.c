@@ -0,0 +1,704 @@
+//
+//  nvram_query.c
+//  ccmach
+//
+//  Created by Landon Fuller on 2/8/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nvram_query.h"
+
+/** Per-scan column buffers */
+struct bhnd_query_scan {
+	uint32_t	*vals;		/**< decoded column values */
+	uint8_t		*valid;		/**< decoded column validity */
+	uint8_t		*sel;		/**< row selection vector */
+	uint32_t	*pvals;		/**< projected values (column-major) */
+	uint8_t		*pvalid;	/**< projected validity (column-major) */
+};
+
+/** Per-chunk callback, invoked for every chunk with selected rows */
+typedef int (*bhnd_query_chunk_fn)(struct bhnd_query *q,
+    struct bhnd_query_scan *scan, size_t chunk, size_t nrows, void *ctx);
+
+/** Initialize an empty query over @p cs; an empty query matches all rows */
+void
+bhnd_query_init (struct bhnd_query *q, const struct bhnd_colstore *cs)
+{
+	memset(q, 0, sizeof(*q));
+	q->q_cs = cs;
+}
+
+/**
+ * Add the predicate "@p name[@p elem] @p op @p value".
+ *
+ * For BHND_NVRAM_DT_SINT columns, @p value is interpreted as a
+ * two's-complement int32_t.
+ *
+ * @retval 0 success
+ * @retval ENOENT if no such column exists.
+ * @retval ENOMEM if the query's predicate limit has been reached.
+ */
+int
+bhnd_query_where (struct bhnd_query *q, const char *name, uint16_t elem,
+    bhnd_query_op op, uint32_t value)
+{
+	struct bhnd_query_pred	*qp;
+	size_t			 col;
+	int			 error;
+
+	if ((error = bhnd_colstore_find(q->q_cs, name, elem, &col)))
+		return (error);
+
+	if (q->q_npreds == BHND_QUERY_MAX_PREDS)
+		return (ENOMEM);
+
+	qp = &q->q_preds[q->q_npreds++];
+	qp->qp_col = col;
+	qp->qp_op = op;
+	qp->qp_value = value;
+	qp->qp_signed = (q->q_cs->cs_cols[col].type == BHND_NVRAM_DT_SINT);
+
+	return (0);
+}
+
+/**
+ * Parse and add a predicate of the form "name[elem] op value", where the
+ * element index is optional, op is one of ==, =, !=, <, <=, >, or >=, and
+ * value is a decimal, negative decimal, 0x-prefixed hex, or single-quoted
+ * character constant.
+ *
+ * @retval 0 success
+ * @retval EINVAL if @p expr cannot be parsed.
+ * @retval ENOENT if no such column exists.
+ * @retval ERANGE if the value cannot be represented in 32 bits.
+ * @retval ENOMEM if the query's predicate limit has been reached.
+ */
+int
+bhnd_query_parse_where (struct bhnd_query *q, const char *expr)
+{
+	static const struct {
+		const char	*str;
+		bhnd_query_op	 op;
+	} ops[] = {
+		{ "==",	BHND_QUERY_EQ },
+		{ "!=",	BHND_QUERY_NE },
+		{ "<=",	BHND_QUERY_LE },
+		{ ">=",	BHND_QUERY_GE },
+		{ "=",	BHND_QUERY_EQ },
+		{ "<",	BHND_QUERY_LT },
+		{ ">",	BHND_QUERY_GT },
+	};
+	char		 name[64];
+	const char	*p;
+	char		*end;
+	unsigned long	 elem;
+	long long	 value;
+	size_t		 len;
+	bhnd_query_op	 op;
+	bool		 found;
+
+	p = expr;
+	while (isspace((unsigned char)*p))
+		p++;
+
+	/* Variable name */
+	for (len = 0; isalnum((unsigned char)p[len]) || p[len] == '_'; len++)
+		continue;
+
+	if (len == 0 || len >= sizeof(name))
+		return (EINVAL);
+
+	memcpy(name, p, len);
+	name[len] = '\0';
+	p += len;
+
+	/* Element index */
+	elem = 0;
+	if (*p == '[') {
+		if (!isdigit((unsigned char)p[1]))
+			return (EINVAL);
+
+		elem = strtoul(p + 1, &end, 10);
+		if (*end != ']' || elem > UINT16_MAX)
+			return (EINVAL);
+
+		p = end + 1;
+	}
+
+	while (isspace((unsigned char)*p))
+		p++;
+
+	/* Operator */
+	found = false;
+	for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+		len = strlen(ops[i].str);
+		if (strncmp(p, ops[i].str, len) == 0) {
+			op = ops[i].op;
+			p += len;
+			found = true;
+			break;
+		}
+	}
+
+	if (!found)
+		return (EINVAL);
+
+	while (isspace((unsigned char)*p))
+		p++;
+
+	/* Value */
+	if (p[0] == '\'') {
+		if (p[1] == '\0' || p[2] != '\'')
+			return (EINVAL);
+
+		value = (unsigned char)p[1];
+		end = (char *)p + 3;
+	} else {
+		errno = 0;
+		value = strtoll(p, &end, 0);
+		if (end == p)
+			return (EINVAL);
+		if (errno == ERANGE || value < INT32_MIN || value > UINT32_MAX)
+			return (ERANGE);
+	}
+
+	while (isspace((unsigned char)*end))
+		end++;
+
+	if (*end != '\0')
+		return (EINVAL);
+
+	return (bhnd_query_where(q, name, (uint16_t)elem, op, (uint32_t)value));
+}
+
+/**
+ * Add element @p elem of variable @p name to the query's projection.
+ *
+ * @retval 0 success
+ * @retval ENOENT if no such column exists.
+ * @retval ENOMEM if the query's projection limit has been reached.
+ */
+int
+bhnd_query_select (struct bhnd_query *q, const char *name, uint16_t elem)
+{
+	size_t	col;
+	int	error;
+
+	if ((error = bhnd_colstore_find(q->q_cs, name, elem, &col)))
+		return (error);
+
+	if (q->q_nproject == BHND_QUERY_MAX_PROJECT)
+		return (ENOMEM);
+
+	q->q_project[q->q_nproject++] = col;
+	return (0);
+}
+
+/** Return true if @p a < @p b */
+static bool
+bhnd_query_lt (bool sign, uint32_t a, uint32_t b)
+{
+	if (sign)
+		return ((int32_t)a < (int32_t)b);
+
+	return (a < b);
+}
+
+/** Evaluate @p qp against constant values @p v */
+static bool
+bhnd_query_test (const struct bhnd_query_pred *qp, uint32_t v)
+{
+	bool sign = qp->qp_signed;
+
+	switch (qp->qp_op) {
+	case BHND_QUERY_EQ:
+		return (v == qp->qp_value);
+	case BHND_QUERY_NE:
+		return (v != qp->qp_value);
+	case BHND_QUERY_LT:
+		return (bhnd_query_lt(sign, v, qp->qp_value));
+	case BHND_QUERY_LE:
+		return (!bhnd_query_lt(sign, qp->qp_value, v));
+	case BHND_QUERY_GT:
+		return (bhnd_query_lt(sign, qp->qp_value, v));
+	case BHND_QUERY_GE:
+		return (!bhnd_query_lt(sign, v, qp->qp_value));
+	}
+
+	return (false);
+}
+
+/** Zone map classification of a predicate over a chunk */
+typedef enum {
+	BHND_QUERY_ZONE_NONE,	/**< no row can match */
+	BHND_QUERY_ZONE_SOME,	/**< rows must be evaluated */
+	BHND_QUERY_ZONE_ALL,	/**< every row matches */
+} bhnd_query_zone;
+
+/** Classify @p qp against the zone map of @p ck */
+static bhnd_query_zone
+bhnd_query_zone_test (const struct bhnd_query_pred *qp,
+    const struct bhnd_colstore_chunk *ck)
+{
+	bool sign = qp->qp_signed;
+	bool any, all;
+
+	if (ck->nnull == ck->nrows)
+		return (BHND_QUERY_ZONE_NONE);
+
+	/* A range [min, max] can satisfy an equality only if it contains the
+	 * value, and an ordering only if its nearest bound does */
+	switch (qp->qp_op) {
+	case BHND_QUERY_EQ:
+		any = !bhnd_query_lt(sign, qp->qp_value, ck->min) &&
+		    !bhnd_query_lt(sign, ck->max, qp->qp_value);
+		all = (ck->min == qp->qp_value && ck->max == qp->qp_value);
+		break;
+	case BHND_QUERY_NE:
+		all = bhnd_query_lt(sign, qp->qp_value, ck->min) ||
+		    bhnd_query_lt(sign, ck->max, qp->qp_value);
+		any = !(ck->min == qp->qp_value && ck->max == qp->qp_value);
+		break;
+	case BHND_QUERY_LT:
+	case BHND_QUERY_LE:
+		any = bhnd_query_test(qp, ck->min);
+		all = bhnd_query_test(qp, ck->max);
+		break;
+	case BHND_QUERY_GT:
+	case BHND_QUERY_GE:
+		any = bhnd_query_test(qp, ck->max);
+		all = bhnd_query_test(qp, ck->min);
+		break;
+	default:
+		any = true;
+		all = false;
+		break;
+	}
+
+	if (!any)
+		return (BHND_QUERY_ZONE_NONE);
+	else if (all && ck->nnull == 0)
+		return (BHND_QUERY_ZONE_ALL);
+	else
+		return (BHND_QUERY_ZONE_SOME);
+}
+
+/* Branch-free selection update; written to be auto-vectorized */
+#define	BHND_QUERY_EVAL(_type, _op)	do {				\
+	const _type v = (_type)qp->qp_value;				\
+	for (size_t i = 0; i < nrows; i++) {				\
+		sel[i] &= valid[i] & ((_type)vals[i] _op v);		\
+	}								\
+} while (0)
+
+/** AND the result of evaluating @p qp over @p nrows values into @p sel */
+static void
+bhnd_query_eval (const struct bhnd_query_pred *qp, const uint32_t *vals,
+    const uint8_t *valid, uint8_t *sel, size_t nrows)
+{
+	if (qp->qp_signed) {
+		switch (qp->qp_op) {
+		case BHND_QUERY_EQ:	BHND_QUERY_EVAL(int32_t, ==); break;
+		case BHND_QUERY_NE:	BHND_QUERY_EVAL(int32_t, !=); break;
+		case BHND_QUERY_LT:	BHND_QUERY_EVAL(int32_t, <); break;
+		case BHND_QUERY_LE:	BHND_QUERY_EVAL(int32_t, <=); break;
+		case BHND_QUERY_GT:	BHND_QUERY_EVAL(int32_t, >); break;
+		case BHND_QUERY_GE:	BHND_QUERY_EVAL(int32_t, >=); break;
+		}
+	} else {
+		switch (qp->qp_op) {
+		case BHND_QUERY_EQ:	BHND_QUERY_EVAL(uint32_t, ==); break;
+		case BHND_QUERY_NE:	BHND_QUERY_EVAL(uint32_t, !=); break;
+		case BHND_QUERY_LT:	BHND_QUERY_EVAL(uint32_t, <); break;
+		case BHND_QUERY_LE:	BHND_QUERY_EVAL(uint32_t, <=); break;
+		case BHND_QUERY_GT:	BHND_QUERY_EVAL(uint32_t, >); break;
+		case BHND_QUERY_GE:	BHND_QUERY_EVAL(uint32_t, >=); break;
+		}
+	}
+}
+
+#undef	BHND_QUERY_EVAL
+
+/**
+ * Compute the selection vector for @p chunk.
+ *
+ * @retval 0 success; *nsel is the number of selected rows.
+ * @retval EINVAL if the chunk data is malformed.
+ */
+static int
+bhnd_query_select_chunk (struct bhnd_query *q, struct bhnd_query_scan *scan,
+    size_t chunk, size_t nrows, size_t *nsel)
+{
+	bhnd_query_zone	zones[BHND_QUERY_MAX_PREDS];
+	size_t		n;
+	int		error;
+
+	/* Prune using the zone maps before decoding anything */
+	for (size_t i = 0; i < q->q_npreds; i++) {
+		const struct bhnd_colstore_chunk *ck;
+
+		ck = bhnd_colstore_get_chunk(q->q_cs, q->q_preds[i].qp_col,
+		    chunk);
+		zones[i] = bhnd_query_zone_test(&q->q_preds[i], ck);
+
+		if (zones[i] == BHND_QUERY_ZONE_NONE) {
+			q->q_chunks_skipped++;
+			*nsel = 0;
+			return (0);
+		}
+	}
+
+	q->q_chunks_scanned++;
+	memset(scan->sel, 1, nrows);
+
+	for (size_t i = 0; i < q->q_npreds; i++) {
+		const struct bhnd_query_pred *qp = &q->q_preds[i];
+
+		if (zones[i] == BHND_QUERY_ZONE_ALL)
+			continue;
+
+		error = bhnd_colstore_read(q->q_cs, qp->qp_col, chunk,
+		    scan->vals, scan->valid);
+		if (error)
+			return (error);
+
+		bhnd_query_eval(qp, scan->vals, scan->valid, scan->sel, nrows);
+	}
+
+	n = 0;
+	for (size_t i = 0; i < nrows; i++)
+		n += scan->sel[i];
+
+	*nsel = n;
+	return (0);
+}
+
+/** Scan all chunks, invoking @p fn for each chunk with selected rows */
+static int
+bhnd_query_scan (struct bhnd_query *q, bhnd_query_chunk_fn fn, void *ctx,
+    uint64_t *nmatched)
+{
+	const struct bhnd_colstore_footer	*footer;
+	struct bhnd_query_scan			 scan;
+	uint64_t				 matched;
+	size_t					 rows, nproj;
+	int					 error;
+
+	footer = q->q_cs->cs_footer;
+	rows = footer->chunk_rows;
+	nproj = (q->q_nproject > 0) ? q->q_nproject : 1;
+
+	q->q_chunks_scanned = 0;
+	q->q_chunks_skipped = 0;
+
+	memset(&scan, 0, sizeof(scan));
+	scan.vals = malloc(rows * sizeof(scan.vals[0]));
+	scan.valid = malloc(rows);
+	scan.sel = malloc(rows);
+	scan.pvals = malloc(rows * nproj * sizeof(scan.pvals[0]));
+	scan.pvalid = malloc(rows * nproj);
+
+	error = 0;
+	if (scan.vals == NULL || scan.valid == NULL || scan.sel == NULL ||
+	    scan.pvals == NULL || scan.pvalid == NULL)
+	{
+		error = ENOMEM;
+		goto cleanup;
+	}
+
+	matched = 0;
+	for (size_t k = 0; k < footer->nchunks; k++) {
+		const struct bhnd_colstore_chunk	*ck;
+		size_t					 nsel;
+
+		/* Row counts are uniform across the columns of a chunk */
+		ck = bhnd_colstore_get_chunk(q->q_cs, 0, k);
+
+		if ((error = bhnd_query_select_chunk(q, &scan, k, ck->nrows,
+		    &nsel)))
+			goto cleanup;
+
+		if (nsel == 0)
+			continue;
+
+		matched += nsel;
+		if (fn != NULL && (error = fn(q, &scan, k, ck->nrows, ctx)))
+			goto cleanup;
+	}
+
+	if (nmatched != NULL)
+		*nmatched = matched;
+
+cleanup:
+	free(scan.vals);
+	free(scan.valid);
+	free(scan.sel);
+	free(scan.pvals);
+	free(scan.pvalid);
+	return (error);
+}
+
+/** bhnd_query_run() state */
+struct bhnd_query_run_ctx {
+	bhnd_query_row_fn	 fn;
+	void			*ctx;
+};
+
+/** Decode the projected columns of a chunk and emit its selected rows */
+static int
+bhnd_query_run_chunk (struct bhnd_query *q, struct bhnd_query_scan *scan,
+    size_t chunk, size_t nrows, void *ctx)
+{
+	struct bhnd_query_run_ctx	*rc = ctx;
+	uint32_t			 vals[BHND_QUERY_MAX_PROJECT];
+	uint8_t				 valid[BHND_QUERY_MAX_PROJECT];
+	size_t				 rows;
+	int				 error;
+
+	rows = q->q_cs->cs_footer->chunk_rows;
+	for (size_t p = 0; p < q->q_nproject; p++) {
+		error = bhnd_colstore_read(q->q_cs, q->q_project[p], chunk,
+		    &scan->pvals[p * rows], &scan->pvalid[p * rows]);
+		if (error)
+			return (error);
+	}
+
+	for (size_t i = 0; i < nrows; i++) {
+		if (!scan->sel[i])
+			continue;
+
+		for (size_t p = 0; p < q->q_nproject; p++) {
+			vals[p] = scan->pvals[(p * rows) + i];
+			valid[p] = scan->pvalid[(p * rows) + i];
+		}
+
+		error = rc->fn(rc->ctx, ((uint64_t)chunk * rows) + i, vals,
+		    valid);
+		if (error)
+			return (error);
+	}
+
+	return (0);
+}
+
+/**
+ * Execute @p q, invoking @p fn with the projected values of each matching
+ * row, in row order.
+ *
+ * @param q query.
+ * @param fn row callback, or NULL to count matching rows only.
+ * @param ctx callback context.
+ * @param[out] nmatched if non-NULL, the number of matching rows.
+ *
+ * @retval 0 success
+ * @retval ENOMEM if allocation fails.
+ * @retval EINVAL if the column store data is malformed.
+ * @retval non-zero the value returned by @p fn, if it stopped the scan.
+ */
+int
+bhnd_query_run (struct bhnd_query *q, bhnd_query_row_fn fn, void *ctx,
+    uint64_t *nmatched)
+{
+	struct bhnd_query_run_ctx rc;
+
+	if (fn == NULL)
+		return (bhnd_query_scan(q, NULL, NULL, nmatched));
+
+	rc.fn = fn;
+	rc.ctx = ctx;
+	return (bhnd_query_scan(q, bhnd_query_run_chunk, &rc, nmatched));
+}
+
+/** bhnd_query_group_count() state; an open-addressed table of groups */
+struct bhnd_query_group_ctx {
+	size_t			 col;		/**< group column */
+	struct bhnd_query_group	*slots;		/**< hash table */
+	size_t			 nslots;	/**< table size; a power of two */
+	size_t			 ngroups;	/**< valid groups */
+	uint64_t		 nunset;	/**< rows with an unset group value */
+};
+
+static size_t
+bhnd_query_group_hash (uint32_t key, size_t nslots)
+{
+	uint32_t h = key * 0x9E3779B1U;
+
+	return ((h ^ (h >> 16)) & (nslots - 1));
+}
+
+/** Grow the group table to twice its current size */
+static int
+bhnd_query_group_grow (struct bhnd_query_group_ctx *gc)
+{
+	struct bhnd_query_group	*slots;
+	size_t			 nslots;
+
+	nslots = gc->nslots * 2;
+	if ((slots = calloc(nslots, sizeof(slots[0]))) == NULL)
+		return (ENOMEM);
+
+	for (size_t i = 0; i < gc->nslots; i++) {
+		size_t h;
+
+		if (!gc->slots[i].qg_valid)
+			continue;
+
+		h = bhnd_query_group_hash(gc->slots[i].qg_key, nslots);
+		while (slots[h].qg_valid)
+			h = (h + 1) & (nslots - 1);
+
+		slots[h] = gc->slots[i];
+	}
+
+	free(gc->slots);
+	gc->slots = slots;
+	gc->nslots = nslots;
+	return (0);
+}
+
+/** Accumulate the group counts of a chunk's selected rows */
+static int
+bhnd_query_group_chunk (struct bhnd_query *q, struct bhnd_query_scan *scan,
+    size_t chunk, size_t nrows, void *ctx)
+{
+	struct bhnd_query_group_ctx	*gc = ctx;
+	int				 error;
+
+	error = bhnd_colstore_read(q->q_cs, gc->col, chunk, scan->pvals,
+	    scan->pvalid);
+	if (error)
+		return (error);
+
+	for (size_t i = 0; i < nrows; i++) {
+		uint32_t	key;
+		size_t		h;
+
+		if (!scan->sel[i])
+			continue;
+
+		if (!scan->pvalid[i]) {
+			gc->nunset++;
+			continue;
+		}
+
+		key = scan->pvals[i];
+		h = bhnd_query_group_hash(key, gc->nslots);
+		while (gc->slots[h].qg_valid && gc->slots[h].qg_key != key)
+			h = (h + 1) & (gc->nslots - 1);
+
+		if (gc->slots[h].qg_valid) {
+			gc->slots[h].qg_count++;
+			continue;
+		}
+
+		gc->slots[h].qg_key = key;
+		gc->slots[h].qg_valid = true;
+		gc->slots[h].qg_count = 1;
+
+		/* Keep the table at most half full */
+		if (++gc->ngroups * 2 > gc->nslots) {
+			if ((error = bhnd_query_group_grow(gc)))
+				return (error);
+		}
+	}
+
+	return (0);
+}
+
+/** Sort groups by key; signed keys are pre-biased by the caller */
+static int
+bhnd_query_group_cmp (const void *lhs, const void *rhs)
+{
+	const struct bhnd_query_group *a = lhs, *b = rhs;
+
+	if (a->qg_key < b->qg_key)
+		return (-1);
+	else if (a->qg_key > b->qg_key)
+		return (1);
+
+	return (0);
+}
+
+/**
+ * Execute @p q, counting matching rows grouped by the value of element
+ * @p elem of variable @p name.
+ *
+ * Groups are returned in ascending key order (signed, for SINT columns),
+ * followed by the group of rows for which the value is unset, if any.
+ *
+ * @param q query; its projection is ignored.
+ * @param name group variable name.
+ * @param elem group variable element.
+ * @param[out] groups on success, the group counts. The caller is
+ * responsible for deallocating this array via free(3).
+ * @param[out] ngroups number of groups.
+ *
+ * @retval 0 success
+ * @retval ENOENT if no such column exists.
+ * @retval ENOMEM if allocation fails.
+ * @retval EINVAL if the column store data is malformed.
+ */
+int
+bhnd_query_group_count (struct bhnd_query *q, const char *name, uint16_t elem,
+    struct bhnd_query_group **groups, size_t *ngroups)
+{
+	struct bhnd_query_group_ctx	 gc;
+	struct bhnd_query_group		*out;
+	uint32_t			 bias;
+	size_t				 n;
+	int				 error;
+
+	memset(&gc, 0, sizeof(gc));
+	if ((error = bhnd_colstore_find(q->q_cs, name, elem, &gc.col)))
+		return (error);
+
+	gc.nslots = 64;
+	if ((gc.slots = calloc(gc.nslots, sizeof(gc.slots[0]))) == NULL)
+		return (ENOMEM);
+
+	if ((error = bhnd_query_scan(q, bhnd_query_group_chunk, &gc, NULL))) {
+		free(gc.slots);
+		return (error);
+	}
+
+	if ((out = calloc(gc.ngroups + 1, sizeof(out[0]))) == NULL) {
+		free(gc.slots);
+		return (ENOMEM);
+	}
+
+	/* Flipping the sign bit orders signed keys as unsigned */
+	bias = (q->q_cs->cs_cols[gc.col].type == BHND_NVRAM_DT_SINT) ?
+	    0x80000000U : 0;
+
+	n = 0;
+	for (size_t i = 0; i < gc.nslots; i++) {
+		if (!gc.slots[i].qg_valid)
+			continue;
+
+		out[n] = gc.slots[i];
+		out[n].qg_key ^= bias;
+		n++;
+	}
+	free(gc.slots);
+
+	qsort(out, n, sizeof(out[0]), bhnd_query_group_cmp);
+	for (size_t i = 0; i < n; i++)
+		out[i].qg_key ^= bias;
+
+	if (gc.nunset > 0) {
+		out[n].qg_key = 0;
+		out[n].qg_valid = false;
+		out[n].qg_count = gc.nunset;
+		n++;
+	}
+
+	*groups = out;
+	*ngroups = n;
+	return (0);
+}
@@ -0,0 +1,100 @@
+//
+//  nvram_query.h
+//  ccmach
+//
+//  Created by Landon Fuller on 2/8/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef _NVRAM_QUERY_H_
+#define _NVRAM_QUERY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nvram_colstore.h"
+
+/*
+ * Filter/project/group-by queries over a column store.
+ *
+ * A query is a conjunction of predicates, each comparing a single column
+ * (one element of one variable) against a constant. Queries are evaluated
+ * one chunk at a time: each chunk's zone map is consulted to skip chunks
+ * that cannot match (or to skip evaluating predicates that all rows
+ * satisfy), and the remaining predicates are evaluated over the decoded
+ * column values into a per-row selection vector. Only the projected or
+ * grouped columns of chunks with selected rows are decoded.
+ *
+ * Comparisons are signed for BHND_NVRAM_DT_SINT columns, and unsigned for
+ * BHND_NVRAM_DT_UINT and BHND_NVRAM_DT_CHAR columns. Unset values never
+ * satisfy a predicate.
+ */
+
+#define	BHND_QUERY_MAX_PREDS	16	/**< maximum predicates per query */
+#define	BHND_QUERY_MAX_PROJECT	16	/**< maximum projected columns per query */
+
+/** Comparison operators */
+typedef enum {
+	BHND_QUERY_EQ,		/**< == */
+	BHND_QUERY_NE,		/**< != */
+	BHND_QUERY_LT,		/**< < */
+	BHND_QUERY_LE,		/**< <= */
+	BHND_QUERY_GT,		/**< > */
+	BHND_QUERY_GE,		/**< >= */
+} bhnd_query_op;
+
+/** A single column predicate */
+struct bhnd_query_pred {
+	size_t		qp_col;		/**< column index */
+	bhnd_query_op	qp_op;		/**< comparison operator */
+	uint32_t	qp_value;	/**< comparison value */
+	bool		qp_signed;	/**< signed comparison */
+};
+
+/** Query */
+struct bhnd_query {
+	const struct bhnd_colstore	*q_cs;			/**< column store */
+	struct bhnd_query_pred		 q_preds[BHND_QUERY_MAX_PREDS];
+	size_t				 q_npreds;		/**< predicate count */
+	size_t				 q_project[BHND_QUERY_MAX_PROJECT];
+	size_t				 q_nproject;		/**< projected column count */
+
+	/* Statistics from the most recent scan */
+	size_t				 q_chunks_scanned;	/**< chunks evaluated */
+	size_t				 q_chunks_skipped;	/**< chunks pruned by zone maps */
+};
+
+/** Group-by result */
+struct bhnd_query_group {
+	uint32_t	qg_key;		/**< group value */
+	bool		qg_valid;	/**< false for the group of unset values */
+	uint64_t	qg_count;	/**< number of matching rows */
+};
+
+/**
+ * Row callback.
+ *
+ * @param ctx caller context.
+ * @param row row index.
+ * @param vals projected values, in projection order.
+ * @param valid projected value validity.
+ *
+ * @retval 0 continue the scan.
+ * @retval non-zero stop the scan, returning this value.
+ */
+typedef int (*bhnd_query_row_fn)(void *ctx, uint64_t row,
+    const uint32_t *vals, const uint8_t *valid);
+
+void	bhnd_query_init(struct bhnd_query *q, const struct bhnd_colstore *cs);
+int	bhnd_query_where(struct bhnd_query *q, const char *name, uint16_t elem,
+	    bhnd_query_op op, uint32_t value);
+int	bhnd_query_parse_where(struct bhnd_query *q, const char *expr);
+int	bhnd_query_select(struct bhnd_query *q, const char *name,
+	    uint16_t elem);
+
+int	bhnd_query_run(struct bhnd_query *q, bhnd_query_row_fn fn, void *ctx,
+	    uint64_t *nmatched);
+int	bhnd_query_group_count(struct bhnd_query *q, const char *name,
+	    uint16_t elem, struct bhnd_query_group **groups, size_t *ngroups);
+
+#endif /* _NVRAM_QUERY_H_ */
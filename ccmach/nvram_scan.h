@@ -0,0 +1,128 @@
+//
+//  nvram_scan.h
+//  ccmach
+//
+//  Created by Landon Fuller on 1/30/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef _NVRAM_SCAN_H_
+#define _NVRAM_SCAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Byte scanning primitives for NVRAM "name=value" environments.
+ *
+ * AVX2 or SSE2 is used when available, with a scalar fallback; none of the
+ * implementations read beyond the provided end pointer.
+ */
+
+/**
+ * Return a pointer to the first byte in [@p p, @p end) equal to @p c1 or
+ * @p c2, or @p end if not found.
+ */
+static inline const char *
+bhnd_nvram_scan2 (const char *p, const char *end, char c1, char c2)
+{
+#ifdef __AVX2__
+	const __m256i w1 = _mm256_set1_epi8(c1);
+	const __m256i w2 = _mm256_set1_epi8(c2);
+
+	while (end - p >= 32) {
+		__m256i		chunk;
+		unsigned int	mask;
+
+		chunk = _mm256_loadu_si256((const __m256i *)p);
+		mask = _mm256_movemask_epi8(_mm256_or_si256(
+		    _mm256_cmpeq_epi8(chunk, w1), _mm256_cmpeq_epi8(chunk, w2)));
+		if (mask != 0)
+			return (p + __builtin_ctz(mask));
+
+		p += 32;
+	}
+#endif
+
+#ifdef __SSE2__
+	const __m128i v1 = _mm_set1_epi8(c1);
+	const __m128i v2 = _mm_set1_epi8(c2);
+
+	while (end - p >= 16) {
+		__m128i		chunk;
+		unsigned int	mask;
+
+		chunk = _mm_loadu_si128((const __m128i *)p);
+		mask = _mm_movemask_epi8(_mm_or_si128(
+		    _mm_cmpeq_epi8(chunk, v1), _mm_cmpeq_epi8(chunk, v2)));
+		if (mask != 0)
+			return (p + __builtin_ctz(mask));
+
+		p += 16;
+	}
+#endif
+
+	for (; p < end; p++) {
+		if (*p == c1 || *p == c2)
+			return (p);
+	}
+
+	return (end);
+}
+
+/** Return the number of bytes in [@p p, @p end) equal to @p c */
+static inline size_t
+bhnd_nvram_count (const char *p, const char *end, char c)
+{
+	size_t count = 0;
+
+#ifdef __AVX2__
+	const __m256i w = _mm256_set1_epi8(c);
+
+	while (end - p >= 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+		count += __builtin_popcount(
+		    _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, w)));
+		p += 32;
+	}
+#endif
+
+#ifdef __SSE2__
+	const __m128i v = _mm_set1_epi8(c);
+
+	while (end - p >= 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)p);
+		count += __builtin_popcount(
+		    _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, v)));
+		p += 16;
+	}
+#endif
+
+	for (; p < end; p++) {
+		if (*p == c)
+			count++;
+	}
+
+	return (count);
+}
+
+/** FNV-1a hash of @p len bytes at @p p */
+static inline uint32_t
+bhnd_nvram_hash (const char *p, size_t len)
+{
+	uint32_t h = 2166136261U;
+	for (size_t i = 0; i < len; i++) {
+		h ^= (uint8_t)p[i];
+		h *= 16777619U;
+	}
+
+	return (h);
+}
+
+#endif /* _NVRAM_SCAN_H_ */
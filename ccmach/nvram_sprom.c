@@ -0,0 +1,564 @@
+//
+//  nvram_sprom.c
+//  ccmach
+//
+//  Created by Landon Fuller on 1/28/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nvram_sprom.h"
+
+#define	nitems(x)	(sizeof((x)) / sizeof((x)[0]))
+
+/** CRC-8 lookup table (reflected polynomial 0xAB, as used by hndcrc8) */
+const uint8_t bhnd_nvram_crc8_tab[] = {
+	0x00, 0xf7, 0xb9, 0x4e, 0x25, 0xd2, 0x9c, 0x6b,
+	0x4a, 0xbd, 0xf3, 0x04, 0x6f, 0x98, 0xd6, 0x21,
+	0x94, 0x63, 0x2d, 0xda, 0xb1, 0x46, 0x08, 0xff,
+	0xde, 0x29, 0x67, 0x90, 0xfb, 0x0c, 0x42, 0xb5,
+	0x7f, 0x88, 0xc6, 0x31, 0x5a, 0xad, 0xe3, 0x14,
+	0x35, 0xc2, 0x8c, 0x7b, 0x10, 0xe7, 0xa9, 0x5e,
+	0xeb, 0x1c, 0x52, 0xa5, 0xce, 0x39, 0x77, 0x80,
+	0xa1, 0x56, 0x18, 0xef, 0x84, 0x73, 0x3d, 0xca,
+	0xfe, 0x09, 0x47, 0xb0, 0xdb, 0x2c, 0x62, 0x95,
+	0xb4, 0x43, 0x0d, 0xfa, 0x91, 0x66, 0x28, 0xdf,
+	0x6a, 0x9d, 0xd3, 0x24, 0x4f, 0xb8, 0xf6, 0x01,
+	0x20, 0xd7, 0x99, 0x6e, 0x05, 0xf2, 0xbc, 0x4b,
+	0x81, 0x76, 0x38, 0xcf, 0xa4, 0x53, 0x1d, 0xea,
+	0xcb, 0x3c, 0x72, 0x85, 0xee, 0x19, 0x57, 0xa0,
+	0x15, 0xe2, 0xac, 0x5b, 0x30, 0xc7, 0x89, 0x7e,
+	0x5f, 0xa8, 0xe6, 0x11, 0x7a, 0x8d, 0xc3, 0x34,
+	0xab, 0x5c, 0x12, 0xe5, 0x8e, 0x79, 0x37, 0xc0,
+	0xe1, 0x16, 0x58, 0xaf, 0xc4, 0x33, 0x7d, 0x8a,
+	0x3f, 0xc8, 0x86, 0x71, 0x1a, 0xed, 0xa3, 0x54,
+	0x75, 0x82, 0xcc, 0x3b, 0x50, 0xa7, 0xe9, 0x1e,
+	0xd4, 0x23, 0x6d, 0x9a, 0xf1, 0x06, 0x48, 0xbf,
+	0x9e, 0x69, 0x27, 0xd0, 0xbb, 0x4c, 0x02, 0xf5,
+	0x40, 0xb7, 0xf9, 0x0e, 0x65, 0x92, 0xdc, 0x2b,
+	0x0a, 0xfd, 0xb3, 0x44, 0x2f, 0xd8, 0x96, 0x61,
+	0x55, 0xa2, 0xec, 0x1b, 0x70, 0x87, 0xc9, 0x3e,
+	0x1f, 0xe8, 0xa6, 0x51, 0x3a, 0xcd, 0x83, 0x74,
+	0xc1, 0x36, 0x78, 0x8f, 0xe4, 0x13, 0x5d, 0xaa,
+	0x8b, 0x7c, 0x32, 0xc5, 0xae, 0x59, 0x17, 0xe0,
+	0x2a, 0xdd, 0x93, 0x64, 0x0f, 0xf8, 0xb6, 0x41,
+	0x60, 0x97, 0xd9, 0x2e, 0x45, 0xb2, 0xfc, 0x0b,
+	0xbe, 0x49, 0x07, 0xf0, 0x9b, 0x6c, 0x22, 0xd5,
+	0xf4, 0x03, 0x4d, 0xba, 0xd1, 0x26, 0x68, 0x9f,
+};
+
+/** SPROM image layout */
+struct bhnd_sprom_layout {
+	size_t		size;		/**< image size, in bytes */
+	uint8_t		rev_first;	/**< first revision using this layout */
+	uint8_t		rev_last;	/**< last revision using this layout */
+	size_t		sig_off;	/**< signature offset, in bytes, if
+					     BHND_SPROM_HAS_SIG(sig) */
+	uint16_t	sig;		/**< signature word, or 0 if none */
+};
+
+#define	BHND_SPROM_HAS_SIG(sig)	((sig) != 0)
+
+/* Ordered by size, largest first; each layout's revision is stored in the
+ * low byte of its final word, and the CRC-8 in the high byte. */
+static const struct bhnd_sprom_layout bhnd_sprom_layouts[] = {
+	{ 468,	11,	11,	128,	0x0634 },	/* SROM11_WORDS, SROM11_SIGN */
+	{ 460,	10,	10,	438,	0x5372 },	/* SROM10_WORDS, SROM10_SIGN */
+	{ 440,	8,	9,	128,	0x5372 },	/* SROM4_WORDS, SROM8_SIGN */
+	{ 440,	4,	7,	64,	0x5372 },	/* SROM4_WORDS, SROM4_SIGN */
+	{ 128,	1,	3,	0,	0 },		/* SROM_WORDS */
+};
+
+/** Return the layout for revision @p rev, or NULL if unsupported */
+static const struct bhnd_sprom_layout *
+bhnd_sprom_find_layout (uint8_t rev)
+{
+	for (size_t i = 0; i < nitems(bhnd_sprom_layouts); i++) {
+		const struct bhnd_sprom_layout *l = &bhnd_sprom_layouts[i];
+
+		if (rev >= l->rev_first && rev <= l->rev_last)
+			return (l);
+	}
+
+	return (NULL);
+}
+
+/**
+ * Identify the SPROM revision and layout size of @p image.
+ *
+ * Layouts are tried largest first. Like bcmsrom, a rev 4+ layout only
+ * matches if its signature word is present; the rev 1-3 layout, which has
+ * no signature, is only tried once no larger layout matches.
+ *
+ * @param image SPROM image, in little-endian byte order.
+ * @param size size of @p image; may be larger than the SPROM layout.
+ * @param[out] rev the SPROM revision.
+ * @param[out] sprom_size the size of the SPROM layout.
+ *
+ * @retval 0 success
+ * @retval EINVAL if no layout with a valid CRC, revision, and signature is
+ * found.
+ */
+int
+bhnd_sprom_identify (const void *image, size_t size, uint8_t *rev,
+    size_t *sprom_size)
+{
+	const uint8_t *p = (const uint8_t *)image;
+
+	for (size_t i = 0; i < nitems(bhnd_sprom_layouts); i++) {
+		const struct bhnd_sprom_layout *l = &bhnd_sprom_layouts[i];
+		uint8_t r;
+
+		if (size < l->size)
+			continue;
+
+		r = p[l->size - 2];
+		if (r < l->rev_first || r > l->rev_last)
+			continue;
+
+		if (BHND_SPROM_HAS_SIG(l->sig) &&
+		    (p[l->sig_off] | (p[l->sig_off + 1] << 8)) != l->sig)
+			continue;
+
+		if (bhnd_nvram_crc8(p, l->size, BHND_NVRAM_CRC8_INITIAL) !=
+		    BHND_NVRAM_CRC8_VALID)
+			continue;
+
+		*rev = r;
+		*sprom_size = l->size;
+		return (0);
+	}
+
+	return (EINVAL);
+}
+
+/**
+ * Determine the SPROM layout size for revision @p rev.
+ *
+ * @retval 0 success
+ * @retval EINVAL if @p rev is not a supported SPROM revision.
+ */
+int
+bhnd_sprom_layout_size (uint8_t rev, size_t *sprom_size)
+{
+	const struct bhnd_sprom_layout *l;
+
+	if ((l = bhnd_sprom_find_layout(rev)) == NULL)
+		return (EINVAL);
+
+	*sprom_size = l->size;
+	return (0);
+}
+
+/**
+ * Determine the signature word of the SPROM layout for revision @p rev.
+ *
+ * @param rev SPROM revision.
+ * @param[out] sig_off the signature's byte offset.
+ * @param[out] sig the signature word, stored little-endian at @p sig_off.
+ *
+ * @retval 0 success
+ * @retval ENOENT if the layout for @p rev has no signature.
+ * @retval EINVAL if @p rev is not a supported SPROM revision.
+ */
+int
+bhnd_sprom_layout_sig (uint8_t rev, size_t *sig_off, uint16_t *sig)
+{
+	const struct bhnd_sprom_layout *l;
+
+	if ((l = bhnd_sprom_find_layout(rev)) == NULL)
+		return (EINVAL);
+
+	if (!BHND_SPROM_HAS_SIG(l->sig))
+		return (ENOENT);
+
+	*sig_off = l->sig_off;
+	*sig = l->sig;
+	return (0);
+}
+
+/**
+ * Initialize @p ctx for decoding of @p image.
+ *
+ * @retval 0 success
+ * @retval EINVAL if @p image is not a valid SPROM image.
+ */
+int
+bhnd_sprom_ctx_init (struct bhnd_sprom_ctx *ctx, const void *image,
+    size_t size)
+{
+	int error;
+
+	memset(ctx, 0, sizeof(*ctx));
+	if ((error = bhnd_sprom_identify(image, size, &ctx->sp_rev,
+	    &ctx->sp_size)))
+		return (error);
+
+	ctx->sp_image = (const uint8_t *)image;
+	return (0);
+}
+
+/** Read a little-endian value of @p width bytes at @p off */
+static uint32_t
+bhnd_sprom_read (const struct bhnd_sprom_ctx *ctx, size_t off, size_t width)
+{
+	const uint8_t *p = ctx->sp_image + off;
+
+	switch (width) {
+	case 1:
+		return (p[0]);
+	case 2:
+		return (p[0] | (p[1] << 8));
+	default:
+		return (p[0] | (p[1] << 8) | (p[2] << 16) |
+		    ((uint32_t)p[3] << 24));
+	}
+}
+
+/** Apply an offset descriptor's shift to @p v */
+static uint32_t
+bhnd_sprom_shift (uint32_t v, int shift)
+{
+	if (shift >= 0)
+		return (v >> shift);
+	else
+		return (v << -shift);
+}
+
+/**
+ * Decode the value(s) of @p nv into @p ctx's value assembly state.
+ *
+ * @retval 0 success
+ * @retval ENOENT if @p nv is not defined for the context's SPROM revision.
+ * @retval EINVAL if the variable's offset descriptors are invalid.
+ */
+int
+bhnd_sprom_decode_var (struct bhnd_sprom_ctx *ctx,
+    const struct bhnd_nvram_var *nv)
+{
+	const struct bhnd_sprom_var	*sv;
+	size_t				 group;
+
+	ctx->sp_nvals = 0;
+	ctx->sp_vmask = 0;
+	ctx->sp_all1 = true;
+
+	if ((sv = bhnd_nvram_find_sprom_var(nv, ctx->sp_rev)) == NULL)
+		return (ENOENT);
+
+	group = 0;
+	for (size_t i = 0; i < sv->num_offsets; i++) {
+		const struct bhnd_sprom_offset *sp = &sv->offsets[i];
+
+		if (sp->width != 1 && sp->width != 2 && sp->width != 4)
+			return (EINVAL);
+
+		if (sp->offset + (sp->count * sp->width) > ctx->sp_size)
+			return (EINVAL);
+
+		/* Continuations are OR'd into the previous elements; all
+		 * other descriptors start a new group of elements */
+		if (!sp->cont) {
+			group = ctx->sp_nvals;
+			if (group + sp->count > BHND_SPROM_ARRAY_MAX)
+				return (EINVAL);
+
+			memset(&ctx->sp_vals[group], 0,
+			    sizeof(ctx->sp_vals[0]) * sp->count);
+			ctx->sp_nvals += sp->count;
+		} else if (i == 0 || group + sp->count > ctx->sp_nvals) {
+			return (EINVAL);
+		}
+
+		for (size_t e = 0; e < sp->count; e++) {
+			uint32_t raw;
+
+			raw = bhnd_sprom_read(ctx, sp->offset + (e * sp->width),
+			    sp->width) & sp->mask;
+			if (raw != sp->mask)
+				ctx->sp_all1 = false;
+
+			ctx->sp_vals[group + e] |= bhnd_sprom_shift(raw,
+			    sp->shift);
+		}
+
+		ctx->sp_vmask |= bhnd_sprom_shift(sp->mask, sp->shift);
+	}
+
+	return (0);
+}
+
+/**
+ * Decode all variables defined for @p ctx's SPROM revision, writing a
+ * packed "name=value\0...\0\0" environment to @p buf.
+ *
+ * If @p buf is NULL, no output is written; the exact size required for the
+ * environment is computed from the variable table and the SPROM image.
+ *
+ * @param ctx an initialized decoding context.
+ * @param buf output buffer, or NULL.
+ * @param[in,out] len on input, the capacity of @p buf; on return, the
+ * number of bytes written (or required, if @p buf is NULL or too small).
+ *
+ * @retval 0 success
+ * @retval ENOMEM if @p buf is non-NULL and too small.
+ * @retval EINVAL if a variable's offset descriptors are invalid.
+ */
+int
+bhnd_sprom_decode (struct bhnd_sprom_ctx *ctx, char *buf, size_t *len)
+{
+	const struct bhnd_nvram_var	*vars;
+	size_t				 num_vars;
+	int				 error;
+
+	bhnd_nvram_obuf_init(&ctx->sp_out, buf, *len);
+
+	bhnd_nvram_put_str(&ctx->sp_out, "sromrev=");
+	bhnd_nvram_put_udec(&ctx->sp_out, ctx->sp_rev);
+	bhnd_nvram_put_char(&ctx->sp_out, '\0');
+
+	vars = bhnd_nvram_get_vars(&num_vars);
+	for (size_t i = 0; i < num_vars; i++) {
+		const struct bhnd_nvram_var *nv = &vars[i];
+
+		error = bhnd_sprom_decode_var(ctx, nv);
+		if (error == ENOENT)
+			continue;
+		else if (error)
+			return (error);
+
+		if ((nv->flags & BHND_NVRAM_VF_IGNALL1) && ctx->sp_all1)
+			continue;
+
+		error = bhnd_nvram_fmt_pair(&ctx->sp_out, nv, ctx->sp_vals,
+		    ctx->sp_nvals, ctx->sp_vmask);
+		if (error)
+			return (error);
+	}
+
+	/* Terminate the environment */
+	bhnd_nvram_put_char(&ctx->sp_out, '\0');
+
+	*len = ctx->sp_out.ob_len;
+	if (buf != NULL && !bhnd_nvram_obuf_fits(&ctx->sp_out))
+		return (ENOMEM);
+
+	return (0);
+}
+
+/**
+ * Decode all variables defined for @p ctx's SPROM revision into a single
+ * exactly-sized allocation.
+ *
+ * The environment size is computed in a sizing pass, and the environment
+ * is then formatted directly into the returned buffer; no fixed-size
+ * scratch buffer or copy is required.
+ *
+ * @param ctx an initialized decoding context.
+ * @param[out] env on success, the packed "name=value\0...\0\0"
+ * environment. The caller is responsible for deallocating this buffer
+ * via free(3).
+ * @param[out] len on success, the size of @p env.
+ *
+ * @retval 0 success
+ * @retval ENOMEM if allocation fails.
+ * @retval EINVAL if a variable's offset descriptors are invalid.
+ */
+int
+bhnd_sprom_decode_alloc (struct bhnd_sprom_ctx *ctx, char **env, size_t *len)
+{
+	char	*buf;
+	size_t	 size, written;
+	int	 error;
+
+	size = 0;
+	if ((error = bhnd_sprom_decode(ctx, NULL, &size)))
+		return (error);
+
+	if ((buf = malloc(size)) == NULL)
+		return (ENOMEM);
+
+	written = size;
+	if ((error = bhnd_sprom_decode(ctx, buf, &written))) {
+		free(buf);
+		return (error);
+	}
+
+	/* The formatting pass must agree with the sizing pass */
+	if (written != size) {
+		free(buf);
+		return (EINVAL);
+	}
+
+	*env = buf;
+	*len = size;
+	return (0);
+}
+
+/** Write a little-endian value of @p width bytes at @p p, replacing only
+ *  the bits in @p mask */
+static void
+bhnd_sprom_write (uint8_t *p, size_t width, uint32_t mask, uint32_t v)
+{
+	for (size_t i = 0; i < width; i++) {
+		uint8_t bmask = (mask >> (i * 8)) & 0xFF;
+		p[i] = (p[i] & ~bmask) | ((v >> (i * 8)) & bmask);
+	}
+}
+
+/**
+ * Return true if @p v is representable within the (post-shift) value
+ * mask @p vmask of a variable of @p type.
+ *
+ * Signed values may be given either sign-extended, or as the raw masked
+ * bits (as produced by hex formatting).
+ */
+bool
+bhnd_sprom_value_fits (bhnd_nvram_dt type, uint32_t v, uint32_t vmask)
+{
+	uint32_t sign;
+
+	if ((v & ~vmask) == 0)
+		return (true);
+
+	if (type != BHND_NVRAM_DT_SINT || vmask == 0)
+		return (false);
+
+	/* Negative signed values must round-trip through sign extension from
+	 * the highest bit of the value mask */
+	for (sign = 1U << 31; (sign & vmask) == 0; sign >>= 1)
+		continue;
+
+	return ((v & sign) != 0 && (v | vmask) == UINT32_MAX);
+}
+
+/**
+ * Validate the offset descriptors of @p sv against a SPROM layout of
+ * @p size bytes.
+ *
+ * @param sv SPROM variable definition.
+ * @param size SPROM layout size.
+ * @param[out] nvals the variable's element count.
+ * @param[out] vmask the variable's combined (post-shift) value mask.
+ *
+ * @retval 0 success
+ * @retval EINVAL if the offset descriptors are invalid.
+ */
+int
+bhnd_sprom_var_layout (const struct bhnd_sprom_var *sv, size_t size,
+    size_t *nvals, uint32_t *vmask)
+{
+	size_t group, total;
+
+	*vmask = 0;
+	group = 0;
+	total = 0;
+	for (size_t i = 0; i < sv->num_offsets; i++) {
+		const struct bhnd_sprom_offset *sp = &sv->offsets[i];
+
+		if (sp->width != 1 && sp->width != 2 && sp->width != 4)
+			return (EINVAL);
+
+		if (sp->offset + (sp->count * sp->width) > size)
+			return (EINVAL);
+
+		if (!sp->cont) {
+			group = total;
+			total += sp->count;
+		} else if (i == 0 || group + sp->count > total) {
+			return (EINVAL);
+		}
+
+		*vmask |= bhnd_sprom_shift(sp->mask, sp->shift);
+	}
+
+	if (total > BHND_SPROM_ARRAY_MAX)
+		return (EINVAL);
+
+	*nvals = total;
+	return (0);
+}
+
+/**
+ * Write @p vals to @p image through the offset descriptors of @p sv.
+ *
+ * The descriptors must have been validated with bhnd_sprom_var_layout(),
+ * and @p vals must hold the variable's full element count. Only the bits
+ * covered by the descriptors are modified.
+ */
+void
+bhnd_sprom_write_var (uint8_t *image, const struct bhnd_sprom_var *sv,
+    const uint32_t *vals)
+{
+	size_t group, total;
+
+	group = 0;
+	total = 0;
+	for (size_t i = 0; i < sv->num_offsets; i++) {
+		const struct bhnd_sprom_offset *sp = &sv->offsets[i];
+
+		if (!sp->cont) {
+			group = total;
+			total += sp->count;
+		}
+
+		for (size_t e = 0; e < sp->count; e++) {
+			uint32_t raw;
+
+			/* Invert the descriptor's shift */
+			raw = bhnd_sprom_shift(vals[group + e], -sp->shift);
+			bhnd_sprom_write(image + sp->offset + (e * sp->width),
+			    sp->width, sp->mask, raw);
+		}
+	}
+}
+
+/**
+ * Encode the value(s) of @p nv into @p image, the inverse of
+ * bhnd_sprom_decode_var().
+ *
+ * Only the bits covered by the variable's offset descriptors are modified;
+ * the image CRC is not updated.
+ *
+ * @param image SPROM image, in little-endian byte order.
+ * @param size SPROM layout size.
+ * @param rev SPROM revision.
+ * @param nv variable to encode.
+ * @param vals values to encode; signed values must be sign-extended.
+ * @param nvals number of elements in @p vals.
+ *
+ * @retval 0 success
+ * @retval ENOENT if @p nv is not defined for @p rev.
+ * @retval EINVAL if @p nvals does not match the variable's element count,
+ * or the variable's offset descriptors are invalid.
+ * @retval ERANGE if a value cannot be represented.
+ */
+int
+bhnd_sprom_encode_var (uint8_t *image, size_t size, uint8_t rev,
+    const struct bhnd_nvram_var *nv, const uint32_t *vals, size_t nvals)
+{
+	const struct bhnd_sprom_var	*sv;
+	uint32_t			 vmask;
+	size_t				 total;
+	int				 error;
+
+	if ((sv = bhnd_nvram_find_sprom_var(nv, rev)) == NULL)
+		return (ENOENT);
+
+	if ((error = bhnd_sprom_var_layout(sv, size, &total, &vmask)))
+		return (error);
+
+	if (nvals != total)
+		return (EINVAL);
+
+	for (size_t i = 0; i < nvals; i++) {
+		if (!bhnd_sprom_value_fits(nv->type, vals[i], vmask))
+			return (ERANGE);
+	}
+
+	bhnd_sprom_write_var(image, sv, vals);
+	return (0);
+}
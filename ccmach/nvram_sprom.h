@@ -0,0 +1,94 @@
+//
+//  nvram_sprom.h
+//  ccmach
+//
+//  Created by Landon Fuller on 1/28/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef _NVRAM_SPROM_H_
+#define _NVRAM_SPROM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nvram_fmt.h"
+#include "nvram_map.h"
+
+/** Initial bhnd_nvram_crc8 value */
+#define	BHND_NVRAM_CRC8_INITIAL	0xFF
+
+/** Valid CRC-8 checksum */
+#define	BHND_NVRAM_CRC8_VALID	0x9F
+
+/** Maximum number of elements in a single SPROM variable */
+#define	BHND_SPROM_ARRAY_MAX	32
+
+/** Maximum SPROM image size, in bytes */
+#define	BHND_SPROM_MAX_SIZE	468
+
+extern const uint8_t bhnd_nvram_crc8_tab[];
+
+/**
+ * Calculate CRC-8 over @p buf.
+ *
+ * @param buf input buffer
+ * @param size buffer size
+ * @param crc last computed crc, or BHND_NVRAM_CRC8_INITIAL
+ */
+static inline uint8_t
+bhnd_nvram_crc8 (const void *buf, size_t size, uint8_t crc)
+{
+	const uint8_t *p = (const uint8_t *)buf;
+	while (size--)
+		crc = bhnd_nvram_crc8_tab[(crc ^ *p++)];
+
+	return (crc);
+}
+
+/**
+ * SPROM decoding context.
+ *
+ * All state required to decode a single SPROM image is held here, rather
+ * than in function-level statics (as in the vendor _initvars_srom_pci());
+ * any number of images may be decoded concurrently, provided that each
+ * decode uses its own context.
+ */
+struct bhnd_sprom_ctx {
+	const uint8_t	*sp_image;	/**< SPROM image, in little-endian byte order */
+	size_t		 sp_size;	/**< SPROM image size, in bytes */
+	uint8_t		 sp_rev;	/**< SPROM revision */
+
+	/* Value assembly state */
+	uint32_t	 sp_vals[BHND_SPROM_ARRAY_MAX];	/**< decoded elements */
+	uint32_t	 sp_vmask;	/**< combined (post-shift) value mask */
+	size_t		 sp_nvals;	/**< number of decoded elements */
+	bool		 sp_all1;	/**< all decoded bits are set */
+
+	struct bhnd_nvram_obuf	 sp_out;	/**< output buffer */
+};
+
+int	bhnd_sprom_identify(const void *image, size_t size, uint8_t *rev,
+	    size_t *sprom_size);
+int	bhnd_sprom_layout_size(uint8_t rev, size_t *sprom_size);
+int	bhnd_sprom_layout_sig(uint8_t rev, size_t *sig_off, uint16_t *sig);
+int	bhnd_sprom_ctx_init(struct bhnd_sprom_ctx *ctx, const void *image,
+	    size_t size);
+int	bhnd_sprom_decode_var(struct bhnd_sprom_ctx *ctx,
+	    const struct bhnd_nvram_var *nv);
+int	bhnd_sprom_decode(struct bhnd_sprom_ctx *ctx, char *buf,
+	    size_t *len);
+int	bhnd_sprom_decode_alloc(struct bhnd_sprom_ctx *ctx, char **env,
+	    size_t *len);
+
+bool	bhnd_sprom_value_fits(bhnd_nvram_dt type, uint32_t v,
+	    uint32_t vmask);
+int	bhnd_sprom_var_layout(const struct bhnd_sprom_var *sv, size_t size,
+	    size_t *nvals, uint32_t *vmask);
+void	bhnd_sprom_write_var(uint8_t *image, const struct bhnd_sprom_var *sv,
+	    const uint32_t *vals);
+int	bhnd_sprom_encode_var(uint8_t *image, size_t size, uint8_t rev,
+	    const struct bhnd_nvram_var *nv, const uint32_t *vals,
+	    size_t nvals);
+
+#endif /* _NVRAM_SPROM_H_ */
@@ -0,0 +1,782 @@
+//
+//  nvram_sprom_delta.c
+//  ccmach
+//
+//  Created by Landon Fuller on 2/10/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "nvram_sprom_delta.h"
+
+/** Serialized delta store header */
+struct bhnd_sprom_delta_hdr {
+	uint32_t	magic;		/**< BHND_SPROM_DELTA_MAGIC */
+	uint32_t	version;	/**< BHND_SPROM_DELTA_VERSION */
+	uint32_t	nbaselines;	/**< baseline count */
+	uint32_t	reserved;
+	uint64_t	count;		/**< record count */
+	uint64_t	data_len;	/**< record data length */
+};
+
+/** Set the CRC byte of a @p size byte SPROM image */
+static void
+bhnd_sprom_delta_set_crc (uint8_t *image, size_t size)
+{
+	image[size - 1] = ~bhnd_nvram_crc8(image, size - 1,
+	    BHND_NVRAM_CRC8_INITIAL);
+}
+
+/**
+ * Initialize a baseline from the valid SPROM image @p image.
+ *
+ * @retval 0 success
+ * @retval EINVAL if @p image is not a valid SPROM image.
+ */
+int
+bhnd_sprom_baseline_init (struct bhnd_sprom_baseline *sb, const void *image,
+    size_t size)
+{
+	size_t	sprom_size;
+	uint8_t	rev;
+	int	error;
+
+	memset(sb, 0, sizeof(*sb));
+
+	if ((error = bhnd_sprom_identify(image, size, &rev, &sprom_size)))
+		return (error);
+
+	sb->sb_rev = rev;
+	sb->sb_size = sprom_size;
+	memcpy(sb->sb_image, image, sprom_size);
+
+	return (0);
+}
+
+/**
+ * Initialize a baseline learner for SPROM revision @p rev.
+ *
+ * @retval 0 success
+ * @retval EINVAL if @p rev is not a supported SPROM revision.
+ */
+int
+bhnd_sprom_learner_init (struct bhnd_sprom_learner *sl, uint8_t rev)
+{
+	memset(sl, 0, sizeof(*sl));
+	sl->sl_rev = rev;
+
+	return (bhnd_sprom_layout_size(rev, &sl->sl_size));
+}
+
+/**
+ * Add a SPROM image to the learner's vote.
+ *
+ * @retval 0 success
+ * @retval EINVAL if @p image is not a valid SPROM image of the learner's
+ * revision.
+ */
+int
+bhnd_sprom_learner_add (struct bhnd_sprom_learner *sl, const void *image,
+    size_t size)
+{
+	const uint8_t	*p = image;
+	size_t		 sprom_size;
+	uint8_t		 rev;
+	int		 error;
+
+	if ((error = bhnd_sprom_identify(image, size, &rev, &sprom_size)))
+		return (error);
+
+	if (rev != sl->sl_rev || sprom_size != sl->sl_size)
+		return (EINVAL);
+
+	for (size_t w = 0; w < sl->sl_size / 2; w++) {
+		uint16_t v = p[w * 2] | (p[(w * 2) + 1] << 8);
+
+		if (sl->sl_votes[w] == 0) {
+			sl->sl_cand[w] = v;
+			sl->sl_votes[w] = 1;
+		} else if (sl->sl_cand[w] == v) {
+			sl->sl_votes[w]++;
+		} else {
+			sl->sl_votes[w]--;
+		}
+	}
+
+	sl->sl_count++;
+	return (0);
+}
+
+/**
+ * Produce the learned baseline.
+ *
+ * @retval 0 success
+ * @retval EINVAL if no images have been added.
+ */
+int
+bhnd_sprom_learner_finish (struct bhnd_sprom_learner *sl,
+    struct bhnd_sprom_baseline *sb)
+{
+	if (sl->sl_count == 0)
+		return (EINVAL);
+
+	memset(sb, 0, sizeof(*sb));
+	sb->sb_rev = sl->sl_rev;
+	sb->sb_size = sl->sl_size;
+
+	for (size_t w = 0; w < sl->sl_size / 2; w++) {
+		sb->sb_image[w * 2] = sl->sl_cand[w] & 0xFF;
+		sb->sb_image[(w * 2) + 1] = sl->sl_cand[w] >> 8;
+	}
+
+	sb->sb_image[sb->sb_size - 2] = sl->sl_rev;
+	bhnd_sprom_delta_set_crc(sb->sb_image, sb->sb_size);
+
+	return (0);
+}
+
+/** Append @p v to @p p as an LEB128 varint, returning the new end */
+static uint8_t *
+bhnd_sprom_delta_put_varint (uint8_t *p, uint32_t v)
+{
+	while (v >= 0x80) {
+		*p++ = (v & 0x7F) | 0x80;
+		v >>= 7;
+	}
+
+	*p++ = v;
+	return (p);
+}
+
+/**
+ * Read an LEB128 varint from [@p *p, @p end).
+ *
+ * @retval 0 success
+ * @retval EINVAL if the varint is truncated or exceeds 32 bits.
+ */
+static int
+bhnd_sprom_delta_get_varint (const uint8_t **p, const uint8_t *end,
+    uint32_t *v)
+{
+	uint32_t result = 0;
+
+	for (unsigned int shift = 0; shift < 35; shift += 7) {
+		uint8_t b;
+
+		if (*p == end)
+			return (EINVAL);
+
+		b = *(*p)++;
+		result |= (uint32_t)(b & 0x7F) << shift;
+
+		if (!(b & 0x80)) {
+			*v = result;
+			return (0);
+		}
+	}
+
+	return (EINVAL);
+}
+
+/**
+ * Find the words of @p image that differ from @p base, writing their
+ * indices to @p idx in ascending order.
+ *
+ * @return the number of differing words.
+ */
+static size_t
+bhnd_sprom_delta_diff (const uint8_t *base, const uint8_t *image,
+    size_t nwords, uint16_t *idx)
+{
+	size_t i, n;
+
+	i = 0;
+	n = 0;
+
+#ifdef __SSE2__
+	/* Images typically differ in a handful of words; compare eight words
+	 * at a time, and only inspect groups containing a difference */
+	for (; i + 8 <= nwords; i += 8) {
+		__m128i		a, b;
+		unsigned int	mask;
+
+		a = _mm_loadu_si128((const __m128i *)(base + (i * 2)));
+		b = _mm_loadu_si128((const __m128i *)(image + (i * 2)));
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+		if (mask == 0xFFFF)
+			continue;
+
+		for (size_t w = 0; w < 8; w++) {
+			if (((mask >> (w * 2)) & 0x3) != 0x3)
+				idx[n++] = (uint16_t)(i + w);
+		}
+	}
+#endif
+
+	for (; i < nwords; i++) {
+		if (base[i * 2] != image[i * 2] ||
+		    base[(i * 2) + 1] != image[(i * 2) + 1])
+			idx[n++] = (uint16_t)i;
+	}
+
+	return (n);
+}
+
+/**
+ * Encode @p image as a delta record against the baseline @p sb.
+ *
+ * @param sb baseline.
+ * @param baseline the baseline's index, as recorded in the output.
+ * @param image a valid SPROM image of the baseline's revision.
+ * @param size size of @p image.
+ * @param[out] out output buffer, of at least BHND_SPROM_DELTA_MAX bytes.
+ * @param[out] len on success, the encoded record length.
+ *
+ * @retval 0 success
+ * @retval EINVAL if @p image is not a valid SPROM image of the baseline's
+ * revision and size.
+ */
+int
+bhnd_sprom_delta_encode (const struct bhnd_sprom_baseline *sb,
+    uint32_t baseline, const void *image, size_t size, uint8_t *out,
+    size_t *len)
+{
+	const uint8_t	*p = image;
+	uint16_t	 idx[BHND_SPROM_MAX_WORDS];
+	uint8_t		*o;
+	size_t		 n, nwords;
+	uint32_t	 prev;
+
+	if (size < sb->sb_size || p[sb->sb_size - 2] != sb->sb_rev)
+		return (EINVAL);
+
+	/* The CRC is recomputed on reconstruction, and must be valid here */
+	if (bhnd_nvram_crc8(p, sb->sb_size, BHND_NVRAM_CRC8_INITIAL) !=
+	    BHND_NVRAM_CRC8_VALID)
+		return (EINVAL);
+
+	/* The final (revision and CRC) word is never stored */
+	nwords = (sb->sb_size / 2) - 1;
+	n = bhnd_sprom_delta_diff(sb->sb_image, p, nwords, idx);
+
+	o = bhnd_sprom_delta_put_varint(out, baseline);
+	o = bhnd_sprom_delta_put_varint(o, (uint32_t)n);
+
+	prev = 0;
+	for (size_t i = 0; i < n; i++) {
+		o = bhnd_sprom_delta_put_varint(o, idx[i] - prev);
+		*o++ = p[idx[i] * 2];
+		*o++ = p[(idx[i] * 2) + 1];
+		prev = idx[i] + 1;
+	}
+
+	*len = (size_t)(o - out);
+	return (0);
+}
+
+/**
+ * Reconstruct a SPROM image from a delta record.
+ *
+ * @param baselines baseline table.
+ * @param nbaselines number of baselines.
+ * @param rec record data.
+ * @param len maximum record length.
+ * @param[out] image output buffer, of at least the referenced baseline's
+ * size.
+ * @param[out] size on success, the reconstructed image size.
+ * @param[out] consumed if non-NULL, the record length.
+ *
+ * @retval 0 success
+ * @retval EINVAL if the record is malformed.
+ */
+int
+bhnd_sprom_delta_decode (const struct bhnd_sprom_baseline *baselines,
+    size_t nbaselines, const uint8_t *rec, size_t len, uint8_t *image,
+    size_t *size, size_t *consumed)
+{
+	const struct bhnd_sprom_baseline	*sb;
+	const uint8_t				*p, *end;
+	uint32_t				 baseline, n, word;
+	size_t					 nwords;
+	int					 error;
+
+	p = rec;
+	end = rec + len;
+
+	if ((error = bhnd_sprom_delta_get_varint(&p, end, &baseline)))
+		return (error);
+
+	if (baseline >= nbaselines)
+		return (EINVAL);
+
+	sb = &baselines[baseline];
+	nwords = (sb->sb_size / 2) - 1;
+
+	if ((error = bhnd_sprom_delta_get_varint(&p, end, &n)))
+		return (error);
+
+	if (n > nwords)
+		return (EINVAL);
+
+	memcpy(image, sb->sb_image, sb->sb_size);
+
+	word = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		uint32_t gap;
+
+		if ((error = bhnd_sprom_delta_get_varint(&p, end, &gap)))
+			return (error);
+
+		if (gap >= nwords - word || end - p < 2)
+			return (EINVAL);
+
+		word += gap;
+		image[word * 2] = p[0];
+		image[(word * 2) + 1] = p[1];
+		p += 2;
+		word++;
+	}
+
+	bhnd_sprom_delta_set_crc(image, sb->sb_size);
+
+	*size = sb->sb_size;
+	if (consumed != NULL)
+		*consumed = (size_t)(p - rec);
+
+	return (0);
+}
+
+/**
+ * Determine the length of the record at @p rec, without decoding it.
+ *
+ * @retval 0 success
+ * @retval EINVAL if the record is malformed.
+ */
+static int
+bhnd_sprom_delta_skip (const uint8_t *rec, size_t len, size_t *consumed)
+{
+	const uint8_t	*p, *end;
+	uint32_t	 v, n;
+	int		 error;
+
+	p = rec;
+	end = rec + len;
+
+	if ((error = bhnd_sprom_delta_get_varint(&p, end, &v)))
+		return (error);
+
+	if ((error = bhnd_sprom_delta_get_varint(&p, end, &n)))
+		return (error);
+
+	for (uint32_t i = 0; i < n; i++) {
+		if ((error = bhnd_sprom_delta_get_varint(&p, end, &v)))
+			return (error);
+
+		if (end - p < 2)
+			return (EINVAL);
+		p += 2;
+	}
+
+	*consumed = (size_t)(p - rec);
+	return (0);
+}
+
+/**
+ * Initialize an empty delta store.
+ *
+ * @retval 0 success
+ */
+int
+bhnd_sprom_delta_store_init (struct bhnd_sprom_delta_store *ds)
+{
+	memset(ds, 0, sizeof(*ds));
+	return (0);
+}
+
+/** Release all resources held by @p ds */
+void
+bhnd_sprom_delta_store_fini (struct bhnd_sprom_delta_store *ds)
+{
+	free(ds->ds_baselines);
+	free(ds->ds_data);
+	free(ds->ds_index);
+
+	memset(ds, 0, sizeof(*ds));
+}
+
+/**
+ * Add a baseline to @p ds.
+ *
+ * @param ds delta store.
+ * @param sb baseline to be copied.
+ * @param[out] baseline on success, the baseline's index.
+ *
+ * @retval 0 success
+ * @retval ENOMEM if allocation fails.
+ */
+int
+bhnd_sprom_delta_store_add_baseline (struct bhnd_sprom_delta_store *ds,
+    const struct bhnd_sprom_baseline *sb, uint32_t *baseline)
+{
+	struct bhnd_sprom_baseline *baselines;
+
+	if (ds->ds_nbaselines == UINT32_MAX)
+		return (ENOMEM);
+
+	baselines = realloc(ds->ds_baselines,
+	    (ds->ds_nbaselines + 1) * sizeof(baselines[0]));
+	if (baselines == NULL)
+		return (ENOMEM);
+
+	ds->ds_baselines = baselines;
+	ds->ds_baselines[ds->ds_nbaselines] = *sb;
+	*baseline = (uint32_t)ds->ds_nbaselines++;
+
+	return (0);
+}
+
+/** Ensure that @p ds has room for @p len additional bytes of record data */
+static int
+bhnd_sprom_delta_store_reserve (struct bhnd_sprom_delta_store *ds, size_t len)
+{
+	uint8_t	*data;
+	size_t	 cap;
+
+	if (ds->ds_len + len <= ds->ds_cap)
+		return (0);
+
+	cap = ds->ds_cap ? ds->ds_cap : 4096;
+	while (ds->ds_len + len > cap)
+		cap *= 2;
+
+	if ((data = realloc(ds->ds_data, cap)) == NULL)
+		return (ENOMEM);
+
+	ds->ds_data = data;
+	ds->ds_cap = cap;
+	return (0);
+}
+
+/**
+ * Delta-encode and append @p count images against baseline @p baseline.
+ *
+ * Either all images are appended, or none are.
+ *
+ * @param ds delta store.
+ * @param baseline baseline index.
+ * @param images the first image.
+ * @param stride distance between images, in bytes; at least the
+ * baseline's size.
+ * @param count number of images.
+ *
+ * @retval 0 success
+ * @retval EINVAL if @p baseline is out of range, or an image is not a valid
+ * SPROM image of the baseline's revision.
+ * @retval ENOMEM if allocation fails.
+ */
+int
+bhnd_sprom_delta_store_append (struct bhnd_sprom_delta_store *ds,
+    uint32_t baseline, const uint8_t *images, size_t stride, size_t count)
+{
+	const struct bhnd_sprom_baseline	*sb;
+	size_t					 saved_len;
+	uint64_t				 saved_count;
+	int					 error;
+
+	if (baseline >= ds->ds_nbaselines)
+		return (EINVAL);
+
+	sb = &ds->ds_baselines[baseline];
+	if (stride < sb->sb_size)
+		return (EINVAL);
+
+	saved_len = ds->ds_len;
+	saved_count = ds->ds_count;
+
+	for (size_t i = 0; i < count; i++) {
+		size_t len;
+
+		if ((error = bhnd_sprom_delta_store_reserve(ds,
+		    BHND_SPROM_DELTA_MAX)))
+			goto failed;
+
+		/* Index every BHND_SPROM_DELTA_INDEX_STRIDE'th record */
+		if (ds->ds_count % BHND_SPROM_DELTA_INDEX_STRIDE == 0) {
+			size_t entry = ds->ds_count / BHND_SPROM_DELTA_INDEX_STRIDE;
+
+			if (entry == ds->ds_index_cap) {
+				size_t		 cap;
+				uint64_t	*index;
+
+				cap = ds->ds_index_cap ? ds->ds_index_cap * 2 : 64;
+				index = realloc(ds->ds_index,
+				    cap * sizeof(index[0]));
+				if (index == NULL) {
+					error = ENOMEM;
+					goto failed;
+				}
+
+				ds->ds_index = index;
+				ds->ds_index_cap = cap;
+			}
+
+			ds->ds_index[entry] = ds->ds_len;
+		}
+
+		error = bhnd_sprom_delta_encode(sb, baseline,
+		    images + (i * stride), stride, ds->ds_data + ds->ds_len,
+		    &len);
+		if (error)
+			goto failed;
+
+		ds->ds_len += len;
+		ds->ds_count++;
+	}
+
+	return (0);
+
+failed:
+	ds->ds_len = saved_len;
+	ds->ds_count = saved_count;
+	return (error);
+}
+
+/**
+ * Reconstruct @p count consecutive images, starting at record @p first.
+ *
+ * The nearest preceding indexed record is located, and any intervening
+ * records are skipped without being decoded.
+ *
+ * @param ds delta store.
+ * @param first index of the first record.
+ * @param count number of records.
+ * @param[out] images output buffer.
+ * @param stride distance between output images, in bytes; at least the
+ * size of the largest baseline referenced.
+ *
+ * @retval 0 success
+ * @retval ENOENT if the requested records are out of range.
+ * @retval EINVAL if a record is malformed, or its image is larger than
+ * @p stride.
+ */
+int
+bhnd_sprom_delta_store_get (const struct bhnd_sprom_delta_store *ds,
+    uint64_t first, size_t count, uint8_t *images, size_t stride)
+{
+	size_t	off, len;
+	int	error;
+
+	if (first > ds->ds_count || count > ds->ds_count - first)
+		return (ENOENT);
+
+	if (count == 0)
+		return (0);
+
+	off = ds->ds_index[first / BHND_SPROM_DELTA_INDEX_STRIDE];
+	for (uint64_t i = first - (first % BHND_SPROM_DELTA_INDEX_STRIDE);
+	    i < first; i++)
+	{
+		error = bhnd_sprom_delta_skip(ds->ds_data + off,
+		    ds->ds_len - off, &len);
+		if (error)
+			return (error);
+
+		off += len;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		uint8_t	 image[BHND_SPROM_MAX_SIZE];
+		size_t	 size;
+
+		error = bhnd_sprom_delta_decode(ds->ds_baselines,
+		    ds->ds_nbaselines, ds->ds_data + off, ds->ds_len - off,
+		    image, &size, &len);
+		if (error)
+			return (error);
+
+		if (size > stride)
+			return (EINVAL);
+
+		memcpy(images + (i * stride), image, size);
+		off += len;
+	}
+
+	return (0);
+}
+
+/** Number of index entries for @p count records */
+static size_t
+bhnd_sprom_delta_nindex (uint64_t count)
+{
+	return ((count + BHND_SPROM_DELTA_INDEX_STRIDE - 1) /
+	    BHND_SPROM_DELTA_INDEX_STRIDE);
+}
+
+/**
+ * Serialize @p ds to a single buffer.
+ *
+ * The serialized form is the header, the baselines (revision, reserved
+ * byte, 16-bit size, and image), the record index, and the record data,
+ * in host (little-endian) byte order.
+ *
+ * @param ds delta store.
+ * @param[out] buf on success, the serialized store. The caller is
+ * responsible for deallocating this buffer via free(3).
+ * @param[out] len on success, the size of @p buf.
+ *
+ * @retval 0 success
+ * @retval ENOMEM if allocation fails.
+ */
+int
+bhnd_sprom_delta_store_serialize (const struct bhnd_sprom_delta_store *ds,
+    uint8_t **buf, size_t *len)
+{
+	struct bhnd_sprom_delta_hdr	 hdr;
+	uint8_t				*out, *p;
+	size_t				 total, nindex;
+
+	nindex = bhnd_sprom_delta_nindex(ds->ds_count);
+
+	total = sizeof(hdr);
+	for (size_t i = 0; i < ds->ds_nbaselines; i++)
+		total += 4 + ds->ds_baselines[i].sb_size;
+	total += nindex * sizeof(ds->ds_index[0]);
+	total += ds->ds_len;
+
+	if ((out = malloc(total)) == NULL)
+		return (ENOMEM);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = BHND_SPROM_DELTA_MAGIC;
+	hdr.version = BHND_SPROM_DELTA_VERSION;
+	hdr.nbaselines = (uint32_t)ds->ds_nbaselines;
+	hdr.count = ds->ds_count;
+	hdr.data_len = ds->ds_len;
+
+	p = out;
+	memcpy(p, &hdr, sizeof(hdr));
+	p += sizeof(hdr);
+
+	for (size_t i = 0; i < ds->ds_nbaselines; i++) {
+		const struct bhnd_sprom_baseline *sb = &ds->ds_baselines[i];
+
+		p[0] = sb->sb_rev;
+		p[1] = 0;
+		p[2] = sb->sb_size & 0xFF;
+		p[3] = sb->sb_size >> 8;
+		memcpy(p + 4, sb->sb_image, sb->sb_size);
+		p += 4 + sb->sb_size;
+	}
+
+	memcpy(p, ds->ds_index, nindex * sizeof(ds->ds_index[0]));
+	p += nindex * sizeof(ds->ds_index[0]);
+
+	memcpy(p, ds->ds_data, ds->ds_len);
+
+	*buf = out;
+	*len = total;
+	return (0);
+}
+
+/**
+ * Initialize @p ds from a store serialized by
+ * bhnd_sprom_delta_store_serialize(). The contents of @p buf are copied.
+ *
+ * @retval 0 success
+ * @retval EINVAL if @p buf is not a valid serialized store.
+ * @retval ENOMEM if allocation fails.
+ */
+int
+bhnd_sprom_delta_store_load (struct bhnd_sprom_delta_store *ds,
+    const uint8_t *buf, size_t len)
+{
+	struct bhnd_sprom_delta_hdr	 hdr;
+	const uint8_t			*p, *end;
+	uint64_t			 nindex;
+
+	bhnd_sprom_delta_store_init(ds);
+
+	if (len < sizeof(hdr))
+		return (EINVAL);
+
+	memcpy(&hdr, buf, sizeof(hdr));
+	if (hdr.magic != BHND_SPROM_DELTA_MAGIC ||
+	    hdr.version != BHND_SPROM_DELTA_VERSION)
+		return (EINVAL);
+
+	p = buf + sizeof(hdr);
+	end = buf + len;
+
+	/* Baselines */
+	if (hdr.nbaselines > (size_t)(end - p) / 4)
+		return (EINVAL);
+
+	ds->ds_baselines = calloc(hdr.nbaselines + 1,
+	    sizeof(ds->ds_baselines[0]));
+	if (ds->ds_baselines == NULL)
+		return (ENOMEM);
+
+	for (uint32_t i = 0; i < hdr.nbaselines; i++) {
+		struct bhnd_sprom_baseline	*sb;
+		size_t				 size;
+
+		if (end - p < 4)
+			goto failed;
+
+		size = p[2] | (p[3] << 8);
+		if (size < 2 || size % 2 != 0 || size > BHND_SPROM_MAX_SIZE ||
+		    (size_t)(end - p) - 4 < size)
+			goto failed;
+
+		sb = &ds->ds_baselines[i];
+		sb->sb_rev = p[0];
+		sb->sb_size = size;
+		memcpy(sb->sb_image, p + 4, size);
+
+		ds->ds_nbaselines++;
+		p += 4 + size;
+	}
+
+	/* Index and records */
+	nindex = bhnd_sprom_delta_nindex(hdr.count);
+	if ((uint64_t)(end - p) / sizeof(uint64_t) < nindex)
+		goto failed;
+
+	if ((uint64_t)(end - p) - (nindex * sizeof(uint64_t)) != hdr.data_len)
+		goto failed;
+
+	ds->ds_index = malloc((nindex + 1) * sizeof(ds->ds_index[0]));
+	ds->ds_data = malloc(hdr.data_len + 1);
+	if (ds->ds_index == NULL || ds->ds_data == NULL) {
+		bhnd_sprom_delta_store_fini(ds);
+		return (ENOMEM);
+	}
+
+	memcpy(ds->ds_index, p, nindex * sizeof(ds->ds_index[0]));
+	p += nindex * sizeof(ds->ds_index[0]);
+	memcpy(ds->ds_data, p, hdr.data_len);
+
+	for (uint64_t i = 0; i < nindex; i++) {
+		if (ds->ds_index[i] > hdr.data_len ||
+		    (i > 0 && ds->ds_index[i] < ds->ds_index[i-1]))
+			goto failed;
+	}
+
+	ds->ds_index_cap = nindex + 1;
+	ds->ds_len = hdr.data_len;
+	ds->ds_cap = hdr.data_len + 1;
+	ds->ds_count = hdr.count;
+
+	return (0);
+
+failed:
+	bhnd_sprom_delta_store_fini(ds);
+	return (EINVAL);
+}
@@ -0,0 +1,118 @@
+//
+//  nvram_sprom_delta.h
+//  ccmach
+//
+//  Created by Landon Fuller on 2/10/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef _NVRAM_SPROM_DELTA_H_
+#define _NVRAM_SPROM_DELTA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nvram_sprom.h"
+#include "nvram_sprom_plan.h"
+
+/*
+ * Delta encoding of SPROM images against baseline images.
+ *
+ * A baseline is any valid SPROM image: one learned from a set of images
+ * of the same model (see bhnd_sprom_learner), or one encoded from a
+ * default variable set (such as the vendor's defaultsromvars tables) with
+ * bhnd_sprom_encode().
+ *
+ * Each image is stored as a variable-length record:
+ *
+ *	varint		baseline index
+ *	varint		number of changed words
+ *	[changed words]
+ *		varint	word index, as a gap from the previous index + 1
+ *		uint16	word value, little-endian
+ *
+ * The CRC byte is not stored; it is recomputed on reconstruction. Images
+ * that differ from their baseline only in per-device fields typically
+ * encode to a few bytes.
+ *
+ * Records are appended to a delta store, which indexes the offset of every
+ * BHND_SPROM_DELTA_INDEX_STRIDE'th record for random access.
+ */
+
+/** Maximum encoded record size */
+#define	BHND_SPROM_DELTA_MAX		(5 + 2 + (BHND_SPROM_MAX_WORDS * 4))
+
+/** Records per delta store index entry */
+#define	BHND_SPROM_DELTA_INDEX_STRIDE	64
+
+#define	BHND_SPROM_DELTA_MAGIC		0x44564E42	/**< 'BNVD' */
+#define	BHND_SPROM_DELTA_VERSION	1
+
+/** Baseline image */
+struct bhnd_sprom_baseline {
+	uint8_t		sb_rev;				/**< SPROM revision */
+	size_t		sb_size;			/**< SPROM layout size, in bytes */
+	uint8_t		sb_image[BHND_SPROM_MAX_SIZE];	/**< baseline image */
+};
+
+/**
+ * Baseline learner.
+ *
+ * Each word of the learned baseline is the majority value of that word
+ * across the added images (Boyer-Moore vote), so that the baseline is
+ * close to the most common value of every field.
+ */
+struct bhnd_sprom_learner {
+	uint8_t		sl_rev;				/**< SPROM revision */
+	size_t		sl_size;			/**< SPROM layout size, in bytes */
+	uint16_t	sl_cand[BHND_SPROM_MAX_WORDS];	/**< per-word candidates */
+	uint32_t	sl_votes[BHND_SPROM_MAX_WORDS];	/**< per-word vote counts */
+	uint64_t	sl_count;			/**< images added */
+};
+
+/** Delta store */
+struct bhnd_sprom_delta_store {
+	struct bhnd_sprom_baseline	*ds_baselines;	/**< baselines */
+	size_t				 ds_nbaselines;	/**< baseline count */
+	uint8_t				*ds_data;	/**< concatenated records */
+	size_t				 ds_len;	/**< ds_data length */
+	size_t				 ds_cap;	/**< ds_data capacity */
+	uint64_t			*ds_index;	/**< offset of every
+							     BHND_SPROM_DELTA_INDEX_STRIDE'th
+							     record */
+	size_t				 ds_index_cap;	/**< ds_index capacity */
+	uint64_t			 ds_count;	/**< record count */
+};
+
+int	bhnd_sprom_baseline_init(struct bhnd_sprom_baseline *sb,
+	    const void *image, size_t size);
+
+int	bhnd_sprom_learner_init(struct bhnd_sprom_learner *sl, uint8_t rev);
+int	bhnd_sprom_learner_add(struct bhnd_sprom_learner *sl,
+	    const void *image, size_t size);
+int	bhnd_sprom_learner_finish(struct bhnd_sprom_learner *sl,
+	    struct bhnd_sprom_baseline *sb);
+
+int	bhnd_sprom_delta_encode(const struct bhnd_sprom_baseline *sb,
+	    uint32_t baseline, const void *image, size_t size, uint8_t *out,
+	    size_t *len);
+int	bhnd_sprom_delta_decode(const struct bhnd_sprom_baseline *baselines,
+	    size_t nbaselines, const uint8_t *rec, size_t len, uint8_t *image,
+	    size_t *size, size_t *consumed);
+
+int	bhnd_sprom_delta_store_init(struct bhnd_sprom_delta_store *ds);
+void	bhnd_sprom_delta_store_fini(struct bhnd_sprom_delta_store *ds);
+int	bhnd_sprom_delta_store_add_baseline(struct bhnd_sprom_delta_store *ds,
+	    const struct bhnd_sprom_baseline *sb, uint32_t *baseline);
+int	bhnd_sprom_delta_store_append(struct bhnd_sprom_delta_store *ds,
+	    uint32_t baseline, const uint8_t *images, size_t stride,
+	    size_t count);
+int	bhnd_sprom_delta_store_get(const struct bhnd_sprom_delta_store *ds,
+	    uint64_t first, size_t count, uint8_t *images, size_t stride);
+int	bhnd_sprom_delta_store_serialize(
+	    const struct bhnd_sprom_delta_store *ds, uint8_t **buf,
+	    size_t *len);
+int	bhnd_sprom_delta_store_load(struct bhnd_sprom_delta_store *ds,
+	    const uint8_t *buf, size_t len);
+
+#endif /* _NVRAM_SPROM_DELTA_H_ */
@@ -0,0 +1,228 @@
+//
+//  nvram_sprom_enc.c
+//  ccmach
+//
+//  Created by Landon Fuller on 2/3/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nvram_fmt.h"
+#include "nvram_scan.h"
+#include "nvram_sprom_enc.h"
+
+/**
+ * Initialize an encoder for SPROM revision @p rev.
+ *
+ * The base image has every variable unset: all bits are zero, other than
+ * those of BHND_NVRAM_VF_IGNALL1 variables, which are set to all ones (and
+ * are therefore omitted when decoded), and the revision and (for rev 4+)
+ * signature words.
+ *
+ * @retval 0 success
+ * @retval EINVAL if @p rev is unsupported, or a variable's offset
+ * descriptors are invalid.
+ * @retval ENOMEM if allocation fails.
+ */
+int
+bhnd_sprom_encoder_init (struct bhnd_sprom_encoder *enc, uint8_t rev)
+{
+	const struct bhnd_nvram_var	*vars;
+	size_t				 num_vars, sig_off;
+	uint16_t			 sig;
+	int				 error;
+
+	memset(enc, 0, sizeof(*enc));
+	enc->se_rev = rev;
+
+	if ((error = bhnd_sprom_layout_size(rev, &enc->se_size)))
+		return (error);
+
+	vars = bhnd_nvram_get_vars(&num_vars);
+	if ((enc->se_vars = calloc(num_vars, sizeof(enc->se_vars[0]))) == NULL)
+		return (ENOMEM);
+
+	for (enc->se_mask = 7; enc->se_mask + 1 < num_vars * 2;)
+		enc->se_mask = (enc->se_mask << 1) | 1;
+
+	enc->se_slots = calloc(enc->se_mask + 1, sizeof(enc->se_slots[0]));
+	if (enc->se_slots == NULL) {
+		bhnd_sprom_encoder_fini(enc);
+		return (ENOMEM);
+	}
+
+	for (size_t i = 0; i < num_vars; i++) {
+		struct bhnd_sprom_enc_var	*ev;
+		const struct bhnd_sprom_var	*sv;
+		size_t				 slot;
+
+		if ((sv = bhnd_nvram_find_sprom_var(&vars[i], rev)) == NULL)
+			continue;
+
+		ev = &enc->se_vars[enc->se_nvars];
+		ev->nv = &vars[i];
+		ev->sv = sv;
+		ev->name_len = strlen(vars[i].name);
+		ev->hash = bhnd_nvram_hash(vars[i].name, ev->name_len);
+
+		error = bhnd_sprom_var_layout(sv, enc->se_size, &ev->nvals,
+		    &ev->vmask);
+		if (error) {
+			bhnd_sprom_encoder_fini(enc);
+			return (error);
+		}
+
+		/* Unset IGNALL1 variables are encoded as all ones */
+		if (vars[i].flags & BHND_NVRAM_VF_IGNALL1) {
+			uint32_t ones[BHND_SPROM_ARRAY_MAX];
+			for (size_t e = 0; e < ev->nvals; e++)
+				ones[e] = ev->vmask;
+
+			bhnd_sprom_write_var(enc->se_base, sv, ones);
+		}
+
+		slot = ev->hash & enc->se_mask;
+		while (enc->se_slots[slot] != 0)
+			slot = (slot + 1) & enc->se_mask;
+
+		enc->se_slots[slot] = (uint32_t)++enc->se_nvars;
+	}
+
+	/* The revision is stored in the low byte of the final word */
+	enc->se_base[enc->se_size - 2] = rev;
+
+	/* Rev 4+ layouts are only identified by their signature word */
+	error = bhnd_sprom_layout_sig(rev, &sig_off, &sig);
+	if (error == 0) {
+		enc->se_base[sig_off] = sig & 0xFF;
+		enc->se_base[sig_off + 1] = sig >> 8;
+	} else if (error != ENOENT) {
+		bhnd_sprom_encoder_fini(enc);
+		return (error);
+	}
+
+	return (0);
+}
+
+/** Release all resources held by @p enc */
+void
+bhnd_sprom_encoder_fini (struct bhnd_sprom_encoder *enc)
+{
+	free(enc->se_vars);
+	free(enc->se_slots);
+
+	enc->se_vars = NULL;
+	enc->se_slots = NULL;
+	enc->se_nvars = 0;
+}
+
+/**
+ * Find the encoding for the variable named @p name, or NULL if the variable
+ * is not defined for the encoder's SPROM revision.
+ */
+const struct bhnd_sprom_enc_var *
+bhnd_sprom_encoder_find (const struct bhnd_sprom_encoder *enc,
+    const char *name, size_t name_len)
+{
+	uint32_t	hash;
+	size_t		slot;
+
+	hash = bhnd_nvram_hash(name, name_len);
+	slot = hash & enc->se_mask;
+	for (; enc->se_slots[slot] != 0; slot = (slot + 1) & enc->se_mask) {
+		const struct bhnd_sprom_enc_var *ev;
+
+		ev = &enc->se_vars[enc->se_slots[slot] - 1];
+		if (ev->hash == hash && ev->name_len == name_len &&
+		    memcmp(ev->nv->name, name, name_len) == 0)
+			return (ev);
+	}
+
+	return (NULL);
+}
+
+/**
+ * Encode a packed "name=value\0...\0" environment as a SPROM image.
+ *
+ * Variables not present in @p env are left unset; if a variable is defined
+ * more than once, the last definition wins. A "sromrev" variable, if
+ * present, must match the encoder's revision.
+ *
+ * @param enc an initialized encoder.
+ * @param env environment to encode; encoding stops at an empty record,
+ * or after @p len bytes.
+ * @param len size of @p env.
+ * @param[out] image output buffer, of at least enc->se_size bytes. On
+ * success, a SPROM image with a valid CRC-8.
+ *
+ * @retval 0 success
+ * @retval ENOENT if a variable is not defined for the encoder's revision.
+ * @retval EINVAL if @p env is malformed, or a value cannot be parsed.
+ * @retval ERANGE if a value cannot be represented.
+ */
+int
+bhnd_sprom_encode (const struct bhnd_sprom_encoder *enc, const char *env,
+    size_t len, uint8_t *image)
+{
+	const char	*p, *end;
+	uint32_t	 vals[BHND_SPROM_ARRAY_MAX];
+	size_t		 crc_off;
+	int		 error;
+
+	memcpy(image, enc->se_base, enc->se_size);
+
+	p = env;
+	end = env + len;
+	while (p < end && *p != '\0') {
+		const struct bhnd_sprom_enc_var	*ev;
+		const char			*eq, *nul;
+
+		eq = bhnd_nvram_scan2(p, end, '=', '\0');
+		if (eq == end || *eq != '=')
+			return (EINVAL);
+
+		nul = bhnd_nvram_scan2(eq + 1, end, '\0', '\0');
+
+		if (eq - p == 7 && memcmp(p, "sromrev", 7) == 0) {
+			error = bhnd_nvram_parse_value(BHND_NVRAM_VFMT_DEC,
+			    BHND_NVRAM_DT_UINT, eq + 1, nul - (eq + 1), vals, 1);
+			if (error)
+				return (error);
+
+			if (vals[0] != enc->se_rev)
+				return (EINVAL);
+		} else {
+			ev = bhnd_sprom_encoder_find(enc, p, eq - p);
+			if (ev == NULL)
+				return (ENOENT);
+
+			error = bhnd_nvram_parse_value(ev->nv->fmt,
+			    ev->nv->type, eq + 1, nul - (eq + 1), vals,
+			    ev->nvals);
+			if (error)
+				return (error);
+
+			for (size_t i = 0; i < ev->nvals; i++) {
+				if (!bhnd_sprom_value_fits(ev->nv->type,
+				    vals[i], ev->vmask))
+					return (ERANGE);
+			}
+
+			bhnd_sprom_write_var(image, ev->sv, vals);
+		}
+
+		if (nul == end)
+			break;
+
+		p = nul + 1;
+	}
+
+	crc_off = enc->se_size - 1;
+	image[crc_off] = ~bhnd_nvram_crc8(image, crc_off,
+	    BHND_NVRAM_CRC8_INITIAL);
+
+	return (0);
+}
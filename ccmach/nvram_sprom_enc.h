@@ -0,0 +1,55 @@
+//
+//  nvram_sprom_enc.h
+//  ccmach
+//
+//  Created by Landon Fuller on 2/3/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef _NVRAM_SPROM_ENC_H_
+#define _NVRAM_SPROM_ENC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nvram_map.h"
+#include "nvram_sprom.h"
+
+/** Precompiled encoding of a single variable */
+struct bhnd_sprom_enc_var {
+	const struct bhnd_nvram_var	*nv;		/**< variable definition */
+	const struct bhnd_sprom_var	*sv;		/**< revision-specific layout */
+	uint32_t			 vmask;		/**< combined (post-shift) value mask */
+	uint32_t			 hash;		/**< name hash */
+	size_t				 name_len;	/**< name length */
+	size_t				 nvals;		/**< element count */
+};
+
+/**
+ * Per-revision SPROM encoder.
+ *
+ * Variable layouts for the target revision are resolved and validated
+ * once, and indexed by name; a single encoder may be used to encode any
+ * number of images, concurrently if desired.
+ */
+struct bhnd_sprom_encoder {
+	uint8_t				 se_rev;	/**< SPROM revision */
+	size_t				 se_size;	/**< SPROM layout size, in bytes */
+	uint8_t				 se_base[BHND_SPROM_MAX_SIZE];	/**< image with
+								     all variables unset */
+	struct bhnd_sprom_enc_var	*se_vars;	/**< encodable variables */
+	size_t				 se_nvars;	/**< number of encodable variables */
+	uint32_t			*se_slots;	/**< open-addressed name table,
+							     mapping to se_vars index + 1 */
+	size_t				 se_mask;	/**< table size - 1 (power of two) */
+};
+
+int	bhnd_sprom_encoder_init(struct bhnd_sprom_encoder *enc, uint8_t rev);
+void	bhnd_sprom_encoder_fini(struct bhnd_sprom_encoder *enc);
+const struct bhnd_sprom_enc_var	*bhnd_sprom_encoder_find(
+				     const struct bhnd_sprom_encoder *enc,
+				     const char *name, size_t name_len);
+int	bhnd_sprom_encode(const struct bhnd_sprom_encoder *enc,
+	    const char *env, size_t len, uint8_t *image);
+
+#endif /* _NVRAM_SPROM_ENC_H_ */
@@ -0,0 +1,177 @@
+//
+//  nvram_sprom_plan.c
+//  ccmach
+//
+//  Created by Landon Fuller on 2/2/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#include <errno.h>
+#include <string.h>
+
+#include "nvram_sprom_plan.h"
+
+/**
+ * Initialize @p plan for modification of the SPROM @p image.
+ *
+ * @retval 0 success
+ * @retval EINVAL if @p image is not a valid SPROM image.
+ */
+int
+bhnd_sprom_plan_init (struct bhnd_sprom_plan *plan, const void *image,
+    size_t size)
+{
+	int error;
+
+	memset(plan, 0, sizeof(*plan));
+	if ((error = bhnd_sprom_identify(image, size, &plan->sp_rev,
+	    &plan->sp_size)))
+		return (error);
+
+	memcpy(plan->sp_old, image, plan->sp_size);
+	memcpy(plan->sp_new, image, plan->sp_size);
+	return (0);
+}
+
+/**
+ * Assign the value(s) of @p nv in the new image.
+ *
+ * @retval 0 success
+ * @retval ENOENT if @p nv is not defined for the image's SPROM revision.
+ * @retval EINVAL if @p nvals does not match the variable's element count.
+ * @retval ERANGE if a value cannot be represented.
+ */
+int
+bhnd_sprom_plan_set (struct bhnd_sprom_plan *plan,
+    const struct bhnd_nvram_var *nv, const uint32_t *vals, size_t nvals)
+{
+	return (bhnd_sprom_encode_var(plan->sp_new, plan->sp_size,
+	    plan->sp_rev, nv, vals, nvals));
+}
+
+/**
+ * Update the new image's CRC, and compute the minimal set of word writes.
+ *
+ * The CRC-8 is affine over GF(2); the new CRC is the existing CRC XOR'd
+ * with the CRC (initial value 0) of the difference between the images,
+ * and unchanged leading bytes need not be visited.
+ */
+void
+bhnd_sprom_plan_finish (struct bhnd_sprom_plan *plan)
+{
+	size_t	crc_off, first, nwords;
+	uint8_t	delta;
+
+	crc_off = plan->sp_size - 1;
+
+	for (first = 0; first < crc_off; first++) {
+		if (plan->sp_old[first] != plan->sp_new[first])
+			break;
+	}
+
+	delta = 0;
+	for (size_t i = first; i < crc_off; i++)
+		delta = bhnd_nvram_crc8_tab[delta ^
+		    (plan->sp_old[i] ^ plan->sp_new[i])];
+
+	plan->sp_new[crc_off] = plan->sp_old[crc_off] ^ delta;
+
+	/* Changed words, in ascending order; the final word holds the CRC,
+	 * and is always written last */
+	plan->sp_nwrites = 0;
+	nwords = plan->sp_size / 2;
+	for (size_t w = first / 2; w < nwords; w++) {
+		const uint8_t *p = &plan->sp_new[w * 2];
+
+		if (memcmp(p, &plan->sp_old[w * 2], 2) == 0)
+			continue;
+
+		plan->sp_writes[plan->sp_nwrites].word = w;
+		plan->sp_writes[plan->sp_nwrites].value = p[0] | (p[1] << 8);
+		plan->sp_nwrites++;
+	}
+}
+
+/**
+ * Perform all planned writes, in order.
+ *
+ * @retval 0 success
+ * @retval non-zero if a write fails; the error returned by @p write.
+ */
+int
+bhnd_sprom_plan_apply (const struct bhnd_sprom_plan *plan,
+    bhnd_sprom_write_fn write, void *dev)
+{
+	int error;
+
+	for (size_t i = 0; i < plan->sp_nwrites; i++) {
+		const struct bhnd_sprom_wr *wr = &plan->sp_writes[i];
+		if ((error = write(dev, wr->word, wr->value)))
+			return (error);
+	}
+
+	return (0);
+}
+
+/**
+ * Validate @p plan by applying it to a simulated SPROM device holding the
+ * existing image.
+ *
+ * @retval 0 success
+ * @retval EINVAL if the resulting image does not match the planned image,
+ * or is not a valid SPROM image of the same revision.
+ */
+int
+bhnd_sprom_plan_verify (const struct bhnd_sprom_plan *plan)
+{
+	struct bhnd_sprom_sim	sim;
+	size_t			size;
+	uint8_t			rev;
+	int			error;
+
+	bhnd_sprom_sim_init(&sim, plan->sp_old, plan->sp_size);
+	if ((error = bhnd_sprom_plan_apply(plan, bhnd_sprom_sim_write, &sim)))
+		return (error);
+
+	if (sim.ss_writes != plan->sp_nwrites)
+		return (EINVAL);
+
+	if (memcmp(sim.ss_image, plan->sp_new, plan->sp_size) != 0)
+		return (EINVAL);
+
+	if ((error = bhnd_sprom_identify(sim.ss_image, sim.ss_size, &rev,
+	    &size)))
+		return (error);
+
+	if (rev != plan->sp_rev || size != plan->sp_size)
+		return (EINVAL);
+
+	return (0);
+}
+
+/** Initialize a simulated SPROM device with the contents of @p image */
+void
+bhnd_sprom_sim_init (struct bhnd_sprom_sim *sim, const void *image,
+    size_t size)
+{
+	memset(sim, 0, sizeof(*sim));
+	sim->ss_size = (size < sizeof(sim->ss_image)) ? size :
+	    sizeof(sim->ss_image);
+	memcpy(sim->ss_image, image, sim->ss_size);
+}
+
+/** bhnd_sprom_write_fn implementation for a simulated SPROM device */
+int
+bhnd_sprom_sim_write (void *dev, uint16_t word, uint16_t value)
+{
+	struct bhnd_sprom_sim *sim = dev;
+
+	if ((size_t)word * 2 + 2 > sim->ss_size)
+		return (EINVAL);
+
+	sim->ss_image[word * 2] = value & 0xFF;
+	sim->ss_image[word * 2 + 1] = value >> 8;
+	sim->ss_writes++;
+
+	return (0);
+}
@@ -0,0 +1,76 @@
+//
+//  nvram_sprom_plan.h
+//  ccmach
+//
+//  Created by Landon Fuller on 2/2/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef _NVRAM_SPROM_PLAN_H_
+#define _NVRAM_SPROM_PLAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nvram_map.h"
+#include "nvram_sprom.h"
+
+/** Maximum number of 16-bit SPROM words */
+#define	BHND_SPROM_MAX_WORDS	(BHND_SPROM_MAX_SIZE / 2)
+
+/** A single SPROM word write */
+struct bhnd_sprom_wr {
+	uint16_t	word;	/**< word index */
+	uint16_t	value;	/**< new word value */
+};
+
+/**
+ * SPROM write plan.
+ *
+ * Variable assignments are encoded into a copy of the existing image; the
+ * plan is the minimal ordered set of word writes that transforms the
+ * existing image into the new image, with the CRC word written last.
+ */
+struct bhnd_sprom_plan {
+	uint8_t			sp_rev;				/**< SPROM revision */
+	size_t			sp_size;			/**< SPROM layout size, in bytes */
+	uint8_t			sp_old[BHND_SPROM_MAX_SIZE];	/**< existing image */
+	uint8_t			sp_new[BHND_SPROM_MAX_SIZE];	/**< new image */
+	struct bhnd_sprom_wr	sp_writes[BHND_SPROM_MAX_WORDS];/**< planned writes */
+	size_t			sp_nwrites;			/**< number of planned writes */
+};
+
+/**
+ * SPROM word write callback.
+ *
+ * @param dev device state.
+ * @param word word index.
+ * @param value word value.
+ *
+ * @retval 0 success
+ * @retval non-zero if the write failed.
+ */
+typedef int (*bhnd_sprom_write_fn)(void *dev, uint16_t word, uint16_t value);
+
+/** Simulated SPROM device */
+struct bhnd_sprom_sim {
+	uint8_t	ss_image[BHND_SPROM_MAX_SIZE];	/**< SPROM contents */
+	size_t	ss_size;			/**< SPROM size, in bytes */
+	size_t	ss_writes;			/**< number of word writes performed */
+};
+
+int	bhnd_sprom_plan_init(struct bhnd_sprom_plan *plan, const void *image,
+	    size_t size);
+int	bhnd_sprom_plan_set(struct bhnd_sprom_plan *plan,
+	    const struct bhnd_nvram_var *nv, const uint32_t *vals,
+	    size_t nvals);
+void	bhnd_sprom_plan_finish(struct bhnd_sprom_plan *plan);
+int	bhnd_sprom_plan_apply(const struct bhnd_sprom_plan *plan,
+	    bhnd_sprom_write_fn write, void *dev);
+int	bhnd_sprom_plan_verify(const struct bhnd_sprom_plan *plan);
+
+void	bhnd_sprom_sim_init(struct bhnd_sprom_sim *sim, const void *image,
+	    size_t size);
+int	bhnd_sprom_sim_write(void *dev, uint16_t word, uint16_t value);
+
+#endif /* _NVRAM_SPROM_PLAN_H_ */
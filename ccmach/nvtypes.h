@@ -24,11 +24,13 @@
 #include <err.h>
 #include <sysexits.h>
 #include <vector>
+#include <mutex>
 #include <unordered_map>
 #include <unordered_set>
 
 #include "maybe.h"
 #include "record_type.hpp"
+#include "symbol.hpp"
 
 #include <Foundation/Foundation.h>
 
@@ -81,7 +83,7 @@ enum {
 
 /** A symbolic constant definition */
 PL_RECORD_STRUCT(symbolic_constant,
-    (string, name),
+    (symbol, name),
     (uint32, value)
 );
 
@@ -419,14 +421,14 @@ class cis_tuple {
 struct cis_vstr {
     PL_RECORD_FIELDS(cis_vstr,
                      (symbolic_constant,	cis_tag),
-                     (string,		name),
+                     (symbol,		name),
                      (string,		fmt_str),
                      (string,		vstr_variable),
                      (uint32_t,		asserted_revmask)
                      );
     
 public:
-    bool is_name_incomplete () const { return name().find("%") != string::npos; }
+    bool is_name_incomplete () const { return name().str().find("%") != string::npos; }
 
     str_fmt sfmt () {
         NSArray *elems = [@(_fmt_str.c_str()) componentsSeparatedByString: @","];
@@ -515,7 +517,7 @@ PL_RECORD_STRUCT(var_set_cis,
 /** NVRAM variable */
 class var {
     PL_RECORD_FIELDS(var,
-        (string,				name),
+        (symbol,				name),
         (prop_type,				type),
         (str_fmt,				sfmt),
         (size_t,				count),
@@ -528,8 +530,8 @@ public:
         return ([@(name().c_str()) compare:@(other.name().c_str()) options:NSNumericSearch] == NSOrderedAscending);
     }
     
-    bool hasCommonCompatRange ();
-    compat_range getCommonCompatRange ();
+    bool hasCommonCompatRange () const;
+    compat_range getCommonCompatRange () const;
     
     size_t decoded_count () const {
         size_t c = 0;
@@ -576,6 +578,46 @@ public:
 
         return t;
     }
+
+    /** Append @p offset to this variable's SPROM offsets */
+    void add_sprom_offset (const nv_offset &offset) {
+        _sprom_offsets->push_back(offset);
+        _compat_memo.invalidate();
+    }
+
+    /** Append all of @p offsets to this variable's SPROM offsets */
+    void add_sprom_offsets (const vector<nv_offset> &offsets) {
+        _sprom_offsets->insert(_sprom_offsets->end(), offsets.begin(), offsets.end());
+        _compat_memo.invalidate();
+    }
+
+private:
+    /**
+     * Memoized common compat range.
+     *
+     * The memo is computed under its lock on first use, and is discarded
+     * by add_sprom_offset() and add_sprom_offsets(). Copies (including
+     * those returned by the record modifiers) start out unmemoized.
+     */
+    struct compat_memo {
+        std::mutex	lock;
+        bool		valid = false;
+        bool		common = false;
+        uint8_t		first = 0;
+        uint8_t		last = 0;
+
+        compat_memo () {}
+        compat_memo (const compat_memo &) {}
+        compat_memo &operator= (const compat_memo &) { invalidate(); return *this; }
+
+        void invalidate () {
+            std::lock_guard<std::mutex> guard(lock);
+            valid = false;
+        }
+    };
+
+    mutable compat_memo _compat_memo;
+    bool common_compat (compat_range *range) const;
 };
 
 /** Struct definition */
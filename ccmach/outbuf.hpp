@@ -0,0 +1,170 @@
+//
+//  outbuf.hpp
+//  ccmach
+//
+//  Created by Landon Fuller on 1/26/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef __ccmach__outbuf__
+#define __ccmach__outbuf__
+
+#include <string>
+#include <memory>
+
+#include <stdint.h>
+#include <string.h>
+
+namespace nvram {
+
+/** Output sink */
+class out_sink {
+public:
+    virtual ~out_sink () {}
+
+    /** Write all of @p len bytes from @p data to the sink. */
+    virtual void write (const char *data, size_t len) = 0;
+
+    /** Complete all output, reporting any deferred write error. */
+    virtual void finish () {}
+};
+
+/** File descriptor sink; the descriptor is not closed by the sink */
+class fd_sink : public out_sink {
+private:
+    int _fd;
+public:
+    fd_sink (int fd) : _fd(fd) {}
+    virtual void write (const char *data, size_t len);
+};
+
+/**
+ * File sink; the file is created (or truncated) when the sink is
+ * constructed, and closed by finish(). Errors closing the file are only
+ * reported by finish().
+ */
+class file_sink : public out_sink {
+private:
+    std::string _path;
+    int _fd = -1;
+public:
+    file_sink (const std::string &path);
+    virtual ~file_sink ();
+    virtual void write (const char *data, size_t len);
+    virtual void finish ();
+};
+
+/** In-memory sink */
+class memory_sink : public out_sink {
+private:
+    std::shared_ptr<std::string> _data;
+public:
+    memory_sink () : _data(std::make_shared<std::string>()) {}
+    virtual void write (const char *data, size_t len) { _data->append(data, len); }
+
+    /** Return all data written to this sink */
+    std::shared_ptr<std::string> data () const { return _data; }
+};
+
+/**
+ * Buffered output writer.
+ *
+ * All output is formatted into a single growable buffer, and written to the
+ * backing sink in one write when flushed. Tab indentation is tracked by the
+ * writer and emitted by indent().
+ */
+class outbuf {
+private:
+    std::string			_buf;
+    std::shared_ptr<out_sink>	_sink;
+    size_t			_depth = 0;
+
+public:
+    outbuf (const std::shared_ptr<out_sink> &sink, size_t capacity = 1024*1024) : _sink(sink) {
+        _buf.reserve(capacity);
+    }
+
+    ~outbuf () { flush(); }
+
+    outbuf (const outbuf &) = delete;
+    outbuf &operator= (const outbuf &) = delete;
+
+    /** Increase the indentation depth */
+    void push () { _depth++; }
+
+    /** Decrease the indentation depth */
+    void pop () { _depth--; }
+
+    /** Append the current indentation */
+    outbuf &indent () { _buf.append(_depth, '\t'); return *this; }
+
+    outbuf &put (char c) { _buf.push_back(c); return *this; }
+    outbuf &put (const char *str) { _buf.append(str); return *this; }
+    outbuf &put (const char *str, size_t len) { _buf.append(str, len); return *this; }
+    outbuf &put (const std::string &str) { _buf.append(str); return *this; }
+
+    /** Append a newline */
+    outbuf &nl () { _buf.push_back('\n'); return *this; }
+
+    /** Append @p value as upper-case hex (without a prefix), zero-padded to at least @p width digits */
+    outbuf &hex (uint64_t value, size_t width = 1) {
+        static const char digits[] = "0123456789ABCDEF";
+        char tmp[16];
+        size_t n = 0;
+
+        do {
+            tmp[n++] = digits[value & 0xF];
+            value >>= 4;
+        } while (value != 0);
+
+        if (width > n)
+            _buf.append(width - n, '0');
+
+        while (n > 0)
+            _buf.push_back(tmp[--n]);
+
+        return *this;
+    }
+
+    /** Append @p value in decimal */
+    outbuf &dec (uint64_t value) {
+        char tmp[20];
+        size_t n = 0;
+
+        do {
+            tmp[n++] = '0' + (value % 10);
+            value /= 10;
+        } while (value != 0);
+
+        while (n > 0)
+            _buf.push_back(tmp[--n]);
+
+        return *this;
+    }
+
+    /** Append signed @p value in decimal */
+    outbuf &sdec (int64_t value) {
+        if (value < 0) {
+            _buf.push_back('-');
+            return dec(-(uint64_t)value);
+        }
+
+        return dec((uint64_t)value);
+    }
+
+    /** Number of bytes pending flush */
+    size_t size () const { return _buf.size(); }
+
+    /** Write all buffered output to the sink */
+    void flush () {
+        if (_buf.empty())
+            return;
+
+        _sink->write(_buf.data(), _buf.size());
+        _buf.clear();
+    }
+};
+
+} /* namespace nvram */
+
+#endif /* defined(__ccmach__outbuf__) */
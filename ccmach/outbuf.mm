@@ -0,0 +1,67 @@
+//
+//  outbuf.mm
+//  ccmach
+//
+//  Created by Landon Fuller on 1/26/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#include "outbuf.hpp"
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+namespace nvram {
+
+static void write_all (int fd, const char *data, size_t len, const char *desc) {
+    while (len > 0) {
+        ssize_t nw = ::write(fd, data, len);
+        if (nw < 0) {
+            if (errno == EINTR)
+                continue;
+            err(EX_IOERR, "write to %s failed", desc);
+        }
+
+        data += nw;
+        len -= nw;
+    }
+}
+
+void fd_sink::write (const char *data, size_t len) {
+    write_all(_fd, data, len, "output descriptor");
+}
+
+file_sink::file_sink (const std::string &path) : _path(path) {
+    _fd = open(_path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (_fd < 0)
+        err(EX_CANTCREAT, "%s", _path.c_str());
+}
+
+file_sink::~file_sink () {
+    /* Unfinished output; any close error is discarded */
+    if (_fd >= 0)
+        close(_fd);
+}
+
+void file_sink::write (const char *data, size_t len) {
+    if (_fd < 0)
+        errx(EX_SOFTWARE, "write to %s after finish()", _path.c_str());
+
+    write_all(_fd, data, len, _path.c_str());
+}
+
+void file_sink::finish () {
+    if (_fd < 0)
+        return;
+
+    int fd = _fd;
+    _fd = -1;
+
+    if (close(fd) != 0)
+        err(EX_IOERR, "%s", _path.c_str());
+}
+
+} /* namespace nvram */
@@ -0,0 +1,79 @@
+//
+//  srom_overlap.hpp
+//  ccmach
+//
+//  Created by Landon Fuller on 1/27/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef __ccmach__srom_overlap__
+#define __ccmach__srom_overlap__
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "nvarena.hpp"
+
+namespace nvram {
+
+/**
+ * Per-revision SPROM bit occupancy analysis.
+ *
+ * For every SPROM revision, each (offset, mask) claimed by a variable is
+ * recorded in a per-bit occupancy map. Claims that overlap are reported
+ * either as aliases (two variables decode exactly the same bits) or as
+ * conflicts (partial overlap), and unclaimed byte ranges are reported as
+ * free regions.
+ */
+class srom_overlap {
+public:
+    /** Two variables claiming the same SPROM bits */
+    struct overlap {
+        const char	*lhs;		/**< first variable */
+        const char	*rhs;		/**< second variable */
+        size_t		 offset;	/**< first overlapping byte offset */
+        size_t		 bits;		/**< number of overlapping bits */
+        bool		 alias;		/**< true if both variables claim identical bits */
+    };
+
+    /** An unclaimed SPROM byte range */
+    struct region {
+        size_t	offset;		/**< first free byte */
+        size_t	size;		/**< number of free bytes */
+    };
+
+    /** Analysis results for a single SPROM revision */
+    struct revision {
+        uint8_t		rev;
+        size_t		size;		/**< SPROM image size, in bytes */
+        vector<overlap>	overlaps;
+        vector<region>	free;
+    };
+
+private:
+    vector<revision> _revs;
+
+    static size_t sprom_size (uint8_t rev);
+    static revision analyze (const nv_arena &arena, uint8_t rev);
+
+public:
+    srom_overlap (const nv_arena &arena);
+
+    /** Analysis results for all revisions with at least one variable */
+    const vector<revision> &revisions () const { return _revs; }
+
+    /** Total number of (non-alias) conflicts across all revisions */
+    size_t conflicts () const;
+
+    /**
+     * Write a report to @p fp. Conflicts are always reported; aliases and
+     * free regions are only reported if @p verbose is true.
+     */
+    void report (FILE *fp, bool verbose) const;
+};
+
+} /* namespace nvram */
+
+#endif /* defined(__ccmach__srom_overlap__) */
@@ -0,0 +1,225 @@
+//
+//  srom_overlap.mm
+//  ccmach
+//
+//  Created by Landon Fuller on 1/27/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#include "srom_overlap.hpp"
+
+#include <map>
+
+namespace nvram {
+
+/** Return the SPROM image size of @p rev, in bytes */
+size_t srom_overlap::sprom_size (uint8_t rev) {
+    if (rev <= 3)
+        return (SROM_WORDS * sizeof(uint16_t));
+    else if (rev <= 9)
+        return (SROM4_WORDS * sizeof(uint16_t));
+    else if (rev == 10)
+        return (SROM10_WORDS * sizeof(uint16_t));
+    else
+        return (SROM11_WORDS * sizeof(uint16_t));
+}
+
+srom_overlap::srom_overlap (const nv_arena &arena) {
+    const size_t nrevs = compat_range::MAX_SPROMREV + 1;
+    vector<revision> revs(nrevs);
+    auto *revp = revs.data();
+    const auto *ap = &arena;
+
+    dispatch_apply(nrevs, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t rev) {
+        revp[rev] = analyze(*ap, (uint8_t) rev);
+    });
+
+    for (auto &r : revs) {
+        if (r.size > 0)
+            _revs.push_back(std::move(r));
+    }
+}
+
+/**
+ * Analyze all variables defined for @p rev. If no variables are defined,
+ * the returned revision's size will be 0.
+ */
+srom_overlap::revision srom_overlap::analyze (const nv_arena &arena, uint8_t rev) {
+    typedef vector<pair<size_t, uint8_t>> footprint;
+
+    revision r;
+    r.rev = rev;
+    r.size = 0;
+
+    /* Collect the (byte, mask) footprint of every variable; the names are
+     * interned within the arena, and a variable that appears in multiple
+     * var sets is only claimed once. */
+    vector<const char *> names;
+    vector<footprint> footprints;
+    unordered_set<const char *> seen;
+    size_t max_off = sprom_size(rev);
+
+    for (const auto &vs : arena.var_sets()) {
+        for (const auto &v : vs.vars()) {
+            footprint fp;
+
+            for (const auto &sp : v.sprom_offsets()) {
+                auto compat = sp.compat();
+                if (rev < compat.first() || rev > compat.last())
+                    continue;
+
+                for (const auto &val : sp.values()) {
+                    for (const auto &seg : val.segments()) {
+                        size_t width = prop_type_size(seg.type());
+                        for (size_t e = 0; e < seg.count(); e++) {
+                            for (size_t b = 0; b < width; b++) {
+                                uint8_t bmask = (seg.mask() >> (8 * b)) & 0xFF;
+                                if (bmask != 0)
+                                    fp.emplace_back(seg.offset() + (e * width) + b, bmask);
+                            }
+                        }
+                    }
+                }
+            }
+
+            if (fp.empty() || !seen.insert(v.name()).second)
+                continue;
+
+            /* Sort and coalesce by byte offset */
+            sort(fp.begin(), fp.end());
+            footprint merged;
+            for (const auto &c : fp) {
+                if (!merged.empty() && merged.back().first == c.first)
+                    merged.back().second |= c.second;
+                else
+                    merged.push_back(c);
+            }
+
+            max_off = std::max(max_off, merged.back().first + 1);
+            names.push_back(v.name());
+            footprints.push_back(std::move(merged));
+        }
+    }
+
+    if (names.empty())
+        return r;
+
+    r.size = sprom_size(rev);
+
+    /* Record every (variable, mask) claim on each byte, pairing each new
+     * claim with all existing claims on the same bits */
+    struct overlap_acc {
+        size_t offset = 0;
+        size_t bits = 0;
+    };
+
+    vector<vector<pair<uint32_t, uint8_t>>> claims(max_off);
+    map<pair<uint32_t, uint32_t>, overlap_acc> pairs;
+
+    for (uint32_t id = 0; id < footprints.size(); id++) {
+        for (const auto &c : footprints[id]) {
+            auto &byte_claims = claims[c.first];
+            for (const auto &owner : byte_claims) {
+                uint8_t shared = owner.second & c.second;
+                if (shared == 0)
+                    continue;
+
+                auto &acc = pairs[{owner.first, id}];
+                if (acc.bits == 0)
+                    acc.offset = c.first;
+                acc.bits += __builtin_popcount(shared);
+            }
+
+            byte_claims.emplace_back(id, c.second);
+        }
+    }
+
+    for (const auto &p : pairs) {
+        auto lhs = p.first.first;
+        auto rhs = p.first.second;
+
+        r.overlaps.push_back({
+            names[lhs],
+            names[rhs],
+            p.second.offset,
+            p.second.bits,
+            footprints[lhs] == footprints[rhs]
+        });
+    }
+
+    sort(r.overlaps.begin(), r.overlaps.end(), [](const overlap &lhs, const overlap &rhs) {
+        if (lhs.offset != rhs.offset)
+            return (lhs.offset < rhs.offset);
+        return (strcmp(lhs.lhs, rhs.lhs) < 0);
+    });
+
+    /* Find unclaimed byte ranges */
+    for (size_t off = 0; off < r.size;) {
+        if (!claims[off].empty()) {
+            off++;
+            continue;
+        }
+
+        if (!r.free.empty() && r.free.back().offset + r.free.back().size == off)
+            r.free.back().size++;
+        else
+            r.free.push_back({ off, 1 });
+
+        off++;
+    }
+
+    return r;
+}
+
+size_t srom_overlap::conflicts () const {
+    size_t count = 0;
+    for (const auto &r : _revs) {
+        for (const auto &o : r.overlaps) {
+            if (!o.alias)
+                count++;
+        }
+    }
+
+    return count;
+}
+
+void srom_overlap::report (FILE *fp, bool verbose) const {
+    for (const auto &r : _revs) {
+        bool did_print_intro = false;
+        for (const auto &o : r.overlaps) {
+            if (o.alias)
+                continue;
+
+            if (!did_print_intro) {
+                fprintf(fp, "# SROM rev %u conflicting variables:\n", r.rev);
+                did_print_intro = true;
+            }
+
+            fprintf(fp, "\t%s, %s at 0x%zX (%zu bits)\n", o.lhs, o.rhs, o.offset, o.bits);
+        }
+
+        if (!verbose)
+            continue;
+
+        did_print_intro = false;
+        for (const auto &o : r.overlaps) {
+            if (!o.alias)
+                continue;
+
+            if (!did_print_intro) {
+                fprintf(fp, "# SROM rev %u aliased variables:\n", r.rev);
+                did_print_intro = true;
+            }
+
+            fprintf(fp, "\t%s, %s at 0x%zX\n", o.lhs, o.rhs, o.offset);
+        }
+
+        if (r.free.size() > 0) {
+            fprintf(fp, "# SROM rev %u free regions (%zu bytes):\n", r.rev, r.size);
+            for (const auto &f : r.free)
+                fprintf(fp, "\t0x%03zX-0x%03zX (%zu bytes)\n", f.offset, f.offset + f.size - 1, f.size);
+        }
+    }
+}
+
+} /* namespace nvram */
@@ -0,0 +1,79 @@
+//
+//  symbol.hpp
+//  ccmach
+//
+//  Created by Landon Fuller on 1/25/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#ifndef __ccmach__symbol__
+#define __ccmach__symbol__
+
+#include <string>
+#include <cstring>
+#include <utility>
+#include <functional>
+
+namespace nvram {
+
+/**
+ * Interned string handle.
+ *
+ * Symbols are pointer-sized references into a global, append-only string
+ * table; equal strings always intern to the same table entry, making
+ * symbol equality a pointer comparison. Each entry's hash is computed once,
+ * when the string is first interned.
+ *
+ * Interning is thread-safe. Interned strings are never freed.
+ */
+class symbol {
+private:
+    /** string table entry (string, precomputed hash) */
+    typedef std::pair<const std::string, size_t> entry;
+
+    const entry *_e;
+
+    static const entry *intern (const std::string &str);
+
+public:
+    symbol () : _e(intern(std::string())) {}
+    symbol (const std::string &str) : _e(intern(str)) {}
+    symbol (const char *str) : _e(intern(std::string(str))) {}
+
+    const std::string &str () const { return _e->first; }
+    const char *c_str () const { return _e->first.c_str(); }
+    size_t size () const { return _e->first.size(); }
+    bool empty () const { return _e->first.empty(); }
+    size_t hash () const { return _e->second; }
+
+    operator const std::string & () const { return _e->first; }
+
+    bool operator== (const symbol &other) const { return (_e == other._e); }
+    bool operator!= (const symbol &other) const { return (_e != other._e); }
+
+    bool operator== (const std::string &other) const { return (_e->first == other); }
+    bool operator!= (const std::string &other) const { return (_e->first != other); }
+
+    bool operator== (const char *other) const { return (strcmp(_e->first.c_str(), other) == 0); }
+    bool operator!= (const char *other) const { return (strcmp(_e->first.c_str(), other) != 0); }
+
+    bool operator< (const symbol &other) const { return (_e != other._e && _e->first < other._e->first); }
+};
+
+inline bool operator== (const std::string &lhs, const symbol &rhs) { return (rhs == lhs); }
+inline bool operator!= (const std::string &lhs, const symbol &rhs) { return (rhs != lhs); }
+inline bool operator== (const char *lhs, const symbol &rhs) { return (rhs == lhs); }
+inline bool operator!= (const char *lhs, const symbol &rhs) { return (rhs != lhs); }
+
+inline std::string operator+ (const symbol &lhs, const std::string &rhs) { return lhs.str() + rhs; }
+inline std::string operator+ (const symbol &lhs, const char *rhs) { return lhs.str() + rhs; }
+
+} /* namespace nvram */
+
+namespace std {
+    template <> struct hash<nvram::symbol> {
+        size_t operator() (const nvram::symbol &sym) const { return sym.hash(); }
+    };
+}
+
+#endif /* defined(__ccmach__symbol__) */
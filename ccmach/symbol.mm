@@ -0,0 +1,37 @@
+//
+//  symbol.mm
+//  ccmach
+//
+//  Created by Landon Fuller on 1/25/16.
+//  Copyright (c) 2016 Landon Fuller. All rights reserved.
+//
+
+#include "symbol.hpp"
+
+#include <mutex>
+#include <unordered_map>
+
+namespace nvram {
+
+/**
+ * Return the string table entry for @p str, adding it if necessary.
+ *
+ * The table is heap-allocated on first use and intentionally leaked, so that
+ * symbols may be safely constructed (and used) from static initializers and
+ * destructors in any translation unit.
+ */
+const symbol::entry *symbol::intern (const std::string &str) {
+    static std::mutex *lock = new std::mutex();
+    static auto *tbl = new std::unordered_map<std::string, size_t>();
+
+    std::lock_guard<std::mutex> guard(*lock);
+
+    auto it = tbl->find(str);
+    if (it == tbl->end())
+        it = tbl->emplace(str, std::hash<std::string>()(str)).first;
+
+    /* unordered_map nodes are never relocated */
+    return &(*it);
+}
+
+} /* namespace nvram */